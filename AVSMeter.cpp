@@ -24,6 +24,20 @@
 #include "ProcessInfo.h"
 #include "GPUInfo.h"
 #include "Timer.h"
+#include "Monitor.h"
+#include "FrameTracer.h"
+#include "Statistics.h"
+#include "Profiler.h"
+#include "AllocTracker.h"
+#include "FrameStore.h"
+#include "MetricsFile.h"
+#include "FileWriter.h"
+#include "Sketch.h"
+#include "JSONWriter.h"
+#include "JSONReader.h"
+#include "ResultsDB.h"
+#include "MetricsServer.h"
+#include "LiveStats.h"
 #include "version.h"
 
 
@@ -36,6 +50,20 @@
 #define REFRESH_INTERVAL              0.25  //seconds
 #define MIN_TIME_PER_FRAMEINTERVAL   10.00  //milliseconds
 #define MIN_RUNTIME                 500     //milliseconds
+#define SWEEP_PASS_TIME              20.00  //seconds
+#define SWEEP_KNEE_FRACTION           0.95
+#define TUNE_TRIAL_TIME               5.00  //seconds
+#define TUNE_MIN_GAIN                 1.02
+#define PERFDATA_MAX_ROWS             10000     //[Performance data] rows, downsampled from all frames
+#define PMC_UNAVAILABLE_CSV_COLUMNS   ",IPC,LLC MPKI,L1D MPKI,Branch MPKI,dTLB MPKI"
+#define PMC_UNAVAILABLE_CSV_VALUES    ",n/a,n/a,n/a,n/a,n/a"
+#define BASELINE_SAMPLE_SIZE          10000     //per-frame times kept in the JSON results for later comparisons
+#define BASELINE_MIN_FRAMES           30
+#define BASELINE_RESAMPLES            1000
+#define BASELINE_THRESHOLD            5.0       //percent
+#define BASELINE_ALPHA                0.05
+#define HISTORY_MAX_ROWS             50
+#define HISTORY_MAX_TREND           500     //runs, the trend fit is O(n^2)
 
 struct stSettings
 {
@@ -60,6 +88,11 @@ struct stSettings
 	BOOL      bLogFileDateTimeSuffix;
 	BOOL      bDisableFFTWDLLWarning;
 	size_t    nLoadPluginInterval;
+	int       iTimerBackend;
+	double    dLeakThreshold;    //KiB per frame, < 0 = no check
+	BOOL      bSaveResults;
+	BOOL      bLiveStats;
+	string    sResultsFile;
 } Settings;
 
 
@@ -73,6 +106,44 @@ struct stPerfData
 	BYTE          vpu_usage;
 	DWORD         process_memory;
 	WORD          num_threads;
+	float         cycles_per_frame;  //millions
+	DWORD         commit_memory;     //MiB, private bytes
+	float         soft_faults;       //per frame
+	float         hard_faults;
+};
+
+struct stBaseline
+{
+	string        sFile;
+	string        sAVSMVersion;
+	string        sStarted;
+	string        sScriptFile;
+	double        dFPS;              //average of the whole run
+	unsigned __int64 ui64Frames;
+	vector<double> vFrameTimes;      //ms, uniform sample of the run's frames
+};
+
+struct stScriptVariant
+{
+	int           iThreads;          //0 = unchanged, 1 = no Prefetch, >1 = Prefetch(n) / SetMTMode(2, n)
+	string        sPrefix;           //prepended to the script
+	unsigned int  uiMaxFrames;       //0 = no frame limit
+	BOOL          bHashFrames;
+	int           iMemoryMax;        //MiB, 0 = unchanged
+	int           iCacheCapacity;    //frames, 0 = unchanged
+};
+
+
+struct stPassResult
+{
+	unsigned int  uiFrames;
+	double        dSeconds;
+	double        dFPS;
+	double        dCPUUsage;
+	DWORD         dwMemPeakMB;
+	int           iPoolThreads;
+	unsigned __int64 ui64Hash;
+	string        sError;
 };
 
 typedef IScriptEnvironment * __stdcall CREATE_ENV(int);
@@ -81,16 +152,53 @@ static CUtils utils;
 static CTimer timer;
 static CAvisynthInfo AvisynthInfo;
 static CSysInfo sys;
+static CFrameTracer tracer;
+static CProfiler profiler;
+static CAllocTracker alloctracker;
 
 
 unsigned int CalculateFrameInterval(string &s_avsfile, string &s_error);
+BOOL         ProbeGraph(string &s_avsfile, string &s_tree, string &s_dot, string &s_error);
 string       CreateLogFile(string &s_avsfile, string &s_logbuffer, string &s_gpuinfo, vector<stPerfData> &cs_pdata, string &s_avserror, BOOL bNVVP, BOOL bOmitstPerfData);
 string       CreateCSVFile(string &s_avsfile, vector<stPerfData> &cs_pdata, BOOL bNVVP);
+string       CreateFrameCSVFile(string &s_avsfile, CFrameStore &framestore, BOOL bNVVP);
+void         WritePerfDataTable(CFileWriter &h_file, vector<stPerfData> &cs_pdata, BOOL bNVVP);
+void         WritePerfDataCSV(CFileWriter &h_file, vector<stPerfData> &cs_pdata, BOOL bNVVP);
+int          ConvertMetricsFile(string &s_ambfile, string &s_avsmversion);
+BOOL         BuildPerfData(CFrameStore &framestore, vector<stPerfData> &v_pdata, size_t n_rows);
+BOOL         BuildIntervalPerfData(CFrameStore &framestore, vector<stPerfData> &v_pdata, size_t n_rows);
+void         MakePerfRow(stFrameRecord &r, double d_frametime, unsigned __int64 ui64_read, stFrameRecord &prev, unsigned __int64 ui64_span, stPerfData &pdata);
+int          MergeSketchFiles(string &s_files, string &s_avsmversion);
+string       GetOutputFileName(string &s_avsfile, string s_extension);
+string       CreateJSONFile(string &s_avsfile, CJSONWriter &json, string &s_avserror, BOOL b_runtime_too_short);
+void         AddJSONPercentiles(CJSONWriter &json, const char *p_key, CDDSketch &sketch);
+void         AddJSONSamples(CJSONWriter &json, vector<stPerfData> &cs_pdata, BOOL bNVVP);
+void         SampleFrameTimes(CFrameStore &framestore, vector<double> &v_sample, size_t n_max);
+BOOL         LoadBaseline(string &s_file, stBaseline &baseline, string &s_error);
+string       CompareBaseline(stBaseline &baseline, vector<double> &v_frametimes, double d_fps, double d_threshold, CJSONWriter *p_json, BOOL &b_regression);
+unsigned __int64 FingerprintScript(string &s_avsfile);
+unsigned __int64 FingerprintEnvironment();
+unsigned __int64 FingerprintMachine();
+int          RunHistory(string &s_avsfile);
+int          RunInstances();
+BOOL         ReadTextFile(string &s_file, string &s_text);
+string       StripFunctionCalls(string s_script, string s_function, BOOL b_keepclip);
+void         InitScriptVariant(stScriptVariant &variant);
+BOOL         ParseValueList(string s_list, vector<int> &v_values);
+int          RunMemorySweep(string &s_avsfile, vector<int> &v_memorymax, vector<int> &v_cachecapacity, string &s_avsmversion);
+BOOL         RunBenchmarkPass(string &s_avsfile, string &s_script, stScriptVariant &variant, double d_timelimit, stPassResult &result);
+int          RunThreadSweep(string &s_avsfile, unsigned int ui_from, unsigned int ui_to, string &s_avsmversion);
+int          RunMTModeTuner(string &s_avsfile, int i_threads, string &s_avsmversion);
+vector<string> GetScriptFilters(string &s_script);
+BOOL         ReturnsClip(IScriptEnvironment *AVS_env, string &s_function, BOOL b_plugin);
+unsigned __int64 HashFrame(PVideoFrame &frame, VideoInfo &vi, unsigned __int64 ui64_hash);
+string       CreateSweepLogHeader(string &s_avsfile, string &s_avsmversion);
 string       ParseINIFile();
 BOOL         WriteINIFile(string &s_inifile);
 void         PrintUsage();
 void         PollKeys();
 void         PrintConsole(BOOL bUseStdOut, WORD wAttributes, const char *fmt, ...);
+void         PrintConsoleBlock(BOOL bUseStdOut, WORD wAttributes, string s_block);
 string       Pad(string s_line);
 
 
@@ -119,6 +227,11 @@ int main(int argc, char* argv[])
 	Settings.bAutoCompleteExtension = FALSE;
 	Settings.bDisableFFTWDLLWarning = FALSE;
 	Settings.nLoadPluginInterval = 40;
+	Settings.iTimerBackend = TIMER_BACKEND_AUTO;
+	Settings.dLeakThreshold = -1.0;
+	Settings.bSaveResults = TRUE;
+	Settings.bLiveStats = TRUE;
+	Settings.sResultsFile = "";
 
 	string sINIRet = ParseINIFile();
 
@@ -143,10 +256,32 @@ int main(int argc, char* argv[])
 	}
 
 	vector<stPerfData> perfdata;
+	vector<stPerfData> csvdata;
+	CFrameStore framestore;
+	CMetricsWriter metricswriter;
+	CSketchWindows sketches;
+	CJSONWriter json;
+	CJSONWriter jsonline;
+	CNDJSONStream ndjson;
 	string sOutBuf = "";
 	string sAVSFile = "";
 	string sLogBuffer = "";
 	BOOL   bRuntimeTooShort = FALSE;
+	BOOL   bLeakDetected = FALSE;
+	BOOL   bMetricsFile = FALSE;
+	string sConvertFile = "";
+	BOOL   bSaveSketches = FALSE;
+	string sMergeFiles = "";
+	BOOL   bJSON = FALSE;
+	stBaseline baseline;
+	string sBaselineFile = "";
+	double dRegressThreshold = BASELINE_THRESHOLD;
+	string sHistoryFile = "";
+	unsigned int uiListenPort = 0;
+	BOOL   bInstances = FALSE;
+	stResultRecord result;
+	BOOL   bResultValid = FALSE;
+	BOOL   bAborted = FALSE;
 	string sGPUInfo = "";
 	BOOL bEarlyExit = TRUE;
 	BOOL bInfoOnly = FALSE;
@@ -158,6 +293,14 @@ int main(int argc, char* argv[])
 	unsigned int uiLogFrameInterval = 1;
 	string sErrorMsg = "";
 	BOOL bModeAVSInfo = FALSE;
+	BOOL bGraphDump = FALSE;
+	string sGraphTree = "";
+	string sGraphDOT = "";
+	unsigned int uiSweepThreadsFrom = 0;
+	unsigned int uiSweepThreadsTo = 0;
+	int iTuneThreads = 0;
+	vector<int> vSweepMemoryMax;
+	vector<int> vSweepCacheCapacity;
 
 	Settings.sSystemDateTime = "";
 
@@ -169,8 +312,29 @@ int main(int argc, char* argv[])
 	BOOL CLSwitches_o = FALSE;
 	BOOL CLSwitches_c = FALSE;
 	BOOL CLSwitches_lf = FALSE;
+	BOOL CLSwitches_trace = FALSE;
+	BOOL CLSwitches_graph = FALSE;
+	BOOL CLSwitches_profile = FALSE;
+	BOOL CLSwitches_allocs = FALSE;
+	BOOL CLSwitches_hardfaults = FALSE;
+	BOOL CLSwitches_leak = FALSE;
+	BOOL CLSwitches_metrics = FALSE;
+	BOOL CLSwitches_sketch = FALSE;
+	BOOL CLSwitches_json = FALSE;
+	BOOL CLSwitches_threshold = FALSE;
+	BOOL CLSwitches_listen = FALSE;
+	BOOL CLSwitches_sweepthreads = FALSE;
+	BOOL CLSwitches_mttune = FALSE;
+	BOOL CLSwitches_sweepmemory = FALSE;
+
+	//the live stats viewer runs next to the instances it watches
+	for (int iArg = 1; iArg < argc; iArg++)
+	{
+		if (_stricmp(argv[iArg], "-instances") == 0)
+			bInstances = TRUE;
+	}
 
-	if (Settings.bAllowOnlyOneInstance)
+	if (Settings.bAllowOnlyOneInstance && !bInstances)
 	{
 		if (PROCESS_64)
 			CreateMutex(NULL, TRUE, "__avsmeter64__single__instance__lock__");
@@ -257,6 +421,251 @@ int main(int argc, char* argv[])
 			continue;
 		}
 
+		if (sArgTest == "-trace")
+		{
+			CLSwitches_trace = TRUE;
+			tracer.bEnabled = TRUE;
+			continue;
+		}
+
+		if (sArgTest == "-graph")
+		{
+			CLSwitches_graph = TRUE;
+			bGraphDump = TRUE;
+			tracer.bEnabled = TRUE;
+			continue;
+		}
+
+		if (sArgTest == "-profile")
+		{
+			CLSwitches_profile = TRUE;
+			profiler.bEnabled = TRUE;
+			continue;
+		}
+
+		if (sArgTest == "-allocs")
+		{
+			CLSwitches_allocs = TRUE;
+			alloctracker.bEnabled = TRUE;
+			continue;
+		}
+
+		if (sArgTest == "-hardfaults")
+		{
+			CLSwitches_hardfaults = TRUE;
+			continue;
+		}
+
+		if (sArgTest == "-metrics")
+		{
+			CLSwitches_metrics = TRUE;
+			bMetricsFile = TRUE;
+			continue;
+		}
+
+		if (sArgTest == "-sketch")
+		{
+			CLSwitches_sketch = TRUE;
+			bSaveSketches = TRUE;
+			continue;
+		}
+
+		if (sArgTest == "-json")
+		{
+			CLSwitches_json = TRUE;
+			bJSON = TRUE;
+			continue;
+		}
+
+		if (sArgTest.substr(0, 10) == "-baseline=")
+		{
+			LPTSTR lpPart;
+			char szOut[MAX_PATH_LEN + 1];
+			sTemp = sArg.substr(sArg.find('=') + 1);
+			utils.StrTrim(sTemp);
+			if ((sTemp == "") || !::GetFullPathName(sTemp.c_str(), MAX_PATH_LEN, szOut, &lpPart) || !utils.FileExists(szOut))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: File not found: \"%s\"\n", sTemp.c_str());
+				PollKeys();
+				return -1;
+			}
+
+			sBaselineFile = utils.StrFormat("%s", szOut);
+			continue;
+		}
+
+		if (sArgTest.substr(0, 11) == "-threshold=")
+		{
+			CLSwitches_threshold = TRUE;
+			sTemp = sArgTest.substr(11);
+			if (!utils.IsNumeric(sTemp) || (atoi(sTemp.c_str()) < 0) || (atoi(sTemp.c_str()) > 100))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nValue must be between \'0\' and \'100\' (percent)\n", sArg.c_str());
+				PollKeys();
+				return -1;
+			}
+
+			dRegressThreshold = (double)atoi(sTemp.c_str());
+			continue;
+		}
+
+		if (sArgTest == "-instances")
+		{
+			bInstances = TRUE;
+			continue;
+		}
+
+		if (sArgTest.substr(0, 8) == "-listen=")
+		{
+			CLSwitches_listen = TRUE;
+			sTemp = sArgTest.substr(8);
+			if (!utils.IsNumeric(sTemp) || (atoi(sTemp.c_str()) < 1024) || (atoi(sTemp.c_str()) > 65535))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nValue must be between \'1024\' and \'65535\' (TCP port)\n", sArg.c_str());
+				PollKeys();
+				return -1;
+			}
+
+			uiListenPort = (unsigned int)atoi(sTemp.c_str());
+			continue;
+		}
+
+		if (sArgTest.substr(0, 7) == "-merge=")
+		{
+			sMergeFiles = sArg.substr(sArg.find('=') + 1);
+			utils.StrTrim(sMergeFiles);
+			if (sMergeFiles == "")
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nExpected a comma separated list of sketch files\n", sArg.c_str());
+				PollKeys();
+				return -1;
+			}
+			continue;
+		}
+
+		if (sArgTest.substr(0, 9) == "-history=")
+		{
+			LPTSTR lpPart;
+			char szOut[MAX_PATH_LEN + 1];
+			sTemp = sArg.substr(sArg.find('=') + 1);
+			utils.StrTrim(sTemp);
+			if ((sTemp == "") || !::GetFullPathName(sTemp.c_str(), MAX_PATH_LEN, szOut, &lpPart) || !utils.FileExists(szOut))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: File not found: \"%s\"\n", sTemp.c_str());
+				PollKeys();
+				return -1;
+			}
+
+			sHistoryFile = utils.StrFormat("%s", szOut);
+			continue;
+		}
+
+		if (sArgTest.substr(0, 9) == "-convert=")
+		{
+			LPTSTR lpPart;
+			char szOut[MAX_PATH_LEN + 1];
+			sTemp = sArg.substr(sArg.find('=') + 1);
+			utils.StrTrim(sTemp);
+			if ((sTemp == "") || !::GetFullPathName(sTemp.c_str(), MAX_PATH_LEN, szOut, &lpPart) || !utils.FileExists(szOut))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: File not found: \"%s\"\n", sTemp.c_str());
+				PollKeys();
+				return -1;
+			}
+
+			sConvertFile = utils.StrFormat("%s", szOut);
+			continue;
+		}
+
+		if (sArgTest.substr(0, 6) == "-leak=")
+		{
+			CLSwitches_leak = TRUE;
+			sTemp = sArgTest.substr(6);
+			//digits with an optional fraction, one side of the point may be empty (".5", "5.")
+			size_t dpos = sTemp.find('.');
+			string sInt = sTemp.substr(0, dpos);
+			string sFrac = (dpos == string::npos) ? "" : sTemp.substr(dpos + 1);
+			BOOL bValid = (sInt != "") || (sFrac != "");
+			if (bValid && (sInt != ""))
+				bValid = utils.IsNumeric(sInt);
+			if (bValid && (sFrac != ""))
+				bValid = utils.IsNumeric(sFrac);
+			if (!bValid || (atof(sTemp.c_str()) > 999999.0))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nValue must be between \'0\' and \'999999\' (KiB per frame, fractions allowed)\n", sArg.c_str());
+				PollKeys();
+				return -1;
+			}
+
+			Settings.dLeakThreshold = atof(sTemp.c_str());
+			continue;
+		}
+
+		if (sArgTest.substr(0, 15) == "-sweep-threads=")
+		{
+			CLSwitches_sweepthreads = TRUE;
+			sTemp = sArgTest.substr(15);
+			size_t spos = sTemp.find("..");
+			if (spos == string::npos)
+			{
+				uiSweepThreadsFrom = 1;
+				uiSweepThreadsTo = utils.IsNumeric(sTemp) ? (unsigned int)atoi(sTemp.c_str()) : 0;
+			}
+			else
+			{
+				uiSweepThreadsFrom = utils.IsNumeric(sTemp.substr(0, spos)) ? (unsigned int)atoi(sTemp.substr(0, spos).c_str()) : 0;
+				uiSweepThreadsTo = utils.IsNumeric(sTemp.substr(spos + 2)) ? (unsigned int)atoi(sTemp.substr(spos + 2).c_str()) : 0;
+			}
+
+			if ((uiSweepThreadsFrom < 1) || (uiSweepThreadsTo < uiSweepThreadsFrom) || (uiSweepThreadsTo > 256))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nThe thread range must be \'n\' or \'first..last\' between \'1\' and \'256\'\n", sArg.c_str());
+				PollKeys();
+				return -1;
+			}
+			continue;
+		}
+
+		if ((sArgTest == "-mttune") || (sArgTest.substr(0, 8) == "-mttune="))
+		{
+			CLSwitches_mttune = TRUE;
+			if (sArgTest.length() > 8)
+			{
+				sTemp = sArgTest.substr(8);
+				iTuneThreads = utils.IsNumeric(sTemp) ? atoi(sTemp.c_str()) : 0;
+				if ((iTuneThreads < 2) || (iTuneThreads > 256))
+				{
+					PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nThe thread count must be between \'2\' and \'256\'\n", sArg.c_str());
+					PollKeys();
+					return -1;
+				}
+			}
+			continue;
+		}
+
+		if (sArgTest.substr(0, 14) == "-sweep-memory=")
+		{
+			CLSwitches_sweepmemory = TRUE;
+			if (!ParseValueList(sArgTest.substr(14), vSweepMemoryMax))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nExpected \'a,b,c\' or \'first..last\' (doubling) in MiB\n", sArg.c_str());
+				PollKeys();
+				return -1;
+			}
+			continue;
+		}
+
+		if (sArgTest.substr(0, 13) == "-sweep-cache=")
+		{
+			if (!ParseValueList(sArgTest.substr(13), vSweepCacheCapacity))
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nInvalid parameter value: \"%s\"\nExpected \'a,b,c\' or \'first..last\' (doubling) in frames\n", sArg.c_str());
+				PollKeys();
+				return -1;
+			}
+			continue;
+		}
+
 		if (sArgTest.substr(0, 7) == "-range=")
 		{
 			CLSwitches_range = TRUE;
@@ -379,6 +788,69 @@ int main(int argc, char* argv[])
 	}
 
 
+	if (bInstances)
+	{
+		if (bModeAVSInfo || (sAVSFile != "") || (sConvertFile != "") || (sMergeFiles != "") || (sHistoryFile != ""))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-instances\' cannot be combined with a script or other switches\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		iRet = RunInstances();
+		SetErrorMode(nPrevErrorMode);
+		return iRet;
+	}
+
+	if (sMergeFiles != "")
+	{
+		if (bModeAVSInfo || (sAVSFile != "") || (sConvertFile != "") || (sHistoryFile != ""))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-merge\' cannot be combined with a script, \'-convert\', \'-history\' or \'-avsinfo\'\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		iRet = MergeSketchFiles(sMergeFiles, sAVSMVersion);
+		SetErrorMode(nPrevErrorMode);
+		PollKeys();
+		return iRet;
+	}
+
+	if (sConvertFile != "")
+	{
+		if (bModeAVSInfo || (sAVSFile != "") || (sHistoryFile != ""))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-convert\' cannot be combined with a script, \'-history\' or \'-avsinfo\'\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		iRet = ConvertMetricsFile(sConvertFile, sAVSMVersion);
+		SetErrorMode(nPrevErrorMode);
+		PollKeys();
+		return iRet;
+	}
+
+	if (sHistoryFile != "")
+	{
+		if (bModeAVSInfo || (sAVSFile != ""))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-history\' cannot be combined with a script or \'-avsinfo\'\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		iRet = RunHistory(sHistoryFile);
+		SetErrorMode(nPrevErrorMode);
+		PollKeys();
+		return iRet;
+	}
+
 	if (bModeAVSInfo)
 	{
 		if (CLSwitches_info)
@@ -429,71 +901,185 @@ int main(int argc, char* argv[])
 			return -1;
 		}
 
-		if (sAVSFile != "")
+		if (CLSwitches_trace)
 		{
-			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Script specified together with \'avsinfo\'\n");
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-trace\"\n");
 			PrintUsage();
 			PollKeys();
 			return -1;
 		}
-	}
-	else
-	{
-		if (CLSwitches_lf)
+
+		if (CLSwitches_graph)
 		{
-			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Switch \'-lf\' must be used in combination with \'avsinfo\'\n");
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-graph\"\n");
 			PrintUsage();
 			PollKeys();
 			return -1;
 		}
-	}
 
+		if (CLSwitches_profile)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-profile\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
 
-	if (bHighPriority)
-		::SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
-
-	PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("Query Avisynth info...").c_str());
-
-	BOOL bRet = FALSE;
-	bRet = AvisynthInfo.GetInfo(sErrorMsg, TRUE);
+		if (CLSwitches_allocs)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-allocs\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
 
-	sys.GetCPUID();
+		if (CLSwitches_hardfaults)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-hardfaults\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
 
-	if (!bRet)
-	{
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
-		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\n%s\n", sErrorMsg.c_str());
-		PollKeys();
-		return -1;
-	}
+		if (CLSwitches_leak)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-leak\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
 
-	if (!bModeAVSInfo)
-	{
-		PrintConsole(Settings.bConUseStdOut, COLOR_AVISYNTH_VERSION, "\r%s", AvisynthInfo.sVersionString.c_str());
-		PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, " (%s)\n", AvisynthInfo.sFileVersion.c_str());
-	}
+		if (CLSwitches_metrics)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-metrics\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
 
-	CGPUInfo gpuinfo;
-	if (Settings.bGPUInfo)
-	{
-		gpuinfo.GPUZInit();
-		if (!gpuinfo.bInitialized)
+		if (CLSwitches_sketch)
 		{
-			PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
-			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Cannot initialize GPU-Z shared memory interface:\n%s\n", gpuinfo.sError.c_str());
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-sketch\"\n");
+			PrintUsage();
 			PollKeys();
 			return -1;
 		}
-	}
 
-	if (!timer.supported)
-	{
+		if (CLSwitches_json)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-json\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		if (CLSwitches_listen)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-listen\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		if ((sBaselineFile != "") || CLSwitches_threshold)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-baseline\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		if (CLSwitches_sweepthreads)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-sweep-threads\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		if (CLSwitches_mttune)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-mttune\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		if (CLSwitches_sweepmemory || (vSweepCacheCapacity.size() > 0))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Invalid switch in combination with \'-avsinfo\': \"-sweep-memory\"\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+
+		if (sAVSFile != "")
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Script specified together with \'avsinfo\'\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+	}
+	else
+	{
+		if (CLSwitches_lf)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Switch \'-lf\' must be used in combination with \'avsinfo\'\n");
+			PrintUsage();
+			PollKeys();
+			return -1;
+		}
+	}
+
+
+	if (bHighPriority)
+		::SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+
+	PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("Query Avisynth info...").c_str());
+
+	BOOL bRet = FALSE;
+	bRet = AvisynthInfo.GetInfo(sErrorMsg, TRUE);
+
+	sys.GetCPUID();
+
+	if (!bRet)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\n%s\n", sErrorMsg.c_str());
+		PollKeys();
+		return -1;
+	}
+
+	if (!bModeAVSInfo)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_AVISYNTH_VERSION, "\r%s", AvisynthInfo.sVersionString.c_str());
+		PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, " (%s)\n", AvisynthInfo.sFileVersion.c_str());
+	}
+
+	CGPUInfo gpuinfo;
+	if (Settings.bGPUInfo)
+	{
+		gpuinfo.GPUZInit();
+		if (!gpuinfo.bInitialized)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Cannot initialize GPU-Z shared memory interface:\n%s\n", gpuinfo.sError.c_str());
+			PollKeys();
+			return -1;
+		}
+	}
+
+	if (!timer.supported)
+	{
 		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
 		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: QueryPerformanceCounter() is not supported\n");
 		PollKeys();
 		return -1;
 	}
 
+	timer.SetBackend(Settings.iTimerBackend);
+
 	PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
 
 	if (bModeAVSInfo)
@@ -802,6 +1388,82 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
+	if (CLSwitches_sweepthreads)
+	{
+		if (bInfoOnly || CLSwitches_trace || CLSwitches_graph || CLSwitches_mttune || CLSwitches_sweepmemory || (vSweepCacheCapacity.size() > 0) || CLSwitches_json || (sBaselineFile != "") || CLSwitches_listen)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-sweep-threads\' cannot be combined with \'-info\', \'-trace\', \'-graph\', \'-mttune\', \'-sweep-memory\', \'-json\', \'-baseline\' or \'-listen\'\n");
+			PollKeys();
+			return -1;
+		}
+
+		iRet = RunThreadSweep(sAVSFile, uiSweepThreadsFrom, uiSweepThreadsTo, sAVSMVersion);
+		SetErrorMode(nPrevErrorMode);
+		PollKeys();
+		return iRet;
+	}
+
+	if ((vSweepCacheCapacity.size() > 0) && !CLSwitches_sweepmemory)
+		vSweepMemoryMax.push_back(0);
+
+	if (CLSwitches_sweepmemory || (vSweepCacheCapacity.size() > 0))
+	{
+		if (bInfoOnly || CLSwitches_trace || CLSwitches_graph || CLSwitches_mttune || CLSwitches_json || (sBaselineFile != "") || CLSwitches_listen)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-sweep-memory\' cannot be combined with \'-info\', \'-trace\', \'-graph\', \'-mttune\', \'-sweep-threads\', \'-json\', \'-baseline\' or \'-listen\'\n");
+			PollKeys();
+			return -1;
+		}
+
+		iRet = RunMemorySweep(sAVSFile, vSweepMemoryMax, vSweepCacheCapacity, sAVSMVersion);
+		SetErrorMode(nPrevErrorMode);
+		PollKeys();
+		return iRet;
+	}
+
+	if (CLSwitches_mttune)
+	{
+		if (bInfoOnly || CLSwitches_trace || CLSwitches_graph || CLSwitches_json || (sBaselineFile != "") || CLSwitches_listen)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-mttune\' cannot be combined with \'-info\', \'-trace\', \'-graph\', \'-sweep-threads\', \'-json\', \'-baseline\' or \'-listen\'\n");
+			PollKeys();
+			return -1;
+		}
+
+		if (iTuneThreads == 0)
+			iTuneThreads = (sys.bCPUIDSuccess && (sys.cpudata.CPULogicalCores > 1)) ? (int)sys.cpudata.CPULogicalCores : 2;
+
+		iRet = RunMTModeTuner(sAVSFile, iTuneThreads, sAVSMVersion);
+		SetErrorMode(nPrevErrorMode);
+		PollKeys();
+		return iRet;
+	}
+
+	if (CLSwitches_threshold && (sBaselineFile == ""))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-threshold\' requires \'-baseline\'\n");
+		PollKeys();
+		return -1;
+	}
+
+	//a broken baseline fails before the benchmark, not after it
+	if (sBaselineFile != "")
+	{
+		if (bInfoOnly)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-baseline\' cannot be combined with \'-info\'\n");
+			PollKeys();
+			return -1;
+		}
+
+		if (!LoadBaseline(sBaselineFile, baseline, sErrorMsg))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: %s\n", sErrorMsg.c_str());
+			PollKeys();
+			return -1;
+		}
+	}
+
 	if (!bInfoOnly)
 	{
 		if (!bOmitPreScan)
@@ -819,6 +1481,17 @@ int main(int argc, char* argv[])
 		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
 	}
 
+	//the graph comes from an instance of its own, the probe frame must not warm the caches of the timed run
+	if (bGraphDump)
+	{
+		if (!ProbeGraph(sAVSFile, sGraphTree, sGraphDOT, sErrorMsg))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: %s\n", sErrorMsg.c_str());
+			PollKeys();
+			return -1;
+		}
+	}
+
 	HINSTANCE hDLL;
 	hDLL = ::LoadLibraryEx("avisynth", NULL, LOAD_WITH_ALTERED_SEARCH_PATH);
 
@@ -830,6 +1503,21 @@ int main(int argc, char* argv[])
 	}
 
 
+	//the document is opened before the script is loaded, a failing script still gets its "error"
+	if (bJSON)
+	{
+		json.BeginObject(NULL);
+		json.String("schema", JSON_SCHEMA_NAME);
+		json.UInt("schema_version", JSON_SCHEMA_VERSION);
+		json.String("avsmeter_version", sAVSMVersion);
+		json.String("script", sAVSFile);
+		json.String("started", sys.GetFormattedSystemDateTime().c_str());
+
+		string sNDJSONFile = GetOutputFileName(sAVSFile, ".ndjson");
+		if (!ndjson.Open(sNDJSONFile))
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: %s\n", ndjson.sError.c_str());
+	}
+
 	IScriptEnvironment *AVS_env = 0;
 	try
 	{
@@ -858,6 +1546,8 @@ int main(int argc, char* argv[])
 		PClip AVS_clip;
 		VideoInfo	AVS_vidinfo;
 
+		tracer.Register(AVS_env);
+
 		AVS_main = AVS_env->Invoke("Import", sAVSFile.c_str());
 
 		if (!AVS_main.IsClip())
@@ -877,6 +1567,9 @@ int main(int argc, char* argv[])
 			bIsSETMTVersion = FALSE;
 		}
 
+		if (tracer.bEnabled)
+			AVS_main = tracer.Wrap(AVS_main.AsClip(), "Output", AVS_env);
+
 		AVS_clip = AVS_main.AsClip();
 		AVS_vidinfo = AVS_clip->GetVideoInfo();
 
@@ -918,6 +1611,9 @@ int main(int argc, char* argv[])
 			sLogBuffer += sOutBuf;
 		}
 
+		sOutBuf = utils.StrFormat("\nTimer:                      %s\n", timer.GetBackendInfo().c_str());
+		sLogBuffer += sOutBuf;
+
 		if (Settings.bGPUInfo)
 		{
 			sOutBuf = utils.StrFormat("\nVideo card:                 %s", gpuinfo.data.CardName.c_str());
@@ -967,6 +1663,62 @@ int main(int argc, char* argv[])
 			}
 		}
 
+		if (bJSON)
+		{
+			json.BeginObject("environment");
+			json.String("os", sys.GetOSVersion().c_str());
+			json.Bool("process_64", PROCESS_64 ? TRUE : FALSE);
+			json.String("timer", timer.GetBackendInfo().c_str());
+			if (Settings.bGPUInfo)
+			{
+				json.BeginObject("gpu");
+				json.String("card", gpuinfo.data.CardName);
+				json.String("gpu", gpuinfo.data.GPUName);
+				json.String("memory_mib", gpuinfo.data.MemSize);
+				json.String("opencl", gpuinfo.data.OpenCLVersion);
+				json.String("driver", gpuinfo.data.DriverVersion);
+				json.EndObject();
+			}
+			else
+				json.Null("gpu");
+			json.EndObject();
+
+			if (sys.bCPUIDSuccess)
+			{
+				json.BeginObject("cpu");
+				json.String("brand", sys.cpudata.CPUBrandString);
+				json.String("codename", sys.cpudata.CPUCodeName);
+				json.UInt("packages", (unsigned __int64)sys.cpudata.NumCPUs);
+				json.UInt("cores", (unsigned __int64)sys.cpudata.CPUCores);
+				json.UInt("logical_cores", (unsigned __int64)sys.cpudata.CPULogicalCores);
+				json.BeginArray("instruction_sets");
+				vector<string> vSets;
+				utils.StrTokenize(sys.cpudata.CPUSupportedInstructionSets, vSets, ",", FALSE);
+				for (size_t i = 0; i < vSets.size(); i++)
+				{
+					utils.StrTrim(vSets[i]);
+					if (vSets[i] != "")
+						json.String(NULL, vSets[i]);
+				}
+				json.EndArray();
+				json.EndObject();
+			}
+			else
+				json.Null("cpu");
+
+			json.BeginObject("avisynth");
+			json.String("version_string", AvisynthInfo.sVersionString);
+			json.String("version_number", AvisynthInfo.sVersionNumber);
+			json.String("file_version", AvisynthInfo.sFileVersion);
+			json.String("product_version", AvisynthInfo.sProductVersion);
+			json.Int("interface_version", AvisynthInfo.iInterfaceVersion);
+			json.Bool("avsplus", AvisynthInfo.bIsAVSPlus);
+			json.Bool("mt", AvisynthInfo.bIsMTVersion);
+			json.String("dll", AvisynthInfo.sDLLPath);
+			json.String("dll_timestamp", AvisynthInfo.sTimeStamp);
+			json.EndObject();
+		}
+
 		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s", Pad("").c_str());
 
 		sLogBuffer += "\n\n[Clip info]\n";
@@ -1102,6 +1854,8 @@ int main(int argc, char* argv[])
 
 		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "%s\n", sOutBuf.c_str());
 		sLogBuffer += sOutBuf + "\n";
+		string sColorspace = sOutBuf;
+		utils.StrTrim(sColorspace);
 
 		if (bIsSETMTVersion)
 		{
@@ -1171,6 +1925,65 @@ int main(int argc, char* argv[])
 		if (AVS_vidinfo.HasAudio())
 			PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "%s\n", sOutBuf.c_str());
 
+		if (bJSON)
+		{
+			json.BeginObject("clip");
+			json.Bool("has_video", AVS_vidinfo.HasVideo() ? TRUE : FALSE);
+			if (!bAudioOnly)
+			{
+				json.UInt("frames", (unsigned __int64)AVS_vidinfo.num_frames);
+				json.Number("length_s", (double)iMilliSeconds / 1000.0, 3);
+				json.UInt("width", (unsigned __int64)AVS_vidinfo.width);
+				json.UInt("height", (unsigned __int64)AVS_vidinfo.height);
+				json.UInt("fps_numerator", (unsigned __int64)AVS_vidinfo.fps_numerator);
+				json.UInt("fps_denominator", (unsigned __int64)AVS_vidinfo.fps_denominator);
+				json.Number("fps", (double)AVS_vidinfo.fps_numerator / (double)AVS_vidinfo.fps_denominator, 6);
+				json.String("field_order", AVS_vidinfo.IsFieldBased() ? (AVS_vidinfo.IsTFF() ? "tff" : (AVS_vidinfo.IsBFF() ? "bff" : "field_based")) : "frame_based");
+			}
+			json.String("colorspace", sColorspace);
+			if (bIsSETMTVersion)
+				json.Int("mt_mode", iMTMode);
+			if (AVS_vidinfo.HasAudio())
+			{
+				json.BeginObject("audio");
+				json.UInt("channels", (unsigned __int64)AVS_vidinfo.nchannels);
+				json.UInt("sample_rate", (unsigned __int64)AVS_vidinfo.audio_samples_per_second);
+				json.Int("samples", AVS_vidinfo.num_audio_samples);
+				json.EndObject();
+			}
+			else
+				json.Null("audio");
+			json.EndObject();
+
+			jsonline.Clear();
+			jsonline.BeginObject(NULL);
+			jsonline.String("type", "start");
+			jsonline.UInt("schema_version", JSON_SCHEMA_VERSION);
+			jsonline.String("script", sAVSFile);
+			jsonline.UInt("frames", (unsigned __int64)(bAudioOnly ? 0 : AVS_vidinfo.num_frames));
+			jsonline.EndObject();
+			ndjson.Write(jsonline);
+		}
+
+		if (bGraphDump && (sGraphTree != ""))
+		{
+			sOutBuf = sGraphTree;
+			sLogBuffer += sOutBuf;
+			PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, sOutBuf);
+
+			string sDOTFile = GetOutputFileName(sAVSFile, ".dot");
+			ofstream hDOTFile(sDOTFile.c_str());
+			if (hDOTFile.is_open())
+			{
+				hDOTFile << sGraphDOT;
+				hDOTFile.flush();
+				hDOTFile.close();
+				PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "Graphviz file: \"%s\"\n", sDOTFile.c_str());
+			}
+			else
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot create \"%s\"\n", sDOTFile.c_str());
+		}
+
 		if (bInfoOnly)
 		{
 			AVS_clip = 0;
@@ -1186,6 +1999,14 @@ int main(int argc, char* argv[])
 					PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, sLogRet.c_str());
 			}
 
+			if (bJSON)
+			{
+				string sJSONRet = CreateJSONFile(sAVSFile, json, sAVSError, FALSE);
+				if (sJSONRet != "")
+					PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, sJSONRet.c_str());
+				ndjson.Close();
+			}
+
 			AVS_linkage = 0;
 			::FreeLibrary(hDLL);
 
@@ -1238,31 +2059,37 @@ int main(int argc, char* argv[])
 		__int64 iElapsedMS = 0;
 		__int64 iEstimatedMS = 0;
 
-		CProcessInfo processinfo;
+		CMonitor monitor;
+		stMonitorSample msample;
+		CMetricsServer metricsserver;   //declared after the monitor, stops before it goes away
+		CLiveStats livestats;
+		stFrameLoopStats loopstats;
+		stFrameRecord frecord;
+		double dPrevRecordTime = 0.0;
+		unsigned __int64 ui64RowCycles = 0;
+		unsigned int uiRowFrames = 0;
+		float fCyclesPerFrame = 0.0f;
+		DWORD dwRowFaults = 0;
+		DWORD dwRowHardFaults = 0;
+		float fSoftFaultsPerFrame = 0.0f;
+		float fHardFaultsPerFrame = 0.0f;
 
 		DWORD dwMemPeakMB = 0;
 		DWORD dwMemCurrentMB = 0;
 
 		double dCPUUsageCur = 0;
-		double dCPUUsageAcc = 0;
 		double dCPUUsageAvg = 0;
 		unsigned int uiGPUUsageCur = 0;
-		unsigned int uiGPUUsageAcc = 0;
 		unsigned int uiGPUUsageAvg = 0;
 		unsigned int uiVPUUsageCur = 0;
-		unsigned int uiVPUUsageAcc = 0;
 		unsigned int uiVPUUsageAvg = 0;
 		double dGPUPowerConsumptionCur = 0.0;
-		double dGPUPowerConsumptionAcc = 0.0;
 		double dGPUPowerConsumptionAvg = 0.0;
 
-		unsigned int uiIntervalCounter = 0;
-
 		unsigned int uiCurrentFrame = 0;
 		double dFPSAverage = 0.0;
 		double dFPSCurrent = 0.0;
-		double dFPSMin = 1.0e+20;
-		double dFPSMax = 0.0;
+		CDDSketch fpssketch;          //interval FPS, exact min/max
 
 		if (Settings.bGPUInfo)
 		{
@@ -1271,7 +2098,51 @@ int main(int argc, char* argv[])
 				AVS_env->ThrowError("Error reading GPU sensors\n");
 		}
 
-		processinfo.Update();
+		//CPU, memory and sensors are sampled by the monitor thread, the frame loop only reads the snapshot
+		monitor.bHardFaults = CLSwitches_hardfaults;
+		if (!monitor.Start(&timer, Settings.bGPUInfo ? &gpuinfo : NULL, MONITOR_PERIOD_MS))
+			AVS_env->ThrowError("Cannot start the monitor thread\n");
+
+		if (profiler.bEnabled && !profiler.Start(PROFILER_PERIOD_MS))
+			AVS_env->ThrowError("Cannot start the profiler thread\n");
+
+		::ZeroMemory(&loopstats, sizeof(stFrameLoopStats));
+		loopstats.frames_total = uiFramesToProcess;
+		metricsserver.Publish(loopstats);
+		if ((uiListenPort > 0) && !metricsserver.Start((unsigned short)uiListenPort, &monitor, sAVSMVersion, sAVSFile, Settings.bGPUInfo))
+			AVS_env->ThrowError("%s\n", metricsserver.sError.c_str());
+
+		//only a convenience for external monitors, the benchmark does not depend on it
+		if (Settings.bLiveStats)
+			livestats.Open(sAVSMVersion, sAVSFile);
+
+		//plugins loaded after this point are not hooked
+		if (alloctracker.bEnabled && !alloctracker.Install())
+			AVS_env->ThrowError("Cannot install the allocation hooks\n");
+
+		if (bMetricsFile)
+		{
+			stMetricsHeader mheader;
+			mheader.wVersion = METRICSFILE_VERSION;
+			mheader.dwFlags = 0;
+			if (Settings.bGPUInfo)
+				mheader.dwFlags |= METRICSFILE_FLAG_GPU;
+			if (gpuinfo.data.NVVPU)
+				mheader.dwFlags |= METRICSFILE_FLAG_NVVP;
+			mheader.sAVSMVersion = sAVSMVersion;
+			mheader.sScriptFile = sAVSFile;
+			mheader.sDateTime = sys.GetFormattedSystemDateTime();
+			ReadTextFile(sAVSFile, mheader.sScriptText);
+
+			string sAMBFile = GetOutputFileName(sAVSFile, ".amb");
+			if (!metricswriter.Open(sAMBFile, mheader))
+				AVS_env->ThrowError("%s\n", metricswriter.sError.c_str());
+		}
+
+		monitor.GetSnapshot(msample);
+		ui64RowCycles = msample.cycles;
+		dwRowFaults = msample.page_faults;
+		dwRowHardFaults = msample.hard_faults;
 
 		double dStartTime = timer.GetTimer();
 		double dCurrentTime = dStartTime;
@@ -1283,46 +2154,55 @@ int main(int argc, char* argv[])
 		{
 			PVideoFrame src_frame = AVS_clip->GetFrame(uiCurrentFrame, AVS_env);
 			++uiFramesRead;
+			monitor.lFramesRead = (LONG)uiFramesRead;
+
+			//every frame is recorded, the log table is picked from these records after the run
+			frecord.frame = uiCurrentFrame;
+			frecord.time = timer.GetTimer() - dStartTime;
+			frecord.cpu_usage = (float)msample.cpu_usage;
+			frecord.gpu_usage = msample.gpu_usage;
+			frecord.vpu_usage = msample.vpu_usage;
+			frecord.num_threads = msample.num_threads;
+			frecord.process_memory = msample.process_memory;
+			frecord.commit_memory = msample.commit;
+			frecord.cycles = msample.cycles;
+			frecord.page_faults = msample.page_faults;
+			frecord.hard_faults = msample.hard_faults;
+			framestore.Add(frecord);
+			metricswriter.Add(frecord);
+			sketches.Add(frecord.time, 1000.0 * (frecord.time - dPrevRecordTime), frecord.cpu_usage, (double)frecord.process_memory);
+			dPrevRecordTime = frecord.time;
 
 			if (((uiFramesRead % uiFrameInterval) != 0) && (uiFramesRead != uiFramesToProcess))
 				continue;
 
 			dCurrentTime = timer.GetTimer();
 
-			processinfo.Update();
-
-			++uiIntervalCounter;
+			monitor.GetSnapshot(msample);
+			monitor.lOwnKiB = (LONG)((framestore.GetMemoryBytes() + perfdata.capacity() * sizeof(stPerfData)) / 1024);
 
-			if ((Settings.bGPUInfo) && (uiIntervalCounter > 0))
+			if (Settings.bGPUInfo)
 			{
-				gpuinfo.ReadSensors();
-				if (gpuinfo.sensors.ReadError)
+				if (msample.gpu_read_error)
 					AVS_env->ThrowError("Error reading GPU sensors\n");
 
-				uiGPUUsageCur = (unsigned int)gpuinfo.sensors.GPULoad;
-				uiGPUUsageAcc += uiGPUUsageCur;
-				uiGPUUsageAvg = (unsigned int)(((double)uiGPUUsageAcc / (double)uiIntervalCounter) + 0.5);
-				uiVPUUsageCur = (unsigned int)gpuinfo.sensors.VPULoad;
-				uiVPUUsageAcc += uiVPUUsageCur;
-				uiVPUUsageAvg = (unsigned int)(((double)uiVPUUsageAcc / (double)uiIntervalCounter) + 0.5);
+				uiGPUUsageCur = (unsigned int)msample.gpu_usage;
+				uiGPUUsageAvg = (unsigned int)(msample.gpu_usage_avg + 0.5);
+				uiVPUUsageCur = (unsigned int)msample.vpu_usage;
+				uiVPUUsageAvg = (unsigned int)(msample.vpu_usage_avg + 0.5);
 
-				dGPUPowerConsumptionCur = gpuinfo.sensors.PowerConsumption;
-				dGPUPowerConsumptionAcc += dGPUPowerConsumptionCur;
-				dGPUPowerConsumptionAvg = (dGPUPowerConsumptionAcc / (double)uiIntervalCounter) + 0.5;
+				dGPUPowerConsumptionCur = msample.gpu_power;
+				dGPUPowerConsumptionAvg = msample.gpu_power_avg + 0.5;
 			}
 
 			iElapsedMS = (__int64)(((dCurrentTime - dStartTime) * 1000.0) + 0.5);
 			iEstimatedMS = (__int64)((double)uiFramesToProcess * (double)iElapsedMS / (double)uiFramesRead);
 
-			dCPUUsageCur = processinfo.dCPUUsage;
-			dCPUUsageAcc += dCPUUsageCur;
-			if (uiIntervalCounter > 0)
-				dCPUUsageAvg = dCPUUsageAcc / (double)uiIntervalCounter;
-
-			dwMemCurrentMB = processinfo.dwMemMB;
+			dCPUUsageCur = msample.cpu_usage;
+			dCPUUsageAvg = msample.cpu_usage_avg;
 
-			if (dwMemCurrentMB > dwMemPeakMB)
-				dwMemPeakMB = dwMemCurrentMB;
+			dwMemCurrentMB = msample.process_memory;
+			dwMemPeakMB = msample.process_memory_peak;
 
 			dFPSAverage = (double)uiFramesRead / (dCurrentTime - dStartTime);
 
@@ -1334,10 +2214,7 @@ int main(int argc, char* argv[])
 			else
 				dFPSCurrent = (double)uiFrameInterval / 0.000001;
 
-			if (dFPSCurrent > dFPSMax)
-				dFPSMax = dFPSCurrent;
-			if (dFPSCurrent < dFPSMin)
-				dFPSMin = dFPSCurrent;
+			fpssketch.Add(dFPSCurrent);
 
 
 			if (((uiFramesRead % uiLogFrameInterval) == 0) || (uiFramesRead == uiFramesToProcess))
@@ -1346,12 +2223,12 @@ int main(int argc, char* argv[])
 				pdata.frame = uiCurrentFrame;
 				pdata.fps_current = (float)dFPSCurrent;
 				pdata.fps_average = (float)dFPSAverage;
-				pdata.cpu_usage = (float)processinfo.dCPUUsage;
+				pdata.cpu_usage = (float)msample.cpu_usage;
 
 				if (Settings.bGPUInfo)
 				{
-					pdata.gpu_usage = gpuinfo.sensors.GPULoad;
-					pdata.vpu_usage = gpuinfo.sensors.VPULoad;
+					pdata.gpu_usage = msample.gpu_usage;
+					pdata.vpu_usage = msample.vpu_usage;
 				}
 				else
 				{
@@ -1359,8 +2236,27 @@ int main(int argc, char* argv[])
 					pdata.vpu_usage = 0;
 				}
 
-				pdata.num_threads = processinfo.wThreadCount;
+				pdata.num_threads = msample.num_threads;
 				pdata.process_memory = dwMemCurrentMB;
+
+				pdata.commit_memory = msample.commit;
+
+				//cycles and page faults are sampled by the monitor, attribute them to the frames finished up to that sample
+				if (msample.frames > uiRowFrames)
+				{
+					double dFrames = (double)(msample.frames - uiRowFrames);
+					DWORD dwHardFaults = msample.hard_faults - dwRowHardFaults;
+					fCyclesPerFrame = (float)((double)(msample.cycles - ui64RowCycles) / dFrames / 1.0e+6);
+					fSoftFaultsPerFrame = (float)((double)((msample.page_faults - dwRowFaults) - dwHardFaults) / dFrames);
+					fHardFaultsPerFrame = (float)((double)dwHardFaults / dFrames);
+					ui64RowCycles = msample.cycles;
+					dwRowFaults = msample.page_faults;
+					dwRowHardFaults = msample.hard_faults;
+					uiRowFrames = msample.frames;
+				}
+				pdata.cycles_per_frame = fCyclesPerFrame;
+				pdata.soft_faults = fSoftFaultsPerFrame;
+				pdata.hard_faults = fHardFaultsPerFrame;
 				perfdata.push_back(pdata);
 			}
 
@@ -1371,6 +2267,47 @@ int main(int argc, char* argv[])
 
 			dLastDisplayTime = dCurrentTime;
 
+			if ((uiListenPort > 0) || Settings.bLiveStats)
+			{
+				loopstats.elapsed = dCurrentTime - dStartTime;
+				loopstats.frames_read = uiFramesRead;
+				loopstats.fps = dFPSCurrent;
+				loopstats.fps_average = dFPSAverage;
+				loopstats.frametime_p50 = sketches.overall.frametime.Quantile(0.50);
+				loopstats.frametime_p95 = sketches.overall.frametime.Quantile(0.95);
+				loopstats.frametime_p99 = sketches.overall.frametime.Quantile(0.99);
+				loopstats.frametime_max = sketches.overall.frametime.GetMax();
+				metricsserver.Publish(loopstats);
+				livestats.Publish(loopstats, msample);
+			}
+
+			if (bJSON)
+			{
+				jsonline.Clear();
+				jsonline.BeginObject(NULL);
+				jsonline.String("type", "interval");
+				jsonline.Number("time_s", dCurrentTime - dStartTime, 3);
+				jsonline.UInt("frame", uiCurrentFrame);
+				jsonline.UInt("frames_read", uiFramesRead);
+				jsonline.UInt("frames_total", uiFramesToProcess);
+				jsonline.Number("fps", dFPSCurrent, 3);
+				jsonline.Number("fps_average", dFPSAverage, 3);
+				jsonline.Number("frametime_p95_ms", sketches.overall.frametime.Quantile(0.95), 3);
+				jsonline.Number("cpu_percent", dCPUUsageCur, 1);
+				jsonline.UInt("memory_mib", dwMemCurrentMB);
+				jsonline.UInt("commit_mib", msample.commit);
+				jsonline.UInt("threads", msample.num_threads);
+				if (Settings.bGPUInfo)
+				{
+					jsonline.UInt("gpu_percent", uiGPUUsageCur);
+					if (gpuinfo.data.NVVPU)
+						jsonline.UInt("vpu_percent", uiVPUUsageCur);
+				}
+				jsonline.Number("eta_s", (double)(iEstimatedMS - iElapsedMS) / 1000.0, 1);
+				jsonline.EndObject();
+				ndjson.Write(jsonline);
+			}
+
 			if (!bFirstScr)
 			{
 				utils.CursorUp(uiCursorOffset);
@@ -1386,14 +2323,14 @@ int main(int argc, char* argv[])
 
 			if (Settings.bDisplayFPS)
 			{
-				sOutBuf = utils.StrFormat("FPS (cur | min | max | avg):        %s | %s | %s | %s", utils.StrFormatFPS(dFPSCurrent).c_str(), utils.StrFormatFPS(dFPSMin).c_str(), utils.StrFormatFPS(dFPSMax).c_str(), utils.StrFormatFPS(dFPSAverage).c_str());
+				sOutBuf = utils.StrFormat("FPS (cur | min | max | avg):        %s | %s | %s | %s", utils.StrFormatFPS(dFPSCurrent).c_str(), utils.StrFormatFPS(fpssketch.GetMin()).c_str(), utils.StrFormatFPS(fpssketch.GetMax()).c_str(), utils.StrFormatFPS(dFPSAverage).c_str());
 				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 				++uiCursorOffset;
 			}
 
 			if (Settings.bDisplayTPF)
 			{
-				sOutBuf = utils.StrFormat("TPF (cur | max | min | avg):        %s | %s | %s | %s ms", utils.StrFormatTPF(1000.0 / dFPSCurrent).c_str(), utils.StrFormatTPF(1000.0 / dFPSMin).c_str(), utils.StrFormatTPF(1000.0 / dFPSMax).c_str(), utils.StrFormatTPF(1000.0 / dFPSAverage).c_str());
+				sOutBuf = utils.StrFormat("TPF (cur | max | min | avg):        %s | %s | %s | %s ms", utils.StrFormatTPF(1000.0 / dFPSCurrent).c_str(), utils.StrFormatTPF(1000.0 / fpssketch.GetMin()).c_str(), utils.StrFormatTPF(1000.0 / fpssketch.GetMax()).c_str(), utils.StrFormatTPF(1000.0 / dFPSAverage).c_str());
 				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 				++uiCursorOffset;
 			}
@@ -1402,7 +2339,7 @@ int main(int argc, char* argv[])
 			PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 			++uiCursorOffset;
 
-			sOutBuf = utils.StrFormat("Thread count:                       %u", processinfo.wThreadCount);
+			sOutBuf = utils.StrFormat("Thread count:                       %u", msample.num_threads);
 			PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 			++uiCursorOffset;
 
@@ -1428,21 +2365,21 @@ int main(int argc, char* argv[])
 
 				if (gpuinfo.data.GeneralMem)
 				{
-					sOutBuf = utils.StrFormat("GPU memory usage:                   %u MiB", gpuinfo.sensors.MemoryUsedGeneral);
+					sOutBuf = utils.StrFormat("GPU memory usage:                   %u MiB", msample.gpu_memory_general);
 					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 					++uiCursorOffset;
 				}
 
 				if (gpuinfo.data.DedicatedMem)
 				{
-					sOutBuf = utils.StrFormat("GPU memory usage (Dedicated):       %u MiB", gpuinfo.sensors.MemoryUsedDedicated);
+					sOutBuf = utils.StrFormat("GPU memory usage (Dedicated):       %u MiB", msample.gpu_memory_dedicated);
 					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 					++uiCursorOffset;
 				}
 
 				if (gpuinfo.data.DynamicMem)
 				{
-					sOutBuf = utils.StrFormat("GPU memory usage (Dynamic):         %u MiB", gpuinfo.sensors.MemoryUsedDynamic);
+					sOutBuf = utils.StrFormat("GPU memory usage (Dynamic):         %u MiB", msample.gpu_memory_dynamic);
 					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 					++uiCursorOffset;
 				}
@@ -1478,12 +2415,51 @@ int main(int argc, char* argv[])
 				if (_getch() == 0x1B) //ESC
 				{
 					uiLastFrame = uiCurrentFrame;
+					bAborted = TRUE;
 					break;
 				}
 			}
 		}
 
-		processinfo.CloseProcess();
+		monitor.Stop();
+		monitor.GetSnapshot(msample);
+		profiler.Stop();
+
+		//the final numbers stay available until the summary is done
+		if ((uiListenPort > 0) || Settings.bLiveStats)
+		{
+			loopstats.elapsed = dCurrentTime - dStartTime;
+			loopstats.frames_read = uiFramesRead;
+			//no interval is running anymore, the current FPS is that of the whole run
+			loopstats.fps = (loopstats.elapsed > 0.0) ? (double)uiFramesRead / loopstats.elapsed : 0.0;
+			loopstats.fps_average = dFPSAverage;
+			loopstats.frametime_p50 = sketches.overall.frametime.Quantile(0.50);
+			loopstats.frametime_p95 = sketches.overall.frametime.Quantile(0.95);
+			loopstats.frametime_p99 = sketches.overall.frametime.Quantile(0.99);
+			loopstats.frametime_max = sketches.overall.frametime.GetMax();
+			loopstats.completed = (uiFramesRead == uiFramesToProcess) ? TRUE : FALSE;
+			metricsserver.Publish(loopstats);
+			livestats.Publish(loopstats, msample);
+			livestats.SetState(LIVESTATS_STATE_FINISHED);
+		}
+		alloctracker.Uninstall();
+		framestore.Close();
+		//a run cancelled with ESC reads as interrupted, like one that threw
+		metricswriter.Close(bAborted ? FALSE : TRUE);
+
+		//the log table is downsampled from every frame, the interval rows are only the fallback,
+		//the csv keeps the interval FPS of the frame loop
+		if (Settings.bCreateCSV)
+			csvdata = perfdata;
+		if ((framestore.ui64Frames > 0) && (framestore.sError == ""))
+			BuildPerfData(framestore, perfdata, PERFDATA_MAX_ROWS);
+
+		if (bSaveSketches)
+		{
+			string sSketchFile = GetOutputFileName(sAVSFile, ".ddsk");
+			if (!sketches.Save(sSketchFile, sAVSFile))
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot create \"%s\"\n", sSketchFile.c_str());
+		}
 
 		if (Settings.bGPUInfo)
 			gpuinfo.GPUZRelease();
@@ -1512,63 +2488,142 @@ int main(int argc, char* argv[])
 			{
 				if (Settings.bDisplayFPS)
 				{
-					sOutBuf = utils.StrFormat("FPS (min | max | average):          %s | %s | %s", utils.StrFormatFPS(dFPSMin).c_str(), utils.StrFormatFPS(dFPSMax).c_str(), utils.StrFormatFPS(dFPSAverage).c_str());
+					sOutBuf = utils.StrFormat("FPS (min | max | average):          %s | %s | %s", utils.StrFormatFPS(fpssketch.GetMin()).c_str(), utils.StrFormatFPS(fpssketch.GetMax()).c_str(), utils.StrFormatFPS(dFPSAverage).c_str());
 					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 					sLogBuffer += sOutBuf + "\n";
 				}
 
 				if (Settings.bDisplayTPF)
 				{
-					sOutBuf = utils.StrFormat("TPF (max | min | average):          %s | %s | %s ms", utils.StrFormatTPF(1000.0 / dFPSMin).c_str(), utils.StrFormatTPF(1000.0 / dFPSMax).c_str(), utils.StrFormatTPF(1000.0 / dFPSAverage).c_str());
+					sOutBuf = utils.StrFormat("TPF (max | min | average):          %s | %s | %s ms", utils.StrFormatTPF(1000.0 / fpssketch.GetMin()).c_str(), utils.StrFormatTPF(1000.0 / fpssketch.GetMax()).c_str(), utils.StrFormatTPF(1000.0 / dFPSAverage).c_str());
 					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 					sLogBuffer += sOutBuf + "\n";
 				}
 
+				//per-frame percentiles from the sketches, within 1% of the exact values
+				sOutBuf = utils.StrFormat("Frame time (p50 | p95 | p99 | max): %s | %s | %s | %s ms", utils.StrFormatTPF(sketches.overall.frametime.Quantile(0.50)).c_str(), utils.StrFormatTPF(sketches.overall.frametime.Quantile(0.95)).c_str(), utils.StrFormatTPF(sketches.overall.frametime.Quantile(0.99)).c_str(), utils.StrFormatTPF(sketches.overall.frametime.GetMax()).c_str());
+				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+				sLogBuffer += sOutBuf + "\n";
+
 				sOutBuf = utils.StrFormat("Process memory usage (max):         %u MiB", dwMemPeakMB);
 				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 				sLogBuffer += sOutBuf + "\n";
 
-				sOutBuf = utils.StrFormat("Thread count:                       %u", processinfo.wThreadCount);
+				sOutBuf = utils.StrFormat("Process memory (p50 | p99):         %.0f | %.0f MiB", sketches.overall.memory.Quantile(0.50), sketches.overall.memory.Quantile(0.99));
 				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 				sLogBuffer += sOutBuf + "\n";
 
-				sOutBuf = utils.StrFormat("CPU usage (average):                %.1f%%", dCPUUsageAvg);
+				sOutBuf = utils.StrFormat("Commit charge (current | peak):     %u | %u MiB", msample.commit, msample.commit_peak);
 				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 				sLogBuffer += sOutBuf + "\n";
 
-				if (Settings.bGPUInfo)
+				sOutBuf = utils.StrFormat("Working set (private | OS peak):    %u | %u MiB", msample.private_ws, msample.working_set_peak);
+				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+				sLogBuffer += sOutBuf + "\n";
+
+				if ((monitor.vSamples.size() > 0) && (msample.frames > 0))
 				{
-					PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\n");
-					sLogBuffer += "\n";
+					DWORD dwHardFaults = msample.hard_faults - monitor.vSamples[0].hard_faults;
+					DWORD dwSoftFaults = (msample.page_faults - monitor.vSamples[0].page_faults) - dwHardFaults;
+					if (CLSwitches_hardfaults)
+						sOutBuf = utils.StrFormat("Page faults (soft | hard):          %u | %u (%.1f | %.2f per frame)", dwSoftFaults, dwHardFaults, (double)dwSoftFaults / (double)msample.frames, (double)dwHardFaults / (double)msample.frames);
+					else
+						sOutBuf = utils.StrFormat("Page faults (soft + hard):          %u (%.1f per frame)", dwSoftFaults, (double)dwSoftFaults / (double)msample.frames);
+					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+					sLogBuffer += sOutBuf + "\n";
+				}
 
-					sOutBuf = utils.StrFormat("GPU usage (average):                %u%%", uiGPUUsageAvg);
+				//robust trend after the warm-up, a leak is reported when even the lower confidence bound exceeds the threshold
+				double dSlope = 0.0;
+				double dLower = 0.0;
+				double dUpper = 0.0;
+				if (monitor.FitMemoryGrowth(FALSE, dSlope, dLower, dUpper))
+				{
+					sOutBuf = utils.StrFormat("Working set growth (95%% CI):        %.2f KiB/frame (%.2f .. %.2f)", dSlope, dLower, dUpper);
 					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 					sLogBuffer += sOutBuf + "\n";
+					if ((Settings.dLeakThreshold >= 0.0) && (dLower > Settings.dLeakThreshold))
+						bLeakDetected = TRUE;
+				}
 
-					if (gpuinfo.data.NVVPU)
-					{
-						sOutBuf = utils.StrFormat("VPU usage (average):                %u%%", uiVPUUsageAvg);
-						PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
-						sLogBuffer += sOutBuf + "\n";
-					}
+				if (monitor.FitMemoryGrowth(TRUE, dSlope, dLower, dUpper))
+				{
+					sOutBuf = utils.StrFormat("Commit growth (95%% CI):             %.2f KiB/frame (%.2f .. %.2f)", dSlope, dLower, dUpper);
+					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+					sLogBuffer += sOutBuf + "\n";
+					if ((Settings.dLeakThreshold >= 0.0) && (dLower > Settings.dLeakThreshold))
+						bLeakDetected = TRUE;
+				}
 
-					if (gpuinfo.data.GeneralMem)
-					{
-						sOutBuf = utils.StrFormat("GPU memory usage:                   %u MiB", gpuinfo.sensors.MemoryUsedGeneral);
-						PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
-						sLogBuffer += sOutBuf + "\n";
-					}
+				sOutBuf = utils.StrFormat("Thread count:                       %u", msample.num_threads);
+				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+				sLogBuffer += sOutBuf + "\n";
 
-					if (gpuinfo.data.DedicatedMem)
+				sOutBuf = utils.StrFormat("CPU usage (average):                %.1f%%", dCPUUsageAvg);
+				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+				sLogBuffer += sOutBuf + "\n";
+
+				sOutBuf = utils.StrFormat("CPU usage (p50 | p95):              %.1f%% | %.1f%%", sketches.overall.cpu.Quantile(0.50), sketches.overall.cpu.Quantile(0.95));
+				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+				sLogBuffer += sOutBuf + "\n";
+
+				sOutBuf = utils.StrFormat("Busy cores (average):               %.2f", monitor.GetMeanConcurrency());
+				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+				sLogBuffer += sOutBuf + "\n";
+
+				if (monitor.vSamples.size() > 0)
+				{
+					sOutBuf = utils.StrFormat("Threads (created | exited):         %d | %d", msample.threads_created - monitor.vSamples[0].threads_created, msample.threads_exited - monitor.vSamples[0].threads_exited);
+					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+					sLogBuffer += sOutBuf + "\n";
+				}
+
+				if ((monitor.vSamples.size() > 0) && (msample.frames > 0))
+				{
+					double dCycles = (double)(msample.cycles - monitor.vSamples[0].cycles);
+					sOutBuf = utils.StrFormat("CPU cycles (per frame | per sec):   %.1f M | %.2f G", dCycles / (double)msample.frames / 1.0e+6, dCycles / msample.time / 1.0e+9);
+					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+					sLogBuffer += sOutBuf + "\n";
+
+					//instructions and misses need the PMU, Windows gives user mode only the cycle count
+					sOutBuf = "IPC, LLC/L1D/branch/dTLB MPKI:     n/a (no user-mode PMU access, CPU cycles only)";
+					PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\n", Pad(sOutBuf).c_str());
+					sLogBuffer += sOutBuf + "\n";
+				}
+
+				if (Settings.bGPUInfo)
+				{
+					PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\n");
+					sLogBuffer += "\n";
+
+					sOutBuf = utils.StrFormat("GPU usage (average):                %u%%", uiGPUUsageAvg);
+					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+					sLogBuffer += sOutBuf + "\n";
+
+					if (gpuinfo.data.NVVPU)
 					{
-						sOutBuf = utils.StrFormat("GPU memory usage (Dedicated):       %u MiB", gpuinfo.sensors.MemoryUsedDedicated);
+						sOutBuf = utils.StrFormat("VPU usage (average):                %u%%", uiVPUUsageAvg);
+						PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+						sLogBuffer += sOutBuf + "\n";
+					}
+
+					if (gpuinfo.data.GeneralMem)
+					{
+						sOutBuf = utils.StrFormat("GPU memory usage:                   %u MiB", msample.gpu_memory_general);
+						PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
+						sLogBuffer += sOutBuf + "\n";
+					}
+
+					if (gpuinfo.data.DedicatedMem)
+					{
+						sOutBuf = utils.StrFormat("GPU memory usage (Dedicated):       %u MiB", msample.gpu_memory_dedicated);
 						PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 						sLogBuffer += sOutBuf + "\n";
 					}
 
 					if (gpuinfo.data.DynamicMem)
 					{
-						sOutBuf = utils.StrFormat("GPU memory usage (Dynamic):         %u MiB", gpuinfo.sensors.MemoryUsedDynamic);
+						sOutBuf = utils.StrFormat("GPU memory usage (Dynamic):         %u MiB", msample.gpu_memory_dynamic);
 						PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 						sLogBuffer += sOutBuf + "\n";
 					}
@@ -1590,6 +2645,14 @@ int main(int argc, char* argv[])
 			PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(sOutBuf).c_str());
 			sLogBuffer += sOutBuf + "\n";
 
+			if (bLeakDetected)
+			{
+				sOutBuf = utils.StrFormat("\nMemory growth exceeds the threshold of %.2f KiB/frame\n", Settings.dLeakThreshold);
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "%s", sOutBuf.c_str());
+				sLogBuffer += sOutBuf;
+				iRet = -1;
+			}
+
 			PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\n", Pad("").c_str());
 			PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\n", Pad("").c_str());
 			utils.CursorUp(2);
@@ -1633,6 +2696,187 @@ int main(int argc, char* argv[])
 			bRuntimeTooShort = TRUE;
 		}
 
+		vector<double> vFrameTimes;
+		if ((bJSON || (sBaselineFile != "")) && !bRuntimeTooShort)
+			SampleFrameTimes(framestore, vFrameTimes, BASELINE_SAMPLE_SIZE);
+
+		if (bJSON)
+		{
+			json.BeginObject("summary");
+			json.UInt("frames_processed", uiFramesRead);
+			json.UInt("first_frame", uiFirstFrame);
+			json.UInt("last_frame", uiLastFrame);
+			json.Bool("completed", (uiFramesRead == uiFramesToProcess) ? TRUE : FALSE);
+			json.Number("runtime_s", (double)iElapsedMS / 1000.0, 3);
+			json.Number("fps_average", dFPSAverage, 3);
+			if (fpssketch.GetCount() > 0)
+			{
+				json.Number("fps_min", fpssketch.GetMin(), 3);
+				json.Number("fps_max", fpssketch.GetMax(), 3);
+			}
+			else
+			{
+				json.Null("fps_min");
+				json.Null("fps_max");
+			}
+			json.Number("cpu_average_percent", dCPUUsageAvg, 1);
+			json.Number("busy_cores_average", monitor.GetMeanConcurrency(), 2);
+			json.UInt("threads", msample.num_threads);
+			json.UInt("memory_peak_mib", dwMemPeakMB);
+			json.UInt("commit_peak_mib", msample.commit_peak);
+			json.UInt("working_set_peak_mib", msample.working_set_peak);
+			if ((monitor.vSamples.size() > 0) && (msample.frames > 0))
+			{
+				DWORD dwHardFaults = msample.hard_faults - monitor.vSamples[0].hard_faults;
+				json.Number("mcycles_per_frame", (double)(msample.cycles - monitor.vSamples[0].cycles) / (double)msample.frames / 1.0e+6, 3);
+				json.BeginObject("hardware_counters");
+				json.Bool("available", FALSE);
+				json.String("source", "QueryProcessCycleTime");
+				json.String("reason", "no user-mode PMU access, CPU cycles only");
+				json.Null("ipc");
+				json.Null("llc_mpki");
+				json.Null("l1d_mpki");
+				json.Null("branch_mpki");
+				json.Null("dtlb_mpki");
+				json.EndObject();
+				if (CLSwitches_hardfaults)
+				{
+					json.UInt("soft_faults", (msample.page_faults - monitor.vSamples[0].page_faults) - dwHardFaults);
+					json.UInt("hard_faults", dwHardFaults);
+				}
+				else
+					json.UInt("page_faults", msample.page_faults - monitor.vSamples[0].page_faults);
+			}
+			if (Settings.bGPUInfo)
+			{
+				json.UInt("gpu_average_percent", uiGPUUsageAvg);
+				if (gpuinfo.data.NVVPU)
+					json.UInt("vpu_average_percent", uiVPUUsageAvg);
+				json.Number("gpu_power_average_w", dGPUPowerConsumptionAvg, 1);
+			}
+			json.Bool("leak_detected", bLeakDetected);
+			json.EndObject();
+
+			if (!bRuntimeTooShort)
+			{
+				json.BeginObject("percentiles");
+				AddJSONPercentiles(json, "frametime_ms", sketches.overall.frametime);
+				AddJSONPercentiles(json, "cpu_percent", sketches.overall.cpu);
+				AddJSONPercentiles(json, "memory_mib", sketches.overall.memory);
+				json.EndObject();
+
+				//what a later run with -baseline compares against
+				json.BeginObject("frametimes_ms");
+				json.UInt("frames", framestore.ui64Frames);
+				json.String("sampling", (framestore.ui64Frames > (unsigned __int64)vFrameTimes.size()) ? "reservoir" : "all");
+				json.BeginArray("values");
+				for (size_t i = 0; i < vFrameTimes.size(); i++)
+					json.Number(NULL, vFrameTimes[i], 4);
+				json.EndArray();
+				json.EndObject();
+			}
+		}
+
+		if (sBaselineFile != "")
+		{
+			BOOL bRegression = FALSE;
+			if (!bRuntimeTooShort)
+				sOutBuf = CompareBaseline(baseline, vFrameTimes, dFPSAverage, dRegressThreshold, bJSON ? &json : NULL, bRegression);
+			else
+			{
+				//the gate cannot pass without a measurement
+				sOutBuf = "\n[Baseline comparison]\nNot possible, the script runtime is too short\n";
+				bRegression = TRUE;
+			}
+
+			PrintConsoleBlock(Settings.bConUseStdOut, bRegression ? COLOR_ERROR : COLOR_DEFAULT, sOutBuf);
+			sLogBuffer += sOutBuf;
+			if (bRegression)
+				iRet = -1;
+		}
+
+		//stored after the catch blocks, only when the run ended without an error.
+		//cancelled, partial and instrumented runs are not comparable with the history
+		if (Settings.bSaveResults && (Settings.sResultsFile != "") && !bRuntimeTooShort && !bAborted && !CLSwitches_range &&
+		    !CLSwitches_trace && !CLSwitches_graph && !CLSwitches_profile && !CLSwitches_allocs)
+		{
+			FILETIME ftNow;
+			::GetSystemTimeAsFileTime(&ftNow);
+			result.ui64Script = FingerprintScript(sAVSFile);
+			result.ui64Environment = FingerprintEnvironment();
+			result.ui64Machine = FingerprintMachine();
+			result.ui64Time = ((unsigned __int64)ftNow.dwHighDateTime << 32) | ftNow.dwLowDateTime;
+			result.dFPS = dFPSAverage;
+			result.dFrameTimeP50 = sketches.overall.frametime.Quantile(0.50);
+			result.dFrameTimeP99 = sketches.overall.frametime.Quantile(0.99);
+			result.dRuntime = (double)iElapsedMS / 1000.0;
+			result.dwFrames = (DWORD)uiFramesRead;
+			result.dwMemPeak = dwMemPeakMB;
+			result.sScriptFile = sAVSFile;
+			result.sAVSMVersion = sAVSMVersion;
+			result.sAVSVersion = AvisynthInfo.sFileVersion;
+			result.sCPU = sys.cpudata.CPUBrandString;
+			bResultValid = TRUE;
+		}
+
+		if (bJSON)
+		{
+			jsonline.Clear();
+			jsonline.BeginObject(NULL);
+			jsonline.String("type", "end");
+			jsonline.UInt("frames_processed", uiFramesRead);
+			jsonline.Number("runtime_s", (double)iElapsedMS / 1000.0, 3);
+			jsonline.Number("fps_average", dFPSAverage, 3);
+			jsonline.Bool("runtime_too_short", bRuntimeTooShort);
+			jsonline.EndObject();
+			ndjson.Write(jsonline);
+		}
+
+		if (tracer.bEnabled)
+		{
+			tracer.QueryHints();
+			sOutBuf = tracer.Report();
+			sLogBuffer += sOutBuf;
+			PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, sOutBuf);
+		}
+
+		if (profiler.bEnabled)
+		{
+			sOutBuf = profiler.Report(AvisynthInfo.vPlugins);
+			sLogBuffer += sOutBuf;
+			PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, sOutBuf);
+		}
+
+		if (alloctracker.bEnabled)
+		{
+			sOutBuf = alloctracker.Report(msample.frames);
+			sLogBuffer += sOutBuf;
+			PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, sOutBuf);
+		}
+
+		if (!bRuntimeTooShort)
+		{
+			sLogBuffer += monitor.threadinfo.FormatTable();
+			SYSTEM_INFO si;
+			::GetSystemInfo(&si);
+			sLogBuffer += monitor.FormatConcurrency((unsigned int)si.dwNumberOfProcessors);
+			sLogBuffer += monitor.FormatSamples(10000);
+			sLogBuffer += sketches.FormatWindows();
+
+			sLogBuffer += "\n\n[Frame records]\n";
+			sLogBuffer += utils.StrFormat("Frames:                             %I64u\n", framestore.ui64Frames);
+			sLogBuffer += utils.StrFormat("Encoded size:                       %.2f MiB (%.2f bytes/frame)\n", (double)framestore.GetEncodedBytes() / 1048576.0, (double)framestore.GetEncodedBytes() / (double)((framestore.ui64Frames > 0) ? framestore.ui64Frames : 1));
+			sLogBuffer += utils.StrFormat("Spilled to disk:                    %.2f MiB\n", (double)framestore.ui64SpilledBytes / 1048576.0);
+			if (framestore.sError != "")
+				sLogBuffer += "Error:                              " + framestore.sError + "\n";
+			if (bMetricsFile)
+			{
+				sLogBuffer += utils.StrFormat("Metrics file:                       %s (%u chunks)\n", GetOutputFileName(sAVSFile, ".amb").c_str(), metricswriter.uiChunks);
+				if (metricswriter.sError != "")
+					sLogBuffer += "Error:                              " + metricswriter.sError + "\n";
+			}
+		}
+
 		AVS_clip = 0;
 		AVS_main = 0;
 		AVS_temp = 0;
@@ -1695,8 +2939,22 @@ int main(int argc, char* argv[])
 			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\n%s\n", sAVSError.c_str());
 	}
 
+	//the hooks patch the import tables of modules that are about to be unloaded
+	profiler.Stop();
+	alloctracker.Uninstall();
+
+	//without the end marker, the metrics file reads as an interrupted run
+	metricswriter.Close(FALSE);
+
 	::FreeLibrary(hDLL);
 
+	if (bResultValid && (sAVSError == ""))
+	{
+		CResultsDB db;
+		if (!db.Append(Settings.sResultsFile, result))
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nWarning: The run was not added to the results database:\n%s\n", db.sError.c_str());
+	}
+
 	if (Settings.bCreateLog)
 	{
 		string sr = CreateLogFile(sAVSFile, sLogBuffer, sGPUInfo, perfdata, sAVSError, gpuinfo.data.NVVPU, bRuntimeTooShort);
@@ -1708,9 +2966,37 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	if (bJSON)
+	{
+		if (!bRuntimeTooShort && (sAVSError == ""))
+			AddJSONSamples(json, perfdata, gpuinfo.data.NVVPU);
+
+		if (sAVSError != "")
+		{
+			jsonline.Clear();
+			jsonline.BeginObject(NULL);
+			jsonline.String("type", "error");
+			jsonline.String("message", sAVSError);
+			jsonline.EndObject();
+			ndjson.Write(jsonline);
+		}
+		ndjson.Close();
+
+		string jr = CreateJSONFile(sAVSFile, json, sAVSError, bRuntimeTooShort);
+		if (jr != "")
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, jr.c_str());
+			PollKeys();
+			return -1;
+		}
+	}
+
 	if (Settings.bCreateCSV && !bRuntimeTooShort && (sAVSError == ""))
 	{
-		string cr = CreateCSVFile(sAVSFile, perfdata, gpuinfo.data.NVVPU);
+		string cr = CreateCSVFile(sAVSFile, csvdata, gpuinfo.data.NVVPU);
+		if (cr == "")
+			cr = CreateFrameCSVFile(sAVSFile, framestore, gpuinfo.data.NVVPU);
+
 		if (cr != "")
 		{
 			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, cr.c_str());
@@ -1750,6 +3036,9 @@ string ParseINIFile()
 			sINIFile = sProgramPath + "\\AVSMeter64.ini";
 		else
 			sINIFile = sProgramPath + "\\AVSMeter.ini";
+
+		//shared by the x86 and x64 builds, the machine fingerprint keeps them apart
+		Settings.sResultsFile = sProgramPath + "\\AVSMeter.results";
 	}
 
 	string sCurrentLine = "";
@@ -1800,6 +3089,24 @@ string ParseINIFile()
 			continue;
 		}
 
+		if (sCurrentLine.substr(0, 12) == "timerbackend")
+		{
+			sTemp = sCurrentLine.substr(13);
+			utils.StrTrim(sTemp);
+			if (sTemp == "auto")
+				Settings.iTimerBackend = TIMER_BACKEND_AUTO;
+			else if (sTemp == "qpc")
+				Settings.iTimerBackend = TIMER_BACKEND_QPC;
+			else if (sTemp == "tsc")
+				Settings.iTimerBackend = TIMER_BACKEND_TSC;
+			else
+			{
+				sRet = utils.StrFormat("\nError: INI setting is invalid:\n\"%s\"\nThe value must be \'Auto\', \'QPC\' or \'TSC\'\n", sOrgLine.c_str());
+				return sRet;
+			}
+			continue;
+		}
+
 		if (sCurrentLine.substr(0, 18) == "loadplugininterval")
 		{
 			sTemp = sCurrentLine.substr(19);
@@ -1868,6 +3175,12 @@ string ParseINIFile()
 
 			if (sCurrentLine.substr(0, 21) == "disablefftwdllwarning")
 				Settings.bDisableFFTWDLLWarning = (iBoolValue == 0) ? FALSE : TRUE;
+
+			if (sCurrentLine.substr(0, 11) == "saveresults")
+				Settings.bSaveResults = (iBoolValue == 0) ? FALSE : TRUE;
+
+			if (sCurrentLine.substr(0, 9) == "livestats")
+				Settings.bLiveStats = (iBoolValue == 0) ? FALSE : TRUE;
 		}
 	}
 
@@ -1917,6 +3230,9 @@ BOOL WriteINIFile(string &s_inifile)
 	sSettings += utils.StrFormat("LogEstimatedTime=%u\n", Settings.bLogEstimatedTime);
 	sSettings += utils.StrFormat("AutoCompleteExtension=%u\n", Settings.bAutoCompleteExtension);
 	sSettings += utils.StrFormat("LoadPluginInterval=%u\n", Settings.nLoadPluginInterval);
+	sSettings += utils.StrFormat("SaveResults=%u\n", Settings.bSaveResults);
+	sSettings += utils.StrFormat("LiveStats=%u\n", Settings.bLiveStats);
+	sSettings += utils.StrFormat("TimerBackend=%s\n", (Settings.iTimerBackend == TIMER_BACKEND_TSC) ? "TSC" : ((Settings.iTimerBackend == TIMER_BACKEND_QPC) ? "QPC" : "Auto"));
 
 	hINIFile << sSettings;
 
@@ -1948,7 +3264,7 @@ string CreateLogFile(string &s_avsfile, string &s_logbuffer, string &s_gpuinfo,
 
 	string sLogFile = "";
 	size_t ilen = s_avsfile.length();
-	ofstream hLogFile;
+	CFileWriter hLogFile;
 
 	Settings.sSystemDateTime = sys.GetFormattedSystemDateTime();
 	if (ilen > 4)
@@ -1979,68 +3295,87 @@ string CreateLogFile(string &s_avsfile, string &s_logbuffer, string &s_gpuinfo,
 		}
 	}
 
-	hLogFile.open(sLogFile.c_str());
-	if (!hLogFile.is_open())
+	if (!hLogFile.Open(sLogFile))
 	{
 		sRet = utils.StrFormat("\nCannot create \"%s\"\n", sLogFile.c_str());
 		return sRet;
 	}
 
-
-	string sLog = "";
-
-	sLog = s_logbuffer + "\n";
-	hLogFile << sLog;
-	sLog = "\n[Script]\n" + sAVSBuffer + "\n\n";
-	hLogFile << sLog;
+	hLogFile.Text(s_logbuffer);
+	hLogFile.Text("\n\n[Script]\n");
+	hLogFile.Text(sAVSBuffer);
+	hLogFile.Text("\n\n");
 
 	if (s_avserror != "")
-		hLogFile << "\n[Errors]\n" + s_avserror + "\n\n";
+	{
+		hLogFile.Text("\n[Errors]\n");
+		hLogFile.Text(s_avserror);
+		hLogFile.Text("\n\n");
+	}
 
 	if (Settings.bGPUInfo)
-		hLogFile << s_gpuinfo;
+		hLogFile.Text(s_gpuinfo);
 
 	if ((cs_pdata.size() > 0) && !bOmitstPerfData)
-	{
-		if (Settings.bGPUInfo)
-		{
-			if (bNVVP)
-				sLog = "\n[Performance data]\n       Frame    Frames/sec   Time/frame(ms)   CPU(%)   GPU(%)   VPU(%)   Threads   Memory(MiB)\n";
-			else
-				sLog = "\n[Performance data]\n       Frame    Frames/sec   Time/frame(ms)   CPU(%)   GPU(%)   Threads   Memory(MiB)\n";
-		}
-		else
-			sLog = "\n[Performance data]\n       Frame    Frames/sec   Time/frame(ms)   CPU(%)   Threads   Memory(MiB)\n";
+		WritePerfDataTable(hLogFile, cs_pdata, bNVVP);
 
+	if (!hLogFile.Close())
+		sRet = utils.StrFormat("\nCannot write \"%s\"\n", sLogFile.c_str());
 
-		hLogFile << sLog;
+	return sRet;
+}
 
-		string stemp1 = "";
-		string stemp2 = "";
-		unsigned int uiFrame = 0;
-		for (unsigned int i = 0; i < cs_pdata.size(); i++)
+
+void WritePerfDataTable(CFileWriter &h_file, vector<stPerfData> &cs_pdata, BOOL bNVVP)
+{
+	if (Settings.bGPUInfo)
+	{
+		if (bNVVP)
+			h_file.Text("\n[Performance data]\n       Frame    Frames/sec   Time/frame(ms)   CPU(%)   GPU(%)   VPU(%)   Threads   Memory(MiB)   Mcycles/frame   Commit(MiB)   Soft PF/frame   Hard PF/frame\n");
+		else
+			h_file.Text("\n[Performance data]\n       Frame    Frames/sec   Time/frame(ms)   CPU(%)   GPU(%)   Threads   Memory(MiB)   Mcycles/frame   Commit(MiB)   Soft PF/frame   Hard PF/frame\n");
+	}
+	else
+		h_file.Text("\n[Performance data]\n       Frame    Frames/sec   Time/frame(ms)   CPU(%)   Threads   Memory(MiB)   Mcycles/frame   Commit(MiB)   Soft PF/frame   Hard PF/frame\n");
+
+	//same column widths as "%12u %13.3f %16.6f %8.1f ..."
+	for (size_t i = 0; i < cs_pdata.size(); i++)
+	{
+		stPerfData &pd = cs_pdata[i];
+		h_file.UInt(pd.frame + 1, 12);
+		h_file.Char(' ');
+		h_file.Fixed(pd.fps_current, 3, 13);
+		h_file.Char(' ');
+		h_file.Fixed(1000.0 / pd.fps_current, 6, 16);
+		h_file.Char(' ');
+		h_file.Fixed(pd.cpu_usage, 1, 8);
+		if (Settings.bGPUInfo)
 		{
-			uiFrame = cs_pdata[i].frame + 1;
-			stemp1 = utils.StrFormat("%u", uiFrame);
-			string spad((12 - stemp1.length()), ' ');
-			if (Settings.bGPUInfo)
+			h_file.Char(' ');
+			h_file.UInt(pd.gpu_usage, 8);
+			if (bNVVP)
 			{
-				if (bNVVP)
-					stemp2 = utils.StrFormat("%s%u %13.3f %16.6f %8.1f %8u %8u %9u %13u", spad.c_str(), uiFrame, cs_pdata[i].fps_current, 1000.0 / cs_pdata[i].fps_current, cs_pdata[i].cpu_usage, cs_pdata[i].gpu_usage, cs_pdata[i].vpu_usage, cs_pdata[i].num_threads, cs_pdata[i].process_memory);
-				else
-					stemp2 = utils.StrFormat("%s%u %13.3f %16.6f %8.1f %8u %9u %13u", spad.c_str(), uiFrame, cs_pdata[i].fps_current, 1000.0 / cs_pdata[i].fps_current, cs_pdata[i].cpu_usage, cs_pdata[i].gpu_usage, cs_pdata[i].num_threads, cs_pdata[i].process_memory);
+				h_file.Char(' ');
+				h_file.UInt(pd.vpu_usage, 8);
 			}
-			else
-				stemp2 = utils.StrFormat("%s%u %13.3f %16.6f %8.1f %9u %13u", spad.c_str(), uiFrame, cs_pdata[i].fps_current, 1000.0 / cs_pdata[i].fps_current, cs_pdata[i].cpu_usage, cs_pdata[i].num_threads, cs_pdata[i].process_memory);
-
-			hLogFile << stemp2 + "\n";
 		}
-	}
 
-	hLogFile.flush();
-	hLogFile.close();
+		h_file.Char(' ');
+		h_file.UInt(pd.num_threads, 9);
+		h_file.Char(' ');
+		h_file.UInt(pd.process_memory, 13);
+		h_file.Char(' ');
+		h_file.Fixed(pd.cycles_per_frame, 3, 15);
+		h_file.Char(' ');
+		h_file.UInt(pd.commit_memory, 13);
+		h_file.Char(' ');
+		h_file.Fixed(pd.soft_faults, 1, 15);
+		h_file.Char(' ');
+		h_file.Fixed(pd.hard_faults, 2, 15);
+		h_file.Char('\n');
+	}
 
-	return sRet;
+	return;
 }
 
 
@@ -2050,7 +3385,7 @@ string CreateCSVFile(string &s_avsfile, vector<stPerfData> &cs_pdata, BOOL bNVVP
 
 	string sCSVFile = "";
 	size_t ilen = s_avsfile.length();
-	ofstream hCSVFile;
+	CFileWriter hCSVFile;
 
 	Settings.sSystemDateTime = sys.GetFormattedSystemDateTime();
 	if (ilen > 4)
@@ -2081,270 +3416,2590 @@ string CreateCSVFile(string &s_avsfile, vector<stPerfData> &cs_pdata, BOOL bNVVP
 		}
 	}
 
-	hCSVFile.open(sCSVFile.c_str());
-	if (!hCSVFile.is_open())
+	if (!hCSVFile.Open(sCSVFile))
 	{
 		sRet = utils.StrFormat("\nCannot create \"%s\"\n", sCSVFile.c_str());
 		return sRet;
 	}
 
-	string sCSV = "";
-
 	if (cs_pdata.size() > 1)
-	{
-		if (Settings.bGPUInfo)
-		{
-			if (bNVVP)
-				sCSV = "Frame,Frames/sec,Frames/sec(average),Time/frame(ms),Time/frame(average)(ms),CPU(%),GPU(%),VPU(%),Threads,Memory(MiB)\n";
-			else
-				sCSV = "Frame,Frames/sec,Frames/sec(average),Time/frame(ms),Time/frame(average)(ms),CPU(%),GPU(%),Threads,Memory(MiB)\n";
-		}
-		else
-			sCSV = "Frame,Frames/sec,Frames/sec(average),Time/frame(ms),Time/frame(average)(ms),CPU(%),Threads,Memory(MiB)\n";
-
-		hCSVFile << sCSV;
-
-		string stemp = "";
-		unsigned int uiFrame = 0;
-		for (unsigned int i = 0; i < cs_pdata.size(); i++)
-		{
-			uiFrame = cs_pdata[i].frame + 1;
-			if (Settings.bGPUInfo)
-			{
-				if (bNVVP)
-					stemp = utils.StrFormat("%u,%.3f,%.3f,%.6f,%.6f,%.1f,%u,%u,%u,%u", uiFrame, cs_pdata[i].fps_current, cs_pdata[i].fps_average, 1000.0 / cs_pdata[i].fps_current, 1000.0 / cs_pdata[i].fps_average, cs_pdata[i].cpu_usage, cs_pdata[i].gpu_usage, cs_pdata[i].vpu_usage, cs_pdata[i].num_threads, cs_pdata[i].process_memory);
-				else
-					stemp = utils.StrFormat("%u,%.3f,%.3f,%.6f,%.6f,%.1f,%u,%u,%u", uiFrame, cs_pdata[i].fps_current, cs_pdata[i].fps_average, 1000.0 / cs_pdata[i].fps_current, 1000.0 / cs_pdata[i].fps_average, cs_pdata[i].cpu_usage, cs_pdata[i].gpu_usage, cs_pdata[i].num_threads, cs_pdata[i].process_memory);
-			}
-			else
-				stemp = utils.StrFormat("%u,%.3f,%.3f,%.6f,%.6f,%.1f,%u,%u", uiFrame, cs_pdata[i].fps_current, cs_pdata[i].fps_average, 1000.0 / cs_pdata[i].fps_current, 1000.0 / cs_pdata[i].fps_average, cs_pdata[i].cpu_usage, cs_pdata[i].num_threads, cs_pdata[i].process_memory);
-
-			hCSVFile << stemp + "\n";
-		}
-	}
+		WritePerfDataCSV(hCSVFile, cs_pdata, bNVVP);
 
-	hCSVFile.flush();
-	hCSVFile.close();
+	if (!hCSVFile.Close())
+		sRet = utils.StrFormat("\nCannot write \"%s\"\n", sCSVFile.c_str());
 
 	return sRet;
 }
 
 
-void PollKeys()
+void WritePerfDataCSV(CFileWriter &h_file, vector<stPerfData> &cs_pdata, BOOL bNVVP)
 {
-	if (Settings.bPauseBeforeExit)
+	if (Settings.bGPUInfo)
 	{
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\nPress any key to exit...");
+		if (bNVVP)
+			h_file.Text("Frame,Frames/sec,Frames/sec(average),Time/frame(ms),Time/frame(average)(ms),CPU(%),GPU(%),VPU(%),Threads,Memory(MiB),Mcycles/frame,Commit(MiB),Soft PF/frame,Hard PF/frame" PMC_UNAVAILABLE_CSV_COLUMNS "\n");
+		else
+			h_file.Text("Frame,Frames/sec,Frames/sec(average),Time/frame(ms),Time/frame(average)(ms),CPU(%),GPU(%),Threads,Memory(MiB),Mcycles/frame,Commit(MiB),Soft PF/frame,Hard PF/frame" PMC_UNAVAILABLE_CSV_COLUMNS "\n");
+	}
+	else
+		h_file.Text("Frame,Frames/sec,Frames/sec(average),Time/frame(ms),Time/frame(average)(ms),CPU(%),Threads,Memory(MiB),Mcycles/frame,Commit(MiB),Soft PF/frame,Hard PF/frame" PMC_UNAVAILABLE_CSV_COLUMNS "\n");
 
-		for (;;)
+	for (size_t i = 0; i < cs_pdata.size(); i++)
+	{
+		stPerfData &pd = cs_pdata[i];
+		h_file.UInt(pd.frame + 1, 0);
+		h_file.Char(',');
+		h_file.Fixed(pd.fps_current, 3, 0);
+		h_file.Char(',');
+		h_file.Fixed(pd.fps_average, 3, 0);
+		h_file.Char(',');
+		h_file.Fixed(1000.0 / pd.fps_current, 6, 0);
+		h_file.Char(',');
+		h_file.Fixed(1000.0 / pd.fps_average, 6, 0);
+		h_file.Char(',');
+		h_file.Fixed(pd.cpu_usage, 1, 0);
+		if (Settings.bGPUInfo)
 		{
-			Sleep(100);
-			if (_getch())
-				break;
+			h_file.Char(',');
+			h_file.UInt(pd.gpu_usage, 0);
+			if (bNVVP)
+			{
+				h_file.Char(',');
+				h_file.UInt(pd.vpu_usage, 0);
+			}
 		}
 
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s", Pad("").c_str());
-		utils.CursorUp(1);
+		h_file.Char(',');
+		h_file.UInt(pd.num_threads, 0);
+		h_file.Char(',');
+		h_file.UInt(pd.process_memory, 0);
+		h_file.Char(',');
+		h_file.Fixed(pd.cycles_per_frame, 3, 0);
+		h_file.Char(',');
+		h_file.UInt(pd.commit_memory, 0);
+		h_file.Char(',');
+		h_file.Fixed(pd.soft_faults, 1, 0);
+		h_file.Char(',');
+		h_file.Fixed(pd.hard_faults, 2, 0);
+		h_file.Text(PMC_UNAVAILABLE_CSV_VALUES);
+		h_file.Char('\n');
 	}
 
 	return;
 }
 
 
-void PrintConsole(BOOL bUseStdOut, WORD wAttributes, const char *fmt, ...)
+string CreateFrameCSVFile(string &s_avsfile, CFrameStore &framestore, BOOL bNVVP)
 {
-	const unsigned int bufsize = 8192;
-	char buffer[bufsize];
-
-	va_list args;
-	va_start(args, fmt);
+	//streams the frame store chunk by chunk, one row per frame
+	string sRet = "";
+	string sCSVFile = GetOutputFileName(s_avsfile, "_frames.csv");
 
-	if (_vsnprintf(buffer, bufsize, fmt, args) < 0)
+	CFileWriter hCSVFile;
+	if (!hCSVFile.Open(sCSVFile))
 	{
-		va_end(args);
-		fprintf(stderr, "\rBuffer overflow...\r");
-		return;
+		sRet = utils.StrFormat("\nCannot create \"%s\"\n", sCSVFile.c_str());
+		return sRet;
 	}
 
-	va_end(args);
-
-	CharToOem(buffer, buffer);
-
-	if (wAttributes && Settings.bUseColor)
-		utils.SetConsoleColors(wAttributes);
-
-	if (bUseStdOut)
+	if (Settings.bGPUInfo)
 	{
-		fputs(buffer, stdout);
-		fflush(stdout);
+		if (bNVVP)
+			hCSVFile.Text("Frame,Time(s),Time/frame(ms),CPU(%),GPU(%),VPU(%),Threads,Memory(MiB),Commit(MiB)\n");
+		else
+			hCSVFile.Text("Frame,Time(s),Time/frame(ms),CPU(%),GPU(%),Threads,Memory(MiB),Commit(MiB)\n");
 	}
 	else
+		hCSVFile.Text("Frame,Time(s),Time/frame(ms),CPU(%),Threads,Memory(MiB),Commit(MiB)\n");
+
+	vector<stFrameRecord> vRecords;
+	double dPrevTime = 0.0;
+	for (size_t n = 0; n < framestore.GetChunkCount(); n++)
 	{
-		fputs(buffer, stderr);
-		fflush(stderr);
+		if (!framestore.ReadChunk(n, vRecords))
+		{
+			sRet = utils.StrFormat("\nCannot read the frame records for \"%s\"\n", sCSVFile.c_str());
+			break;
+		}
+
+		for (size_t i = 0; i < vRecords.size(); i++)
+		{
+			stFrameRecord &r = vRecords[i];
+			hCSVFile.UInt(r.frame + 1, 0);
+			hCSVFile.Char(',');
+			hCSVFile.Fixed(r.time, 6, 0);
+			hCSVFile.Char(',');
+			hCSVFile.Fixed(1000.0 * (r.time - dPrevTime), 6, 0);
+			hCSVFile.Char(',');
+			hCSVFile.Fixed(r.cpu_usage, 1, 0);
+			if (Settings.bGPUInfo)
+			{
+				hCSVFile.Char(',');
+				hCSVFile.UInt(r.gpu_usage, 0);
+				if (bNVVP)
+				{
+					hCSVFile.Char(',');
+					hCSVFile.UInt(r.vpu_usage, 0);
+				}
+			}
+
+			hCSVFile.Char(',');
+			hCSVFile.UInt(r.num_threads, 0);
+			hCSVFile.Char(',');
+			hCSVFile.UInt(r.process_memory, 0);
+			hCSVFile.Char(',');
+			hCSVFile.UInt(r.commit_memory, 0);
+			hCSVFile.Char('\n');
+			dPrevTime = r.time;
+		}
 	}
 
-	if (wAttributes && Settings.bUseColor)
-		utils.ResetConsoleColors();
+	if (!hCSVFile.Close() && (sRet == ""))
+		sRet = utils.StrFormat("\nCannot write \"%s\"\n", sCSVFile.c_str());
 
-	return;
+	return sRet;
 }
 
 
-string Pad(string s_line)
+void MakePerfRow(stFrameRecord &r, double d_frametime, unsigned __int64 ui64_read, stFrameRecord &prev, unsigned __int64 ui64_span, stPerfData &pdata)
 {
-	int iPadLen = utils.GetConsoleWidth() - (int)s_line.length();
-	if ((iPadLen > 0) && (iPadLen <= 1000))
-		s_line.append(iPadLen - 1, ' ');
+	//the row shows the selected frame itself, cycles and faults are spread over the frames since the previous row
+	double dFrames = (double)((ui64_span > 0) ? ui64_span : 1);
+	DWORD dwHardFaults = r.hard_faults - prev.hard_faults;
+
+	pdata.frame = r.frame;
+	pdata.fps_current = (float)(1000.0 / ((d_frametime > 0.000001) ? d_frametime : 0.000001));
+	pdata.fps_average = (float)((double)ui64_read / ((r.time > 0.000001) ? r.time : 0.000001));
+	pdata.cpu_usage = r.cpu_usage;
+	pdata.gpu_usage = r.gpu_usage;
+	pdata.vpu_usage = r.vpu_usage;
+	pdata.num_threads = r.num_threads;
+	pdata.process_memory = r.process_memory;
+	pdata.commit_memory = r.commit_memory;
+	pdata.cycles_per_frame = (float)((double)(r.cycles - prev.cycles) / dFrames / 1.0e+6);
+	pdata.soft_faults = (float)((double)((r.page_faults - prev.page_faults) - dwHardFaults) / dFrames);
+	pdata.hard_faults = (float)((double)dwHardFaults / dFrames);
 
-	return s_line;
+	return;
 }
 
 
-unsigned int CalculateFrameInterval(string &s_avsfile, string &s_error)
+BOOL BuildPerfData(CFrameStore &framestore, vector<stPerfData> &v_pdata, size_t n_rows)
 {
-	s_error = "";
-	unsigned int uiFrameInterval = 10;
+	//picks the rows by LTTB over the frame times, a stall between two rows can not be stepped over
+	vector<stFrameRecord> vRecords;
+	CLTTB lttb;
+	lttb.Init(framestore.ui64Frames, n_rows);
 
-	HINSTANCE hDLL;
+	double dPrevTime = 0.0;
+	for (size_t n = 0; n < framestore.GetChunkCount(); n++)
+	{
+		if (!framestore.ReadChunk(n, vRecords))
+			return FALSE;
+
+		for (size_t i = 0; i < vRecords.size(); i++)
+		{
+			lttb.Average(1000.0 * (vRecords[i].time - dPrevTime));
+			dPrevTime = vRecords[i].time;
+		}
+	}
+
+	vector<stPerfData> vRows;
+	vRows.reserve(n_rows + 1);
+
+	stFrameRecord best;
+	stFrameRecord prev;
+	double dBestFrameTime = 0.0;
+	unsigned __int64 ui64Best = 0;
+	unsigned __int64 ui64Prev = 0;
+	unsigned __int64 ui64Read = 0;
+	BOOL bEmit = FALSE;
+	dPrevTime = 0.0;
+
+	for (size_t n = 0; n < framestore.GetChunkCount(); n++)
+	{
+		if (!framestore.ReadChunk(n, vRecords))
+			return FALSE;
+
+		for (size_t i = 0; i < vRecords.size(); i++)
+		{
+			stFrameRecord &r = vRecords[i];
+			double dFrameTime = 1000.0 * (r.time - dPrevTime);
+			dPrevTime = r.time;
+			++ui64Read;
+
+			if (ui64Read == 1)
+				prev = r;
+
+			if (lttb.Select(dFrameTime, bEmit))
+			{
+				best = r;
+				dBestFrameTime = dFrameTime;
+				ui64Best = ui64Read;
+			}
+
+			if (!bEmit)
+				continue;
+
+			stPerfData pdata;
+			MakePerfRow(best, dBestFrameTime, ui64Best, prev, ui64Best - ui64Prev, pdata);
+			vRows.push_back(pdata);
+			prev = best;
+			ui64Prev = ui64Best;
+		}
+	}
+
+	v_pdata.swap(vRows);
+
+	return TRUE;
+}
+
+
+BOOL BuildIntervalPerfData(CFrameStore &framestore, vector<stPerfData> &v_pdata, size_t n_rows)
+{
+	//rows over equal frame intervals like those of the live csv, the FPS is that of the whole interval
+	unsigned __int64 ui64Interval = (n_rows > 0) ? ((framestore.ui64Frames + n_rows - 1) / n_rows) : 1;
+	if (ui64Interval < 1)
+		ui64Interval = 1;
+
+	vector<stFrameRecord> vRecords;
+	vector<stPerfData> vRows;
+	vRows.reserve(n_rows + 1);
+
+	stFrameRecord prev;
+	double dPrevTime = 0.0;
+	unsigned __int64 ui64Read = 0;
+	unsigned __int64 ui64Prev = 0;
+
+	for (size_t n = 0; n < framestore.GetChunkCount(); n++)
+	{
+		if (!framestore.ReadChunk(n, vRecords))
+			return FALSE;
+
+		for (size_t i = 0; i < vRecords.size(); i++)
+		{
+			stFrameRecord &r = vRecords[i];
+			++ui64Read;
+
+			if (ui64Read == 1)
+				prev = r;
+
+			if (((ui64Read % ui64Interval) != 0) && (ui64Read != framestore.ui64Frames))
+				continue;
+
+			unsigned __int64 ui64Span = ui64Read - ui64Prev;
+			stPerfData pdata;
+			MakePerfRow(r, 1000.0 * (r.time - dPrevTime) / (double)ui64Span, ui64Read, prev, ui64Span, pdata);
+			vRows.push_back(pdata);
+			prev = r;
+			ui64Prev = ui64Read;
+			dPrevTime = r.time;
+		}
+	}
+
+	v_pdata.swap(vRows);
+
+	return TRUE;
+}
+
+
+int ConvertMetricsFile(string &s_ambfile, string &s_avsmversion)
+{
+	//rebuilds the log and csv of a live run from the per-frame records
+	CMetricsReader reader;
+	if (!reader.Open(s_ambfile))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: %s\n", reader.sError.c_str());
+		return -1;
+	}
+
+	BOOL bNVVP = (reader.header.dwFlags & METRICSFILE_FLAG_NVVP) ? TRUE : FALSE;
+	Settings.bGPUInfo = (reader.header.dwFlags & METRICSFILE_FLAG_GPU) ? TRUE : FALSE;
+
+	//the records go through a frame store, the row selection needs two passes
+	CFrameStore framestore;
+	CDDSketch frametimes;
+	vector<stFrameRecord> vRecords;
+	double dRuntime = 0.0;
+	while (reader.ReadChunk(vRecords))
+	{
+		for (size_t i = 0; i < vRecords.size(); i++)
+		{
+			frametimes.Add(1000.0 * (vRecords[i].time - dRuntime));
+			dRuntime = vRecords[i].time;
+			framestore.Add(vRecords[i]);
+		}
+	}
+
+	framestore.Close();
+	unsigned __int64 ui64Frames = framestore.ui64Frames;
+	BOOL bComplete = reader.bComplete;
+	BOOL bCorrupt = reader.bCorrupt;
+	reader.Close();
+
+	if (ui64Frames < 2)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \"%s\" contains no frame records\n", s_ambfile.c_str());
+		return -1;
+	}
+
+	vector<stPerfData> perfdata;
+	if ((framestore.sError != "") || !BuildPerfData(framestore, perfdata, PERFDATA_MAX_ROWS))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Cannot read back the frame records of \"%s\" %s\n", s_ambfile.c_str(), framestore.sError.c_str());
+		return -1;
+	}
+
+	string sStatus = "Complete";
+	if (bCorrupt)
+		sStatus = "Truncated at a corrupt chunk";
+	else if (!bComplete)
+		sStatus = "Interrupted (no end marker)";
+
+	string sLogBuffer = "";
+	sLogBuffer += utils.StrFormat("Log file created with:      AVSMeter %s\n", s_avsmversion.c_str());
+	sLogBuffer += utils.StrFormat("Metrics file:               %s\n", s_ambfile.c_str());
+	sLogBuffer += utils.StrFormat("Recorded with:              AVSMeter %s\n", reader.header.sAVSMVersion.c_str());
+	sLogBuffer += utils.StrFormat("Script file:                %s\n", reader.header.sScriptFile.c_str());
+	sLogBuffer += utils.StrFormat("Started:                    %s\n", reader.header.sDateTime.c_str());
+	sLogBuffer += utils.StrFormat("Status:                     %s\n", sStatus.c_str());
+
+	sLogBuffer += "\n\n[Runtime info]\n";
+	sLogBuffer += utils.StrFormat("Frames processed:                   %I64u\n", ui64Frames);
+	sLogBuffer += utils.StrFormat("FPS (average):                      %s\n", utils.StrFormatFPS((double)ui64Frames / ((dRuntime > 0.000001) ? dRuntime : 0.000001)).c_str());
+	sLogBuffer += utils.StrFormat("Frame time (p50 | p95 | p99 | max): %s | %s | %s | %s ms\n", utils.StrFormatTPF(frametimes.Quantile(0.50)).c_str(), utils.StrFormatTPF(frametimes.Quantile(0.95)).c_str(), utils.StrFormatTPF(frametimes.Quantile(0.99)).c_str(), utils.StrFormatTPF(frametimes.GetMax()).c_str());
+	sLogBuffer += utils.StrFormat("Runtime:                            %.3f s\n", dRuntime);
+	PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, "\n" + sLogBuffer);
+
+	string sScript = reader.header.sScriptText;
+	utils.StrTrim(sScript);
+
+	//the run's own log and csv keep the script's name
+	string sLogFile = GetOutputFileName(s_ambfile, "_converted.log");
+	CFileWriter hOutFile;
+	if (!hOutFile.Open(sLogFile))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot create \"%s\"\n", sLogFile.c_str());
+		return -1;
+	}
+
+	hOutFile.Text(sLogBuffer);
+	hOutFile.Text("\n\n[Script]\n");
+	hOutFile.Text(sScript);
+	hOutFile.Text("\n\n");
+	WritePerfDataTable(hOutFile, perfdata, bNVVP);
+	if (!hOutFile.Close())
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot write \"%s\"\n", sLogFile.c_str());
+		return -1;
+	}
+
+	vector<stPerfData> csvdata;
+	if (!BuildIntervalPerfData(framestore, csvdata, PERFDATA_MAX_ROWS))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Cannot read back the frame records of \"%s\" %s\n", s_ambfile.c_str(), framestore.sError.c_str());
+		return -1;
+	}
+
+	string sCSVFile = GetOutputFileName(s_ambfile, "_converted.csv");
+	if (!hOutFile.Open(sCSVFile))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot create \"%s\"\n", sCSVFile.c_str());
+		return -1;
+	}
+
+	WritePerfDataCSV(hOutFile, csvdata, bNVVP);
+	if (!hOutFile.Close())
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot write \"%s\"\n", sCSVFile.c_str());
+		return -1;
+	}
+
+	PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\nLog file: \"%s\"\nCSV file: \"%s\"\n", sLogFile.c_str(), sCSVFile.c_str());
+
+	return 0;
+}
+
+
+int MergeSketchFiles(string &s_files, string &s_avsmversion)
+{
+	//sketches with the same accuracy merge losslessly, so the percentiles are those of all runs together
+	vector<string> vFiles;
+	utils.StrTokenize(s_files, vFiles, ",", FALSE);
+
+	CSketchWindows merged;
+	string sOutBuf = CSketchWindows::FormatHeader();
+	string sError = "";
+	for (size_t n = 0; n < vFiles.size(); n++)
+	{
+		utils.StrTrim(vFiles[n]);
+		stSketchSet run;
+		run.iWindow = -1;
+		if (!CSketchWindows::Load(vFiles[n], run, sError))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: %s\n", sError.c_str());
+			return -1;
+		}
+
+		if (!merged.overall.frametime.Merge(run.frametime) || !merged.overall.cpu.Merge(run.cpu) || !merged.overall.memory.Merge(run.memory))
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \"%s\" was written with a different sketch accuracy\n", vFiles[n].c_str());
+			return -1;
+		}
+
+		sOutBuf += CSketchWindows::FormatSet(utils.StrFormat("Run %u", (unsigned int)n + 1), run);
+	}
+
+	if (vFiles.size() == 0)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: No sketch files specified\n");
+		return -1;
+	}
+
+	sOutBuf += "\n" + CSketchWindows::FormatSet("Merged", merged.overall) + "\n";
+	for (size_t n = 0; n < vFiles.size(); n++)
+		sOutBuf += utils.StrFormat("Run %u: %s\n", (unsigned int)n + 1, vFiles[n].c_str());
+
+	PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, "\n" + sOutBuf);
+
+	string sMergedFile = GetOutputFileName(vFiles[0], "_merged.ddsk");
+	string sSource = "merged by AVSMeter " + s_avsmversion;
+	if (!merged.Save(sMergedFile, sSource))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot create \"%s\"\n", sMergedFile.c_str());
+		return -1;
+	}
+
+	PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\nMerged sketch file: \"%s\"\n", sMergedFile.c_str());
+
+	return 0;
+}
+
+
+string CreateJSONFile(string &s_avsfile, CJSONWriter &json, string &s_avserror, BOOL b_runtime_too_short)
+{
+	//the schema is the same for complete and failed runs, whatever the run got to is closed here
+	if (json.GetDepth() == 0)
+		json.BeginObject(NULL);
+	json.Unwind(1);
+	json.Bool("runtime_too_short", b_runtime_too_short);
+	if (s_avserror != "")
+		json.String("error", s_avserror);
+	else
+		json.Null("error");
+	json.EndAll();
+
+	string sJSONFile = GetOutputFileName(s_avsfile, ".json");
+	CFileWriter hJSONFile;
+	if (!hJSONFile.Open(sJSONFile))
+		return utils.StrFormat("\nCannot create \"%s\"\n", sJSONFile.c_str());
+
+	hJSONFile.Text(json.sText);
+	hJSONFile.Char('\n');
+	if (!hJSONFile.Close())
+		return utils.StrFormat("\nCannot write \"%s\"\n", sJSONFile.c_str());
+
+	return "";
+}
+
+
+void AddJSONPercentiles(CJSONWriter &json, const char *p_key, CDDSketch &sketch)
+{
+	json.BeginObject(p_key);
+	json.UInt("count", sketch.GetCount());
+	if (sketch.GetCount() > 0)
+	{
+		json.Number("min", sketch.GetMin(), 3);
+		json.Number("mean", sketch.GetMean(), 3);
+		json.Number("p50", sketch.Quantile(0.50), 3);
+		json.Number("p90", sketch.Quantile(0.90), 3);
+		json.Number("p95", sketch.Quantile(0.95), 3);
+		json.Number("p99", sketch.Quantile(0.99), 3);
+		json.Number("p999", sketch.Quantile(0.999), 3);
+		json.Number("max", sketch.GetMax(), 3);
+	}
+	json.EndObject();
+
+	return;
+}
+
+
+void AddJSONSamples(CJSONWriter &json, vector<stPerfData> &cs_pdata, BOOL bNVVP)
+{
+	//the rows of the [Performance data] table, a columnar layout keeps the document small
+	json.BeginObject("samples");
+	json.UInt("count", cs_pdata.size());
+
+	size_t i = 0;
+	json.BeginArray("frame");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.UInt(NULL, cs_pdata[i].frame);
+	json.EndArray();
+
+	json.BeginArray("fps");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.Number(NULL, cs_pdata[i].fps_current, 3);
+	json.EndArray();
+
+	json.BeginArray("fps_average");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.Number(NULL, cs_pdata[i].fps_average, 3);
+	json.EndArray();
+
+	json.BeginArray("cpu_percent");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.Number(NULL, cs_pdata[i].cpu_usage, 1);
+	json.EndArray();
+
+	if (Settings.bGPUInfo)
+	{
+		json.BeginArray("gpu_percent");
+		for (i = 0; i < cs_pdata.size(); i++)
+			json.UInt(NULL, cs_pdata[i].gpu_usage);
+		json.EndArray();
+
+		if (bNVVP)
+		{
+			json.BeginArray("vpu_percent");
+			for (i = 0; i < cs_pdata.size(); i++)
+				json.UInt(NULL, cs_pdata[i].vpu_usage);
+			json.EndArray();
+		}
+	}
+
+	json.BeginArray("threads");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.UInt(NULL, cs_pdata[i].num_threads);
+	json.EndArray();
+
+	json.BeginArray("memory_mib");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.UInt(NULL, cs_pdata[i].process_memory);
+	json.EndArray();
+
+	json.BeginArray("commit_mib");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.UInt(NULL, cs_pdata[i].commit_memory);
+	json.EndArray();
+
+	json.BeginArray("mcycles_per_frame");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.Number(NULL, cs_pdata[i].cycles_per_frame, 3);
+	json.EndArray();
+
+	json.BeginArray("soft_faults_per_frame");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.Number(NULL, cs_pdata[i].soft_faults, 3);
+	json.EndArray();
+
+	json.BeginArray("hard_faults_per_frame");
+	for (i = 0; i < cs_pdata.size(); i++)
+		json.Number(NULL, cs_pdata[i].hard_faults, 3);
+	json.EndArray();
+
+	json.EndObject();
+
+	return;
+}
+
+
+void SampleFrameTimes(CFrameStore &framestore, vector<double> &v_sample, size_t n_max)
+{
+	//uniform reservoir sample of the per-frame times (Algorithm R), all frames if they fit.
+	//the sample is returned in frame order, the block bootstrap of the comparison relies on it
+	CStats stats;
+	unsigned __int64 ui64State = framestore.ui64Frames;
+	unsigned __int64 ui64Seen = 0;
+	vector<stFrameRecord> vRecords;
+	vector<std::pair<unsigned __int64, double> > vSample;
+	double dPrevTime = 0.0;
+
+	v_sample.clear();
+	vSample.reserve((framestore.ui64Frames < (unsigned __int64)n_max) ? (size_t)framestore.ui64Frames : n_max);
+
+	for (size_t n = 0; n < framestore.GetChunkCount(); n++)
+	{
+		if (!framestore.ReadChunk(n, vRecords))
+			break;
+
+		for (size_t i = 0; i < vRecords.size(); i++)
+		{
+			double dFrameTime = 1000.0 * (vRecords[i].time - dPrevTime);
+			dPrevTime = vRecords[i].time;
+
+			if (vSample.size() < n_max)
+				vSample.push_back(std::make_pair(ui64Seen, dFrameTime));
+			else
+			{
+				unsigned __int64 ui64Slot = (((unsigned __int64)stats.Random(ui64State) << 31) ^ (unsigned __int64)stats.Random(ui64State)) % (ui64Seen + 1);
+				if (ui64Slot < (unsigned __int64)n_max)
+					vSample[(size_t)ui64Slot] = std::make_pair(ui64Seen, dFrameTime);
+			}
+			++ui64Seen;
+		}
+	}
+
+	sort(vSample.begin(), vSample.end());
+	v_sample.reserve(vSample.size());
+	for (size_t i = 0; i < vSample.size(); i++)
+		v_sample.push_back(vSample[i].second);
+
+	return;
+}
+
+
+BOOL LoadBaseline(string &s_file, stBaseline &baseline, string &s_error)
+{
+	CJSONReader reader;
+	if (!reader.Load(s_file))
+	{
+		s_error = reader.sError;
+		return FALSE;
+	}
+
+	if (reader.GetString(0, "schema") != JSON_SCHEMA_NAME)
+	{
+		s_error = "\"" + s_file + "\" is not an AVSMeter results file (-json)";
+		return FALSE;
+	}
+
+	if (reader.GetNumber(0, "schema_version", 0.0) > (double)JSON_SCHEMA_VERSION)
+	{
+		s_error = "\"" + s_file + "\" was written by a newer AVSMeter";
+		return FALSE;
+	}
+
+	size_t nValues = reader.Find(0, "frametimes_ms.values");
+	if ((nValues == JSON_NOT_FOUND) || (reader.vNodes[nValues].iType != JSON_ARRAY))
+	{
+		s_error = "\"" + s_file + "\" contains no frame times (run too short or failed)";
+		return FALSE;
+	}
+
+	baseline.sFile = s_file;
+	baseline.sAVSMVersion = reader.GetString(0, "avsmeter_version");
+	baseline.sStarted = reader.GetString(0, "started");
+	baseline.sScriptFile = reader.GetString(0, "script");
+	baseline.dFPS = reader.GetNumber(0, "summary.fps_average", 0.0);
+	baseline.ui64Frames = (unsigned __int64)reader.GetNumber(0, "frametimes_ms.frames", 0.0);
+	baseline.vFrameTimes.clear();
+
+	vector<size_t> &vChildren = reader.vNodes[nValues].vChildren;
+	baseline.vFrameTimes.reserve(vChildren.size());
+	for (size_t i = 0; i < vChildren.size(); i++)
+	{
+		if (reader.vNodes[vChildren[i]].iType == JSON_NUMBER)
+			baseline.vFrameTimes.push_back(reader.vNodes[vChildren[i]].dNumber);
+	}
+
+	if ((baseline.vFrameTimes.size() < BASELINE_MIN_FRAMES) || (baseline.dFPS <= 0.0))
+	{
+		s_error = utils.StrFormat("\"%s\" contains too few frames for a comparison (minimum %u)", s_file.c_str(), BASELINE_MIN_FRAMES);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+string CompareBaseline(stBaseline &baseline, vector<double> &v_frametimes, double d_fps, double d_threshold, CJSONWriter *p_json, BOOL &b_regression)
+{
+	/*
+	Throughput: exact averages of both runs, the interval comes from a block bootstrap of the mean frame time.
+	p99: block bootstrap of the sampled frame times. Mann-Whitney U (autocorrelation adjusted) tells whether
+	the frame times shifted at all.
+	A regression has to exceed the threshold and its interval must not include zero.
+	*/
+	string sRet = "\n[Baseline comparison]\n";
+	b_regression = FALSE;
+
+	sRet += utils.StrFormat("Baseline:                           %s\n", baseline.sFile.c_str());
+	sRet += utils.StrFormat("Recorded with:                      AVSMeter %s, %s\n", baseline.sAVSMVersion.c_str(), baseline.sStarted.c_str());
+
+	if (v_frametimes.size() < BASELINE_MIN_FRAMES)
+	{
+		sRet += utils.StrFormat("Not possible, fewer than %u frames were processed\n", BASELINE_MIN_FRAMES);
+		b_regression = TRUE;
+		return sRet;
+	}
+
+	CStats stats;
+	double dThroughput = (d_fps / baseline.dFPS) - 1.0;
+	double dMean = 0.0, dMeanLower = 0.0, dMeanUpper = 0.0;
+	double dP99 = 0.0, dP99Lower = 0.0, dP99Upper = 0.0;
+	double dZ = 0.0, dP = 1.0;
+	BOOL bMean = stats.BootstrapChange(baseline.vFrameTimes, v_frametimes, -1.0, BASELINE_RESAMPLES, dMean, dMeanLower, dMeanUpper);
+	BOOL bP99 = stats.BootstrapChange(baseline.vFrameTimes, v_frametimes, 0.99, BASELINE_RESAMPLES, dP99, dP99Lower, dP99Upper);
+	BOOL bMWU = stats.MannWhitneyU(baseline.vFrameTimes, v_frametimes, dZ, dP);
+
+	//throughput is the inverse of the mean frame time, the bounds swap
+	double dThroughputLower = bMean ? (1.0 / (1.0 + dMeanUpper)) - 1.0 : 0.0;
+	double dThroughputUpper = bMean ? (1.0 / (1.0 + dMeanLower)) - 1.0 : 0.0;
+
+	BOOL bThroughputRegressed = bMean && ((-100.0 * dThroughput) > d_threshold) && (dThroughputUpper < 0.0);
+	BOOL bP99Regressed = bP99 && ((100.0 * dP99) > d_threshold) && (dP99Lower > 0.0);
+	b_regression = bThroughputRegressed || bP99Regressed;
+
+	vector<double> vTemp(baseline.vFrameTimes);
+	double dBaseP99 = stats.SampleStatistic(vTemp, 0.99);
+	vTemp = v_frametimes;
+	double dCurP99 = stats.SampleStatistic(vTemp, 0.99);
+
+	sRet += utils.StrFormat("Frame times (baseline | current):   %u | %u (sampled)\n", (unsigned int)baseline.vFrameTimes.size(), (unsigned int)v_frametimes.size());
+	sRet += utils.StrFormat("FPS (baseline | current):           %s | %s\n", utils.StrFormatFPS(baseline.dFPS).c_str(), utils.StrFormatFPS(d_fps).c_str());
+	if (bMean)
+		sRet += utils.StrFormat("Throughput change (95%% CI):         %+.2f%% (%+.2f%% .. %+.2f%%)%s\n", 100.0 * dThroughput, 100.0 * dThroughputLower, 100.0 * dThroughputUpper, ((dThroughputLower > 0.0) || (dThroughputUpper < 0.0)) ? "" : ", not significant");
+	sRet += utils.StrFormat("Frame time p99 (baseline | current): %s | %s ms\n", utils.StrFormatTPF(dBaseP99).c_str(), utils.StrFormatTPF(dCurP99).c_str());
+	if (bP99)
+		sRet += utils.StrFormat("Frame time p99 change (95%% CI):     %+.2f%% (%+.2f%% .. %+.2f%%)%s\n", 100.0 * dP99, 100.0 * dP99Lower, 100.0 * dP99Upper, ((dP99Lower > 0.0) || (dP99Upper < 0.0)) ? "" : ", not significant");
+	if (bMWU)
+		sRet += utils.StrFormat("Mann-Whitney U (frame times):       z = %.2f, p = %.4f, %s\n", dZ, dP, (dP >= BASELINE_ALPHA) ? "no significant shift" : ((dZ > 0.0) ? "current is slower" : "current is faster"));
+
+	if (b_regression)
+		sRet += utils.StrFormat("Result:                             REGRESSION (%s%s%s beyond %.0f%%)\n", bThroughputRegressed ? "throughput" : "", (bThroughputRegressed && bP99Regressed) ? " and " : "", bP99Regressed ? "p99" : "", d_threshold);
+	else
+		sRet += utils.StrFormat("Result:                             OK (threshold %.0f%%)\n", d_threshold);
+
+	if (p_json)
+	{
+		p_json->BeginObject("baseline");
+		p_json->String("file", baseline.sFile);
+		p_json->Number("threshold_percent", d_threshold, 1);
+		p_json->Number("fps_baseline", baseline.dFPS, 3);
+		p_json->Number("fps_current", d_fps, 3);
+		p_json->Number("throughput_change_percent", 100.0 * dThroughput, 3);
+		if (bMean)
+		{
+			p_json->Number("throughput_change_lower", 100.0 * dThroughputLower, 3);
+			p_json->Number("throughput_change_upper", 100.0 * dThroughputUpper, 3);
+		}
+		p_json->Number("p99_baseline_ms", dBaseP99, 4);
+		p_json->Number("p99_current_ms", dCurP99, 4);
+		if (bP99)
+		{
+			p_json->Number("p99_change_percent", 100.0 * dP99, 3);
+			p_json->Number("p99_change_lower", 100.0 * dP99Lower, 3);
+			p_json->Number("p99_change_upper", 100.0 * dP99Upper, 3);
+		}
+		if (bMWU)
+		{
+			p_json->Number("mann_whitney_z", dZ, 4);
+			p_json->Number("mann_whitney_p", dP, 6);
+		}
+		p_json->Bool("regression", b_regression);
+		p_json->EndObject();
+	}
+
+	return sRet;
+}
+
+
+unsigned __int64 FingerprintScript(string &s_avsfile)
+{
+	//the script text and the files it imports, one level deep. the path is not part of it,
+	//a copied or renamed script keeps its history, an edited one starts a new one
+	string sScript = "";
+	ReadTextFile(s_avsfile, sScript);
+	unsigned __int64 ui64Hash = CResultsDB::HashString(sScript, RESULTSDB_FNV_OFFSET);
+
+	string sDir = s_avsfile.substr(0, s_avsfile.find_last_of('\\') + 1);
+	string sLC = sScript;
+	utils.StrToLC(sLC);
+	size_t pos = 0;
+	while ((pos = sLC.find("import", pos)) != string::npos)
+	{
+		BOOL bCall = (pos == 0) || !(isalnum((unsigned char)sLC[pos - 1]) || (sLC[pos - 1] == '_'));
+		pos += 6;
+		size_t start = sLC.find_first_not_of(" \t", pos);
+		if (!bCall || (start == string::npos) || (sLC[start] != '('))
+			continue;
+
+		start = sLC.find_first_not_of(" \t", start + 1);
+		if ((start == string::npos) || (sLC[start] != '"'))
+			continue;
+
+		size_t end = sLC.find('"', start + 1);
+		if (end == string::npos)
+			break;
+
+		string sImport = sScript.substr(start + 1, end - start - 1);
+		if ((sImport.length() > 1) && (sImport[1] != ':') && (sImport[0] != '\\') && (sImport[0] != '/'))
+			sImport = sDir + sImport;
+
+		string sText = "";
+		if (!ReadTextFile(sImport, sText))
+			sText = sImport;   //a missing import still changes the key
+		ui64Hash = CResultsDB::HashString(sText, ui64Hash);
+		pos = end + 1;
+	}
+
+	return ui64Hash;
+}
+
+
+unsigned __int64 FingerprintEnvironment()
+{
+	//Avisynth version and the plugin inventory. files are identified by name, version, size and time stamp
+	string sVersion = AvisynthInfo.sFileVersion;
+	unsigned __int64 ui64Hash = CResultsDB::HashString(sVersion, RESULTSDB_FNV_OFFSET);
+
+	vector<string> vPlugins = AvisynthInfo.vPlugins;
+	for (size_t n = 0; n < vPlugins.size(); n++)
+		utils.StrToLC(vPlugins[n]);
+	sort(vPlugins.begin(), vPlugins.end());
+
+	for (size_t n = 0; n < vPlugins.size(); n++)
+	{
+		string sFile = vPlugins[n].substr(vPlugins[n].find('|') + 1);
+		string sEntry = vPlugins[n];
+		if ((sFile.length() > 4) && (sFile.substr(sFile.length() - 4) == ".dll"))
+			sEntry += "|" + utils.GetFileVersion(sFile);
+
+		WIN32_FILE_ATTRIBUTE_DATA fad;
+		if (::GetFileAttributesEx(sFile.c_str(), GetFileExInfoStandard, &fad))
+			sEntry += utils.StrFormat("|%u|%u|%u|%u", fad.nFileSizeHigh, fad.nFileSizeLow, fad.ftLastWriteTime.dwHighDateTime, fad.ftLastWriteTime.dwLowDateTime);
+
+		ui64Hash = CResultsDB::HashString(sEntry, ui64Hash);
+	}
+
+	return ui64Hash;
+}
+
+
+unsigned __int64 FingerprintMachine()
+{
+	//the machine class, runs on identical machines are comparable
+	string sMachine = utils.StrFormat("%s|%d|%d|%s", sys.cpudata.CPUBrandString.c_str(), (int)sys.cpudata.NumCPUs, (int)sys.cpudata.CPULogicalCores, PROCESS_64 ? "x64" : "x86");
+
+	return CResultsDB::HashString(sMachine, RESULTSDB_FNV_OFFSET);
+}
+
+
+int RunHistory(string &s_avsfile)
+{
+	if (Settings.sResultsFile == "")
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: The location of the results database is unknown\n");
+		return -1;
+	}
+
+	CResultsDB db;
+	vector<stResultRecord> vRecords;
+	if (!db.Load(Settings.sResultsFile, vRecords))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: %s\n", db.sError.c_str());
+		return -1;
+	}
+
+	sys.GetCPUID();
+	unsigned __int64 ui64Script = FingerprintScript(s_avsfile);
+	unsigned __int64 ui64Machine = FingerprintMachine();
+
+	string sFileLC = s_avsfile;
+	utils.StrToLC(sFileLC);
+	vector<stResultRecord> vRuns;
+	size_t nOtherVersions = 0;
+	for (size_t n = 0; n < vRecords.size(); n++)
+	{
+		if (vRecords[n].ui64Machine != ui64Machine)
+			continue;
+
+		if (vRecords[n].ui64Script == ui64Script)
+		{
+			vRuns.push_back(vRecords[n]);
+			continue;
+		}
+
+		string sRecordLC = vRecords[n].sScriptFile;
+		utils.StrToLC(sRecordLC);
+		if (sRecordLC == sFileLC)
+			nOtherVersions++;
+	}
+
+	string sOutBuf = "\n[History]\n";
+	sOutBuf += utils.StrFormat("Script:                             %s\n", s_avsfile.c_str());
+	sOutBuf += utils.StrFormat("Machine:                            %s\n", sys.cpudata.CPUBrandString.c_str());
+	sOutBuf += utils.StrFormat("Database:                           %s\n", Settings.sResultsFile.c_str());
+	if (db.uiSkipped > 0)
+		sOutBuf += utils.StrFormat("Damaged records skipped:            %u\n", db.uiSkipped);
+	if (nOtherVersions > 0)
+		sOutBuf += utils.StrFormat("Runs of other versions of the file: %u (not shown)\n", (unsigned int)nOtherVersions);
+
+	if (vRuns.size() == 0)
+	{
+		sOutBuf += "\nNo runs of this script on this machine\n";
+		PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, sOutBuf);
+		return 0;
+	}
+
+	//the file is in append order, which is nearly chronological with several instances
+	for (size_t i = 1; i < vRuns.size(); i++)
+	{
+		for (size_t j = i; (j > 0) && (vRuns[j - 1].ui64Time > vRuns[j].ui64Time); j--)
+			std::swap(vRuns[j - 1], vRuns[j]);
+	}
+
+	sOutBuf += "\nDate              AVSMeter            Avisynth           FPS    p50 ms    p99 ms  Environment\n";
+	size_t nFirst = (vRuns.size() > HISTORY_MAX_ROWS) ? vRuns.size() - HISTORY_MAX_ROWS : 0;
+	if (nFirst > 0)
+		sOutBuf += utils.StrFormat("(%u older runs not shown)\n", (unsigned int)nFirst);
+	for (size_t n = nFirst; n < vRuns.size(); n++)
+	{
+		FILETIME ftUTC, ftLocal;
+		SYSTEMTIME st;
+		ftUTC.dwLowDateTime = (DWORD)(vRuns[n].ui64Time & 0xFFFFFFFF);
+		ftUTC.dwHighDateTime = (DWORD)(vRuns[n].ui64Time >> 32);
+		::ZeroMemory(&st, sizeof(st));
+		::FileTimeToLocalFileTime(&ftUTC, &ftLocal);
+		::FileTimeToSystemTime(&ftLocal, &st);
+
+		//'*': plugins or Avisynth changed since the previous run
+		BOOL bChanged = (n > 0) && (vRuns[n].ui64Environment != vRuns[n - 1].ui64Environment);
+		sOutBuf += utils.StrFormat("%04u-%02u-%02u %02u:%02u  %-18s  %-12s %9s %9.3f %9.3f  %08X%s\n", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute,
+		           vRuns[n].sAVSMVersion.c_str(), vRuns[n].sAVSVersion.c_str(), utils.StrFormatFPS(vRuns[n].dFPS).c_str(),
+		           vRuns[n].dFrameTimeP50, vRuns[n].dFrameTimeP99, (DWORD)(vRuns[n].ui64Environment >> 32), bChanged ? " *" : "");
+	}
+
+	//Theil-Sen is robust against the odd run on a busy machine, O(n^2) limits the number of runs.
+	//a step from new plugins or a new Avisynth is not a trend, only the runs since the last change count
+	size_t nTrend = (vRuns.size() > HISTORY_MAX_TREND) ? vRuns.size() - HISTORY_MAX_TREND : 0;
+	BOOL bEnvChanged = FALSE;
+	for (size_t n = vRuns.size() - 1; n > nTrend; n--)
+	{
+		if (vRuns[n].ui64Environment != vRuns[n - 1].ui64Environment)
+		{
+			nTrend = n;
+			bEnvChanged = TRUE;
+			break;
+		}
+	}
+	vector<double> vX;
+	vector<double> vY;
+	double dMeanFPS = 0.0;
+	for (size_t n = nTrend; n < vRuns.size(); n++)
+	{
+		vX.push_back((double)(vRuns[n].ui64Time - vRuns[nTrend].ui64Time) / (10000000.0 * 86400.0 * 7.0));
+		vY.push_back(vRuns[n].dFPS);
+		dMeanFPS += vRuns[n].dFPS;
+	}
+	dMeanFPS /= (double)vY.size();
+
+	CStats stats;
+	double dSlope = 0.0, dLower = 0.0, dUpper = 0.0;
+	if ((vX.back() > 0.0) && (dMeanFPS > 0.0) && stats.FitTheilSen(vX, vY, dSlope, dLower, dUpper))
+	{
+		sOutBuf += utils.StrFormat("\nFPS trend (%u runs):                %+.2f%%/week (95%% CI %+.2f%% .. %+.2f%%)\n", (unsigned int)vY.size(),
+		           100.0 * dSlope / dMeanFPS, 100.0 * dLower / dMeanFPS, 100.0 * dUpper / dMeanFPS);
+		if (bEnvChanged)
+			sOutBuf += "Trend from the runs since the last environment change ('*')\n";
+		if ((dLower > 0.0) || (dUpper < 0.0))
+			sOutBuf += (dSlope > 0.0) ? "Throughput is improving\n" : "Throughput is degrading\n";
+		else
+			sOutBuf += "No significant trend\n";
+	}
+	else
+		sOutBuf += "\nFPS trend:                          Not possible, at least 3 runs at different times since the last environment change are needed\n";
+
+	PrintConsoleBlock(Settings.bConUseStdOut, COLOR_DEFAULT, sOutBuf);
+
+	return 0;
+}
+
+
+int RunInstances()
+{
+	//reads the shared memory of every running instance, refreshed every second until ESC is pressed
+	unsigned int uiCursorOffset = 0;
+	for (;;)
+	{
+		vector<stLiveStats> vStats;
+		CLiveStats::ReadAll(vStats);
+
+		vector<string> vLines;
+		vLines.push_back(utils.StrFormat("Instances:                          %u (ESC to exit)", (unsigned int)vStats.size()));
+		vLines.push_back("");
+		vLines.push_back("     PID  State        Frames (read | total)       FPS   FPS avg    p99 ms   CPU %      MiB  Script");
+
+		double dFPS = 0.0;
+		double dCPU = 0.0;
+		DWORD dwMemory = 0;
+		unsigned int uiRunning = 0;
+		for (size_t n = 0; n < vStats.size(); n++)
+		{
+			stLiveStats &stats = vStats[n];
+			string sScript = stats.script;
+			sScript = sScript.substr(sScript.find_last_of('\\') + 1);
+			const char *pState = (stats.state == LIVESTATS_STATE_RUNNING) ? "running" : ((stats.state == LIVESTATS_STATE_FINISHED) ? "finished" : "starting");
+			string sFrames = utils.StrFormat("%u | %u", stats.frames_read, stats.frames_total);
+
+			vLines.push_back(utils.StrFormat("%8u  %-10s %23s %9s %9s %9.3f  %6.1f %8u  %s", stats.pid, pState, sFrames.c_str(), utils.StrFormatFPS(stats.fps).c_str(),
+			                 utils.StrFormatFPS(stats.fps_average).c_str(), stats.frametime_p99, stats.cpu_usage, stats.process_memory, sScript.c_str()));
+
+			dwMemory += stats.process_memory;
+			if (stats.state != LIVESTATS_STATE_RUNNING)
+				continue;
+
+			dFPS += stats.fps;
+			dCPU += stats.cpu_usage;
+			uiRunning++;
+		}
+
+		vLines.push_back("");
+		vLines.push_back(utils.StrFormat("Running (FPS | CPU):                %u (%s | %.1f%%)", uiRunning, utils.StrFormatFPS(dFPS).c_str(), dCPU));
+		vLines.push_back(utils.StrFormat("Process memory (all):               %u MiB", dwMemory));
+
+		//lines of a longer previous table are blanked
+		while (vLines.size() < uiCursorOffset)
+			vLines.push_back("");
+
+		if (uiCursorOffset > 0)
+			utils.CursorUp(uiCursorOffset);
+		for (size_t n = 0; n < vLines.size(); n++)
+			PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\r%s\n", Pad(vLines[n]).c_str());
+		uiCursorOffset = (unsigned int)vLines.size();
+
+		for (int i = 0; i < 10; i++)
+		{
+			if (_kbhit() && (_getch() == 0x1B)) //ESC
+				return 0;
+			Sleep(100);
+		}
+	}
+
+	return 0;
+}
+
+
+string GetOutputFileName(string &s_avsfile, string s_extension)
+{
+	//same naming rules as the log and csv files
+	string sOutFile = "";
+	size_t ilen = s_avsfile.length();
+
+	if (Settings.sSystemDateTime == "")
+		Settings.sSystemDateTime = sys.GetFormattedSystemDateTime();
+
+	if (ilen > 4)
+		sOutFile = s_avsfile.substr(0, ilen - 4);
+	else
+		sOutFile = s_avsfile;
+
+	if (Settings.bLogFileDateTimeSuffix)
+		sOutFile += " [" + Settings.sSystemDateTime + "]";
+
+	sOutFile += s_extension;
+
+	if (Settings.sLogDirectory != "")
+	{
+		size_t sLen = sOutFile.length();
+		for (size_t nPos = (sLen - 1); nPos > 0; nPos--)
+		{
+			if (sOutFile[nPos] == '\\')
+			{
+				sOutFile = Settings.sLogDirectory + "\\" + sOutFile.substr(nPos + 1);
+				break;
+			}
+		}
+	}
+
+	return sOutFile;
+}
+
+
+void PollKeys()
+{
+	if (Settings.bPauseBeforeExit)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\nPress any key to exit...");
+
+		for (;;)
+		{
+			Sleep(100);
+			if (_getch())
+				break;
+		}
+
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s", Pad("").c_str());
+		utils.CursorUp(1);
+	}
+
+	return;
+}
+
+
+void PrintConsole(BOOL bUseStdOut, WORD wAttributes, const char *fmt, ...)
+{
+	const unsigned int bufsize = 8192;
+	char buffer[bufsize];
+
+	va_list args;
+	va_start(args, fmt);
+
+	if (_vsnprintf(buffer, bufsize, fmt, args) < 0)
+	{
+		va_end(args);
+		fprintf(stderr, "\rBuffer overflow...\r");
+		return;
+	}
+
+	va_end(args);
+
+	CharToOem(buffer, buffer);
+
+	if (wAttributes && Settings.bUseColor)
+		utils.SetConsoleColors(wAttributes);
+
+	if (bUseStdOut)
+	{
+		fputs(buffer, stdout);
+		fflush(stdout);
+	}
+	else
+	{
+		fputs(buffer, stderr);
+		fflush(stderr);
+	}
+
+	if (wAttributes && Settings.bUseColor)
+		utils.ResetConsoleColors();
+
+	return;
+}
+
+
+void PrintConsoleBlock(BOOL bUseStdOut, WORD wAttributes, string s_block)
+{
+	//PrintConsole() is limited to 8K per call, print larger blocks line by line
+	size_t current = 0;
+	size_t next = 0;
+	while (current < s_block.length())
+	{
+		next = s_block.find('\n', current);
+		if (next == string::npos)
+			next = s_block.length() - 1;
+
+		PrintConsole(bUseStdOut, wAttributes, "%s", s_block.substr(current, next - current + 1).c_str());
+		current = next + 1;
+	}
+
+	return;
+}
+
+
+string Pad(string s_line)
+{
+	int iPadLen = utils.GetConsoleWidth() - (int)s_line.length();
+	if ((iPadLen > 0) && (iPadLen <= 1000))
+		s_line.append(iPadLen - 1, ' ');
+
+	return s_line;
+}
+
+
+unsigned int CalculateFrameInterval(string &s_avsfile, string &s_error)
+{
+	s_error = "";
+	unsigned int uiFrameInterval = 10;
+
+	HINSTANCE hDLL;
+	hDLL = ::LoadLibraryEx("avisynth", NULL, LOAD_WITH_ALTERED_SEARCH_PATH);
+
+	if (!hDLL)
+	{
+		s_error = "Cannot load avisynth.dll";
+		return uiFrameInterval;
+	}
+
+	IScriptEnvironment *AVS_env = 0;
+
+	try
+	{
+		_set_se_translator(SE_Translator);
+
+		CREATE_ENV *CreateEnvironment = (CREATE_ENV *)GetProcAddress(hDLL, "CreateScriptEnvironment");
+		if (!CreateEnvironment)
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Failed to load CreateScriptEnvironment()\n");
+			PollKeys();
+			return -1;
+		}
+
+		AVS_env = CreateEnvironment(AvisynthInfo.iInterfaceVersion);
+
+		if (!AVS_env)
+		{
+			s_error = "Could not create IScriptenvironment";
+			::FreeLibrary(hDLL);
+			return uiFrameInterval;
+		}
+
+
+		AVS_linkage = AVS_env->GetAVSLinkage();
+		AVSValue AVS_main;
+		AVSValue AVS_temp;
+		PClip AVS_clip;
+		VideoInfo	AVS_vidinfo;
+
+		//trace points are pass-through during the pre-scan
+		BOOL bTraceEnabled = tracer.bEnabled;
+		tracer.bEnabled = FALSE;
+		tracer.Register(AVS_env);
+		AVS_main = AVS_env->Invoke("Import", s_avsfile.c_str());
+		tracer.bEnabled = bTraceEnabled;
+
+		if (!AVS_main.IsClip()) //not a clip
+			AVS_env->ThrowError("Script did not return a video clip:\n%s", s_avsfile.c_str());
+
+		int iMTMode = 0;
+		try
+		{
+			AVS_temp = AVS_env->Invoke("GetMTMode", false);
+			iMTMode = AVS_temp.IsInt() ? AVS_temp.AsInt() : 0;
+			if ((iMTMode > 0) && (iMTMode < 5) && Settings.bInvokeDistributor)
+				AVS_main = AVS_env->Invoke("Distributor", AVS_main);
+		}
+		catch (IScriptEnvironment::NotFound)
+		{
+			iMTMode = 0;
+		}
+
+		AVS_clip = AVS_main.AsClip();
+		AVS_vidinfo = AVS_clip->GetVideoInfo();
+
+		unsigned int uiTotalFrames = (unsigned int)AVS_vidinfo.num_frames;
+
+		if (!AVS_vidinfo.HasVideo())
+			AVS_env->ThrowError("Script did not return a video clip:\n%s", s_avsfile.c_str());
+
+		unsigned int uiFrame = 0;
+		double TDelta = 0.0;
+		double T0 = timer.GetSTDTimer();
+		unsigned __int64 D0 = 0;
+		while ((TDelta < 5.0) && (uiFrame < uiTotalFrames))
+		{
+			if ((timer.GetSTDTimerMS() - D0) >= 100)
+			{
+				PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\rPre-scanning script (F%u / T%.2lf)\r", uiFrame, TDelta);
+				D0 = timer.GetSTDTimerMS();
+
+				if (_kbhit())
+				{
+					if (_getch() == 0x1B) //ESC
+						AVS_env->ThrowError("\'ESC\' pressed, cancelled.");
+				}
+			}
+
+			PVideoFrame src_frame = AVS_clip->GetFrame(uiFrame, AVS_env);
+			++uiFrame;
+			TDelta = timer.GetSTDTimer() - T0;
+		}
+
+		double dAverageFrameTime = 0.0;
+		if (TDelta >= ((double)MIN_RUNTIME / 1000.0))
+			dAverageFrameTime = (1000.0 * TDelta) / (double)uiFrame; //convert to milliseconds
+
+
+		uiFrameInterval = 1000;
+		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /  500.0)) uiFrameInterval =  500;
+		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /  200.0)) uiFrameInterval =  200;
+		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /  100.0)) uiFrameInterval =  100;
+		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /   50.0)) uiFrameInterval =   50;
+		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /   20.0)) uiFrameInterval =   20;
+		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /   10.0)) uiFrameInterval =   10;
+		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL))          uiFrameInterval =    1;
+
+		AVS_clip = 0;
+		AVS_main = 0;
+		AVS_temp = 0;
+		Sleep(DSE_DELAY);
+		AVS_env->DeleteScriptEnvironment();
+		AVS_env = 0;
+		AVS_linkage = 0;
+
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+	}
+	catch (AvisynthError err)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		s_error = utils.StrFormat("%s", (PCSTR)err.msg);
+		uiFrameInterval = 10;
+	}
+	catch (exception& ex)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		s_error = ex.what();
+		uiFrameInterval = 10;
+	}
+	catch (...)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		s_error = utils.SysErrorMessage();
+		uiFrameInterval = 10;
+	}
+
+	if (!::FreeLibrary(hDLL))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		s_error = "Cannot unload avisynth.dll";
+		uiFrameInterval = 10;
+	}
+
+	return uiFrameInterval;
+}
+
+
+BOOL ProbeGraph(string &s_avsfile, string &s_tree, string &s_dot, string &s_error)
+{
+	/*
+	Loads the script in an environment of its own and requests frame 0 so that the trace points
+	learn which of them feed which. The environment, its caches and its MT pool are gone before
+	the timed run starts, the nodes of the probe are dropped again.
+	*/
+	s_error = "";
+	s_tree = "";
+	s_dot = "";
+
+	HINSTANCE hDLL;
+	hDLL = ::LoadLibraryEx("avisynth", NULL, LOAD_WITH_ALTERED_SEARCH_PATH);
+
+	if (!hDLL)
+	{
+		s_error = "Cannot load avisynth.dll";
+		return FALSE;
+	}
+
+	IScriptEnvironment *AVS_env = 0;
+
+	try
+	{
+		_set_se_translator(SE_Translator);
+
+		CREATE_ENV *CreateEnvironment = (CREATE_ENV *)GetProcAddress(hDLL, "CreateScriptEnvironment");
+		if (!CreateEnvironment)
+		{
+			s_error = "Failed to load CreateScriptEnvironment()";
+			::FreeLibrary(hDLL);
+			return FALSE;
+		}
+
+		AVS_env = CreateEnvironment(AvisynthInfo.iInterfaceVersion);
+
+		if (!AVS_env)
+		{
+			s_error = "Could not create IScriptenvironment";
+			::FreeLibrary(hDLL);
+			return FALSE;
+		}
+
+		AVS_linkage = AVS_env->GetAVSLinkage();
+		AVSValue AVS_main;
+		AVSValue AVS_temp;
+		PClip AVS_clip;
+
+		tracer.Register(AVS_env);
+		AVS_main = AVS_env->Invoke("Import", s_avsfile.c_str());
+
+		if (!AVS_main.IsClip()) //not a clip
+			AVS_env->ThrowError("\"%s\":\nScript did not return a clip", s_avsfile.c_str());
+
+		try
+		{
+			AVS_temp = AVS_env->Invoke("GetMTMode", false);
+			int iMTMode = AVS_temp.IsInt() ? AVS_temp.AsInt() : 0;
+			if ((iMTMode > 0) && (iMTMode < 5) && Settings.bInvokeDistributor)
+				AVS_main = AVS_env->Invoke("Distributor", AVS_main);
+		}
+		catch (IScriptEnvironment::NotFound)
+		{
+		}
+
+		AVS_clip = tracer.Wrap(AVS_main.AsClip(), "Output", AVS_env);
+		if (AVS_clip->GetVideoInfo().HasVideo())
+		{
+			PVideoFrame probe_frame = AVS_clip->GetFrame(0, AVS_env);
+			probe_frame = 0;
+
+			tracer.QueryHints();
+			s_tree = tracer.GraphTree();
+			s_dot = tracer.GraphDOT(s_avsfile);
+		}
+
+		AVS_clip = 0;
+		AVS_main = 0;
+		AVS_temp = 0;
+		Sleep(DSE_DELAY);
+		AVS_env->DeleteScriptEnvironment();
+		AVS_env = 0;
+		AVS_linkage = 0;
+	}
+	catch (AvisynthError err)
+	{
+		s_error = utils.StrFormat("%s", (PCSTR)err.msg);
+	}
+	catch (exception& ex)
+	{
+		s_error = ex.what();
+	}
+	catch (...)
+	{
+		s_error = utils.SysErrorMessage();
+	}
+
+	//the timed run creates its own nodes
+	tracer.Reset();
+
+	if (!::FreeLibrary(hDLL) && (s_error == ""))
+		s_error = "Cannot unload avisynth.dll";
+
+	return (s_error == "") ? TRUE : FALSE;
+}
+
+
+BOOL ReadTextFile(string &s_file, string &s_text)
+{
+	s_text = "";
+	string sCurrentLine = "";
+
+	ifstream hFile(s_file.c_str());
+	if (!hFile.is_open())
+		return FALSE;
+
+	while (getline(hFile, sCurrentLine))
+		s_text += sCurrentLine + "\n";
+
+	hFile.close();
+
+	return TRUE;
+}
+
+
+string StripFunctionCalls(string s_script, string s_function, BOOL b_keepclip)
+{
+	/*
+	Removes all calls of s_function from the script text. Comments and strings are skipped.
+	"clip.Function(...)" is removed including the dot. If b_keepclip is set, "Function(clip, ...)"
+	is replaced with its clip argument and "Function(n)" with "last", otherwise the call is removed.
+	*/
+	string sLC = s_script;
+	string sFunctionLC = s_function;
+	utils.StrToLC(sLC);
+	utils.StrToLC(sFunctionLC);
+
+	string sOut = "";
+	size_t nLen = s_script.length();
+	size_t pos = 0;
+
+	while (pos < nLen)
+	{
+		char c = sLC[pos];
+
+		if (c == '#')
+		{
+			size_t eol = sLC.find('\n', pos);
+			if (eol == string::npos)
+				eol = nLen;
+			sOut += s_script.substr(pos, eol - pos);
+			pos = eol;
+			continue;
+		}
+
+		if (c == '"')
+		{
+			size_t end = string::npos;
+			if (sLC.substr(pos, 3) == "\"\"\"")
+			{
+				end = sLC.find("\"\"\"", pos + 3);
+				end = (end == string::npos) ? nLen : end + 3;
+			}
+			else
+			{
+				end = sLC.find('"', pos + 1);
+				end = (end == string::npos) ? nLen : end + 1;
+			}
+			sOut += s_script.substr(pos, end - pos);
+			pos = end;
+			continue;
+		}
+
+		if (isalnum((unsigned char)c) || (c == '_'))
+		{
+			size_t start = pos;
+			while ((pos < nLen) && (isalnum((unsigned char)sLC[pos]) || (sLC[pos] == '_')))
+				++pos;
+
+			if (sLC.substr(start, pos - start) == sFunctionLC)
+			{
+				size_t open = sLC.find_first_not_of(" \t", pos);
+				if ((open != string::npos) && (sLC[open] == '('))
+				{
+					//find the matching parenthesis and the first top level comma
+					int iDepth = 0;
+					size_t close = string::npos;
+					size_t comma = string::npos;
+					BOOL bInString = FALSE;
+					for (size_t n = open; n < nLen; n++)
+					{
+						if (sLC[n] == '"')
+							bInString = !bInString;
+						if (bInString)
+							continue;
+						if (sLC[n] == '(')
+							++iDepth;
+						if ((sLC[n] == ',') && (iDepth == 1) && (comma == string::npos))
+							comma = n;
+						if ((sLC[n] == ')') && (--iDepth == 0))
+						{
+							close = n;
+							break;
+						}
+					}
+
+					if (close != string::npos)
+					{
+						size_t dot = sOut.find_last_not_of(" \t");
+						if ((dot != string::npos) && (sOut[dot] == '.'))
+							sOut.erase(dot);
+						else if (b_keepclip)
+						{
+							string sFirstArg = s_script.substr(open + 1, ((comma != string::npos) ? comma : close) - open - 1);
+							utils.StrTrim(sFirstArg);
+							string sFirstArgLC = sFirstArg;
+							utils.StrToLC(sFirstArgLC);
+
+							if ((sFirstArg == "") || utils.IsNumeric(sFirstArg) || (sFirstArgLC.find('=') != string::npos))
+								sOut += "last";
+							else
+								sOut += sFirstArg;
+						}
+
+						pos = close + 1;
+						continue;
+					}
+				}
+			}
+
+			sOut += s_script.substr(start, pos - start);
+			continue;
+		}
+
+		sOut += s_script[pos];
+		++pos;
+	}
+
+	return sOut;
+}
+
+
+BOOL RunBenchmarkPass(string &s_avsfile, string &s_script, stScriptVariant &variant, double d_timelimit, stPassResult &result)
+{
+	result.uiFrames = 0;
+	result.dSeconds = 0.0;
+	result.dFPS = 0.0;
+	result.dCPUUsage = 0.0;
+	result.dwMemPeakMB = 0;
+	result.iPoolThreads = 0;
+	result.ui64Hash = 14695981039346656037ULL;
+	result.sError = "";
+
+	HINSTANCE hDLL;
 	hDLL = ::LoadLibraryEx("avisynth", NULL, LOAD_WITH_ALTERED_SEARCH_PATH);
 
 	if (!hDLL)
 	{
-		s_error = "Cannot load avisynth.dll";
-		return uiFrameInterval;
+		result.sError = "Cannot load avisynth.dll";
+		return FALSE;
+	}
+
+	char szCurrentDir[MAX_PATH_LEN + 1];
+	::GetCurrentDirectory(MAX_PATH_LEN, szCurrentDir);
+	string sScriptDir = s_avsfile.substr(0, s_avsfile.find_last_of('\\') + 1);
+
+	IScriptEnvironment *AVS_env = 0;
+
+	try
+	{
+		_set_se_translator(SE_Translator);
+
+		CREATE_ENV *CreateEnvironment = (CREATE_ENV *)GetProcAddress(hDLL, "CreateScriptEnvironment");
+		if (!CreateEnvironment)
+		{
+			result.sError = "Failed to load CreateScriptEnvironment()";
+			::FreeLibrary(hDLL);
+			return FALSE;
+		}
+
+		AVS_env = CreateEnvironment(AvisynthInfo.iInterfaceVersion);
+
+		if (!AVS_env)
+		{
+			result.sError = "Could not create IScriptenvironment";
+			::FreeLibrary(hDLL);
+			return FALSE;
+		}
+
+		AVS_linkage = AVS_env->GetAVSLinkage();
+		AVSValue AVS_main;
+		AVSValue AVS_temp;
+		PClip AVS_clip;
+		VideoInfo	AVS_vidinfo;
+
+		BOOL bHasPrefetch = AVS_env->FunctionExists("Prefetch");
+		BOOL bHasSetMTMode = AVS_env->FunctionExists("SetMTMode");
+
+		string sScript = s_script;
+		if (variant.iThreads > 0)
+		{
+			sScript = StripFunctionCalls(sScript, "Prefetch", TRUE);
+			sScript = StripFunctionCalls(sScript, "SetMTMode", FALSE);
+			if ((variant.iThreads > 1) && bHasSetMTMode && !bHasPrefetch)
+				sScript = utils.StrFormat("SetMTMode(2, %d)\n", variant.iThreads) + sScript;
+		}
+
+		if (variant.sPrefix != "")
+			sScript = variant.sPrefix + sScript;
+
+		if (variant.iMemoryMax > 0)
+		{
+			sScript = StripFunctionCalls(sScript, "SetMemoryMax", FALSE);
+			AVS_env->SetMemoryMax(variant.iMemoryMax);
+		}
+
+		//evaluate the modified script like Import() would
+		BOOL bTraceEnabled = tracer.bEnabled;
+		tracer.bEnabled = FALSE;
+		tracer.Register(AVS_env);
+		AVS_env->SetGlobalVar("$ScriptName$", AVS_env->SaveString(s_avsfile.c_str()));
+		AVS_env->SetGlobalVar("$ScriptFile$", AVS_env->SaveString(s_avsfile.substr(sScriptDir.length()).c_str()));
+		AVS_env->SetGlobalVar("$ScriptDir$", AVS_env->SaveString(sScriptDir.c_str()));
+		::SetCurrentDirectory(sScriptDir.c_str());
+		AVSValue AVS_evalargs[2] = { sScript.c_str(), s_avsfile.c_str() };
+		AVS_main = AVS_env->Invoke("Eval", AVSValue(AVS_evalargs, 2));
+		::SetCurrentDirectory(szCurrentDir);
+		tracer.bEnabled = bTraceEnabled;
+
+		if (!AVS_main.IsClip())
+			AVS_env->ThrowError("\"%s\":\nScript did not return a clip", s_avsfile.c_str());
+
+		result.iPoolThreads = (variant.iThreads > 1) ? variant.iThreads : 0;
+
+		if ((variant.iThreads > 1) && bHasPrefetch)
+		{
+			AVSValue AVS_pfargs[2] = { AVS_main, variant.iThreads };
+			AVS_main = AVS_env->Invoke("Prefetch", AVSValue(AVS_pfargs, 2));
+
+			if (AvisynthInfo.iInterfaceVersion >= 8)
+				result.iPoolThreads = (int)AVS_env->GetEnvProperty(AEP_THREADPOOL_THREADS);
+		}
+		else if (bHasSetMTMode)
+		{
+			try
+			{
+				AVS_temp = AVS_env->Invoke("GetMTMode", false);
+				int iMTMode = AVS_temp.IsInt() ? AVS_temp.AsInt() : 0;
+				if ((iMTMode > 0) && (iMTMode < 5) && Settings.bInvokeDistributor)
+					AVS_main = AVS_env->Invoke("Distributor", AVS_main);
+			}
+			catch (IScriptEnvironment::NotFound)
+			{
+			}
+		}
+
+		AVS_clip = AVS_main.AsClip();
+		AVS_vidinfo = AVS_clip->GetVideoInfo();
+
+		if (!AVS_vidinfo.HasVideo())
+			AVS_env->ThrowError("Script did not return a video clip:\n%s", s_avsfile.c_str());
+
+		//only the cache of the output clip is reachable through the clip interface
+		if ((variant.iCacheCapacity > 0) && (AVS_clip->GetVersion() >= 5))
+			AVS_clip->SetCacheHints(CACHE_SET_MAX_CAPACITY, variant.iCacheCapacity);
+
+		unsigned int uiFirstFrame = 0;
+		unsigned int uiLastFrame = (unsigned int)AVS_vidinfo.num_frames - 1;
+		if ((Settings.iStartFrame >= 0) && (Settings.iStopFrame >= Settings.iStartFrame) && (Settings.iStopFrame < (__int64)AVS_vidinfo.num_frames))
+		{
+			uiFirstFrame = (unsigned int)Settings.iStartFrame;
+			uiLastFrame = (unsigned int)Settings.iStopFrame;
+		}
+
+		if ((variant.uiMaxFrames > 0) && ((uiLastFrame - uiFirstFrame) >= variant.uiMaxFrames))
+			uiLastFrame = uiFirstFrame + variant.uiMaxFrames - 1;
+
+		CMonitor monitor;
+		stMonitorSample msample;
+
+		//the first frame includes the start-up of the thread pool and is not measured
+		PVideoFrame src_frame = AVS_clip->GetFrame(uiFirstFrame, AVS_env);
+
+		if (!monitor.Start(&timer, NULL, MONITOR_PERIOD_MS))
+			AVS_env->ThrowError("Cannot start the monitor thread\n");
+
+		double dStartTime = timer.GetTimer();
+		unsigned __int64 uiLastCheckMS = timer.GetSTDTimerMS();
+		unsigned __int64 uiTimeLimitMS = (d_timelimit > 0.0) ? (uiLastCheckMS + (unsigned __int64)(d_timelimit * 1000.0)) : _UI64_MAX;
+		unsigned int uiFrames = 0;
+
+		for (unsigned int uiFrame = uiFirstFrame + 1; uiFrame <= uiLastFrame; uiFrame++)
+		{
+			src_frame = AVS_clip->GetFrame(uiFrame, AVS_env);
+			++uiFrames;
+
+			unsigned __int64 uiNowMS = timer.GetSTDTimerMS();
+			if ((uiNowMS - uiLastCheckMS) < (unsigned __int64)(REFRESH_INTERVAL * 1000.0))
+				continue;
+
+			uiLastCheckMS = uiNowMS;
+
+			PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad(utils.StrFormat("Frame %u | %u", uiFrame, uiLastFrame)).c_str());
+
+			if (_kbhit())
+			{
+				if (_getch() == 0x1B) //ESC
+					AVS_env->ThrowError("\'ESC\' pressed, cancelled.");
+			}
+
+			if (uiNowMS >= uiTimeLimitMS)
+				break;
+		}
+
+		result.dSeconds = timer.GetTimer() - dStartTime;
+		result.uiFrames = uiFrames;
+		if (result.dSeconds > 0.0)
+			result.dFPS = (double)uiFrames / result.dSeconds;
+
+		monitor.Stop();
+		monitor.GetSnapshot(msample);
+		result.dCPUUsage = msample.cpu_usage_avg;
+		result.dwMemPeakMB = msample.process_memory_peak;
+
+		//the output is verified in a separate pass so that hashing does not slow down the measured frames
+		if (variant.bHashFrames)
+		{
+			for (unsigned int uiFrame = uiFirstFrame; uiFrame <= (uiFirstFrame + uiFrames); uiFrame++)
+			{
+				src_frame = AVS_clip->GetFrame(uiFrame, AVS_env);
+				result.ui64Hash = HashFrame(src_frame, AVS_vidinfo, result.ui64Hash);
+
+				unsigned __int64 uiNowMS = timer.GetSTDTimerMS();
+				if ((uiNowMS - uiLastCheckMS) < (unsigned __int64)(REFRESH_INTERVAL * 1000.0))
+					continue;
+
+				uiLastCheckMS = uiNowMS;
+				PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad(utils.StrFormat("Verifying frame %u | %u", uiFrame, uiFirstFrame + uiFrames)).c_str());
+
+				if (_kbhit())
+				{
+					if (_getch() == 0x1B) //ESC
+						AVS_env->ThrowError("\'ESC\' pressed, cancelled.");
+				}
+			}
+		}
+
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+
+		src_frame = 0;
+		AVS_clip = 0;
+		AVS_main = 0;
+		AVS_temp = 0;
+		AVS_env->DeleteScriptEnvironment();
+		AVS_env = 0;
+		AVS_linkage = 0;
+	}
+	catch (AvisynthError err)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		result.sError = utils.StrFormat("%s", (PCSTR)err.msg);
+	}
+	catch (exception& ex)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		result.sError = ex.what();
+		if (result.sError == "")
+			result.sError = "Unknown exception";
+	}
+	catch (...)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+		result.sError = utils.SysErrorMessage();
+		if (result.sError == "")
+			result.sError = "Unknown exception";
+	}
+
+	::SetCurrentDirectory(szCurrentDir);
+	::FreeLibrary(hDLL);
+
+	return (result.sError == "") ? TRUE : FALSE;
+}
+
+
+string CreateSweepLogHeader(string &s_avsfile, string &s_avsmversion)
+{
+	string sLogBuffer = "";
+
+	sLogBuffer += utils.StrFormat("Log file created with:      AVSMeter %s\n", s_avsmversion.c_str());
+	sLogBuffer += utils.StrFormat("Script file:                %s\n", s_avsfile.c_str());
+
+	sLogBuffer += "\n[OS/Hardware info]\n";
+	sLogBuffer += utils.StrFormat("Operating system:           %s\n\n", sys.GetOSVersion().c_str());
+
+	if (sys.bCPUIDSuccess)
+	{
+		sLogBuffer += utils.StrFormat("CPU:                        %s / %s\n", sys.cpudata.CPUBrandString.c_str(), sys.cpudata.CPUCodeName.c_str());
+		sLogBuffer += utils.StrFormat("                            %u physical cores / %u logical cores\n", sys.cpudata.CPUCores, sys.cpudata.CPULogicalCores);
+	}
+
+	sLogBuffer += utils.StrFormat("\nTimer:                      %s\n", timer.GetBackendInfo().c_str());
+
+	sLogBuffer += "\n\n[Avisynth info]\n";
+	sLogBuffer += utils.StrFormat("VersionString:              %s\n", AvisynthInfo.sVersionString.c_str());
+	sLogBuffer += utils.StrFormat("File / Product version:     %s / %s\n", AvisynthInfo.sFileVersion.c_str(), AvisynthInfo.sProductVersion.c_str());
+	sLogBuffer += utils.StrFormat("Interface Version:          %d\n", AvisynthInfo.iInterfaceVersion);
+
+	return sLogBuffer;
+}
+
+
+int RunThreadSweep(string &s_avsfile, unsigned int ui_from, unsigned int ui_to, string &s_avsmversion)
+{
+	string sScript = "";
+	string sOutBuf = "";
+	string sAVSError = "";
+	string sGPUInfo = "";
+	vector<stPerfData> perfdata;
+
+	if (!AvisynthInfo.bIsMTVersion)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: The installed Avisynth version does not support multi-threading\n");
+		return -1;
+	}
+
+	if (!ReadTextFile(s_avsfile, sScript))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot open \"%s\"\n", s_avsfile.c_str());
+		return -1;
+	}
+
+	double dPassTime = (Settings.iTimeLimit != -1) ? (double)Settings.iTimeLimit : SWEEP_PASS_TIME;
+
+	//one thread (no Prefetch) is always measured as the reference for speedup and efficiency
+	vector<unsigned int> vThreadCounts;
+	vThreadCounts.push_back(1);
+	for (unsigned int t = ((ui_from > 1) ? ui_from : 2); t <= ui_to; t++)
+		vThreadCounts.push_back(t);
+
+	string sLogBuffer = CreateSweepLogHeader(s_avsfile, s_avsmversion);
+	sLogBuffer += "\n\n[Thread sweep]\n";
+	sOutBuf = utils.StrFormat("Threads: %u - %u, %.0f seconds per pass (1 = no Prefetch)\n\n", vThreadCounts[(vThreadCounts.size() > 1) ? 1 : 0], ui_to, dPassTime);
+	sOutBuf += "Threads          FPS    Speedup   Efficiency    CPU(%)   Memory(MiB)   Pool threads\n";
+	sLogBuffer += sOutBuf;
+	PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\n%s", sOutBuf.c_str());
+
+	vector<double> vThreads;
+	vector<double> vSpeedup;
+	vector<double> vFPS;
+	double dBaseFPS = 0.0;
+
+	for (size_t n = 0; n < vThreadCounts.size(); n++)
+	{
+		stScriptVariant variant;
+		InitScriptVariant(variant);
+		variant.iThreads = (int)vThreadCounts[n];
+
+		stPassResult result;
+		if (!RunBenchmarkPass(s_avsfile, sScript, variant, dPassTime, result))
+		{
+			sAVSError = result.sError;
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\n%s\n", sAVSError.c_str());
+			break;
+		}
+
+		if (n == 0)
+			dBaseFPS = result.dFPS;
+
+		double dSpeedup = (dBaseFPS > 0.0) ? (result.dFPS / dBaseFPS) : 0.0;
+		string sPoolThreads = (result.iPoolThreads > 0) ? utils.StrFormat("%d", result.iPoolThreads) : "-";
+
+		sOutBuf = utils.StrFormat("%7u %12s %10.2f %11.1f%% %9.1f %13u %14s\n", vThreadCounts[n], utils.StrFormatFPS(result.dFPS).c_str(), dSpeedup,
+			100.0 * dSpeedup / (double)vThreadCounts[n], result.dCPUUsage, result.dwMemPeakMB, sPoolThreads.c_str());
+		sLogBuffer += sOutBuf;
+		PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+
+		vThreads.push_back((double)vThreadCounts[n]);
+		vSpeedup.push_back(dSpeedup);
+		vFPS.push_back(result.dFPS);
+	}
+
+	if (vFPS.size() > 1)
+	{
+		CStats stats;
+		double dParallel = 0.0;
+		double dSigma = 0.0;
+		double dKappa = 0.0;
+
+		sOutBuf = "\n";
+		if (stats.FitAmdahl(vThreads, vSpeedup, dParallel))
+		{
+			if (dParallel < 1.0)
+				sOutBuf += utils.StrFormat("Amdahl fit:                 parallel fraction %.3f, speedup limit %.2f\n", dParallel, 1.0 / (1.0 - dParallel));
+			else
+				sOutBuf += utils.StrFormat("Amdahl fit:                 parallel fraction %.3f\n", dParallel);
+		}
+
+		if (stats.FitUSL(vThreads, vSpeedup, dSigma, dKappa))
+		{
+			double dPeak = stats.USLPeakThreads(dSigma, dKappa);
+			if (dPeak > 0.0)
+				sOutBuf += utils.StrFormat("USL fit:                    contention %.4f, coherency %.6f, peak at %.1f threads (speedup %.2f)\n", dSigma, dKappa, dPeak, stats.USLSpeedup(dPeak, dSigma, dKappa));
+			else
+				sOutBuf += utils.StrFormat("USL fit:                    contention %.4f, coherency %.6f, no throughput peak\n", dSigma, dKappa);
+		}
+
+		//knee: fewest threads that reach most of the best measured throughput
+		double dMaxFPS = 0.0;
+		for (size_t n = 0; n < vFPS.size(); n++)
+		{
+			if (vFPS[n] > dMaxFPS)
+				dMaxFPS = vFPS[n];
+		}
+
+		for (size_t n = 0; n < vFPS.size(); n++)
+		{
+			if (vFPS[n] >= (SWEEP_KNEE_FRACTION * dMaxFPS))
+			{
+				if (vThreads[n] > 1.0)
+					sOutBuf += utils.StrFormat("Recommended:                Prefetch(%u), %.1f%% of the best throughput\n", (unsigned int)vThreads[n], 100.0 * vFPS[n] / dMaxFPS);
+				else
+					sOutBuf += "Recommended:                no Prefetch, multi-threading does not improve throughput\n";
+				break;
+			}
+		}
+
+		sLogBuffer += sOutBuf;
+		PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+	}
+
+	if (Settings.bCreateLog)
+	{
+		string sLogRet = CreateLogFile(s_avsfile, sLogBuffer, sGPUInfo, perfdata, sAVSError, FALSE, TRUE);
+		if (sLogRet != "")
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, sLogRet.c_str());
+			return -1;
+		}
+	}
+
+	return (sAVSError == "") ? 0 : -1;
+}
+
+
+unsigned __int64 HashFrame(PVideoFrame &frame, VideoInfo &vi, unsigned __int64 ui64_hash)
+{
+	//FNV-1a over the visible bytes of all planes, the padding between rows is skipped
+	int iPlanesYUV[4] = { PLANAR_Y, PLANAR_U, PLANAR_V, PLANAR_A };
+	int iPlanesRGB[4] = { PLANAR_G, PLANAR_B, PLANAR_R, PLANAR_A };
+	int iInterleaved[1] = { 0 };
+	int *piPlanes = iInterleaved;
+	int iNumPlanes = 1;
+
+	if (vi.IsPlanar() && !vi.IsY())
+	{
+		piPlanes = (vi.IsPlanarRGB() || vi.IsPlanarRGBA()) ? iPlanesRGB : iPlanesYUV;
+		iNumPlanes = (vi.NumComponents() == 4) ? 4 : 3;
+	}
+
+	for (int p = 0; p < iNumPlanes; p++)
+	{
+		const BYTE *pSrc = frame->GetReadPtr(piPlanes[p]);
+		int iPitch = frame->GetPitch(piPlanes[p]);
+		int iRowSize = frame->GetRowSize(piPlanes[p]);
+		int iHeight = frame->GetHeight(piPlanes[p]);
+
+		for (int y = 0; y < iHeight; y++)
+		{
+			for (int x = 0; x < iRowSize; x++)
+			{
+				ui64_hash ^= pSrc[x];
+				ui64_hash *= 1099511628211ULL;
+			}
+			pSrc += iPitch;
+		}
+	}
+
+	return ui64_hash;
+}
+
+
+vector<string> GetScriptFilters(string &s_script)
+{
+	//internal and plugin functions called by the script, in order of appearance
+	static const char *szSkip[] = { "prefetch", "setmtmode", "setfiltermtmode", "setmemorymax", "setcachemode", "import", "loadplugin",
+		"loadcplugin", "load_stdcall_plugin", "loadvirtualdubplugin", "loadvfapiplugin", "eval", "apply", "avsmetertrace", 0 };
+
+	vector<string> vFilters;
+	vector<BOOL> vPlugin;
+	string sLC = s_script;
+	utils.StrToLC(sLC);
+	size_t nLen = sLC.length();
+	size_t pos = 0;
+
+	while (pos < nLen)
+	{
+		char c = sLC[pos];
+
+		if (c == '#')
+		{
+			pos = sLC.find('\n', pos);
+			if (pos == string::npos)
+				break;
+			continue;
+		}
+
+		if (c == '"')
+		{
+			BOOL bTripleQuote = (sLC.substr(pos, 3) == "\"\"\"") ? TRUE : FALSE;
+			size_t end = bTripleQuote ? sLC.find("\"\"\"", pos + 3) : sLC.find('"', pos + 1);
+			if (end == string::npos)
+				break;
+			pos = end + (bTripleQuote ? 3 : 1);
+			continue;
+		}
+
+		if (!isalpha((unsigned char)c) && (c != '_'))
+		{
+			++pos;
+			continue;
+		}
+
+		size_t start = pos;
+		while ((pos < nLen) && (isalnum((unsigned char)sLC[pos]) || (sLC[pos] == '_')))
+			++pos;
+
+		string sToken = sLC.substr(start, pos - start);
+
+		BOOL bSkip = FALSE;
+		for (int i = 0; szSkip[i]; i++)
+		{
+			if (sToken == szSkip[i])
+				bSkip = TRUE;
+		}
+
+		for (size_t i = 0; (i < vFilters.size()) && !bSkip; i++)
+		{
+			string sFilterLC = vFilters[i];
+			utils.StrToLC(sFilterLC);
+			if (sFilterLC == sToken)
+				bSkip = TRUE;
+		}
+
+		if (bSkip)
+			continue;
+
+		for (size_t i = 0; i < AvisynthInfo.vAllFunctions.size(); i++)
+		{
+			size_t sep = AvisynthInfo.vAllFunctions[i].find('|');
+			string sName = AvisynthInfo.vAllFunctions[i].substr(0, sep);
+			string sNameLC = sName;
+			utils.StrToLC(sNameLC);
+			if (sNameLC != sToken)
+				continue;
+
+			string sSource = AvisynthInfo.vAllFunctions[i].substr(sep + 1);
+			if ((sSource == "[InternalFunction]") || (sSource == "[PluginFunction]"))
+			{
+				vFilters.push_back(sName);
+				vPlugin.push_back((sSource == "[PluginFunction]") ? TRUE : FALSE);
+			}
+			break;
+		}
 	}
 
+	//only functions that return a clip can be given an MT mode, String(), Round() etc. are dropped
+	HINSTANCE hDLL = ::LoadLibraryEx("avisynth", NULL, LOAD_WITH_ALTERED_SEARCH_PATH);
+	if (!hDLL)
+		return vFilters;
+
 	IScriptEnvironment *AVS_env = 0;
+	vector<string> vClipFilters;
 
 	try
 	{
 		_set_se_translator(SE_Translator);
 
 		CREATE_ENV *CreateEnvironment = (CREATE_ENV *)GetProcAddress(hDLL, "CreateScriptEnvironment");
-		if (!CreateEnvironment)
+		if (CreateEnvironment)
+			AVS_env = CreateEnvironment(AvisynthInfo.iInterfaceVersion);
+
+		if (!AVS_env)
 		{
-			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: Failed to load CreateScriptEnvironment()\n");
-			PollKeys();
-			return -1;
+			::FreeLibrary(hDLL);
+			return vFilters;
 		}
 
-		AVS_env = CreateEnvironment(AvisynthInfo.iInterfaceVersion);
+		AVS_linkage = AVS_env->GetAVSLinkage();
 
-		if (!AVS_env)
+		for (size_t i = 0; i < vFilters.size(); i++)
 		{
-			s_error = "Could not create IScriptenvironment";
-			::FreeLibrary(hDLL);
-			return uiFrameInterval;
+			if (ReturnsClip(AVS_env, vFilters[i], vPlugin[i]))
+				vClipFilters.push_back(vFilters[i]);
 		}
 
+		AVS_env->DeleteScriptEnvironment();
+		AVS_env = 0;
+		AVS_linkage = 0;
+	}
+	catch (...)
+	{
+		vClipFilters = vFilters;
+	}
 
-		AVS_linkage = AVS_env->GetAVSLinkage();
-		AVSValue AVS_main;
-		AVSValue AVS_temp;
-		PClip AVS_clip;
-		VideoInfo	AVS_vidinfo;
+	::FreeLibrary(hDLL);
 
-		AVS_main = AVS_env->Invoke("Import", s_avsfile.c_str());
+	return vClipFilters;
+}
 
-		if (!AVS_main.IsClip()) //not a clip
-			AVS_env->ThrowError("Script did not return a video clip:\n%s", s_avsfile.c_str());
 
-		int iMTMode = 0;
+BOOL ReturnsClip(IScriptEnvironment *AVS_env, string &s_function, BOOL b_plugin)
+{
+	//Avisynth+ exports the parameter types of every function as "$Plugin!<name>!Param$", the return type is only known after a call
+	string sParams = "";
+	try
+	{
+		AVS_env->FunctionExists(s_function.c_str()); //triggers the plugin autoload
+		AVSValue AVS_params = AVS_env->GetVar(AVS_env->SaveString(utils.StrFormat("$Plugin!%s!Param$", s_function.c_str()).c_str()));
+		if (!AVS_params.IsString())
+			return TRUE;
+		sParams = AVS_params.AsString();
+	}
+	catch (...)
+	{
+		return TRUE;
+	}
+
+	//types of the unnamed arguments that have to be passed
+	string sRequired = "";
+	BOOL bOptional = FALSE;
+	BOOL bLastRequired = FALSE;
+	for (size_t n = 0; n < sParams.length(); n++)
+	{
+		char c = sParams[n];
+		if (c == '[')
+		{
+			size_t end = sParams.find(']', n);
+			if (end == string::npos)
+				break;
+			n = end;
+			bOptional = TRUE;
+			continue;
+		}
+
+		if (c == '+')
+			continue;
+
+		if (c == '*')
+		{
+			if (bLastRequired)
+				sRequired.erase(sRequired.length() - 1);
+			bLastRequired = FALSE;
+			continue;
+		}
+
+		if (!bOptional)
+			sRequired += c;
+		bLastRequired = !bOptional;
+		bOptional = FALSE;
+	}
+
+	//functions that can be called without arguments or with a single clip are probed
+	if ((sRequired == "") || (sRequired == "c"))
+	{
 		try
 		{
-			AVS_temp = AVS_env->Invoke("GetMTMode", false);
-			iMTMode = AVS_temp.IsInt() ? AVS_temp.AsInt() : 0;
-			if ((iMTMode > 0) && (iMTMode < 5) && Settings.bInvokeDistributor)
-				AVS_main = AVS_env->Invoke("Distributor", AVS_main);
+			AVSValue AVS_none;
+			AVSValue AVS_result;
+			if (sRequired == "")
+				AVS_result = AVS_env->Invoke(s_function.c_str(), AVSValue(&AVS_none, 0));
+			else
+			{
+				AVSValue AVS_args[1] = { AVS_env->Invoke("Eval", AVSValue("BlankClip(length=1, width=64, height=64, pixel_type=\"YV12\")")) };
+				AVS_result = AVS_env->Invoke(s_function.c_str(), AVSValue(AVS_args, 1));
+			}
+			return AVS_result.IsClip() ? TRUE : FALSE;
 		}
-		catch (IScriptEnvironment::NotFound)
+		catch (...)
 		{
-			iMTMode = 0;
+			//plugin filters may reject the probe clip, internal ones accept it unless they are run-time functions
+			return b_plugin;
 		}
+	}
 
-		AVS_clip = AVS_main.AsClip();
-		AVS_vidinfo = AVS_clip->GetVideoInfo();
+	//filters take a clip first, plugin functions taking a string first are usually source filters
+	if (sRequired[0] == 'c')
+		return TRUE;
 
-		unsigned int uiTotalFrames = (unsigned int)AVS_vidinfo.num_frames;
+	return (b_plugin && (sRequired[0] == 's')) ? TRUE : FALSE;
+}
 
-		if (!AVS_vidinfo.HasVideo())
-			AVS_env->ThrowError("Script did not return a video clip:\n%s", s_avsfile.c_str());
 
-		unsigned int uiFrame = 0;
-		double TDelta = 0.0;
-		double T0 = timer.GetSTDTimer();
-		unsigned __int64 D0 = 0;
-		while ((TDelta < 5.0) && (uiFrame < uiTotalFrames))
+int RunMTModeTuner(string &s_avsfile, int i_threads, string &s_avsmversion)
+{
+	string sScript = "";
+	string sOutBuf = "";
+	string sAVSError = "";
+	string sGPUInfo = "";
+	vector<stPerfData> perfdata;
+
+	if (!AvisynthInfo.bIsAVSPlus || !AvisynthInfo.bIsMTVersion)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: \'-mttune\' requires a multi-threaded version of Avisynth+\n");
+		return -1;
+	}
+
+	if (!ReadTextFile(s_avsfile, sScript))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot open \"%s\"\n", s_avsfile.c_str());
+		return -1;
+	}
+
+	//modes set by the script itself would override the trials
+	sScript = StripFunctionCalls(sScript, "SetFilterMTMode", FALSE);
+
+	vector<string> vFilters = GetScriptFilters(sScript);
+	if (vFilters.size() == 0)
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nError: No internal or plugin filters found in \"%s\"\n", s_avsfile.c_str());
+		return -1;
+	}
+
+	string sLogBuffer = CreateSweepLogHeader(s_avsfile, s_avsmversion);
+	sLogBuffer += "\n\n[MT mode tuner]\n";
+
+	//serial reference: output hash and number of frames for all trials
+	stScriptVariant variant;
+	InitScriptVariant(variant);
+	variant.iThreads = 1;
+	variant.bHashFrames = TRUE;
+
+	stPassResult result;
+	PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\nSerial reference...\n");
+	if (!RunBenchmarkPass(s_avsfile, sScript, variant, TUNE_TRIAL_TIME, result))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\n%s\n", result.sError.c_str());
+		return -1;
+	}
+
+	unsigned __int64 ui64RefHash = result.ui64Hash;
+	variant.iThreads = i_threads;
+	variant.uiMaxFrames = result.uiFrames + 1;
+
+	sOutBuf = utils.StrFormat("Filters:                    %u\n", (unsigned int)vFilters.size());
+	sOutBuf += utils.StrFormat("Threads:                    %d\n", i_threads);
+	sOutBuf += utils.StrFormat("Frames per trial:           %u\n", variant.uiMaxFrames);
+	sOutBuf += utils.StrFormat("Serial FPS:                 %s\n\n", utils.StrFormatFPS(result.dFPS).c_str());
+	sOutBuf += "Filter                               Mode          FPS   Output\n";
+	sLogBuffer += sOutBuf;
+	PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+
+	//mode 0 keeps the default of the filter (not written to the prefix)
+	vector<int> vModes(vFilters.size(), 0);
+	double dBestFPS = 0.0;
+
+	if (!RunBenchmarkPass(s_avsfile, sScript, variant, 0.0, result))
+	{
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\n%s\n", result.sError.c_str());
+		return -1;
+	}
+
+	dBestFPS = (result.ui64Hash == ui64RefHash) ? result.dFPS : 0.0;
+	sOutBuf = utils.StrFormat("%-32s %8s %12s   %s\n", "(defaults)", "-", utils.StrFormatFPS(result.dFPS).c_str(), (result.ui64Hash == ui64RefHash) ? "identical" : "DIFFERENT");
+	sLogBuffer += sOutBuf;
+	PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+
+	//coordinate descent: one filter at a time, the others keep their best mode so far
+	BOOL bChanged = TRUE;
+	for (int iRound = 0; (iRound < 2) && bChanged; iRound++)
+	{
+		bChanged = FALSE;
+
+		for (size_t f = 0; f < vFilters.size(); f++)
 		{
-			if ((timer.GetSTDTimerMS() - D0) >= 100)
+			for (int iMode = MT_NICE_FILTER; iMode <= MT_SERIALIZED; iMode++)
 			{
-				PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\rPre-scanning script (F%u / T%.2lf)\r", uiFrame, TDelta);
-				D0 = timer.GetSTDTimerMS();
+				if (iMode == vModes[f])
+					continue;
 
-				if (_kbhit())
+				variant.sPrefix = "";
+				for (size_t i = 0; i < vFilters.size(); i++)
 				{
-					if (_getch() == 0x1B) //ESC
-						AVS_env->ThrowError("\'ESC\' pressed, cancelled.");
+					int iTrialMode = (i == f) ? iMode : vModes[i];
+					if (iTrialMode > 0)
+						variant.sPrefix += utils.StrFormat("SetFilterMTMode(\"%s\", %d, true)\n", vFilters[i].c_str(), iTrialMode);
+				}
+
+				if (!RunBenchmarkPass(s_avsfile, sScript, variant, 0.0, result))
+				{
+					sOutBuf = utils.StrFormat("%-32s %8d %12s   %s\n", vFilters[f].c_str(), iMode, "-", "failed");
+					sLogBuffer += sOutBuf;
+					PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+					if (result.sError == "\'ESC\' pressed, cancelled.")
+					{
+						sAVSError = result.sError;
+						break;
+					}
+					continue;
+				}
+
+				BOOL bIdentical = (result.ui64Hash == ui64RefHash) ? TRUE : FALSE;
+				sOutBuf = utils.StrFormat("%-32s %8d %12s   %s\n", vFilters[f].c_str(), iMode, utils.StrFormatFPS(result.dFPS).c_str(), bIdentical ? "identical" : "DIFFERENT");
+				sLogBuffer += sOutBuf;
+				PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+
+				if (bIdentical && (result.dFPS > (dBestFPS * TUNE_MIN_GAIN)))
+				{
+					dBestFPS = result.dFPS;
+					vModes[f] = iMode;
+					bChanged = TRUE;
 				}
 			}
 
-			PVideoFrame src_frame = AVS_clip->GetFrame(uiFrame, AVS_env);
-			++uiFrame;
-			TDelta = timer.GetSTDTimer() - T0;
+			if (sAVSError != "")
+				break;
 		}
 
-		double dAverageFrameTime = 0.0;
-		if (TDelta >= ((double)MIN_RUNTIME / 1000.0))
-			dAverageFrameTime = (1000.0 * TDelta) / (double)uiFrame; //convert to milliseconds
+		if (sAVSError != "")
+			break;
+	}
 
+	string sModeBlock = "";
+	for (size_t i = 0; i < vFilters.size(); i++)
+	{
+		if (vModes[i] > 0)
+			sModeBlock += utils.StrFormat("SetFilterMTMode(\"%s\", %d, true)\n", vFilters[i].c_str(), vModes[i]);
+	}
 
-		uiFrameInterval = 1000;
-		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /  500.0)) uiFrameInterval =  500;
-		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /  200.0)) uiFrameInterval =  200;
-		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /  100.0)) uiFrameInterval =  100;
-		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /   50.0)) uiFrameInterval =   50;
-		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /   20.0)) uiFrameInterval =   20;
-		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL /   10.0)) uiFrameInterval =   10;
-		if (dAverageFrameTime > (MIN_TIME_PER_FRAMEINTERVAL))          uiFrameInterval =    1;
+	if (sModeBlock == "")
+		sOutBuf = "\nNo mode change improves throughput with identical output\n";
+	else
+		sOutBuf = utils.StrFormat("\nBest FPS:                   %s\n\n%s", utils.StrFormatFPS(dBestFPS).c_str(), sModeBlock.c_str());
+	sLogBuffer += sOutBuf;
+	PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
 
-		AVS_clip = 0;
-		AVS_main = 0;
-		AVS_temp = 0;
-		Sleep(DSE_DELAY);
-		AVS_env->DeleteScriptEnvironment();
-		AVS_env = 0;
-		AVS_linkage = 0;
+	if (sModeBlock != "")
+	{
+		string sAVSIFile = GetOutputFileName(s_avsfile, "_mtmodes.avsi");
+		ofstream hAVSIFile(sAVSIFile.c_str());
+		if (hAVSIFile.is_open())
+		{
+			hAVSIFile << sModeBlock;
+			hAVSIFile.flush();
+			hAVSIFile.close();
+			PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\nMode block written to \"%s\"\n", sAVSIFile.c_str());
+		}
+	}
 
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
+	if (Settings.bCreateLog)
+	{
+		string sLogRet = CreateLogFile(s_avsfile, sLogBuffer, sGPUInfo, perfdata, sAVSError, FALSE, TRUE);
+		if (sLogRet != "")
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, sLogRet.c_str());
+			return -1;
+		}
 	}
-	catch (AvisynthError err)
+
+	return (sAVSError == "") ? 0 : -1;
+}
+
+
+void InitScriptVariant(stScriptVariant &variant)
+{
+	variant.iThreads = 0;
+	variant.sPrefix = "";
+	variant.uiMaxFrames = 0;
+	variant.bHashFrames = FALSE;
+	variant.iMemoryMax = 0;
+	variant.iCacheCapacity = 0;
+
+	return;
+}
+
+
+BOOL ParseValueList(string s_list, vector<int> &v_values)
+{
+	//"a,b,c" or "first..last" (doubling)
+	v_values.clear();
+	string sValue = "";
+
+	size_t spos = s_list.find("..");
+	if (spos != string::npos)
 	{
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
-		s_error = utils.StrFormat("%s", (PCSTR)err.msg);
-		uiFrameInterval = 10;
+		string sFirst = s_list.substr(0, spos);
+		string sLast = s_list.substr(spos + 2);
+		if (!utils.IsNumeric(sFirst) || !utils.IsNumeric(sLast))
+			return FALSE;
+
+		int iFirst = atoi(sFirst.c_str());
+		int iLast = atoi(sLast.c_str());
+		if ((iFirst < 1) || (iLast < iFirst) || (iLast > 1048576))
+			return FALSE;
+
+		for (int i = iFirst; i < iLast; i *= 2)
+			v_values.push_back(i);
+		v_values.push_back(iLast);
+
+		return TRUE;
 	}
-	catch (exception& ex)
+
+	s_list += ",";
+	for (size_t n = 0; n < s_list.length(); n++)
 	{
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
-		s_error = ex.what();
-		uiFrameInterval = 10;
+		if (s_list[n] != ',')
+		{
+			sValue += s_list[n];
+			continue;
+		}
+
+		if (!utils.IsNumeric(sValue) || (atoi(sValue.c_str()) < 1) || (atoi(sValue.c_str()) > 1048576))
+			return FALSE;
+
+		v_values.push_back(atoi(sValue.c_str()));
+		sValue = "";
 	}
-	catch (...)
+
+	return (v_values.size() > 0) ? TRUE : FALSE;
+}
+
+
+int RunMemorySweep(string &s_avsfile, vector<int> &v_memorymax, vector<int> &v_cachecapacity, string &s_avsmversion)
+{
+	string sScript = "";
+	string sOutBuf = "";
+	string sAVSError = "";
+	string sGPUInfo = "";
+	vector<stPerfData> perfdata;
+
+	if (!ReadTextFile(s_avsfile, sScript))
 	{
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
-		s_error = utils.SysErrorMessage();
-		uiFrameInterval = 10;
+		PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\nCannot open \"%s\"\n", s_avsfile.c_str());
+		return -1;
 	}
 
-	if (!::FreeLibrary(hDLL))
+	vector<int> vCache = v_cachecapacity;
+	if (vCache.size() == 0)
+		vCache.push_back(0);
+
+	double dPassTime = (Settings.iTimeLimit != -1) ? (double)Settings.iTimeLimit : SWEEP_PASS_TIME;
+
+	string sLogBuffer = CreateSweepLogHeader(s_avsfile, s_avsmversion);
+	sLogBuffer += "\n\n[Memory sweep]\n";
+	sOutBuf = utils.StrFormat("Passes: %u, %.0f seconds per pass\n\n", (unsigned int)(v_memorymax.size() * vCache.size()), dPassTime);
+	sOutBuf += "SetMemoryMax(MiB)   Cache(frames)          FPS   Peak memory(MiB)    CPU(%)\n";
+	sLogBuffer += sOutBuf;
+	PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "\n%s", sOutBuf.c_str());
+
+	vector<int> vMem;
+	vector<int> vCap;
+	vector<double> vFPS;
+	vector<DWORD> vPeak;
+
+	for (size_t m = 0; (m < v_memorymax.size()) && (sAVSError == ""); m++)
 	{
-		PrintConsole(Settings.bConUseStdOut, COLOR_DEFAULT, "\r%s\r", Pad("").c_str());
-		s_error = "Cannot unload avisynth.dll";
-		uiFrameInterval = 10;
+		for (size_t c = 0; c < vCache.size(); c++)
+		{
+			stScriptVariant variant;
+			InitScriptVariant(variant);
+			variant.iMemoryMax = v_memorymax[m];
+			variant.iCacheCapacity = vCache[c];
+
+			stPassResult result;
+			if (!RunBenchmarkPass(s_avsfile, sScript, variant, dPassTime, result))
+			{
+				sAVSError = result.sError;
+				PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, "\n%s\n", sAVSError.c_str());
+				break;
+			}
+
+			string sMem = (v_memorymax[m] > 0) ? utils.StrFormat("%d", v_memorymax[m]) : "-";
+			string sCap = (vCache[c] > 0) ? utils.StrFormat("%d", vCache[c]) : "-";
+			sOutBuf = utils.StrFormat("%17s %15s %12s %18u %9.1f\n", sMem.c_str(), sCap.c_str(), utils.StrFormatFPS(result.dFPS).c_str(), result.dwMemPeakMB, result.dCPUUsage);
+			sLogBuffer += sOutBuf;
+			PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+
+			vMem.push_back(v_memorymax[m]);
+			vCap.push_back(vCache[c]);
+			vFPS.push_back(result.dFPS);
+			vPeak.push_back(result.dwMemPeakMB);
+		}
 	}
 
-	return uiFrameInterval;
+	if (vFPS.size() > 0)
+	{
+		//Pareto frontier: no other pass is at least as fast with less peak memory
+		double dMaxFPS = 0.0;
+		for (size_t i = 0; i < vFPS.size(); i++)
+		{
+			if (vFPS[i] > dMaxFPS)
+				dMaxFPS = vFPS[i];
+		}
+
+		vector<size_t> vFrontier;
+		for (size_t i = 0; i < vFPS.size(); i++)
+		{
+			BOOL bDominated = FALSE;
+			for (size_t j = 0; (j < vFPS.size()) && !bDominated; j++)
+			{
+				if ((j != i) && (vPeak[j] <= vPeak[i]) && (vFPS[j] >= vFPS[i]) && ((vPeak[j] < vPeak[i]) || (vFPS[j] > vFPS[i])))
+					bDominated = TRUE;
+			}
+
+			if (!bDominated)
+				vFrontier.push_back(i);
+		}
+
+		for (size_t n = 1; n < vFrontier.size(); n++)
+		{
+			for (size_t k = n; (k > 0) && (vPeak[vFrontier[k]] < vPeak[vFrontier[k - 1]]); k--)
+				std::swap(vFrontier[k], vFrontier[k - 1]);
+		}
+
+		sOutBuf = "\nPareto frontier (peak memory vs. FPS):\n";
+		sOutBuf += "SetMemoryMax(MiB)   Cache(frames)          FPS   Peak memory(MiB)   FPS(% of best)\n";
+		size_t iRecommended = vFrontier[vFrontier.size() - 1];
+		BOOL bFound = FALSE;
+		for (size_t n = 0; n < vFrontier.size(); n++)
+		{
+			size_t i = vFrontier[n];
+			string sMem = (vMem[i] > 0) ? utils.StrFormat("%d", vMem[i]) : "-";
+			string sCap = (vCap[i] > 0) ? utils.StrFormat("%d", vCap[i]) : "-";
+			double dRelative = (dMaxFPS > 0.0) ? (100.0 * vFPS[i] / dMaxFPS) : 0.0;
+			sOutBuf += utils.StrFormat("%17s %15s %12s %18u %16.1f\n", sMem.c_str(), sCap.c_str(), utils.StrFormatFPS(vFPS[i]).c_str(), vPeak[i], dRelative);
+
+			if (!bFound && (vFPS[i] >= (SWEEP_KNEE_FRACTION * dMaxFPS)))
+			{
+				iRecommended = i;
+				bFound = TRUE;
+			}
+		}
+
+		sOutBuf += utils.StrFormat("\nRecommended:                SetMemoryMax(%s)", (vMem[iRecommended] > 0) ? utils.StrFormat("%d", vMem[iRecommended]).c_str() : "default");
+		if (vCap[iRecommended] > 0)
+			sOutBuf += utils.StrFormat(", cache capacity %d frames", vCap[iRecommended]);
+		sOutBuf += utils.StrFormat(", %u MiB peak, %.1f%% of the best throughput\n", vPeak[iRecommended], (dMaxFPS > 0.0) ? (100.0 * vFPS[iRecommended] / dMaxFPS) : 0.0);
+
+		sLogBuffer += sOutBuf;
+		PrintConsole(Settings.bConUseStdOut, COLOR_EMPHASIS, "%s", sOutBuf.c_str());
+	}
+
+	if (Settings.bCreateLog)
+	{
+		string sLogRet = CreateLogFile(s_avsfile, sLogBuffer, sGPUInfo, perfdata, sAVSError, FALSE, TRUE);
+		if (sLogRet != "")
+		{
+			PrintConsole(Settings.bConUseStdOut, COLOR_ERROR, sLogRet.c_str());
+			return -1;
+		}
+	}
+
+	return (sAVSError == "") ? 0 : -1;
 }
 
 
@@ -2363,6 +6018,26 @@ void PrintUsage()
 	PrintConsole(TRUE, COLOR_EMPHASIS, "  -timelimit=n        Sets time limit (seconds)\n");
 	PrintConsole(TRUE, COLOR_EMPHASIS, "  -hp                 Sets process priority to high\n");
 	PrintConsole(TRUE, COLOR_EMPHASIS, "  -o                  Omits script pre-scanning\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -trace              Traces frame requests of the output and AVSMeterTrace() nodes\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -graph              Dumps the filter graph with cache/MT hints (log and .dot file)\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -profile            Samples running threads, reports CPU time per module and function\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -allocs             Counts heap allocations of Avisynth and plugins per thread and frame\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -hardfaults         Separates hard page faults (reads the system process list every 2 s)\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -leak=n             Fails if memory grows by more than n KiB per frame (e.g. 0.5)\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -metrics            Streams all frame records to a binary metrics file (.amb)\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -convert=file.amb   Creates log and csv files from a metrics file\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -sketch             Saves frame time, CPU and memory percentile sketches (.ddsk)\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -merge=a,b,...      Merges sketch files of several runs and reports the percentiles\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -json               Writes the results as JSON, streams progress records (.ndjson)\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -baseline=file.json Compares against an earlier -json run, fails on a regression\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -threshold=n        Regression threshold for -baseline (percent, default 5)\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -instances          Shows the live stats of all running AVSMeter instances\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -listen=port        Serves live metrics for Prometheus at http://127.0.0.1:port/metrics\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -history=file.avs   Shows the stored runs of the script on this machine and the FPS trend\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -sweep-threads=n    Benchmarks Prefetch(1..n) or (first..last), recommends thread count\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -mttune[=n]         Finds the fastest MT mode per filter with identical output\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -sweep-memory=a,b   Benchmarks SetMemoryMax values (MiB), reports FPS vs. peak memory\n");
+	PrintConsole(TRUE, COLOR_EMPHASIS, "  -sweep-cache=a,b    Adds output cache capacities (frames) to the memory sweep\n");
 	PrintConsole(TRUE, COLOR_EMPHASIS, "  -lf                 Adds internal/external functions to the avsinfo*.log file\n");
 	PrintConsole(TRUE, COLOR_EMPHASIS, "  -p                  Pauses the program at the end and returns after pressing a key.\n\n\n");
 
@@ -0,0 +1,564 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_ALLOCTRACKER_H)
+#define _ALLOCTRACKER_H
+
+#include "common.h"
+#include <intrin.h>
+
+#pragma intrinsic(_ReturnAddress)
+
+/*
+Counts heap allocations by redirecting the HeapAlloc/HeapReAlloc/HeapFree imports of the
+plugins, avisynth.dll and the shared CRT modules to the hooks below. Every malloc/new in
+these modules ends up there. AVSMeter shares the CRT with the plugins, calls whose first
+caller outside the CRT lies in AVSMeter's own image are not counted. The hooks only use
+interlocked operations on static data, they must never allocate themselves. Frees are only
+counted: HeapSize() would take the heap lock on every free and cannot tell blocks allocated
+before Install(), so the net growth is taken from the heap summaries instead.
+*/
+
+#define ALLOCTRACKER_LARGE_BYTES    (1024 * 1024)
+#define ALLOCTRACKER_THREAD_SLOTS   256
+#define ALLOCTRACKER_SITE_SLOTS     1024
+#define ALLOCTRACKER_CRT_MODULES    16
+#define ALLOCTRACKER_STACK_DEPTH    12
+
+struct stAllocThreadSlot
+{
+	volatile LONG     lTID;
+	volatile LONGLONG llAllocs;
+	volatile LONGLONG llFrees;
+	volatile LONGLONG llBytes;
+};
+
+struct stAllocSite
+{
+	PVOID volatile    pAddress;        //first caller outside the CRT
+	volatile LONGLONG llAllocs;
+	volatile LONGLONG llBytes;
+};
+
+struct stAllocCounters
+{
+	volatile LONG     lEnabled;
+	volatile LONGLONG llAllocs;
+	volatile LONGLONG llFrees;
+	volatile LONGLONG llReallocs;
+	volatile LONGLONG llAllocBytes;
+	volatile LONGLONG llLargeAllocs;
+	volatile LONG     lThreadOverflow;
+	volatile LONG     lSiteOverflow;
+	DWORD_PTR         dwpOwnBase;
+	DWORD_PTR         dwpOwnEnd;
+	DWORD_PTR         dwpCRTBase[ALLOCTRACKER_CRT_MODULES];
+	DWORD_PTR         dwpCRTEnd[ALLOCTRACKER_CRT_MODULES];
+	int               iCRTModules;
+	stAllocThreadSlot threads[ALLOCTRACKER_THREAD_SLOTS];
+	stAllocSite       sites[ALLOCTRACKER_SITE_SLOTS];
+};
+
+static stAllocCounters alloccounters;
+
+
+stAllocThreadSlot *AllocThreadSlot()
+{
+	LONG lTID = (LONG)::GetCurrentThreadId();
+	for (int i = 0; i < ALLOCTRACKER_THREAD_SLOTS; i++)
+	{
+		stAllocThreadSlot *pSlot = &alloccounters.threads[((DWORD)lTID / 4 + i) % ALLOCTRACKER_THREAD_SLOTS];
+		if (pSlot->lTID == lTID)
+			return pSlot;
+		if ((pSlot->lTID == 0) && (::InterlockedCompareExchange(&pSlot->lTID, lTID, 0) == 0))
+			return pSlot;
+	}
+
+	::InterlockedIncrement(&alloccounters.lThreadOverflow);
+
+	return NULL;
+}
+
+
+BOOL AllocIsCRTAddress(PVOID p_address)
+{
+	for (int i = 0; i < alloccounters.iCRTModules; i++)
+	{
+		if (((DWORD_PTR)p_address >= alloccounters.dwpCRTBase[i]) && ((DWORD_PTR)p_address < alloccounters.dwpCRTEnd[i]))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+BOOL AllocIsOwnCall(PVOID p_return)
+{
+	//p_return is the caller of the hook, a CRT caller is followed up the stack to its own caller
+	if (!AllocIsCRTAddress(p_return))
+		return (((DWORD_PTR)p_return >= alloccounters.dwpOwnBase) && ((DWORD_PTR)p_return < alloccounters.dwpOwnEnd));
+
+	PVOID pFrames[ALLOCTRACKER_STACK_DEPTH];
+	USHORT nFrames = ::RtlCaptureStackBackTrace(1, ALLOCTRACKER_STACK_DEPTH, pFrames, NULL);
+	BOOL bAbove = FALSE;
+	for (USHORT n = 0; n < nFrames; n++)
+	{
+		//the frames of the hook itself lie in AVSMeter's image, the scan starts at its caller
+		if (!bAbove)
+		{
+			bAbove = (pFrames[n] == p_return);
+			continue;
+		}
+
+		if (!AllocIsCRTAddress(pFrames[n]))
+			return (((DWORD_PTR)pFrames[n] >= alloccounters.dwpOwnBase) && ((DWORD_PTR)pFrames[n] < alloccounters.dwpOwnEnd));
+	}
+
+	return FALSE;
+}
+
+
+void AllocRecordLargeSite(SIZE_T n_bytes)
+{
+	//attribute to the first return address that is not inside a CRT module or the hooks (AVSMeter's calls are filtered before)
+	PVOID pFrames[ALLOCTRACKER_STACK_DEPTH];
+	USHORT nFrames = ::RtlCaptureStackBackTrace(2, ALLOCTRACKER_STACK_DEPTH, pFrames, NULL);
+	PVOID pCaller = NULL;
+	for (USHORT n = 0; (n < nFrames) && !pCaller; n++)
+	{
+		BOOL bOwn = (((DWORD_PTR)pFrames[n] >= alloccounters.dwpOwnBase) && ((DWORD_PTR)pFrames[n] < alloccounters.dwpOwnEnd));
+		if (!bOwn && !AllocIsCRTAddress(pFrames[n]))
+			pCaller = pFrames[n];
+	}
+
+	if (!pCaller)
+		return;
+
+	for (int i = 0; i < ALLOCTRACKER_SITE_SLOTS; i++)
+	{
+		stAllocSite *pSite = &alloccounters.sites[((DWORD_PTR)pCaller / 16 + i) % ALLOCTRACKER_SITE_SLOTS];
+		PVOID pAddress = pSite->pAddress;
+		if (!pAddress)
+			pAddress = ::InterlockedCompareExchangePointer(&pSite->pAddress, pCaller, NULL);
+
+		if (!pAddress || (pAddress == pCaller))
+		{
+			::InterlockedIncrement64(&pSite->llAllocs);
+			::InterlockedExchangeAdd64(&pSite->llBytes, (LONGLONG)n_bytes);
+			return;
+		}
+	}
+
+	::InterlockedIncrement(&alloccounters.lSiteOverflow);
+
+	return;
+}
+
+
+void AllocRecord(SIZE_T n_bytes)
+{
+	::InterlockedIncrement64(&alloccounters.llAllocs);
+	::InterlockedExchangeAdd64(&alloccounters.llAllocBytes, (LONGLONG)n_bytes);
+
+	stAllocThreadSlot *pSlot = AllocThreadSlot();
+	if (pSlot)
+	{
+		::InterlockedIncrement64(&pSlot->llAllocs);
+		::InterlockedExchangeAdd64(&pSlot->llBytes, (LONGLONG)n_bytes);
+	}
+
+	if (n_bytes >= ALLOCTRACKER_LARGE_BYTES)
+	{
+		::InterlockedIncrement64(&alloccounters.llLargeAllocs);
+		AllocRecordLargeSite(n_bytes);
+	}
+
+	return;
+}
+
+
+void AllocRecordFree()
+{
+	::InterlockedIncrement64(&alloccounters.llFrees);
+
+	stAllocThreadSlot *pSlot = AllocThreadSlot();
+	if (pSlot)
+		::InterlockedIncrement64(&pSlot->llFrees);
+
+	return;
+}
+
+
+LPVOID WINAPI AllocHookHeapAlloc(HANDLE h_heap, DWORD dw_flags, SIZE_T n_bytes)
+{
+	LPVOID p = ::HeapAlloc(h_heap, dw_flags, n_bytes);
+	if (p && alloccounters.lEnabled && !AllocIsOwnCall(_ReturnAddress()))
+		AllocRecord(n_bytes);
+
+	return p;
+}
+
+
+LPVOID WINAPI AllocHookHeapReAlloc(HANDLE h_heap, DWORD dw_flags, LPVOID p_mem, SIZE_T n_bytes)
+{
+	LPVOID p = ::HeapReAlloc(h_heap, dw_flags, p_mem, n_bytes);
+	if (p && alloccounters.lEnabled && !AllocIsOwnCall(_ReturnAddress()))
+	{
+		::InterlockedIncrement64(&alloccounters.llReallocs);
+		if (p_mem)
+			AllocRecordFree();
+		AllocRecord(n_bytes);
+	}
+
+	return p;
+}
+
+
+BOOL WINAPI AllocHookHeapFree(HANDLE h_heap, DWORD dw_flags, LPVOID p_mem)
+{
+	if (p_mem && alloccounters.lEnabled && !AllocIsOwnCall(_ReturnAddress()))
+		AllocRecordFree();
+
+	return ::HeapFree(h_heap, dw_flags, p_mem);
+}
+
+
+typedef BOOL (WINAPI *HEAP_SUMMARY)(HANDLE, DWORD, PVOID);
+
+struct stHeapSummary
+{
+	DWORD  cb;
+	SIZE_T cbAllocated;
+	SIZE_T cbCommitted;
+	SIZE_T cbReserved;
+	SIZE_T cbMaxReserve;
+};
+
+
+struct stAllocPatch
+{
+	PVOID *ppSlot;
+	PVOID pOriginal;
+};
+
+
+class CAllocTracker
+{
+public:
+	CAllocTracker();
+	virtual ~CAllocTracker();
+
+	BOOL   Install();
+	void   Uninstall();
+	string Report(unsigned int ui_frames);
+
+	BOOL   bEnabled;
+	unsigned int uiModules;
+
+private:
+	void   PatchModule(HMODULE h_module);
+	BOOL   IsCRTModule(string &s_name);
+	BOOL   GetHeapSummary(unsigned __int64 &ui64_allocated, unsigned __int64 &ui64_committed);
+
+	vector<stAllocPatch> vPatches;
+	unsigned __int64 ui64HeapAllocatedStart;
+	unsigned __int64 ui64HeapCommittedStart;
+};
+
+
+CAllocTracker::CAllocTracker()
+{
+	bEnabled = FALSE;
+	uiModules = 0;
+	ui64HeapAllocatedStart = 0;
+	ui64HeapCommittedStart = 0;
+}
+
+CAllocTracker::~CAllocTracker()
+{
+	Uninstall();
+}
+
+
+BOOL CAllocTracker::IsCRTModule(string &s_name)
+{
+	return ((s_name.substr(0, 8) == "ucrtbase") || (s_name.substr(0, 5) == "msvcr") || (s_name.substr(0, 5) == "msvcp") || (s_name.substr(0, 9) == "vcruntime") || (s_name.substr(0, 14) == "api-ms-win-crt"));
+}
+
+
+BOOL CAllocTracker::Install()
+{
+	if (vPatches.size() > 0)
+		return FALSE;
+
+	GetHeapSummary(ui64HeapAllocatedStart, ui64HeapCommittedStart);
+
+	char szWindowsDir[MAX_PATH + 1];
+	string sWindowsDir = "";
+	if (::GetWindowsDirectory(szWindowsDir, MAX_PATH))
+	{
+		sWindowsDir = szWindowsDir;
+		transform(sWindowsDir.begin(), sWindowsDir.end(), sWindowsDir.begin(), ::tolower);
+		sWindowsDir += "\\";
+	}
+
+	HMODULE hModules[2048];
+	DWORD dwSizeNeeded = 0;
+	if (!::EnumProcessModules(::GetCurrentProcess(), hModules, sizeof(hModules), &dwSizeNeeded))
+		return FALSE;
+
+	alloccounters.iCRTModules = 0;
+	alloccounters.dwpOwnBase = 0;
+	alloccounters.dwpOwnEnd = 0;
+	MODULEINFO miOwn;
+	if (::GetModuleInformation(::GetCurrentProcess(), ::GetModuleHandle(NULL), &miOwn, sizeof(miOwn)))
+	{
+		alloccounters.dwpOwnBase = (DWORD_PTR)miOwn.lpBaseOfDll;
+		alloccounters.dwpOwnEnd = (DWORD_PTR)miOwn.lpBaseOfDll + miOwn.SizeOfImage;
+	}
+
+	char szModule[MAX_PATH_LEN + 1];
+	for (unsigned int i = 0; (i < (dwSizeNeeded / sizeof(HMODULE))) && (i < 2048); i++)
+	{
+		//AVSMeter's own imports are not patched, its calls through the shared CRT are filtered in the hooks
+		if (hModules[i] == ::GetModuleHandle(NULL))
+			continue;
+
+		if (!::GetModuleFileName(hModules[i], szModule, MAX_PATH_LEN))
+			continue;
+
+		string sPath = szModule;
+		transform(sPath.begin(), sPath.end(), sPath.begin(), ::tolower);
+		string sName = sPath.substr(sPath.find_last_of('\\') + 1);
+		BOOL bCRT = IsCRTModule(sName);
+
+		if (bCRT && (alloccounters.iCRTModules < ALLOCTRACKER_CRT_MODULES))
+		{
+			MODULEINFO mi;
+			if (::GetModuleInformation(::GetCurrentProcess(), hModules[i], &mi, sizeof(mi)))
+			{
+				alloccounters.dwpCRTBase[alloccounters.iCRTModules] = (DWORD_PTR)mi.lpBaseOfDll;
+				alloccounters.dwpCRTEnd[alloccounters.iCRTModules] = (DWORD_PTR)mi.lpBaseOfDll + mi.SizeOfImage;
+				alloccounters.iCRTModules++;
+			}
+		}
+
+		//system modules other than the CRT are left alone
+		if (!bCRT && (sWindowsDir != "") && (sPath.substr(0, sWindowsDir.length()) == sWindowsDir))
+			continue;
+
+		PatchModule(hModules[i]);
+	}
+
+	::InterlockedExchange(&alloccounters.lEnabled, 1);
+
+	return (vPatches.size() > 0);
+}
+
+
+void CAllocTracker::PatchModule(HMODULE h_module)
+{
+	ULONG ulSize = 0;
+	PIMAGE_IMPORT_DESCRIPTOR pImport = (PIMAGE_IMPORT_DESCRIPTOR)::ImageDirectoryEntryToData(h_module, TRUE, IMAGE_DIRECTORY_ENTRY_IMPORT, &ulSize);
+	if (!pImport)
+		return;
+
+	BOOL bPatched = FALSE;
+	BYTE *pBase = (BYTE *)h_module;
+	for (; pImport->Name; pImport++)
+	{
+		if (!pImport->OriginalFirstThunk || !pImport->FirstThunk)
+			continue;
+
+		PIMAGE_THUNK_DATA pNames = (PIMAGE_THUNK_DATA)(pBase + pImport->OriginalFirstThunk);
+		PIMAGE_THUNK_DATA pIAT = (PIMAGE_THUNK_DATA)(pBase + pImport->FirstThunk);
+		for (; pNames->u1.AddressOfData; pNames++, pIAT++)
+		{
+			if (IMAGE_SNAP_BY_ORDINAL(pNames->u1.Ordinal))
+				continue;
+
+			const char *pszName = (const char *)((PIMAGE_IMPORT_BY_NAME)(pBase + pNames->u1.AddressOfData))->Name;
+			PVOID pHook = NULL;
+			if (!strcmp(pszName, "HeapAlloc") || !strcmp(pszName, "RtlAllocateHeap"))
+				pHook = (PVOID)AllocHookHeapAlloc;
+			else if (!strcmp(pszName, "HeapReAlloc") || !strcmp(pszName, "RtlReAllocateHeap"))
+				pHook = (PVOID)AllocHookHeapReAlloc;
+			else if (!strcmp(pszName, "HeapFree") || !strcmp(pszName, "RtlFreeHeap"))
+				pHook = (PVOID)AllocHookHeapFree;
+
+			if (!pHook)
+				continue;
+
+			PVOID *ppSlot = (PVOID *)&pIAT->u1.Function;
+			DWORD dwOldProtect = 0;
+			if (!::VirtualProtect(ppSlot, sizeof(PVOID), PAGE_READWRITE, &dwOldProtect))
+				continue;
+
+			stAllocPatch patch;
+			patch.ppSlot = ppSlot;
+			patch.pOriginal = ::InterlockedExchangePointer(ppSlot, pHook);
+			vPatches.push_back(patch);
+			::VirtualProtect(ppSlot, sizeof(PVOID), dwOldProtect, &dwOldProtect);
+			bPatched = TRUE;
+		}
+	}
+
+	if (bPatched)
+		++uiModules;
+
+	return;
+}
+
+
+void CAllocTracker::Uninstall()
+{
+	::InterlockedExchange(&alloccounters.lEnabled, 0);
+
+	for (size_t i = 0; i < vPatches.size(); i++)
+	{
+		DWORD dwOldProtect = 0;
+		if (!::VirtualProtect(vPatches[i].ppSlot, sizeof(PVOID), PAGE_READWRITE, &dwOldProtect))
+			continue;
+
+		::InterlockedExchangePointer(vPatches[i].ppSlot, vPatches[i].pOriginal);
+		::VirtualProtect(vPatches[i].ppSlot, sizeof(PVOID), dwOldProtect, &dwOldProtect);
+	}
+
+	vPatches.clear();
+
+	return;
+}
+
+
+BOOL CAllocTracker::GetHeapSummary(unsigned __int64 &ui64_allocated, unsigned __int64 &ui64_committed)
+{
+	ui64_allocated = 0;
+	ui64_committed = 0;
+
+	//HeapSummary() is available since Windows 7
+	HEAP_SUMMARY pHeapSummary = (HEAP_SUMMARY)::GetProcAddress(::GetModuleHandle("kernel32.dll"), "HeapSummary");
+	if (!pHeapSummary)
+		return FALSE;
+
+	HANDLE hHeaps[256];
+	DWORD dwHeaps = ::GetProcessHeaps(256, hHeaps);
+	if ((dwHeaps == 0) || (dwHeaps > 256))
+		return FALSE;
+
+	for (DWORD i = 0; i < dwHeaps; i++)
+	{
+		stHeapSummary hs;
+		::ZeroMemory(&hs, sizeof(hs));
+		hs.cb = sizeof(hs);
+		if (pHeapSummary(hHeaps[i], 0, &hs))
+		{
+			ui64_allocated += hs.cbAllocated;
+			ui64_committed += hs.cbCommitted;
+		}
+	}
+
+	return TRUE;
+}
+
+
+string CAllocTracker::Report(unsigned int ui_frames)
+{
+	string sOut = "";
+	char buffer[MAX_PATH_LEN + 256];
+
+	double dFrames = (ui_frames > 0) ? (double)ui_frames : 1.0;
+	LONGLONG llAllocs = alloccounters.llAllocs;
+	LONGLONG llFrees = alloccounters.llFrees;
+	LONGLONG llAllocBytes = alloccounters.llAllocBytes;
+
+	sOut += "\n\n[Heap allocations]\n";
+	sprintf(buffer, "Hooked modules:                     %u\n", uiModules);
+	sOut += buffer;
+	sprintf(buffer, "Allocations (total | per frame):    %I64d | %.1f\n", llAllocs, (double)llAllocs / dFrames);
+	sOut += buffer;
+	sprintf(buffer, "Frees (total | per frame):          %I64d | %.1f\n", llFrees, (double)llFrees / dFrames);
+	sOut += buffer;
+	sprintf(buffer, "Reallocations:                      %I64d\n", (LONGLONG)alloccounters.llReallocs);
+	sOut += buffer;
+	sprintf(buffer, "Allocated (total | per frame):      %.1f MiB | %.1f KiB\n", (double)llAllocBytes / 1048576.0, (double)llAllocBytes / dFrames / 1024.0);
+	sOut += buffer;
+	sprintf(buffer, "Large allocations (>= %u KiB):      %I64d | %.2f per frame\n", ALLOCTRACKER_LARGE_BYTES / 1024, (LONGLONG)alloccounters.llLargeAllocs, (double)alloccounters.llLargeAllocs / dFrames);
+	sOut += buffer;
+
+	//fragmentation: heap memory committed but not handed out
+	unsigned __int64 ui64Allocated = 0;
+	unsigned __int64 ui64Committed = 0;
+	if (GetHeapSummary(ui64Allocated, ui64Committed) && (ui64Committed > 0))
+	{
+		sprintf(buffer, "Heaps (allocated | committed):      %.1f | %.1f MiB (start: %.1f | %.1f MiB)\n", (double)ui64Allocated / 1048576.0, (double)ui64Committed / 1048576.0,
+			(double)ui64HeapAllocatedStart / 1048576.0, (double)ui64HeapCommittedStart / 1048576.0);
+		sOut += buffer;
+		sprintf(buffer, "Net growth (all heaps):             %.1f MiB\n", ((double)ui64Allocated - (double)ui64HeapAllocatedStart) / 1048576.0);
+		sOut += buffer;
+		sprintf(buffer, "Heap fragmentation (unused commit): %.1f%%\n", 100.0 * (1.0 - (double)ui64Allocated / (double)ui64Committed));
+		sOut += buffer;
+	}
+
+	if (alloccounters.lThreadOverflow || alloccounters.lSiteOverflow)
+	{
+		sprintf(buffer, "Untracked (thread | site slots):    %d | %d\n", alloccounters.lThreadOverflow, alloccounters.lSiteOverflow);
+		sOut += buffer;
+	}
+
+	sOut += "\n  Thread ID   Allocations   Allocs/frame   Frees        Allocated (MiB)\n";
+	for (int i = 0; i < ALLOCTRACKER_THREAD_SLOTS; i++)
+	{
+		stAllocThreadSlot &slot = alloccounters.threads[i];
+		if ((slot.lTID == 0) || (slot.llAllocs == 0))
+			continue;
+
+		sprintf(buffer, "%11u %13I64d %14.1f %7I64d %22.1f\n", (DWORD)slot.lTID, (LONGLONG)slot.llAllocs, (double)slot.llAllocs / dFrames, (LONGLONG)slot.llFrees, (double)slot.llBytes / 1048576.0);
+		sOut += buffer;
+	}
+
+	//large allocations grouped by the module that requested them
+	map<string, std::pair<LONGLONG, LONGLONG> > mModules;
+	for (int i = 0; i < ALLOCTRACKER_SITE_SLOTS; i++)
+	{
+		stAllocSite &site = alloccounters.sites[i];
+		if (!site.pAddress)
+			continue;
+
+		string sModule = GetExceptionModule(site.pAddress);
+		if (sModule == "")
+			sModule = "(unknown)";
+
+		mModules[sModule].first += site.llAllocs;
+		mModules[sModule].second += site.llBytes;
+	}
+
+	if (mModules.size() > 0)
+	{
+		sOut += "\nLarge allocations   Per frame   Allocated (MiB)   Module\n";
+		for (map<string, std::pair<LONGLONG, LONGLONG> >::iterator it = mModules.begin(); it != mModules.end(); ++it)
+		{
+			sprintf(buffer, "%17I64d %11.2f %17.1f   %s\n", it->second.first, (double)it->second.first / dFrames, (double)it->second.second / 1048576.0, it->first.c_str());
+			sOut += buffer;
+		}
+	}
+
+	return sOut;
+}
+
+
+#endif //_ALLOCTRACKER_H
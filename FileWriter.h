@@ -0,0 +1,303 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_FILEWRITER_H)
+#define _FILEWRITER_H
+
+#include "common.h"
+#include <float.h>
+
+//log and csv output: numbers are formatted straight into one reusable buffer
+//which goes to the file in large writes, no temporary strings per row.
+//line feeds become CR/LF, like the text mode ofstream it replaces
+#define FILEWRITER_BUFFER_SIZE      (4 * 1048576)
+#define FILEWRITER_MAX_DECIMALS     9
+
+
+class CFileWriter
+{
+public:
+	CFileWriter();
+	virtual ~CFileWriter();
+
+	BOOL   Open(string &s_file);
+	BOOL   Close();
+
+	void   Text(const char *p_text);
+	void   Text(string &s_text);
+	void   Char(char c_value);
+	void   UInt(unsigned __int64 ui_value, int i_width);
+	void   Fixed(double d_value, int i_decimals, int i_width);
+
+	string sError;
+
+private:
+	void   Put(const char *p_data, size_t n_size);
+	void   PutRaw(const char *p_data, size_t n_size);
+	void   Pad(const char *p_data, size_t n_size, int i_width);
+	BOOL   Flush();
+	static size_t FormatUInt(char *p_end, unsigned __int64 ui_value);
+
+	HANDLE hFile;
+	vector<char> vBuffer;
+	size_t nUsed;
+	BOOL   bWriteError;
+};
+
+
+CFileWriter::CFileWriter()
+{
+	hFile = INVALID_HANDLE_VALUE;
+	nUsed = 0;
+	bWriteError = FALSE;
+	sError = "";
+}
+
+CFileWriter::~CFileWriter()
+{
+	Close();
+}
+
+
+BOOL CFileWriter::Open(string &s_file)
+{
+	Close();
+
+	hFile = ::CreateFile(s_file.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		sError = "Cannot create \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	if (vBuffer.size() == 0)
+		vBuffer.resize(FILEWRITER_BUFFER_SIZE);
+
+	nUsed = 0;
+	bWriteError = FALSE;
+	sError = "";
+
+	return TRUE;
+}
+
+
+BOOL CFileWriter::Close()
+{
+	if (hFile == INVALID_HANDLE_VALUE)
+		return !bWriteError;
+
+	Flush();
+	::CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+
+	return !bWriteError;
+}
+
+
+BOOL CFileWriter::Flush()
+{
+	if ((nUsed == 0) || (hFile == INVALID_HANDLE_VALUE))
+		return TRUE;
+
+	DWORD dwWritten = 0;
+	if (!bWriteError && (!::WriteFile(hFile, &vBuffer[0], (DWORD)nUsed, &dwWritten, NULL) || (dwWritten != (DWORD)nUsed)))
+	{
+		bWriteError = TRUE;
+		sError = "Cannot write the output file (disk full?)";
+	}
+
+	nUsed = 0;
+
+	return !bWriteError;
+}
+
+
+void CFileWriter::Put(const char *p_data, size_t n_size)
+{
+	const char *pLF = (const char *)memchr(p_data, '\n', n_size);
+	while (pLF)
+	{
+		PutRaw(p_data, (size_t)(pLF - p_data));
+		PutRaw("\r\n", 2);
+		n_size -= (size_t)(pLF - p_data) + 1;
+		p_data = pLF + 1;
+		pLF = (const char *)memchr(p_data, '\n', n_size);
+	}
+
+	PutRaw(p_data, n_size);
+
+	return;
+}
+
+
+void CFileWriter::PutRaw(const char *p_data, size_t n_size)
+{
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	while (n_size > 0)
+	{
+		if (nUsed == vBuffer.size())
+			Flush();
+
+		size_t nCopy = vBuffer.size() - nUsed;
+		if (nCopy > n_size)
+			nCopy = n_size;
+
+		memcpy(&vBuffer[nUsed], p_data, nCopy);
+		nUsed += nCopy;
+		p_data += nCopy;
+		n_size -= nCopy;
+	}
+
+	return;
+}
+
+
+void CFileWriter::Pad(const char *p_data, size_t n_size, int i_width)
+{
+	//right aligned like printf's "%*"
+	static const char szSpaces[] = "                                ";
+	while ((i_width > 0) && ((size_t)i_width > n_size))
+	{
+		size_t nPad = (size_t)i_width - n_size;
+		if (nPad > sizeof(szSpaces) - 1)
+			nPad = sizeof(szSpaces) - 1;
+		Put(szSpaces, nPad);
+		i_width -= (int)nPad;
+	}
+
+	Put(p_data, n_size);
+
+	return;
+}
+
+
+void CFileWriter::Text(const char *p_text)
+{
+	Put(p_text, strlen(p_text));
+
+	return;
+}
+
+
+void CFileWriter::Text(string &s_text)
+{
+	Put(s_text.c_str(), s_text.length());
+
+	return;
+}
+
+
+void CFileWriter::Char(char c_value)
+{
+	if ((c_value != '\n') && (nUsed < vBuffer.size()) && (hFile != INVALID_HANDLE_VALUE))
+		vBuffer[nUsed++] = c_value;
+	else
+		Put(&c_value, 1);
+
+	return;
+}
+
+
+size_t CFileWriter::FormatUInt(char *p_end, unsigned __int64 ui_value)
+{
+	//writes the digits backwards, two at a time, ending before p_end
+	static const char szPairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	char *p = p_end;
+	while (ui_value >= 100)
+	{
+		unsigned int uiPair = (unsigned int)(ui_value % 100) * 2;
+		ui_value /= 100;
+		*--p = szPairs[uiPair + 1];
+		*--p = szPairs[uiPair];
+	}
+
+	if (ui_value >= 10)
+	{
+		unsigned int uiPair = (unsigned int)ui_value * 2;
+		*--p = szPairs[uiPair + 1];
+		*--p = szPairs[uiPair];
+	}
+	else
+		*--p = (char)('0' + ui_value);
+
+	return (size_t)(p_end - p);
+}
+
+
+void CFileWriter::UInt(unsigned __int64 ui_value, int i_width)
+{
+	char szTemp[32];
+	size_t nLen = FormatUInt(szTemp + sizeof(szTemp), ui_value);
+	Pad(szTemp + sizeof(szTemp) - nLen, nLen, i_width);
+
+	return;
+}
+
+
+void CFileWriter::Fixed(double d_value, int i_decimals, int i_width)
+{
+	static const unsigned __int64 ui64Scale[FILEWRITER_MAX_DECIMALS + 1] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+	char szTemp[64];
+	if (i_decimals < 0)
+		i_decimals = 0;
+
+	//inf, nan and values that do not fit the integer path go through the CRT
+	if ((i_decimals > FILEWRITER_MAX_DECIMALS) || !_finite(d_value) || ((fabs(d_value) * (double)ui64Scale[i_decimals]) >= 1.0e+18))
+	{
+		int iLen = _snprintf(szTemp, sizeof(szTemp) - 1, "%.*f", i_decimals, d_value);
+		if ((iLen < 0) || (iLen >= (int)sizeof(szTemp)))
+			iLen = 0;
+		Pad(szTemp, (size_t)iLen, i_width);
+		return;
+	}
+
+	BOOL bNegative = (d_value < 0.0);
+	unsigned __int64 ui64Scaled = (unsigned __int64)(fabs(d_value) * (double)ui64Scale[i_decimals] + 0.5);
+	unsigned __int64 ui64Int = ui64Scaled / ui64Scale[i_decimals];
+	unsigned __int64 ui64Frac = ui64Scaled % ui64Scale[i_decimals];
+
+	char *pEnd = szTemp + sizeof(szTemp);
+	char *p = pEnd;
+	if (i_decimals > 0)
+	{
+		for (int i = 0; i < i_decimals; i++)
+		{
+			*--p = (char)('0' + (ui64Frac % 10));
+			ui64Frac /= 10;
+		}
+		*--p = '.';
+	}
+
+	p -= FormatUInt(p, ui64Int);
+	if (bNegative)
+		*--p = '-';
+
+	Pad(p, (size_t)(pEnd - p), i_width);
+
+	return;
+}
+
+
+#endif //_FILEWRITER_H
@@ -0,0 +1,412 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_FRAMESTORE_H)
+#define _FRAMESTORE_H
+
+#include "common.h"
+
+/*
+Keeps one record per frame. Every column is stored separately as zigzag/varint encoded
+deltas, so a frame costs a few bytes (the monitor values only change every sample period).
+Chunks are self-contained (deltas restart at 0) and are moved to a temporary file, oldest
+first, when the in-memory size exceeds the budget.
+*/
+
+#define FRAMESTORE_CHUNK_FRAMES     65536
+#define FRAMESTORE_MEMORY_BUDGET    (64 * 1048576)
+#define FRAMESTORE_TIME_UNITS       10000000.0    //100 ns ticks
+
+#define FRAMESTORE_COL_FRAME        0
+#define FRAMESTORE_COL_TIME         1
+#define FRAMESTORE_COL_CPU          2    //0.1 percent
+#define FRAMESTORE_COL_GPU          3
+#define FRAMESTORE_COL_VPU          4
+#define FRAMESTORE_COL_THREADS      5
+#define FRAMESTORE_COL_MEMORY       6
+#define FRAMESTORE_COL_COMMIT       7
+#define FRAMESTORE_COL_CYCLES       8    //cumulative, like the two fault counters
+#define FRAMESTORE_COL_FAULTS        9
+#define FRAMESTORE_COL_HARDFAULTS   10
+#define FRAMESTORE_COLUMNS          11
+
+
+struct stFrameRecord
+{
+	unsigned int  frame;
+	double        time;              //seconds since the start of the frame loop
+	float         cpu_usage;
+	BYTE          gpu_usage;
+	BYTE          vpu_usage;
+	WORD          num_threads;
+	DWORD         process_memory;    //MiB
+	DWORD         commit_memory;     //MiB
+	unsigned __int64 cycles;         //monitor snapshot, since process start
+	DWORD         page_faults;
+	DWORD         hard_faults;
+};
+
+
+struct stFrameChunk
+{
+	unsigned int     uiFrames;
+	vector<BYTE>     vColumns[FRAMESTORE_COLUMNS];
+	DWORD            dwColumnBytes[FRAMESTORE_COLUMNS];
+	BOOL             bSealed;
+	BOOL             bSpilled;
+	unsigned __int64 ui64FileOffset;
+};
+
+
+class CFrameStore
+{
+public:
+	CFrameStore();
+	virtual ~CFrameStore();
+
+	void   Add(stFrameRecord &record);
+	void   Close();
+	BOOL   ReadChunk(size_t n_chunk, vector<stFrameRecord> &v_records);
+	size_t GetChunkCount();
+	unsigned __int64 GetEncodedBytes();
+	size_t GetMemoryBytes();
+
+	//column codec, shared with the binary metrics file
+	static void EncodeRecord(vector<BYTE> *p_columns, __int64 *p_prev, stFrameRecord &record);
+	static void DecodeRecords(const BYTE **p_columns, size_t *p_sizes, unsigned int ui_frames, vector<stFrameRecord> &v_records);
+
+	unsigned __int64 ui64Frames;
+	unsigned __int64 ui64SpilledBytes;
+	size_t nMemoryBudget;
+	string sError;
+
+private:
+	void   Spill();
+	static void Encode(vector<BYTE> &v_column, __int64 &i_prev, __int64 i_value);
+	static __int64 Decode(const BYTE *p_data, size_t &n_pos, size_t n_size);
+
+	vector<stFrameChunk> vChunks;
+	__int64 iPrev[FRAMESTORE_COLUMNS];
+	size_t nMemoryBytes;
+	size_t nFirstInMemory;
+	unsigned __int64 ui64EncodedBytes;
+	HANDLE hSpillFile;
+};
+
+
+CFrameStore::CFrameStore()
+{
+	ui64Frames = 0;
+	ui64SpilledBytes = 0;
+	ui64EncodedBytes = 0;
+	nMemoryBudget = FRAMESTORE_MEMORY_BUDGET;
+	nMemoryBytes = 0;
+	nFirstInMemory = 0;
+	hSpillFile = INVALID_HANDLE_VALUE;
+	sError = "";
+	::ZeroMemory(iPrev, sizeof(iPrev));
+	vChunks.reserve(1024);
+}
+
+CFrameStore::~CFrameStore()
+{
+	if (hSpillFile != INVALID_HANDLE_VALUE)
+		::CloseHandle(hSpillFile);
+}
+
+
+void CFrameStore::Encode(vector<BYTE> &v_column, __int64 &i_prev, __int64 i_value)
+{
+	__int64 iDelta = i_value - i_prev;
+	i_prev = i_value;
+
+	//zigzag, small negative deltas stay small
+	unsigned __int64 uiValue = ((unsigned __int64)iDelta << 1) ^ (unsigned __int64)(iDelta >> 63);
+	while (uiValue >= 0x80)
+	{
+		v_column.push_back((BYTE)(uiValue | 0x80));
+		uiValue >>= 7;
+	}
+	v_column.push_back((BYTE)uiValue);
+
+	return;
+}
+
+
+void CFrameStore::EncodeRecord(vector<BYTE> *p_columns, __int64 *p_prev, stFrameRecord &record)
+{
+	Encode(p_columns[FRAMESTORE_COL_FRAME], p_prev[FRAMESTORE_COL_FRAME], (__int64)record.frame);
+	Encode(p_columns[FRAMESTORE_COL_TIME], p_prev[FRAMESTORE_COL_TIME], (__int64)(record.time * FRAMESTORE_TIME_UNITS + 0.5));
+	Encode(p_columns[FRAMESTORE_COL_CPU], p_prev[FRAMESTORE_COL_CPU], (__int64)(record.cpu_usage * 10.0f + 0.5f));
+	Encode(p_columns[FRAMESTORE_COL_GPU], p_prev[FRAMESTORE_COL_GPU], (__int64)record.gpu_usage);
+	Encode(p_columns[FRAMESTORE_COL_VPU], p_prev[FRAMESTORE_COL_VPU], (__int64)record.vpu_usage);
+	Encode(p_columns[FRAMESTORE_COL_THREADS], p_prev[FRAMESTORE_COL_THREADS], (__int64)record.num_threads);
+	Encode(p_columns[FRAMESTORE_COL_MEMORY], p_prev[FRAMESTORE_COL_MEMORY], (__int64)record.process_memory);
+	Encode(p_columns[FRAMESTORE_COL_COMMIT], p_prev[FRAMESTORE_COL_COMMIT], (__int64)record.commit_memory);
+	Encode(p_columns[FRAMESTORE_COL_CYCLES], p_prev[FRAMESTORE_COL_CYCLES], (__int64)record.cycles);
+	Encode(p_columns[FRAMESTORE_COL_FAULTS], p_prev[FRAMESTORE_COL_FAULTS], (__int64)record.page_faults);
+	Encode(p_columns[FRAMESTORE_COL_HARDFAULTS], p_prev[FRAMESTORE_COL_HARDFAULTS], (__int64)record.hard_faults);
+
+	return;
+}
+
+
+void CFrameStore::DecodeRecords(const BYTE **p_columns, size_t *p_sizes, unsigned int ui_frames, vector<stFrameRecord> &v_records)
+{
+	size_t nPos[FRAMESTORE_COLUMNS];
+	__int64 iValue[FRAMESTORE_COLUMNS];
+	::ZeroMemory(nPos, sizeof(nPos));
+	::ZeroMemory(iValue, sizeof(iValue));
+
+	v_records.reserve(v_records.size() + ui_frames);
+	for (unsigned int f = 0; f < ui_frames; f++)
+	{
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+			iValue[c] += Decode(p_columns[c], nPos[c], p_sizes[c]);
+
+		stFrameRecord record;
+		record.frame = (unsigned int)iValue[FRAMESTORE_COL_FRAME];
+		record.time = (double)iValue[FRAMESTORE_COL_TIME] / FRAMESTORE_TIME_UNITS;
+		record.cpu_usage = (float)iValue[FRAMESTORE_COL_CPU] / 10.0f;
+		record.gpu_usage = (BYTE)iValue[FRAMESTORE_COL_GPU];
+		record.vpu_usage = (BYTE)iValue[FRAMESTORE_COL_VPU];
+		record.num_threads = (WORD)iValue[FRAMESTORE_COL_THREADS];
+		record.process_memory = (DWORD)iValue[FRAMESTORE_COL_MEMORY];
+		record.commit_memory = (DWORD)iValue[FRAMESTORE_COL_COMMIT];
+		record.cycles = (unsigned __int64)iValue[FRAMESTORE_COL_CYCLES];
+		record.page_faults = (DWORD)iValue[FRAMESTORE_COL_FAULTS];
+		record.hard_faults = (DWORD)iValue[FRAMESTORE_COL_HARDFAULTS];
+		v_records.push_back(record);
+	}
+
+	return;
+}
+
+
+__int64 CFrameStore::Decode(const BYTE *p_data, size_t &n_pos, size_t n_size)
+{
+	unsigned __int64 uiValue = 0;
+	int iShift = 0;
+	while ((n_pos < n_size) && (iShift < 64))
+	{
+		BYTE b = p_data[n_pos++];
+		uiValue |= ((unsigned __int64)(b & 0x7F)) << iShift;
+		if (!(b & 0x80))
+			break;
+		iShift += 7;
+	}
+
+	return (__int64)(uiValue >> 1) ^ -(__int64)(uiValue & 1);
+}
+
+
+void CFrameStore::Add(stFrameRecord &record)
+{
+	if ((vChunks.size() == 0) || (vChunks.back().uiFrames >= FRAMESTORE_CHUNK_FRAMES))
+	{
+		Close();
+
+		stFrameChunk chunk;
+		chunk.uiFrames = 0;
+		chunk.bSealed = FALSE;
+		chunk.bSpilled = FALSE;
+		chunk.ui64FileOffset = 0;
+		::ZeroMemory(chunk.dwColumnBytes, sizeof(chunk.dwColumnBytes));
+		vChunks.push_back(chunk);
+		::ZeroMemory(iPrev, sizeof(iPrev));
+	}
+
+	EncodeRecord(vChunks.back().vColumns, iPrev, record);
+
+	vChunks.back().uiFrames++;
+	ui64Frames++;
+
+	return;
+}
+
+
+void CFrameStore::Close()
+{
+	//seals the current chunk, the vectors are trimmed to their final size
+	if ((vChunks.size() == 0) || vChunks.back().bSealed)
+		return;
+
+	stFrameChunk &chunk = vChunks.back();
+	chunk.bSealed = TRUE;
+
+	for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+	{
+		vector<BYTE>(chunk.vColumns[c]).swap(chunk.vColumns[c]);
+		chunk.dwColumnBytes[c] = (DWORD)chunk.vColumns[c].size();
+		nMemoryBytes += chunk.vColumns[c].size();
+		ui64EncodedBytes += chunk.vColumns[c].size();
+	}
+
+	if (nMemoryBytes > nMemoryBudget)
+		Spill();
+
+	return;
+}
+
+
+void CFrameStore::Spill()
+{
+	if (hSpillFile == INVALID_HANDLE_VALUE)
+	{
+		char szTempPath[MAX_PATH + 1];
+		char szTempFile[MAX_PATH + 1];
+		if (!::GetTempPath(MAX_PATH, szTempPath) || !::GetTempFileName(szTempPath, "avs", 0, szTempFile))
+		{
+			sError = "Cannot create the frame store spill file";
+			return;
+		}
+
+		hSpillFile = ::CreateFile(szTempFile, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+		if (hSpillFile == INVALID_HANDLE_VALUE)
+		{
+			sError = "Cannot create the frame store spill file";
+			return;
+		}
+	}
+
+	//oldest sealed chunks first, the last chunk stays in memory
+	while ((nMemoryBytes > nMemoryBudget / 2) && (nFirstInMemory < vChunks.size()))
+	{
+		stFrameChunk &chunk = vChunks[nFirstInMemory];
+		if (!chunk.bSealed)
+			break;
+
+		LARGE_INTEGER liPos;
+		liPos.QuadPart = (LONGLONG)ui64SpilledBytes;
+		if (!::SetFilePointerEx(hSpillFile, liPos, NULL, FILE_BEGIN))
+		{
+			sError = "Cannot write the frame store spill file";
+			return;
+		}
+
+		unsigned __int64 ui64ChunkBytes = 0;
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+		{
+			DWORD dwWritten = 0;
+			if (chunk.dwColumnBytes[c] && (!::WriteFile(hSpillFile, &chunk.vColumns[c][0], chunk.dwColumnBytes[c], &dwWritten, NULL) || (dwWritten != chunk.dwColumnBytes[c])))
+			{
+				sError = "Cannot write the frame store spill file";
+				return;
+			}
+
+			ui64ChunkBytes += chunk.dwColumnBytes[c];
+		}
+
+		//the chunk only leaves memory once it has been written completely
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+		{
+			nMemoryBytes -= chunk.vColumns[c].size();
+			vector<BYTE>().swap(chunk.vColumns[c]);
+		}
+
+		chunk.ui64FileOffset = ui64SpilledBytes;
+		chunk.bSpilled = TRUE;
+		ui64SpilledBytes += ui64ChunkBytes;
+		nFirstInMemory++;
+	}
+
+	return;
+}
+
+
+size_t CFrameStore::GetChunkCount()
+{
+	return vChunks.size();
+}
+
+
+size_t CFrameStore::GetMemoryBytes()
+{
+	//heap memory held by the store, including the capacity of the chunk being filled
+	size_t nBytes = nMemoryBytes + vChunks.capacity() * sizeof(stFrameChunk);
+	if ((vChunks.size() > 0) && !vChunks.back().bSealed)
+	{
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+			nBytes += vChunks.back().vColumns[c].capacity();
+	}
+
+	return nBytes;
+}
+
+
+unsigned __int64 CFrameStore::GetEncodedBytes()
+{
+	unsigned __int64 ui64Bytes = ui64EncodedBytes;
+	if ((vChunks.size() > 0) && !vChunks.back().bSealed)
+	{
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+			ui64Bytes += vChunks.back().vColumns[c].size();
+	}
+
+	return ui64Bytes;
+}
+
+
+BOOL CFrameStore::ReadChunk(size_t n_chunk, vector<stFrameRecord> &v_records)
+{
+	v_records.clear();
+	if (n_chunk >= vChunks.size())
+		return FALSE;
+
+	stFrameChunk &chunk = vChunks[n_chunk];
+	vector<BYTE> vSpilled;
+	const BYTE *pColumns[FRAMESTORE_COLUMNS];
+	size_t nSizes[FRAMESTORE_COLUMNS];
+
+	if (chunk.bSpilled)
+	{
+		size_t nTotal = 0;
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+			nTotal += chunk.dwColumnBytes[c];
+
+		vSpilled.resize(nTotal + 1);
+		LARGE_INTEGER liPos;
+		liPos.QuadPart = (LONGLONG)chunk.ui64FileOffset;
+		DWORD dwRead = 0;
+		if (!::SetFilePointerEx(hSpillFile, liPos, NULL, FILE_BEGIN) || !::ReadFile(hSpillFile, &vSpilled[0], (DWORD)nTotal, &dwRead, NULL) || (dwRead != (DWORD)nTotal))
+			return FALSE;
+
+		size_t nOffset = 0;
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+		{
+			pColumns[c] = &vSpilled[nOffset];
+			nSizes[c] = chunk.dwColumnBytes[c];
+			nOffset += chunk.dwColumnBytes[c];
+		}
+	}
+	else
+	{
+		for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+		{
+			pColumns[c] = (chunk.vColumns[c].size() > 0) ? &chunk.vColumns[c][0] : NULL;
+			nSizes[c] = chunk.vColumns[c].size();
+		}
+	}
+
+	DecodeRecords(pColumns, nSizes, chunk.uiFrames, v_records);
+
+	return TRUE;
+}
+
+
+#endif //_FRAMESTORE_H
@@ -0,0 +1,735 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_FRAMETRACER_H)
+#define _FRAMETRACER_H
+
+#include "common.h"
+#include "utility.h"
+#include "avs_headers\avisynth.h"
+
+#define TRACE_FUNCTION_NAME      "AVSMeterTrace"
+#define TRACE_RECOMPUTE_RATIO    0.25   //repeated request is a recomputation if it takes longer than this fraction of the first fetch
+#define TRACE_RECOMPUTE_MIN      0.05   //milliseconds, below this a repeated request is always considered a cache hit
+#define TRACE_BUFFER_SIZE        4096   //requests buffered per thread before they are merged into the node statistics
+
+class CTraceClip;
+
+class CFrameTracer
+{
+public:
+	CFrameTracer();
+	virtual ~CFrameTracer();
+
+	struct stFrameStat
+	{
+		unsigned int  uiCount;
+		double        dFirstFetchMS;
+	};
+
+	struct stTraceNode
+	{
+		string                        sName;
+		CTraceClip                    *pClip;
+		map <int, stFrameStat>        mFrames;
+		map <DWORD, unsigned __int64> mThreads;
+		unsigned __int64              uiRequests;
+		unsigned __int64              uiRepeated;
+		unsigned __int64              uiRecomputed;
+		double                        dFetchTimeMS;
+		int                           iFrontier;
+		int                           iMaxBehind;
+		int                           iMaxAhead;
+		int                           iCacheCapacity;
+		int                           iCost;
+		int                           iThreadMode;
+		int                           iAccessCost;
+		int                           iMTMode;
+		set <size_t>                  sUpstream;
+		BOOL                          bHasConsumer;
+	};
+
+	struct stTraceRecord
+	{
+		size_t nNode;
+		size_t nPrevious;
+		int    iFrame;
+		double dFetchTimeMS;
+		DWORD  dwThreadID;
+	};
+
+	struct stTraceBuffer
+	{
+		CRITICAL_SECTION        csBuffer;
+		vector <stTraceRecord>  vRecords;
+	};
+
+	void   Register(IScriptEnvironment *AVS_env);
+	PClip  Wrap(PClip clip, string s_name, IScriptEnvironment *AVS_env);
+	size_t AddNode(string s_name, CTraceClip *p_clip);
+	void   DetachClip(size_t n_node);
+	size_t EnterNode(size_t n_node);
+	void   LeaveNode(size_t n_previous);
+	void   Record(size_t n_node, size_t n_previous, int i_frame, double d_fetchtime_ms);
+	void   QueryHints();
+	void   ClearStats();
+	void   Reset();
+	string Report();
+	string GraphTree();
+	string GraphDOT(string s_title);
+	double GetTimeMS();
+	int    SuggestedCapacity(size_t n_node);
+
+	BOOL   bEnabled;
+	vector <stTraceNode*> vNodes;
+
+private:
+	static AVSValue __cdecl Create(AVSValue args, void* user_data, IScriptEnvironment* env);
+	void             ApplyRecords(vector <stTraceRecord> &v_records);
+	void             Flush();
+	void             GraphTreeNode(size_t n_node, unsigned int ui_depth, set <size_t> &s_visited, string &s_tree);
+	string           NodeHints(stTraceNode *p_node);
+	BOOL             IsSerializing(stTraceNode *p_node);
+	string           CostName(int i_cost);
+	string           ThreadModeName(int i_threadmode);
+	string           AccessCostName(int i_accesscost);
+	string           MTModeName(int i_mtmode);
+	CRITICAL_SECTION csLock;
+	DWORD            dwTlsIndex;
+	DWORD            dwBufferTlsIndex;
+	vector <stTraceBuffer*> vBuffers;
+	double           dPerfFreq;
+	CUtils           utils;
+};
+
+
+class CTraceClip : public GenericVideoFilter
+{
+public:
+	CTraceClip(PClip _child, CFrameTracer *p_tracer, string s_name);
+	virtual ~CTraceClip();
+
+	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+	int __stdcall SetCacheHints(int cachehints, int frame_range);
+	int QueryChild(int i_cachehint);
+
+private:
+	CFrameTracer *pTracer;
+	size_t       nNode;
+};
+
+
+CFrameTracer::CFrameTracer()
+{
+	bEnabled = FALSE;
+
+	LARGE_INTEGER liPerfFreq = {0,0};
+	::QueryPerformanceFrequency(&liPerfFreq);
+	dPerfFreq = (double)liPerfFreq.QuadPart;
+
+	::InitializeCriticalSection(&csLock);
+	dwTlsIndex = ::TlsAlloc();
+	dwBufferTlsIndex = ::TlsAlloc();
+}
+
+CFrameTracer::~CFrameTracer()
+{
+	Reset();
+	for (size_t n = 0; n < vBuffers.size(); n++)
+	{
+		::DeleteCriticalSection(&vBuffers[n]->csBuffer);
+		delete vBuffers[n];
+	}
+	vBuffers.clear();
+	::TlsFree(dwBufferTlsIndex);
+	::TlsFree(dwTlsIndex);
+	::DeleteCriticalSection(&csLock);
+}
+
+
+void CFrameTracer::Register(IScriptEnvironment *AVS_env)
+{
+	//always registered so that scripts containing trace points also run without "-trace"
+	AVS_env->AddFunction(TRACE_FUNCTION_NAME, "c[name]s", CFrameTracer::Create, this);
+	return;
+}
+
+
+AVSValue __cdecl CFrameTracer::Create(AVSValue args, void* user_data, IScriptEnvironment* env)
+{
+	CFrameTracer *pTracer = (CFrameTracer *)user_data;
+
+	string sName = "";
+	if (args[1].Defined())
+		sName = args[1].AsString();
+
+	return pTracer->Wrap(args[0].AsClip(), sName, env);
+}
+
+
+PClip CFrameTracer::Wrap(PClip clip, string s_name, IScriptEnvironment *AVS_env)
+{
+	if (!bEnabled)
+		return clip;
+
+	if (s_name == "")
+		s_name = utils.StrFormat("Node %u", (unsigned int)(vNodes.size() + 1));
+
+	return new CTraceClip(clip, this, s_name);
+}
+
+
+size_t CFrameTracer::AddNode(string s_name, CTraceClip *p_clip)
+{
+	stTraceNode *pNode = new stTraceNode;
+	pNode->sName = s_name;
+	pNode->pClip = p_clip;
+	pNode->uiRequests = 0;
+	pNode->uiRepeated = 0;
+	pNode->uiRecomputed = 0;
+	pNode->dFetchTimeMS = 0.0;
+	pNode->iFrontier = -1;
+	pNode->iMaxBehind = 0;
+	pNode->iMaxAhead = 0;
+	pNode->iCacheCapacity = 0;
+	pNode->iCost = 0;
+	pNode->iThreadMode = 0;
+	pNode->iAccessCost = 0;
+	pNode->iMTMode = 0;
+	pNode->bHasConsumer = FALSE;
+
+	::EnterCriticalSection(&csLock);
+	vNodes.push_back(pNode);
+	size_t nNode = vNodes.size() - 1;
+	::LeaveCriticalSection(&csLock);
+
+	return nNode;
+}
+
+
+void CFrameTracer::DetachClip(size_t n_node)
+{
+	::EnterCriticalSection(&csLock);
+	if (n_node < vNodes.size())
+		vNodes[n_node]->pClip = NULL;
+	::LeaveCriticalSection(&csLock);
+
+	return;
+}
+
+
+size_t CFrameTracer::EnterNode(size_t n_node)
+{
+	//the trace node currently fetching on this thread (index + 1, 0 = none) is the consumer of n_node
+	size_t nPrevious = (size_t)::TlsGetValue(dwTlsIndex);
+	::TlsSetValue(dwTlsIndex, (LPVOID)(n_node + 1));
+
+	return nPrevious;
+}
+
+
+void CFrameTracer::LeaveNode(size_t n_previous)
+{
+	::TlsSetValue(dwTlsIndex, (LPVOID)n_previous);
+	return;
+}
+
+
+void CFrameTracer::Record(size_t n_node, size_t n_previous, int i_frame, double d_fetchtime_ms)
+{
+	//every thread collects its requests in its own buffer so that the MT worker threads do not serialize on csLock
+	stTraceBuffer *pBuffer = (stTraceBuffer *)::TlsGetValue(dwBufferTlsIndex);
+	if (!pBuffer)
+	{
+		pBuffer = new stTraceBuffer;
+		::InitializeCriticalSection(&pBuffer->csBuffer);
+		pBuffer->vRecords.reserve(TRACE_BUFFER_SIZE);
+		::EnterCriticalSection(&csLock);
+		vBuffers.push_back(pBuffer);
+		::LeaveCriticalSection(&csLock);
+		::TlsSetValue(dwBufferTlsIndex, pBuffer);
+	}
+
+	stTraceRecord record;
+	record.nNode = n_node;
+	record.nPrevious = n_previous;
+	record.iFrame = i_frame;
+	record.dFetchTimeMS = d_fetchtime_ms;
+	record.dwThreadID = ::GetCurrentThreadId();
+
+	vector <stTraceRecord> vFull;
+	::EnterCriticalSection(&pBuffer->csBuffer);
+	pBuffer->vRecords.push_back(record);
+	if (pBuffer->vRecords.size() >= TRACE_BUFFER_SIZE)
+	{
+		vFull.reserve(TRACE_BUFFER_SIZE);
+		std::swap(vFull, pBuffer->vRecords);
+	}
+	::LeaveCriticalSection(&pBuffer->csBuffer);
+
+	if (vFull.size() > 0)
+		ApplyRecords(vFull);
+
+	return;
+}
+
+
+void CFrameTracer::ApplyRecords(vector <stTraceRecord> &v_records)
+{
+	::EnterCriticalSection(&csLock);
+
+	for (size_t r = 0; r < v_records.size(); r++)
+	{
+		stTraceRecord &rec = v_records[r];
+		if (rec.nNode >= vNodes.size())
+			continue;
+
+		stTraceNode *pNode = vNodes[rec.nNode];
+
+		if ((rec.nPrevious > 0) && (rec.nPrevious <= vNodes.size()) && ((rec.nPrevious - 1) != rec.nNode))
+		{
+			vNodes[rec.nPrevious - 1]->sUpstream.insert(rec.nNode);
+			pNode->bHasConsumer = TRUE;
+		}
+
+		++pNode->uiRequests;
+		pNode->dFetchTimeMS += rec.dFetchTimeMS;
+		++pNode->mThreads[rec.dwThreadID];
+
+		map <int, stFrameStat>::iterator it = pNode->mFrames.find(rec.iFrame);
+		if (it == pNode->mFrames.end())
+		{
+			stFrameStat fstat;
+			fstat.uiCount = 1;
+			fstat.dFirstFetchMS = rec.dFetchTimeMS;
+			pNode->mFrames[rec.iFrame] = fstat;
+		}
+		else
+		{
+			++it->second.uiCount;
+			++pNode->uiRepeated;
+			if ((rec.dFetchTimeMS > TRACE_RECOMPUTE_MIN) && (rec.dFetchTimeMS > (it->second.dFirstFetchMS * TRACE_RECOMPUTE_RATIO)))
+				++pNode->uiRecomputed;
+		}
+
+		//request window relative to the highest frame requested so far
+		if (pNode->iFrontier < 0)
+			pNode->iFrontier = rec.iFrame;
+		else if (rec.iFrame > pNode->iFrontier)
+		{
+			if ((rec.iFrame - pNode->iFrontier) > pNode->iMaxAhead)
+				pNode->iMaxAhead = rec.iFrame - pNode->iFrontier;
+			pNode->iFrontier = rec.iFrame;
+		}
+		else if ((pNode->iFrontier - rec.iFrame) > pNode->iMaxBehind)
+			pNode->iMaxBehind = pNode->iFrontier - rec.iFrame;
+
+	}
+
+	::LeaveCriticalSection(&csLock);
+
+	return;
+}
+
+
+void CFrameTracer::Flush()
+{
+	//merges the requests still pending in the per-thread buffers, never holds a buffer lock and csLock at the same time
+	::EnterCriticalSection(&csLock);
+	vector <stTraceBuffer*> vPending = vBuffers;
+	::LeaveCriticalSection(&csLock);
+
+	for (size_t n = 0; n < vPending.size(); n++)
+	{
+		vector <stTraceRecord> vRecords;
+		::EnterCriticalSection(&vPending[n]->csBuffer);
+		std::swap(vRecords, vPending[n]->vRecords);
+		vPending[n]->vRecords.reserve(TRACE_BUFFER_SIZE);
+		::LeaveCriticalSection(&vPending[n]->csBuffer);
+
+		ApplyRecords(vRecords);
+	}
+
+	return;
+}
+
+
+void CFrameTracer::QueryHints()
+{
+	//must be called while the clips are still alive, i.e. before the script environment is deleted
+	::EnterCriticalSection(&csLock);
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		CTraceClip *pClip = vNodes[n]->pClip;
+		if (!pClip)
+			continue;
+
+		vNodes[n]->iCacheCapacity = pClip->QueryChild(CACHE_GET_CAPACITY);
+		vNodes[n]->iCost = pClip->QueryChild(CACHE_GETCHILD_COST);
+		vNodes[n]->iThreadMode = pClip->QueryChild(CACHE_GETCHILD_THREAD_MODE);
+		vNodes[n]->iAccessCost = pClip->QueryChild(CACHE_GETCHILD_ACCESS_COST);
+		vNodes[n]->iMTMode = pClip->QueryChild(CACHE_GET_MTMODE);
+	}
+	::LeaveCriticalSection(&csLock);
+
+	return;
+}
+
+
+void CFrameTracer::ClearStats()
+{
+	//keeps the nodes and the discovered graph edges
+	Flush();
+	::EnterCriticalSection(&csLock);
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		stTraceNode *pNode = vNodes[n];
+		pNode->mFrames.clear();
+		pNode->mThreads.clear();
+		pNode->uiRequests = 0;
+		pNode->uiRepeated = 0;
+		pNode->uiRecomputed = 0;
+		pNode->dFetchTimeMS = 0.0;
+		pNode->iFrontier = -1;
+		pNode->iMaxBehind = 0;
+		pNode->iMaxAhead = 0;
+	}
+	::LeaveCriticalSection(&csLock);
+
+	return;
+}
+
+
+void CFrameTracer::Reset()
+{
+	::EnterCriticalSection(&csLock);
+	for (size_t n = 0; n < vBuffers.size(); n++)
+	{
+		::EnterCriticalSection(&vBuffers[n]->csBuffer);
+		vBuffers[n]->vRecords.clear();
+		::LeaveCriticalSection(&vBuffers[n]->csBuffer);
+	}
+	for (size_t n = 0; n < vNodes.size(); n++)
+		delete vNodes[n];
+	vNodes.clear();
+	::LeaveCriticalSection(&csLock);
+
+	return;
+}
+
+
+int CFrameTracer::SuggestedCapacity(size_t n_node)
+{
+	stTraceNode *pNode = vNodes[n_node];
+
+	//frames that are never requested twice do not need to be cached
+	if (pNode->uiRepeated == 0)
+		return 0;
+
+	return pNode->iMaxBehind + 1;
+}
+
+
+string CFrameTracer::Report()
+{
+	string sReport = "";
+
+	Flush();
+	::EnterCriticalSection(&csLock);
+
+	sReport = "\n[Frame request trace]\n";
+	sReport += "Node                        Requests       Unique     Repeated   Recomputed   Window   Ahead   Threads   Avg fetch(ms)\n";
+
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		stTraceNode *pNode = vNodes[n];
+		string sName = pNode->sName;
+		if (sName.length() > 24)
+			sName = sName.substr(0, 21) + "...";
+
+		double dAvgFetch = (pNode->uiRequests > 0) ? (pNode->dFetchTimeMS / (double)pNode->uiRequests) : 0.0;
+
+		sReport += utils.StrFormat("%-24s %12I64u %12u %12I64u %12I64u %8d %7d %9u %15.3f\n", sName.c_str(), pNode->uiRequests, (unsigned int)pNode->mFrames.size(),
+			pNode->uiRepeated, pNode->uiRecomputed, pNode->iMaxBehind + 1, pNode->iMaxAhead, (unsigned int)pNode->mThreads.size(), dAvgFetch);
+	}
+
+	sReport += "\n[Suggested cache hints]\n";
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		stTraceNode *pNode = vNodes[n];
+		int iSuggested = SuggestedCapacity(n);
+		string sCurrent = (pNode->iCacheCapacity > 0) ? utils.StrFormat("%d", pNode->iCacheCapacity) : "n/a";
+
+		if (iSuggested == 0)
+			sReport += utils.StrFormat("%-24s SetCacheHints(CACHE_NOTHING, 0)                   (current capacity: %s)\n", pNode->sName.c_str(), sCurrent.c_str());
+		else
+			sReport += utils.StrFormat("%-24s SetCacheHints(CACHE_SET_MAX_CAPACITY, %d)%*s(current capacity: %s)\n", pNode->sName.c_str(), iSuggested,
+				(int)(11 - utils.StrFormat("%d", iSuggested).length()), "", sCurrent.c_str());
+	}
+
+	sReport += "\n[Requests per thread]\n";
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		stTraceNode *pNode = vNodes[n];
+		sReport += utils.StrFormat("%s:\n", pNode->sName.c_str());
+		for (map <DWORD, unsigned __int64>::iterator it = pNode->mThreads.begin(); it != pNode->mThreads.end(); ++it)
+			sReport += utils.StrFormat("    Thread %6u: %12I64u\n", it->first, it->second);
+	}
+
+	::LeaveCriticalSection(&csLock);
+
+	return sReport;
+}
+
+
+string CFrameTracer::GraphTree()
+{
+	string sTree = "\n[Filter graph]\n";
+	set <size_t> sVisited;
+
+	Flush();
+	::EnterCriticalSection(&csLock);
+
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		if (!vNodes[n]->bHasConsumer)
+			GraphTreeNode(n, 0, sVisited, sTree);
+	}
+
+	//nodes that were never reached by the probe
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		if (sVisited.find(n) == sVisited.end())
+			sTree += utils.StrFormat("%s (not requested)  %s\n", vNodes[n]->sName.c_str(), NodeHints(vNodes[n]).c_str());
+	}
+
+	::LeaveCriticalSection(&csLock);
+
+	return sTree;
+}
+
+
+void CFrameTracer::GraphTreeNode(size_t n_node, unsigned int ui_depth, set <size_t> &s_visited, string &s_tree)
+{
+	stTraceNode *pNode = vNodes[n_node];
+	string sIndent(ui_depth * 4, ' ');
+
+	if (s_visited.find(n_node) != s_visited.end())
+	{
+		s_tree += utils.StrFormat("%s%s (see above)\n", sIndent.c_str(), pNode->sName.c_str());
+		return;
+	}
+
+	s_visited.insert(n_node);
+	s_tree += utils.StrFormat("%s%s  %s%s\n", sIndent.c_str(), pNode->sName.c_str(), NodeHints(pNode).c_str(), IsSerializing(pNode) ? "  <-- serializes the chain" : "");
+
+	for (set <size_t>::iterator it = pNode->sUpstream.begin(); it != pNode->sUpstream.end(); ++it)
+		GraphTreeNode(*it, ui_depth + 1, s_visited, s_tree);
+
+	return;
+}
+
+
+string CFrameTracer::GraphDOT(string s_title)
+{
+	string sDOT = "digraph AVSMeter {\n";
+	sDOT += "  rankdir=BT;\n";
+	sDOT += "  node [shape=box, fontname=\"Courier New\"];\n";
+
+	for (size_t n = 0; n < s_title.length(); n++)
+	{
+		if ((s_title[n] == '\\') || (s_title[n] == '\"'))
+			s_title[n] = '/';
+	}
+	sDOT += utils.StrFormat("  label=\"%s\";\n", s_title.c_str());
+
+	Flush();
+	::EnterCriticalSection(&csLock);
+
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		stTraceNode *pNode = vNodes[n];
+		string sName = pNode->sName;
+		for (size_t c = 0; c < sName.length(); c++)
+		{
+			if (sName[c] == '\"')
+				sName[c] = '\'';
+		}
+
+		sDOT += utils.StrFormat("  n%u [label=\"%s\\ncost: %s\\nthread: %s\\naccess: %s\\nMT mode: %s\\ncapacity: %d\"%s];\n", (unsigned int)n, sName.c_str(),
+			CostName(pNode->iCost).c_str(), ThreadModeName(pNode->iThreadMode).c_str(), AccessCostName(pNode->iAccessCost).c_str(), MTModeName(pNode->iMTMode).c_str(),
+			pNode->iCacheCapacity, IsSerializing(pNode) ? ", style=filled, fillcolor=salmon" : "");
+	}
+
+	//edges point in the direction of the data flow, from upstream to consumer
+	for (size_t n = 0; n < vNodes.size(); n++)
+	{
+		for (set <size_t>::iterator it = vNodes[n]->sUpstream.begin(); it != vNodes[n]->sUpstream.end(); ++it)
+			sDOT += utils.StrFormat("  n%u -> n%u;\n", (unsigned int)*it, (unsigned int)n);
+	}
+
+	::LeaveCriticalSection(&csLock);
+
+	sDOT += "}\n";
+
+	return sDOT;
+}
+
+
+string CFrameTracer::NodeHints(stTraceNode *p_node)
+{
+	return utils.StrFormat("[cost: %s, thread: %s, access: %s, MT mode: %s, capacity: %d]", CostName(p_node->iCost).c_str(), ThreadModeName(p_node->iThreadMode).c_str(),
+		AccessCostName(p_node->iAccessCost).c_str(), MTModeName(p_node->iMTMode).c_str(), p_node->iCacheCapacity);
+}
+
+
+BOOL CFrameTracer::IsSerializing(stTraceNode *p_node)
+{
+	if ((p_node->iMTMode == MT_SERIALIZED) || (p_node->iThreadMode == CACHE_THREAD_UNSAFE))
+		return TRUE;
+
+	return FALSE;
+}
+
+
+string CFrameTracer::CostName(int i_cost)
+{
+	switch (i_cost)
+	{
+		case CACHE_COST_ZERO: return "zero";
+		case CACHE_COST_UNIT: return "unit";
+		case CACHE_COST_LOW:  return "low";
+		case CACHE_COST_MED:  return "medium";
+		case CACHE_COST_HI:   return "high";
+	}
+
+	return "n/a";
+}
+
+
+string CFrameTracer::ThreadModeName(int i_threadmode)
+{
+	switch (i_threadmode)
+	{
+		case CACHE_THREAD_UNSAFE: return "CACHE_THREAD_UNSAFE";
+		case CACHE_THREAD_CLASS:  return "CACHE_THREAD_CLASS";
+		case CACHE_THREAD_SAFE:   return "CACHE_THREAD_SAFE";
+		case CACHE_THREAD_OWN:    return "CACHE_THREAD_OWN";
+	}
+
+	return "n/a";
+}
+
+
+string CFrameTracer::AccessCostName(int i_accesscost)
+{
+	switch (i_accesscost)
+	{
+		case CACHE_ACCESS_RAND: return "random";
+		case CACHE_ACCESS_SEQ0: return "sequential (preferred)";
+		case CACHE_ACCESS_SEQ1: return "sequential (required)";
+	}
+
+	return "n/a";
+}
+
+
+string CFrameTracer::MTModeName(int i_mtmode)
+{
+	switch (i_mtmode)
+	{
+		case MT_NICE_FILTER:    return "MT_NICE_FILTER";
+		case MT_MULTI_INSTANCE: return "MT_MULTI_INSTANCE";
+		case MT_SERIALIZED:     return "MT_SERIALIZED";
+	}
+
+	return "n/a";
+}
+
+
+double CFrameTracer::GetTimeMS()
+{
+	//plain QPC, this is called from inside the filter chain and must not migrate or yield the thread
+	LARGE_INTEGER liPerfCounter = {0,0};
+	::QueryPerformanceCounter(&liPerfCounter);
+
+	return ((double)liPerfCounter.QuadPart * 1000.0) / dPerfFreq;
+}
+
+
+
+CTraceClip::CTraceClip(PClip _child, CFrameTracer *p_tracer, string s_name) : GenericVideoFilter(_child)
+{
+	pTracer = p_tracer;
+	nNode = pTracer->AddNode(s_name, this);
+}
+
+CTraceClip::~CTraceClip()
+{
+	pTracer->DetachClip(nNode);
+}
+
+
+PVideoFrame __stdcall CTraceClip::GetFrame(int n, IScriptEnvironment* env)
+{
+	size_t nPrevious = pTracer->EnterNode(nNode);
+	double dStart = pTracer->GetTimeMS();
+	PVideoFrame frame;
+
+	try
+	{
+		frame = child->GetFrame(n, env);
+	}
+	catch (...)
+	{
+		pTracer->LeaveNode(nPrevious);
+		throw;
+	}
+
+	pTracer->Record(nNode, nPrevious, n, pTracer->GetTimeMS() - dStart);
+	pTracer->LeaveNode(nPrevious);
+
+	return frame;
+}
+
+
+int __stdcall CTraceClip::SetCacheHints(int cachehints, int frame_range)
+{
+	AVS_UNUSED(frame_range);
+
+	//no cache in front of the trace point, otherwise repeated requests would never reach it
+	if (cachehints == CACHE_DONT_CACHE_ME)
+		return 1;
+
+	if (cachehints == CACHE_GET_MTMODE)
+		return MT_NICE_FILTER;
+
+	return 0;
+}
+
+
+int CTraceClip::QueryChild(int i_cachehint)
+{
+	if (child->GetVersion() < 5)
+		return 0;
+
+	return child->SetCacheHints(i_cachehint, 0);
+}
+
+
+#endif //_FRAMETRACER_H
@@ -0,0 +1,432 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_JSONREADER_H)
+#define _JSONREADER_H
+
+#include "common.h"
+
+//reads the documents written by CJSONWriter back, e.g. a results file used as a baseline.
+//all values end up in one flat node list, node 0 is the root. strings stay UTF-8
+#define JSON_NULL                   0
+#define JSON_BOOL                   1
+#define JSON_NUMBER                 2
+#define JSON_STRING                 3
+#define JSON_ARRAY                  4
+#define JSON_OBJECT                 5
+
+#define JSON_NOT_FOUND              ((size_t)-1)
+#define JSON_MAX_DEPTH              64
+
+
+struct stJSONNode
+{
+	int    iType;
+	double dNumber;              //numbers, and 0/1 for booleans
+	string sValue;               //strings
+	string sKey;                 //name in the parent object
+	vector<size_t> vChildren;
+};
+
+
+class CJSONReader
+{
+public:
+	CJSONReader();
+
+	BOOL   Parse(string &s_text);
+	BOOL   Load(string &s_file);
+	size_t Find(size_t n_node, const char *p_path);
+	double GetNumber(size_t n_node, const char *p_path, double d_default);
+	string GetString(size_t n_node, const char *p_path);
+
+	vector<stJSONNode> vNodes;
+	string sError;
+
+private:
+	size_t ParseValue(int i_depth);
+	BOOL   ParseString(string &s_value);
+	void   SkipWhiteSpace();
+	BOOL   Fail(const char *p_reason);
+
+	const char *pText;
+	size_t nPos;
+	size_t nSize;
+};
+
+
+CJSONReader::CJSONReader()
+{
+	pText = NULL;
+	nPos = 0;
+	nSize = 0;
+	sError = "";
+}
+
+
+BOOL CJSONReader::Load(string &s_file)
+{
+	ifstream hFile(s_file.c_str(), std::ios::in | std::ios::binary);
+	if (!hFile.is_open())
+	{
+		sError = "Cannot open \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	string sText = "";
+	char szBuffer[65536];
+	while (hFile.read(szBuffer, sizeof(szBuffer)) || (hFile.gcount() > 0))
+		sText.append(szBuffer, (size_t)hFile.gcount());
+	hFile.close();
+
+	if (!Parse(sText))
+	{
+		sError = "\"" + s_file + "\": " + sError;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+BOOL CJSONReader::Parse(string &s_text)
+{
+	vNodes.clear();
+	sError = "";
+	pText = s_text.c_str();
+	nSize = s_text.length();
+	nPos = 0;
+
+	//UTF-8 byte order mark
+	if ((nSize >= 3) && ((unsigned char)pText[0] == 0xEF) && ((unsigned char)pText[1] == 0xBB) && ((unsigned char)pText[2] == 0xBF))
+		nPos = 3;
+
+	if (ParseValue(0) == JSON_NOT_FOUND)
+	{
+		vNodes.clear();
+		return FALSE;
+	}
+
+	SkipWhiteSpace();
+	if (nPos != nSize)
+	{
+		vNodes.clear();
+		return Fail("unexpected data after the document");
+	}
+
+	return TRUE;
+}
+
+
+BOOL CJSONReader::Fail(const char *p_reason)
+{
+	if (sError == "")
+	{
+		char szTemp[256];
+		_snprintf(szTemp, sizeof(szTemp) - 1, "%s at offset %u", p_reason, (unsigned int)nPos);
+		szTemp[sizeof(szTemp) - 1] = 0;
+		sError = szTemp;
+	}
+
+	return FALSE;
+}
+
+
+void CJSONReader::SkipWhiteSpace()
+{
+	while ((nPos < nSize) && ((pText[nPos] == ' ') || (pText[nPos] == '\t') || (pText[nPos] == '\r') || (pText[nPos] == '\n')))
+		nPos++;
+
+	return;
+}
+
+
+BOOL CJSONReader::ParseString(string &s_value)
+{
+	//nPos is on the opening quote
+	s_value = "";
+	nPos++;
+	while (nPos < nSize)
+	{
+		char c = pText[nPos++];
+		if (c == '\"')
+			return TRUE;
+
+		if ((unsigned char)c < 0x20)
+			return Fail("control character in string");
+
+		if (c != '\\')
+		{
+			s_value += c;
+			continue;
+		}
+
+		if (nPos >= nSize)
+			break;
+
+		c = pText[nPos++];
+		switch (c)
+		{
+			case '\"': s_value += '\"'; break;
+			case '\\': s_value += '\\'; break;
+			case '/':  s_value += '/';  break;
+			case 'b':  s_value += '\b'; break;
+			case 'f':  s_value += '\f'; break;
+			case 'n':  s_value += '\n'; break;
+			case 'r':  s_value += '\r'; break;
+			case 't':  s_value += '\t'; break;
+			case 'u':
+			{
+				if ((nPos + 4) > nSize)
+					return Fail("truncated \\u escape");
+
+				unsigned int uiCode = 0;
+				for (int i = 0; i < 4; i++)
+				{
+					char h = pText[nPos++];
+					uiCode <<= 4;
+					if ((h >= '0') && (h <= '9'))      uiCode |= (unsigned int)(h - '0');
+					else if ((h >= 'a') && (h <= 'f')) uiCode |= (unsigned int)(h - 'a' + 10);
+					else if ((h >= 'A') && (h <= 'F')) uiCode |= (unsigned int)(h - 'A' + 10);
+					else return Fail("invalid \\u escape");
+				}
+
+				//surrogate pairs are not combined, the writer never produces them
+				if (uiCode < 0x80)
+					s_value += (char)uiCode;
+				else if (uiCode < 0x800)
+				{
+					s_value += (char)(0xC0 | (uiCode >> 6));
+					s_value += (char)(0x80 | (uiCode & 0x3F));
+				}
+				else
+				{
+					s_value += (char)(0xE0 | (uiCode >> 12));
+					s_value += (char)(0x80 | ((uiCode >> 6) & 0x3F));
+					s_value += (char)(0x80 | (uiCode & 0x3F));
+				}
+				break;
+			}
+			default:
+				return Fail("invalid escape");
+		}
+	}
+
+	return Fail("unterminated string");
+}
+
+
+size_t CJSONReader::ParseValue(int i_depth)
+{
+	if (i_depth > JSON_MAX_DEPTH)
+	{
+		Fail("nested too deeply");
+		return JSON_NOT_FOUND;
+	}
+
+	SkipWhiteSpace();
+	if (nPos >= nSize)
+	{
+		Fail("unexpected end of document");
+		return JSON_NOT_FOUND;
+	}
+
+	size_t nNode = vNodes.size();
+	stJSONNode node;
+	node.iType = JSON_NULL;
+	node.dNumber = 0.0;
+	vNodes.push_back(node);
+
+	char c = pText[nPos];
+	if ((c == '{') || (c == '['))
+	{
+		//children are parsed first, their indices are attached afterwards since vNodes may move
+		BOOL bObject = (c == '{');
+		char cClose = bObject ? '}' : ']';
+		vector<size_t> vChildren;
+		vector<string> vKeys;
+		nPos++;
+
+		SkipWhiteSpace();
+		if ((nPos < nSize) && (pText[nPos] == cClose))
+			nPos++;
+		else
+		{
+			for (;;)
+			{
+				string sKey = "";
+				if (bObject)
+				{
+					SkipWhiteSpace();
+					if ((nPos >= nSize) || (pText[nPos] != '\"'))
+					{
+						Fail("expected a key");
+						return JSON_NOT_FOUND;
+					}
+					if (!ParseString(sKey))
+						return JSON_NOT_FOUND;
+
+					SkipWhiteSpace();
+					if ((nPos >= nSize) || (pText[nPos] != ':'))
+					{
+						Fail("expected ':'");
+						return JSON_NOT_FOUND;
+					}
+					nPos++;
+				}
+
+				size_t nChild = ParseValue(i_depth + 1);
+				if (nChild == JSON_NOT_FOUND)
+					return JSON_NOT_FOUND;
+				vChildren.push_back(nChild);
+				vKeys.push_back(sKey);
+
+				SkipWhiteSpace();
+				if (nPos >= nSize)
+				{
+					Fail("unexpected end of document");
+					return JSON_NOT_FOUND;
+				}
+				if (pText[nPos] == ',')
+				{
+					nPos++;
+					continue;
+				}
+				if (pText[nPos] == cClose)
+				{
+					nPos++;
+					break;
+				}
+
+				Fail(bObject ? "expected ',' or '}'" : "expected ',' or ']'");
+				return JSON_NOT_FOUND;
+			}
+		}
+
+		for (size_t i = 0; i < vChildren.size(); i++)
+			vNodes[vChildren[i]].sKey = vKeys[i];
+		vNodes[nNode].iType = bObject ? JSON_OBJECT : JSON_ARRAY;
+		vNodes[nNode].vChildren.swap(vChildren);
+
+		return nNode;
+	}
+
+	if (c == '\"')
+	{
+		string sValue = "";
+		if (!ParseString(sValue))
+			return JSON_NOT_FOUND;
+		vNodes[nNode].iType = JSON_STRING;
+		vNodes[nNode].sValue = sValue;
+
+		return nNode;
+	}
+
+	if ((nSize - nPos >= 4) && (strncmp(pText + nPos, "true", 4) == 0))
+	{
+		nPos += 4;
+		vNodes[nNode].iType = JSON_BOOL;
+		vNodes[nNode].dNumber = 1.0;
+		return nNode;
+	}
+
+	if ((nSize - nPos >= 5) && (strncmp(pText + nPos, "false", 5) == 0))
+	{
+		nPos += 5;
+		vNodes[nNode].iType = JSON_BOOL;
+		return nNode;
+	}
+
+	if ((nSize - nPos >= 4) && (strncmp(pText + nPos, "null", 4) == 0))
+	{
+		nPos += 4;
+		return nNode;
+	}
+
+	//numbers, the text is terminated by the caller's string
+	char *pEnd = NULL;
+	double dValue = strtod(pText + nPos, &pEnd);
+	if ((pEnd == pText + nPos) || !((c == '-') || ((c >= '0') && (c <= '9'))))
+	{
+		Fail("invalid value");
+		return JSON_NOT_FOUND;
+	}
+
+	nPos = (size_t)(pEnd - pText);
+	vNodes[nNode].iType = JSON_NUMBER;
+	vNodes[nNode].dNumber = dValue;
+
+	return nNode;
+}
+
+
+size_t CJSONReader::Find(size_t n_node, const char *p_path)
+{
+	//dotted path of object keys below n_node, e.g. "summary.fps_average"
+	string sPath = p_path;
+	size_t nStart = 0;
+	while ((n_node < vNodes.size()) && (nStart <= sPath.length()))
+	{
+		size_t nDot = sPath.find('.', nStart);
+		string sKey = sPath.substr(nStart, (nDot == string::npos) ? string::npos : nDot - nStart);
+
+		if (vNodes[n_node].iType != JSON_OBJECT)
+			return JSON_NOT_FOUND;
+
+		size_t nChild = JSON_NOT_FOUND;
+		for (size_t i = 0; i < vNodes[n_node].vChildren.size(); i++)
+		{
+			if (vNodes[vNodes[n_node].vChildren[i]].sKey == sKey)
+			{
+				nChild = vNodes[n_node].vChildren[i];
+				break;
+			}
+		}
+
+		if ((nChild == JSON_NOT_FOUND) || (nDot == string::npos))
+			return nChild;
+
+		n_node = nChild;
+		nStart = nDot + 1;
+	}
+
+	return JSON_NOT_FOUND;
+}
+
+
+double CJSONReader::GetNumber(size_t n_node, const char *p_path, double d_default)
+{
+	size_t nNode = Find(n_node, p_path);
+	if ((nNode == JSON_NOT_FOUND) || (vNodes[nNode].iType != JSON_NUMBER))
+		return d_default;
+
+	return vNodes[nNode].dNumber;
+}
+
+
+string CJSONReader::GetString(size_t n_node, const char *p_path)
+{
+	size_t nNode = Find(n_node, p_path);
+	if ((nNode == JSON_NOT_FOUND) || (vNodes[nNode].iType != JSON_STRING))
+		return "";
+
+	return vNodes[nNode].sValue;
+}
+
+
+#endif //_JSONREADER_H
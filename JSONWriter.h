@@ -0,0 +1,400 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_JSONWRITER_H)
+#define _JSONWRITER_H
+
+#include "common.h"
+#include <float.h>
+
+//results for machines: compact JSON, built front to back into one string.
+//keys are ignored inside arrays, pass NULL there. non-finite numbers become null,
+//strings are converted from the ANSI code page to UTF-8
+#define JSON_SCHEMA_NAME            "avsmeter-results"
+#define JSON_SCHEMA_VERSION         1
+
+
+class CJSONWriter
+{
+public:
+	CJSONWriter();
+
+	void   BeginObject(const char *p_key);
+	void   EndObject();
+	void   BeginArray(const char *p_key);
+	void   EndArray();
+	void   Unwind(size_t n_depth);
+	void   EndAll();
+	void   Clear();
+	size_t GetDepth();
+
+	void   String(const char *p_key, const char *p_value);
+	void   String(const char *p_key, string &s_value);
+	void   Number(const char *p_key, double d_value, int i_decimals);
+	void   UInt(const char *p_key, unsigned __int64 ui_value);
+	void   Int(const char *p_key, __int64 i_value);
+	void   Bool(const char *p_key, BOOL b_value);
+	void   Null(const char *p_key);
+
+	string sText;
+
+private:
+	void   Key(const char *p_key);
+	void   Quote(const char *p_text);
+
+	vector<char> vClose;   //'}' or ']' per open level
+	vector<BOOL> vEmpty;   //nothing written on that level yet
+};
+
+
+//one JSON object per line, every line goes to the file when it is complete
+//so that a reader can follow the file while the run is going on
+class CNDJSONStream
+{
+public:
+	CNDJSONStream();
+	virtual ~CNDJSONStream();
+
+	BOOL   Open(string &s_file);
+	void   Write(CJSONWriter &json);
+	void   Close();
+
+	string sError;
+
+private:
+	HANDLE hFile;
+};
+
+
+CJSONWriter::CJSONWriter()
+{
+	Clear();
+}
+
+
+void CJSONWriter::Clear()
+{
+	sText = "";
+	vClose.clear();
+	vEmpty.clear();
+
+	return;
+}
+
+
+void CJSONWriter::Key(const char *p_key)
+{
+	if (vEmpty.size() > 0)
+	{
+		if (!vEmpty.back())
+			sText += ',';
+		vEmpty.back() = FALSE;
+	}
+
+	if (p_key && (vClose.size() > 0) && (vClose.back() == '}'))
+	{
+		Quote(p_key);
+		sText += ':';
+	}
+
+	return;
+}
+
+
+void CJSONWriter::Quote(const char *p_text)
+{
+	string sUTF8 = p_text;
+
+	//the Win32 API hands out ANSI strings, only convert when they are not plain ASCII
+	BOOL bASCII = TRUE;
+	for (size_t i = 0; i < sUTF8.length(); i++)
+	{
+		if ((unsigned char)sUTF8[i] >= 0x80)
+		{
+			bASCII = FALSE;
+			break;
+		}
+	}
+
+	if (!bASCII)
+	{
+		int iWide = ::MultiByteToWideChar(CP_ACP, 0, p_text, -1, NULL, 0);
+		if (iWide > 0)
+		{
+			vector<wchar_t> vWide(iWide);
+			::MultiByteToWideChar(CP_ACP, 0, p_text, -1, &vWide[0], iWide);
+			int iUTF8 = ::WideCharToMultiByte(CP_UTF8, 0, &vWide[0], -1, NULL, 0, NULL, NULL);
+			if (iUTF8 > 0)
+			{
+				vector<char> vUTF8(iUTF8);
+				::WideCharToMultiByte(CP_UTF8, 0, &vWide[0], -1, &vUTF8[0], iUTF8, NULL, NULL);
+				sUTF8 = &vUTF8[0];
+			}
+		}
+	}
+
+	static const char szHex[] = "0123456789abcdef";
+	sText += '\"';
+	for (size_t i = 0; i < sUTF8.length(); i++)
+	{
+		unsigned char c = (unsigned char)sUTF8[i];
+		switch (c)
+		{
+			case '\"': sText += "\\\""; break;
+			case '\\': sText += "\\\\"; break;
+			case '\n': sText += "\\n";  break;
+			case '\r': sText += "\\r";  break;
+			case '\t': sText += "\\t";  break;
+			default:
+				if (c < 0x20)
+				{
+					sText += "\\u00";
+					sText += szHex[c >> 4];
+					sText += szHex[c & 0x0F];
+				}
+				else
+					sText += (char)c;
+		}
+	}
+	sText += '\"';
+
+	return;
+}
+
+
+void CJSONWriter::BeginObject(const char *p_key)
+{
+	Key(p_key);
+	sText += '{';
+	vClose.push_back('}');
+	vEmpty.push_back(TRUE);
+
+	return;
+}
+
+
+void CJSONWriter::BeginArray(const char *p_key)
+{
+	Key(p_key);
+	sText += '[';
+	vClose.push_back(']');
+	vEmpty.push_back(TRUE);
+
+	return;
+}
+
+
+void CJSONWriter::EndObject()
+{
+	if ((vClose.size() == 0) || (vClose.back() != '}'))
+		return;
+
+	sText += '}';
+	vClose.pop_back();
+	vEmpty.pop_back();
+
+	return;
+}
+
+
+void CJSONWriter::EndArray()
+{
+	if ((vClose.size() == 0) || (vClose.back() != ']'))
+		return;
+
+	sText += ']';
+	vClose.pop_back();
+	vEmpty.pop_back();
+
+	return;
+}
+
+
+void CJSONWriter::Unwind(size_t n_depth)
+{
+	//an aborted run still leaves a valid document
+	while (vClose.size() > n_depth)
+	{
+		sText += vClose.back();
+		vClose.pop_back();
+		vEmpty.pop_back();
+	}
+
+	return;
+}
+
+
+void CJSONWriter::EndAll()
+{
+	Unwind(0);
+
+	return;
+}
+
+
+size_t CJSONWriter::GetDepth()
+{
+	return vClose.size();
+}
+
+
+void CJSONWriter::String(const char *p_key, const char *p_value)
+{
+	Key(p_key);
+	Quote(p_value);
+
+	return;
+}
+
+
+void CJSONWriter::String(const char *p_key, string &s_value)
+{
+	Key(p_key);
+	Quote(s_value.c_str());
+
+	return;
+}
+
+
+void CJSONWriter::Number(const char *p_key, double d_value, int i_decimals)
+{
+	Key(p_key);
+	if (!_finite(d_value))
+	{
+		sText += "null";
+		return;
+	}
+
+	char szTemp[64];
+	int iLen = _snprintf(szTemp, sizeof(szTemp) - 1, "%.*f", i_decimals, d_value);
+	if ((iLen < 0) || (iLen >= (int)sizeof(szTemp)))
+	{
+		sText += "null";
+		return;
+	}
+	szTemp[iLen] = 0;
+	sText += szTemp;
+
+	return;
+}
+
+
+void CJSONWriter::UInt(const char *p_key, unsigned __int64 ui_value)
+{
+	Key(p_key);
+
+	char szTemp[32];
+	_snprintf(szTemp, sizeof(szTemp) - 1, "%I64u", ui_value);
+	szTemp[sizeof(szTemp) - 1] = 0;
+	sText += szTemp;
+
+	return;
+}
+
+
+void CJSONWriter::Int(const char *p_key, __int64 i_value)
+{
+	Key(p_key);
+
+	char szTemp[32];
+	_snprintf(szTemp, sizeof(szTemp) - 1, "%I64d", i_value);
+	szTemp[sizeof(szTemp) - 1] = 0;
+	sText += szTemp;
+
+	return;
+}
+
+
+void CJSONWriter::Bool(const char *p_key, BOOL b_value)
+{
+	Key(p_key);
+	sText += b_value ? "true" : "false";
+
+	return;
+}
+
+
+void CJSONWriter::Null(const char *p_key)
+{
+	Key(p_key);
+	sText += "null";
+
+	return;
+}
+
+
+CNDJSONStream::CNDJSONStream()
+{
+	hFile = INVALID_HANDLE_VALUE;
+	sError = "";
+}
+
+CNDJSONStream::~CNDJSONStream()
+{
+	Close();
+}
+
+
+BOOL CNDJSONStream::Open(string &s_file)
+{
+	Close();
+
+	hFile = ::CreateFile(s_file.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		sError = "Cannot create \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	sError = "";
+
+	return TRUE;
+}
+
+
+void CNDJSONStream::Write(CJSONWriter &json)
+{
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	//one call per line, a reader never sees half a record unless the disk is full
+	string sLine = json.sText + "\n";
+	DWORD dwWritten = 0;
+	if (!::WriteFile(hFile, sLine.c_str(), (DWORD)sLine.length(), &dwWritten, NULL) || (dwWritten != (DWORD)sLine.length()))
+	{
+		sError = "Cannot write the NDJSON stream (disk full?)";
+		Close();
+	}
+
+	return;
+}
+
+
+void CNDJSONStream::Close()
+{
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	::CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+
+	return;
+}
+
+
+#endif //_JSONWRITER_H
@@ -0,0 +1,365 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_LIVESTATS_H)
+#define _LIVESTATS_H
+
+#include "common.h"
+#include "Monitor.h"
+
+/*
+Live stats in shared memory, like GPU-Z's GPUZShMem: every instance owns one named mapping,
+"Global\AVSMeterLiveStats_<process ID>", which disappears with the process. Without
+SeCreateGlobalPrivilege (not elevated, no service) the mapping is created in "Local\" and is
+only visible in the same session, a reader tries both. A monitor maps it read-only and copies
+the block, no call into AVSMeter and no syscall per read.
+
+The layout is fixed (no pointers or size_t), x86 and x64 builds read each other's blocks.
+The header is written once. The fields after "sequence" are a seqlock: the writer makes the
+sequence odd, updates, makes it even again. A reader copies the block and retries if the
+sequence was odd or changed meanwhile. Newer versions only append fields and raise "size".
+*/
+#define LIVESTATS_NAME_GLOBAL       "Global\\AVSMeterLiveStats_%u"
+#define LIVESTATS_NAME_LOCAL        "Local\\AVSMeterLiveStats_%u"
+#define LIVESTATS_MAGIC             0x534C4D41    //"AMLS"
+#define LIVESTATS_VERSION           1
+#define LIVESTATS_READ_RETRIES      1000          //a writer that died during an update leaves an odd sequence
+
+#define LIVESTATS_STATE_STARTING    0
+#define LIVESTATS_STATE_RUNNING     1
+#define LIVESTATS_STATE_FINISHED    2
+
+
+#pragma pack(push, 8)
+
+struct stLiveStats
+{
+	DWORD            magic;
+	DWORD            version;
+	DWORD            size;               //sizeof(stLiveStats) of the writer
+	DWORD            pid;
+	char             avsm_version[32];
+	char             script[MAX_PATH];   //ANSI, truncated
+	unsigned __int64 started;            //FILETIME, UTC
+
+	volatile LONG    sequence;
+	DWORD            state;
+	unsigned __int64 updated;            //FILETIME, UTC
+	double           elapsed;            //seconds
+	double           fps;                //current interval
+	double           fps_average;
+	double           frametime_p50;      //ms
+	double           frametime_p95;
+	double           frametime_p99;
+	double           cpu_usage;          //percent, 100 = all cores
+	double           busy_cores;
+	DWORD            frames_read;
+	DWORD            frames_total;
+	DWORD            process_memory;     //MiB
+	DWORD            commit;             //MiB
+	DWORD            threads;
+	DWORD            gpu_usage;          //percent
+};
+
+#pragma pack(pop)
+
+
+class CLiveStats
+{
+public:
+	CLiveStats();
+	virtual ~CLiveStats();
+
+	BOOL   Open(string &s_avsmversion, string &s_avsfile);
+	void   Publish(stFrameLoopStats &stats, stMonitorSample &sample);
+	void   SetState(DWORD dw_state);
+	void   Close();
+
+	static BOOL Read(DWORD dw_pid, stLiveStats &stats);
+	static void ReadAll(vector<stLiveStats> &v_stats);
+
+	string sError;
+	BOOL   bGlobal;
+
+private:
+	void   BeginUpdate();
+	void   EndUpdate();
+	BOOL   HasGlobalPrivilege();
+	static BOOL ReadMapping(const char *sz_format, DWORD dw_pid, stLiveStats &stats);
+
+	HANDLE       hMapFile;
+	stLiveStats  *pStats;
+};
+
+
+CLiveStats::CLiveStats()
+{
+	hMapFile = NULL;
+	pStats = NULL;
+	sError = "";
+	bGlobal = FALSE;
+}
+
+CLiveStats::~CLiveStats()
+{
+	Close();
+}
+
+
+BOOL CLiveStats::Open(string &s_avsmversion, string &s_avsfile)
+{
+	Close();
+
+	char szName[64];
+	bGlobal = FALSE;
+	if (HasGlobalPrivilege())
+	{
+		_snprintf(szName, sizeof(szName) - 1, LIVESTATS_NAME_GLOBAL, (unsigned int)::GetCurrentProcessId());
+		szName[sizeof(szName) - 1] = 0;
+		hMapFile = ::CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(stLiveStats), szName);
+		bGlobal = hMapFile ? TRUE : FALSE;
+	}
+
+	if (!hMapFile)
+	{
+		_snprintf(szName, sizeof(szName) - 1, LIVESTATS_NAME_LOCAL, (unsigned int)::GetCurrentProcessId());
+		szName[sizeof(szName) - 1] = 0;
+		hMapFile = ::CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(stLiveStats), szName);
+	}
+
+	if (!hMapFile)
+	{
+		sError = "Cannot create the live stats shared memory";
+		return FALSE;
+	}
+
+	pStats = (stLiveStats *)::MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(stLiveStats));
+	if (!pStats)
+	{
+		sError = "Cannot map the live stats shared memory";
+		Close();
+		return FALSE;
+	}
+
+	//the magic comes last, a reader ignores the block until the header is complete
+	FILETIME ftNow;
+	::GetSystemTimeAsFileTime(&ftNow);
+	::ZeroMemory(pStats, sizeof(stLiveStats));
+	pStats->version = LIVESTATS_VERSION;
+	pStats->size = sizeof(stLiveStats);
+	pStats->pid = ::GetCurrentProcessId();
+	strncpy(pStats->avsm_version, s_avsmversion.c_str(), sizeof(pStats->avsm_version) - 1);
+	strncpy(pStats->script, s_avsfile.c_str(), sizeof(pStats->script) - 1);
+	pStats->started = ((unsigned __int64)ftNow.dwHighDateTime << 32) | ftNow.dwLowDateTime;
+	pStats->updated = pStats->started;
+	pStats->state = LIVESTATS_STATE_STARTING;
+	::MemoryBarrier();
+	pStats->magic = LIVESTATS_MAGIC;
+	sError = "";
+
+	return TRUE;
+}
+
+
+void CLiveStats::Close()
+{
+	if (pStats)
+	{
+		::UnmapViewOfFile(pStats);
+		pStats = NULL;
+	}
+
+	if (hMapFile)
+	{
+		::CloseHandle(hMapFile);
+		hMapFile = NULL;
+	}
+
+	return;
+}
+
+
+void CLiveStats::BeginUpdate()
+{
+	::InterlockedIncrement(&pStats->sequence);
+
+	return;
+}
+
+
+void CLiveStats::EndUpdate()
+{
+	FILETIME ftNow;
+	::GetSystemTimeAsFileTime(&ftNow);
+	pStats->updated = ((unsigned __int64)ftNow.dwHighDateTime << 32) | ftNow.dwLowDateTime;
+	::InterlockedIncrement(&pStats->sequence);
+
+	return;
+}
+
+
+void CLiveStats::Publish(stFrameLoopStats &stats, stMonitorSample &sample)
+{
+	if (!pStats)
+		return;
+
+	BeginUpdate();
+	pStats->state = LIVESTATS_STATE_RUNNING;
+	pStats->elapsed = stats.elapsed;
+	pStats->fps = stats.fps;
+	pStats->fps_average = stats.fps_average;
+	pStats->frametime_p50 = stats.frametime_p50;
+	pStats->frametime_p95 = stats.frametime_p95;
+	pStats->frametime_p99 = stats.frametime_p99;
+	pStats->cpu_usage = sample.cpu_usage;
+	pStats->busy_cores = sample.concurrency;
+	pStats->frames_read = stats.frames_read;
+	pStats->frames_total = stats.frames_total;
+	pStats->process_memory = sample.process_memory;
+	pStats->commit = sample.commit;
+	pStats->threads = sample.num_threads;
+	pStats->gpu_usage = sample.gpu_usage;
+	EndUpdate();
+
+	return;
+}
+
+
+void CLiveStats::SetState(DWORD dw_state)
+{
+	if (!pStats)
+		return;
+
+	BeginUpdate();
+	pStats->state = dw_state;
+	EndUpdate();
+
+	return;
+}
+
+
+BOOL CLiveStats::HasGlobalPrivilege()
+{
+	//SeCreateGlobalPrivilege is held by administrators and services, the check avoids a failing create
+	HANDLE hToken = NULL;
+	if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_QUERY, &hToken))
+		return FALSE;
+
+	BOOL bRet = FALSE;
+	PRIVILEGE_SET ps;
+	::ZeroMemory(&ps, sizeof(ps));
+	ps.PrivilegeCount = 1;
+	ps.Control = PRIVILEGE_SET_ALL_NECESSARY;
+	if (::LookupPrivilegeValueA(NULL, "SeCreateGlobalPrivilege", &ps.Privilege[0].Luid))
+	{
+		BOOL bHeld = FALSE;
+		if (::PrivilegeCheck(hToken, &ps, &bHeld))
+			bRet = bHeld;
+	}
+	::CloseHandle(hToken);
+
+	return bRet;
+}
+
+
+BOOL CLiveStats::Read(DWORD dw_pid, stLiveStats &stats)
+{
+	//an instance without the privilege created its mapping in its own session
+	if (ReadMapping(LIVESTATS_NAME_GLOBAL, dw_pid, stats))
+		return TRUE;
+
+	return ReadMapping(LIVESTATS_NAME_LOCAL, dw_pid, stats);
+}
+
+
+BOOL CLiveStats::ReadMapping(const char *sz_format, DWORD dw_pid, stLiveStats &stats)
+{
+	char szName[64];
+	_snprintf(szName, sizeof(szName) - 1, sz_format, (unsigned int)dw_pid);
+	szName[sizeof(szName) - 1] = 0;
+
+	HANDLE hMap = ::OpenFileMapping(FILE_MAP_READ, FALSE, szName);
+	if (!hMap)
+		return FALSE;
+
+	BOOL bRet = FALSE;
+	const stLiveStats *pMap = (const stLiveStats *)::MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+	if (pMap)
+	{
+		//an older writer has a shorter block, the missing fields stay zero
+		if ((pMap->magic == LIVESTATS_MAGIC) && (pMap->size >= 4 * sizeof(DWORD)))
+		{
+			size_t nSize = (pMap->size < sizeof(stLiveStats)) ? pMap->size : sizeof(stLiveStats);
+			for (int i = 0; i < LIVESTATS_READ_RETRIES; i++)
+			{
+				LONG lBefore = pMap->sequence;
+				if (lBefore & 1)
+				{
+					YieldProcessor();
+					continue;
+				}
+
+				::MemoryBarrier();
+				::ZeroMemory(&stats, sizeof(stLiveStats));
+				memcpy(&stats, (const void *)pMap, nSize);
+				::MemoryBarrier();
+
+				if (pMap->sequence == lBefore)
+				{
+					bRet = TRUE;
+					break;
+				}
+			}
+		}
+		::UnmapViewOfFile(pMap);
+	}
+	::CloseHandle(hMap);
+
+	stats.avsm_version[sizeof(stats.avsm_version) - 1] = 0;
+	stats.script[sizeof(stats.script) - 1] = 0;
+
+	return bRet;
+}
+
+
+void CLiveStats::ReadAll(vector<stLiveStats> &v_stats)
+{
+	//only the process list is enumerated, the names of the mappings follow from the IDs
+	v_stats.clear();
+
+	HANDLE hSnapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if (hSnapshot == INVALID_HANDLE_VALUE)
+		return;
+
+	PROCESSENTRY32 pe;
+	pe.dwSize = sizeof(PROCESSENTRY32);
+	BOOL bNext = ::Process32First(hSnapshot, &pe);
+	while (bNext)
+	{
+		stLiveStats stats;
+		if ((pe.th32ProcessID != ::GetCurrentProcessId()) && Read(pe.th32ProcessID, stats))
+			v_stats.push_back(stats);
+		bNext = ::Process32Next(hSnapshot, &pe);
+	}
+	::CloseHandle(hSnapshot);
+
+	return;
+}
+
+
+#endif //_LIVESTATS_H
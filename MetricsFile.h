@@ -0,0 +1,584 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_METRICSFILE_H)
+#define _METRICSFILE_H
+
+#include "common.h"
+#include "FrameStore.h"
+
+/*
+Binary metrics file (.amb), little endian:
+
+Header:  "AVSM", WORD version, WORD reserved, DWORD flags,
+         4 strings (DWORD length + chars): AVSMeter version, script path, start time, script text,
+         DWORD CRC32 of everything before it
+Chunk:   "CHNK", DWORD frames, WORD columns, WORD encoding,
+         per column: WORD column id (FRAMESTORE_COL_*), WORD reserved, DWORD bytes,
+         column data, DWORD CRC32 of the chunk
+End:     "ENDS", DWORD frames in the file, DWORD CRC32
+
+Chunks are written and flushed by a background thread once per second, a reader stops at
+the first incomplete or corrupt chunk, so files of crashed or running processes stay usable.
+*/
+
+#define METRICSFILE_VERSION         1
+#define METRICSFILE_MAGIC_HEADER    0x4D535641    //"AVSM"
+#define METRICSFILE_MAGIC_CHUNK     0x4B4E4843    //"CHNK"
+#define METRICSFILE_MAGIC_END       0x53444E45    //"ENDS"
+#define METRICSFILE_ENCODING_DELTA  1             //zigzag/varint deltas, restarting at 0 in every chunk
+#define METRICSFILE_FLAG_GPU        0x00000001
+#define METRICSFILE_FLAG_NVVP       0x00000002
+#define METRICSFILE_FLUSH_MS        1000
+#define METRICSFILE_MAX_COLUMNS     64
+#define METRICSFILE_MAX_STRING      (16 * 1048576)
+
+
+struct stMetricsHeader
+{
+	WORD   wVersion;
+	DWORD  dwFlags;
+	string sAVSMVersion;
+	string sScriptFile;
+	string sDateTime;
+	string sScriptText;
+};
+
+
+DWORD MetricsCRC32(const BYTE *p_data, size_t n_size, DWORD dw_crc)
+{
+	static DWORD dwTable[256];
+	static BOOL bTable = FALSE;
+	if (!bTable)
+	{
+		for (DWORD i = 0; i < 256; i++)
+		{
+			DWORD c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+			dwTable[i] = c;
+		}
+		bTable = TRUE;
+	}
+
+	dw_crc = ~dw_crc;
+	for (size_t n = 0; n < n_size; n++)
+		dw_crc = dwTable[(dw_crc ^ p_data[n]) & 0xFF] ^ (dw_crc >> 8);
+
+	return ~dw_crc;
+}
+
+
+void MetricsPut(vector<BYTE> &v_buffer, const void *p_data, size_t n_size)
+{
+	const BYTE *p = (const BYTE *)p_data;
+	v_buffer.insert(v_buffer.end(), p, p + n_size);
+
+	return;
+}
+
+
+void MetricsPutString(vector<BYTE> &v_buffer, string &s_value)
+{
+	DWORD dwLength = (DWORD)s_value.length();
+	MetricsPut(v_buffer, &dwLength, sizeof(dwLength));
+	MetricsPut(v_buffer, s_value.c_str(), s_value.length());
+
+	return;
+}
+
+
+class CMetricsWriter
+{
+public:
+	CMetricsWriter();
+	virtual ~CMetricsWriter();
+
+	BOOL   Open(string &s_file, stMetricsHeader &header);
+	void   Add(stFrameRecord &record);
+	void   Close(BOOL b_complete);
+
+	unsigned __int64 ui64Frames;
+	unsigned int uiChunks;
+	string sError;
+
+private:
+	static unsigned __stdcall WriterThread(void *p_param);
+	void   WriteChunk(vector<stFrameRecord> &v_records);
+	BOOL   WriteBuffer(vector<BYTE> &v_buffer);
+
+	CRITICAL_SECTION csPending;
+	vector<stFrameRecord> vPending;
+	HANDLE hFile;
+	HANDLE hThread;
+	HANDLE hStopEvent;
+};
+
+
+CMetricsWriter::CMetricsWriter()
+{
+	::InitializeCriticalSection(&csPending);
+	hFile = INVALID_HANDLE_VALUE;
+	hThread = NULL;
+	hStopEvent = NULL;
+	ui64Frames = 0;
+	uiChunks = 0;
+	sError = "";
+}
+
+CMetricsWriter::~CMetricsWriter()
+{
+	Close(FALSE);
+	::DeleteCriticalSection(&csPending);
+}
+
+
+BOOL CMetricsWriter::Open(string &s_file, stMetricsHeader &header)
+{
+	if (hFile != INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	//readers may open the file while it is being written
+	hFile = ::CreateFile(s_file.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		sError = "Cannot create \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	vector<BYTE> vBuffer;
+	DWORD dwMagic = METRICSFILE_MAGIC_HEADER;
+	WORD wVersion = METRICSFILE_VERSION;
+	WORD wReserved = 0;
+	MetricsPut(vBuffer, &dwMagic, sizeof(dwMagic));
+	MetricsPut(vBuffer, &wVersion, sizeof(wVersion));
+	MetricsPut(vBuffer, &wReserved, sizeof(wReserved));
+	MetricsPut(vBuffer, &header.dwFlags, sizeof(header.dwFlags));
+	MetricsPutString(vBuffer, header.sAVSMVersion);
+	MetricsPutString(vBuffer, header.sScriptFile);
+	MetricsPutString(vBuffer, header.sDateTime);
+	MetricsPutString(vBuffer, header.sScriptText);
+	DWORD dwCRC = MetricsCRC32(&vBuffer[0], vBuffer.size(), 0);
+	MetricsPut(vBuffer, &dwCRC, sizeof(dwCRC));
+
+	if (!WriteBuffer(vBuffer))
+	{
+		::CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+		return FALSE;
+	}
+
+	hStopEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (hStopEvent)
+		hThread = (HANDLE)_beginthreadex(NULL, 0, WriterThread, this, 0, NULL);
+
+	if (!hThread)
+	{
+		sError = "Cannot start the metrics writer thread";
+		if (hStopEvent)
+			::CloseHandle(hStopEvent);
+		hStopEvent = NULL;
+		::CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+void CMetricsWriter::Add(stFrameRecord &record)
+{
+	if (!hThread)
+		return;
+
+	::EnterCriticalSection(&csPending);
+	vPending.push_back(record);
+	::LeaveCriticalSection(&csPending);
+
+	return;
+}
+
+
+unsigned __stdcall CMetricsWriter::WriterThread(void *p_param)
+{
+	CMetricsWriter *pWriter = (CMetricsWriter *)p_param;
+	vector<stFrameRecord> vRecords;
+	BOOL bStop = FALSE;
+
+	while (!bStop)
+	{
+		bStop = (::WaitForSingleObject(pWriter->hStopEvent, METRICSFILE_FLUSH_MS) != WAIT_TIMEOUT);
+
+		//the frame loop only holds the lock for a push_back
+		vRecords.clear();
+		::EnterCriticalSection(&pWriter->csPending);
+		vRecords.swap(pWriter->vPending);
+		::LeaveCriticalSection(&pWriter->csPending);
+
+		if (vRecords.size() > 0)
+			pWriter->WriteChunk(vRecords);
+	}
+
+	return 0;
+}
+
+
+void CMetricsWriter::WriteChunk(vector<stFrameRecord> &v_records)
+{
+	vector<BYTE> vColumns[FRAMESTORE_COLUMNS];
+	__int64 iPrev[FRAMESTORE_COLUMNS];
+	::ZeroMemory(iPrev, sizeof(iPrev));
+
+	for (size_t i = 0; i < v_records.size(); i++)
+		CFrameStore::EncodeRecord(vColumns, iPrev, v_records[i]);
+
+	vector<BYTE> vBuffer;
+	DWORD dwMagic = METRICSFILE_MAGIC_CHUNK;
+	DWORD dwFrames = (DWORD)v_records.size();
+	WORD wColumns = FRAMESTORE_COLUMNS;
+	WORD wEncoding = METRICSFILE_ENCODING_DELTA;
+	MetricsPut(vBuffer, &dwMagic, sizeof(dwMagic));
+	MetricsPut(vBuffer, &dwFrames, sizeof(dwFrames));
+	MetricsPut(vBuffer, &wColumns, sizeof(wColumns));
+	MetricsPut(vBuffer, &wEncoding, sizeof(wEncoding));
+
+	for (WORD c = 0; c < FRAMESTORE_COLUMNS; c++)
+	{
+		WORD wReserved = 0;
+		DWORD dwBytes = (DWORD)vColumns[c].size();
+		MetricsPut(vBuffer, &c, sizeof(c));
+		MetricsPut(vBuffer, &wReserved, sizeof(wReserved));
+		MetricsPut(vBuffer, &dwBytes, sizeof(dwBytes));
+	}
+
+	for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+	{
+		if (vColumns[c].size() > 0)
+			MetricsPut(vBuffer, &vColumns[c][0], vColumns[c].size());
+	}
+
+	DWORD dwCRC = MetricsCRC32(&vBuffer[0], vBuffer.size(), 0);
+	MetricsPut(vBuffer, &dwCRC, sizeof(dwCRC));
+
+	if (WriteBuffer(vBuffer))
+	{
+		::FlushFileBuffers(hFile);
+		ui64Frames += v_records.size();
+		uiChunks++;
+	}
+
+	return;
+}
+
+
+BOOL CMetricsWriter::WriteBuffer(vector<BYTE> &v_buffer)
+{
+	DWORD dwWritten = 0;
+	if (!::WriteFile(hFile, &v_buffer[0], (DWORD)v_buffer.size(), &dwWritten, NULL) || (dwWritten != (DWORD)v_buffer.size()))
+	{
+		sError = "Cannot write the metrics file";
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+void CMetricsWriter::Close(BOOL b_complete)
+{
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	if (hThread)
+	{
+		::SetEvent(hStopEvent);
+		::WaitForSingleObject(hThread, INFINITE);
+		::CloseHandle(hThread);
+		::CloseHandle(hStopEvent);
+		hThread = NULL;
+		hStopEvent = NULL;
+	}
+
+	//the end marker tells readers that the run finished
+	if (b_complete)
+	{
+		vector<BYTE> vBuffer;
+		DWORD dwMagic = METRICSFILE_MAGIC_END;
+		DWORD dwFrames = (DWORD)ui64Frames;
+		MetricsPut(vBuffer, &dwMagic, sizeof(dwMagic));
+		MetricsPut(vBuffer, &dwFrames, sizeof(dwFrames));
+		DWORD dwCRC = MetricsCRC32(&vBuffer[0], vBuffer.size(), 0);
+		MetricsPut(vBuffer, &dwCRC, sizeof(dwCRC));
+		WriteBuffer(vBuffer);
+	}
+
+	::FlushFileBuffers(hFile);
+	::CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+
+	return;
+}
+
+
+class CMetricsReader
+{
+public:
+	CMetricsReader();
+	virtual ~CMetricsReader();
+
+	BOOL   Open(string &s_file);
+	BOOL   ReadChunk(vector<stFrameRecord> &v_records);
+	BOOL   Rewind();
+	void   Close();
+
+	stMetricsHeader header;
+	BOOL   bComplete;         //end marker found
+	BOOL   bCorrupt;          //stopped at a chunk with a bad checksum
+	string sError;
+
+private:
+	BOOL   Read(void *p_data, size_t n_size);
+	BOOL   ReadString(string &s_value);
+
+	HANDLE hFile;
+	LARGE_INTEGER liFirstChunk;
+	vector<BYTE> vChunk;
+};
+
+
+CMetricsReader::CMetricsReader()
+{
+	hFile = INVALID_HANDLE_VALUE;
+	liFirstChunk.QuadPart = 0;
+	bComplete = FALSE;
+	bCorrupt = FALSE;
+	sError = "";
+	header.wVersion = 0;
+	header.dwFlags = 0;
+}
+
+CMetricsReader::~CMetricsReader()
+{
+	Close();
+}
+
+
+void CMetricsReader::Close()
+{
+	if (hFile != INVALID_HANDLE_VALUE)
+		::CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+
+	return;
+}
+
+
+BOOL CMetricsReader::Read(void *p_data, size_t n_size)
+{
+	DWORD dwRead = 0;
+	return (::ReadFile(hFile, p_data, (DWORD)n_size, &dwRead, NULL) && (dwRead == (DWORD)n_size));
+}
+
+
+BOOL CMetricsReader::ReadString(string &s_value)
+{
+	DWORD dwLength = 0;
+	if (!Read(&dwLength, sizeof(dwLength)) || (dwLength > METRICSFILE_MAX_STRING))
+		return FALSE;
+
+	s_value = "";
+	if (dwLength == 0)
+		return TRUE;
+
+	vector<char> vChars(dwLength);
+	if (!Read(&vChars[0], dwLength))
+		return FALSE;
+
+	s_value.assign(&vChars[0], dwLength);
+
+	return TRUE;
+}
+
+
+BOOL CMetricsReader::Open(string &s_file)
+{
+	Close();
+	bComplete = FALSE;
+	bCorrupt = FALSE;
+
+	//the writer may still be running
+	hFile = ::CreateFile(s_file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		sError = "Cannot open \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	DWORD dwMagic = 0;
+	WORD wReserved = 0;
+	if (!Read(&dwMagic, sizeof(dwMagic)) || (dwMagic != METRICSFILE_MAGIC_HEADER) || !Read(&header.wVersion, sizeof(header.wVersion)) || !Read(&wReserved, sizeof(wReserved)))
+	{
+		sError = "\"" + s_file + "\" is not an AVSMeter metrics file";
+		return FALSE;
+	}
+
+	if (header.wVersion > METRICSFILE_VERSION)
+	{
+		sError = "\"" + s_file + "\" was written by a newer AVSMeter version";
+		return FALSE;
+	}
+
+	if (!Read(&header.dwFlags, sizeof(header.dwFlags)) || !ReadString(header.sAVSMVersion) || !ReadString(header.sScriptFile) || !ReadString(header.sDateTime) || !ReadString(header.sScriptText))
+	{
+		sError = "The header of \"" + s_file + "\" is incomplete";
+		return FALSE;
+	}
+
+	//the header CRC covers the same bytes in the same order
+	vector<BYTE> vHeader;
+	MetricsPut(vHeader, &dwMagic, sizeof(dwMagic));
+	MetricsPut(vHeader, &header.wVersion, sizeof(header.wVersion));
+	MetricsPut(vHeader, &wReserved, sizeof(wReserved));
+	MetricsPut(vHeader, &header.dwFlags, sizeof(header.dwFlags));
+	MetricsPutString(vHeader, header.sAVSMVersion);
+	MetricsPutString(vHeader, header.sScriptFile);
+	MetricsPutString(vHeader, header.sDateTime);
+	MetricsPutString(vHeader, header.sScriptText);
+
+	DWORD dwCRC = 0;
+	if (!Read(&dwCRC, sizeof(dwCRC)) || (dwCRC != MetricsCRC32(&vHeader[0], vHeader.size(), 0)))
+	{
+		sError = "The header of \"" + s_file + "\" is corrupt";
+		return FALSE;
+	}
+
+	LARGE_INTEGER liZero;
+	liZero.QuadPart = 0;
+	::SetFilePointerEx(hFile, liZero, &liFirstChunk, FILE_CURRENT);
+
+	return TRUE;
+}
+
+
+BOOL CMetricsReader::Rewind()
+{
+	bComplete = FALSE;
+	bCorrupt = FALSE;
+
+	return ::SetFilePointerEx(hFile, liFirstChunk, NULL, FILE_BEGIN);
+}
+
+
+BOOL CMetricsReader::ReadChunk(vector<stFrameRecord> &v_records)
+{
+	//FALSE at the end marker, at the end of a truncated file or at a corrupt chunk
+	v_records.clear();
+
+	DWORD dwMagic = 0;
+	DWORD dwFrames = 0;
+	if (!Read(&dwMagic, sizeof(dwMagic)) || !Read(&dwFrames, sizeof(dwFrames)))
+		return FALSE;
+
+	if (dwMagic == METRICSFILE_MAGIC_END)
+	{
+		DWORD dwCRC = 0;
+		BYTE bEnd[8];
+		memcpy(bEnd, &dwMagic, 4);
+		memcpy(bEnd + 4, &dwFrames, 4);
+		bComplete = (Read(&dwCRC, sizeof(dwCRC)) && (dwCRC == MetricsCRC32(bEnd, 8, 0)));
+		return FALSE;
+	}
+
+	WORD wColumns = 0;
+	WORD wEncoding = 0;
+	if ((dwMagic != METRICSFILE_MAGIC_CHUNK) || !Read(&wColumns, sizeof(wColumns)) || !Read(&wEncoding, sizeof(wEncoding)) || (wColumns > METRICSFILE_MAX_COLUMNS))
+	{
+		bCorrupt = (dwMagic != METRICSFILE_MAGIC_CHUNK);
+		return FALSE;
+	}
+
+	vector<BYTE> vDirectory(wColumns * 8);
+	if ((wColumns > 0) && !Read(&vDirectory[0], vDirectory.size()))
+		return FALSE;
+
+	//the directory is not verified yet, a damaged size must not be allocated
+	unsigned __int64 ui64Data = 0;
+	for (WORD c = 0; c < wColumns; c++)
+		ui64Data += *(DWORD *)&vDirectory[c * 8 + 4];
+
+	LARGE_INTEGER liPos;
+	LARGE_INTEGER liSize;
+	LARGE_INTEGER liZero;
+	liZero.QuadPart = 0;
+	if (!::SetFilePointerEx(hFile, liZero, &liPos, FILE_CURRENT) || !::GetFileSizeEx(hFile, &liSize))
+		return FALSE;
+
+	if ((ui64Data + sizeof(DWORD)) > (unsigned __int64)(liSize.QuadPart - liPos.QuadPart))
+		return FALSE;
+
+	size_t nData = (size_t)ui64Data;
+	vChunk.resize(nData + 1);
+	DWORD dwCRC = 0;
+	if (((nData > 0) && !Read(&vChunk[0], nData)) || !Read(&dwCRC, sizeof(dwCRC)))
+		return FALSE;
+
+	DWORD dwCheck = MetricsCRC32((BYTE *)&dwMagic, sizeof(dwMagic), 0);
+	dwCheck = MetricsCRC32((BYTE *)&dwFrames, sizeof(dwFrames), dwCheck);
+	dwCheck = MetricsCRC32((BYTE *)&wColumns, sizeof(wColumns), dwCheck);
+	dwCheck = MetricsCRC32((BYTE *)&wEncoding, sizeof(wEncoding), dwCheck);
+	if (wColumns > 0)
+		dwCheck = MetricsCRC32(&vDirectory[0], vDirectory.size(), dwCheck);
+	dwCheck = MetricsCRC32(&vChunk[0], nData, dwCheck);
+
+	//every column stores at least one byte per frame
+	if ((dwCRC != dwCheck) || (wEncoding != METRICSFILE_ENCODING_DELTA) || ((dwFrames > 0) && ((wColumns == 0) || ((unsigned __int64)dwFrames > ui64Data))))
+	{
+		bCorrupt = TRUE;
+		return FALSE;
+	}
+
+	//columns are matched by id, unknown ones are skipped and missing ones decode as 0
+	const BYTE *pColumns[FRAMESTORE_COLUMNS];
+	size_t nSizes[FRAMESTORE_COLUMNS];
+	for (int c = 0; c < FRAMESTORE_COLUMNS; c++)
+	{
+		pColumns[c] = NULL;
+		nSizes[c] = 0;
+	}
+
+	size_t nOffset = 0;
+	for (WORD c = 0; c < wColumns; c++)
+	{
+		WORD wID = *(WORD *)&vDirectory[c * 8];
+		DWORD dwBytes = *(DWORD *)&vDirectory[c * 8 + 4];
+		if (wID < FRAMESTORE_COLUMNS)
+		{
+			pColumns[wID] = &vChunk[nOffset];
+			nSizes[wID] = dwBytes;
+		}
+		nOffset += dwBytes;
+	}
+
+	CFrameStore::DecodeRecords(pColumns, nSizes, dwFrames, v_records);
+
+	return TRUE;
+}
+
+
+#endif //_METRICSFILE_H
@@ -0,0 +1,431 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_METRICSSERVER_H)
+#define _METRICSSERVER_H
+
+#include "common.h"
+#include "utility.h"
+#include <winsock2.h>
+#include "Monitor.h"
+
+//live metrics for Prometheus/Grafana: a minimal HTTP server on 127.0.0.1 with its own thread.
+//a scrape reads the monitor snapshot and the frame loop counters, both are seqlocks, so the
+//frame loop never waits for a client. one connection at a time, a scraper does not need more
+#define METRICSSERVER_POLL_MS       250
+#define METRICSSERVER_TIMEOUT_MS    2000
+#define METRICSSERVER_MAX_REQUEST   8192
+
+
+class CMetricsServer
+{
+public:
+	CMetricsServer();
+	virtual ~CMetricsServer();
+
+	BOOL   Start(unsigned short us_port, CMonitor *p_monitor, string &s_avsmversion, string &s_avsfile, BOOL b_gpu);
+	void   Stop();
+	void   Publish(stFrameLoopStats &stats);
+
+	string sError;
+
+private:
+	static unsigned __stdcall ServerThread(void *p_param);
+	void   HandleClient(SOCKET s_client);
+	void   GetStats(stFrameLoopStats &stats);
+	string FormatMetrics(BOOL b_openmetrics);
+	static string EscapeLabel(string &s_value);
+	static void SendAll(SOCKET s_client, string &s_data);
+
+	CUtils       utils;
+	CMonitor     *pMonitor;
+	string       sAVSMVersion;
+	string       sScriptFile;
+	BOOL         bGPU;
+	SOCKET       sListen;
+	HANDLE       hThread;
+	HANDLE       hStopEvent;
+	BOOL         bWSAStarted;
+
+	//seqlock: odd while the frame loop is updating the stats
+	volatile LONG    lSequence;
+	stFrameLoopStats framestats;
+};
+
+
+CMetricsServer::CMetricsServer()
+{
+	pMonitor = NULL;
+	bGPU = FALSE;
+	sListen = INVALID_SOCKET;
+	hThread = NULL;
+	hStopEvent = NULL;
+	bWSAStarted = FALSE;
+	lSequence = 0;
+	::ZeroMemory(&framestats, sizeof(stFrameLoopStats));
+	sError = "";
+}
+
+CMetricsServer::~CMetricsServer()
+{
+	Stop();
+}
+
+
+BOOL CMetricsServer::Start(unsigned short us_port, CMonitor *p_monitor, string &s_avsmversion, string &s_avsfile, BOOL b_gpu)
+{
+	if (hThread)
+		return FALSE;
+
+	pMonitor = p_monitor;
+	sAVSMVersion = s_avsmversion;
+	sScriptFile = s_avsfile;
+	bGPU = b_gpu;
+
+	WSADATA wsadata;
+	if (::WSAStartup(MAKEWORD(2, 2), &wsadata) != 0)
+	{
+		sError = "Cannot initialize Winsock";
+		return FALSE;
+	}
+	bWSAStarted = TRUE;
+
+	sListen = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sListen == INVALID_SOCKET)
+	{
+		sError = "Cannot create the metrics socket";
+		Stop();
+		return FALSE;
+	}
+
+	//loopback only, the endpoint is not meant to be reachable from the network
+	sockaddr_in addr;
+	::ZeroMemory(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(us_port);
+	addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+
+	BOOL bExclusive = TRUE;
+	::setsockopt(sListen, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char *)&bExclusive, sizeof(bExclusive));
+
+	if ((::bind(sListen, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) || (::listen(sListen, 4) == SOCKET_ERROR))
+	{
+		sError = utils.StrFormat("Cannot listen on 127.0.0.1:%u (port in use?)", (unsigned int)us_port);
+		Stop();
+		return FALSE;
+	}
+
+	hStopEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!hStopEvent)
+	{
+		Stop();
+		return FALSE;
+	}
+
+	hThread = (HANDLE)_beginthreadex(NULL, 0, ServerThread, this, 0, NULL);
+	if (!hThread)
+	{
+		sError = "Cannot start the metrics server thread";
+		Stop();
+		return FALSE;
+	}
+
+	//scrapes must not compete with the frame loop
+	::SetThreadPriority(hThread, THREAD_PRIORITY_BELOW_NORMAL);
+	sError = "";
+
+	return TRUE;
+}
+
+
+void CMetricsServer::Stop()
+{
+	if (hThread)
+	{
+		::SetEvent(hStopEvent);
+		::WaitForSingleObject(hThread, INFINITE);
+		::CloseHandle(hThread);
+		hThread = NULL;
+	}
+
+	if (hStopEvent)
+	{
+		::CloseHandle(hStopEvent);
+		hStopEvent = NULL;
+	}
+
+	if (sListen != INVALID_SOCKET)
+	{
+		::closesocket(sListen);
+		sListen = INVALID_SOCKET;
+	}
+
+	if (bWSAStarted)
+	{
+		::WSACleanup();
+		bWSAStarted = FALSE;
+	}
+
+	return;
+}
+
+
+void CMetricsServer::Publish(stFrameLoopStats &stats)
+{
+	::InterlockedIncrement(&lSequence);
+	framestats = stats;
+	::InterlockedIncrement(&lSequence);
+
+	return;
+}
+
+
+void CMetricsServer::GetStats(stFrameLoopStats &stats)
+{
+	for (;;)
+	{
+		LONG lBefore = lSequence;
+		if (lBefore & 1)
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		::MemoryBarrier();
+		stats = framestats;
+		::MemoryBarrier();
+
+		if (lSequence == lBefore)
+			break;
+	}
+
+	return;
+}
+
+
+unsigned __stdcall CMetricsServer::ServerThread(void *p_param)
+{
+	CMetricsServer *pServer = (CMetricsServer *)p_param;
+
+	for (;;)
+	{
+		if (::WaitForSingleObject(pServer->hStopEvent, 0) != WAIT_TIMEOUT)
+			break;
+
+		//select() with a timeout, so the stop event is seen without closing the socket under accept()
+		fd_set fdsRead;
+		FD_ZERO(&fdsRead);
+		FD_SET(pServer->sListen, &fdsRead);
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = METRICSSERVER_POLL_MS * 1000;
+		int iReady = ::select(0, &fdsRead, NULL, NULL, &tv);
+		if (iReady == SOCKET_ERROR)
+			break;
+		if (iReady == 0)
+			continue;
+
+		SOCKET sClient = ::accept(pServer->sListen, NULL, NULL);
+		if (sClient == INVALID_SOCKET)
+			continue;
+
+		pServer->HandleClient(sClient);
+		::closesocket(sClient);
+	}
+
+	return 0;
+}
+
+
+void CMetricsServer::HandleClient(SOCKET s_client)
+{
+	DWORD dwTimeout = METRICSSERVER_TIMEOUT_MS;
+	::setsockopt(s_client, SOL_SOCKET, SO_RCVTIMEO, (const char *)&dwTimeout, sizeof(dwTimeout));
+	::setsockopt(s_client, SOL_SOCKET, SO_SNDTIMEO, (const char *)&dwTimeout, sizeof(dwTimeout));
+
+	//the request line and headers, the body of a GET is empty
+	string sRequest = "";
+	char szBuffer[1024];
+	while ((sRequest.find("\r\n\r\n") == string::npos) && (sRequest.length() < METRICSSERVER_MAX_REQUEST))
+	{
+		int iRead = ::recv(s_client, szBuffer, sizeof(szBuffer), 0);
+		if (iRead <= 0)
+			break;
+		sRequest.append(szBuffer, iRead);
+	}
+
+	string sLine = sRequest.substr(0, sRequest.find("\r\n"));
+	string sResponse = "";
+	if ((sLine.substr(0, 4) != "GET ") && (sLine.substr(0, 5) != "HEAD "))
+		sResponse = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	else
+	{
+		size_t nPath = sLine.find(' ') + 1;
+		string sPath = sLine.substr(nPath, sLine.find(' ', nPath) - nPath);
+		sPath = sPath.substr(0, sPath.find('?'));
+		if ((sPath != "/metrics") && (sPath != "/"))
+		{
+			string sBody = "Not found, the metrics are served at /metrics\n";
+			sResponse = utils.StrFormat("HTTP/1.1 404 Not Found\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", (unsigned int)sBody.length()) + sBody;
+		}
+		else
+		{
+			//Prometheus asks for OpenMetrics in the Accept header, everything else gets the classic text format
+			string sHeaders = sRequest;
+			utils.StrToLC(sHeaders);
+			BOOL bOpenMetrics = (sHeaders.find("application/openmetrics-text") != string::npos);
+
+			string sBody = FormatMetrics(bOpenMetrics);
+			sResponse = utils.StrFormat("HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n",
+			            bOpenMetrics ? "application/openmetrics-text; version=1.0.0; charset=utf-8" : "text/plain; version=0.0.4; charset=utf-8", (unsigned int)sBody.length());
+			if (sLine.substr(0, 4) == "GET ")
+				sResponse += sBody;
+		}
+	}
+
+	SendAll(s_client, sResponse);
+	::shutdown(s_client, SD_SEND);
+
+	return;
+}
+
+
+void CMetricsServer::SendAll(SOCKET s_client, string &s_data)
+{
+	size_t nSent = 0;
+	while (nSent < s_data.length())
+	{
+		int iSent = ::send(s_client, s_data.c_str() + nSent, (int)(s_data.length() - nSent), 0);
+		if (iSent <= 0)
+			break;
+		nSent += (size_t)iSent;
+	}
+
+	return;
+}
+
+
+string CMetricsServer::EscapeLabel(string &s_value)
+{
+	string sRet = "";
+	for (size_t i = 0; i < s_value.length(); i++)
+	{
+		if (s_value[i] == '\\')
+			sRet += "\\\\";
+		else if (s_value[i] == '\"')
+			sRet += "\\\"";
+		else if (s_value[i] == '\n')
+			sRet += "\\n";
+		else
+			sRet += s_value[i];
+	}
+
+	return sRet;
+}
+
+
+string CMetricsServer::FormatMetrics(BOOL b_openmetrics)
+{
+	/*
+	OpenMetrics text or the Prometheus 0.0.4 format. OpenMetrics names a counter family without
+	"_total" and knows UNIT and EOF, in 0.0.4 the TYPE line carries the sample name itself.
+	*/
+	string sCounter = b_openmetrics ? "" : "_total";
+	stFrameLoopStats stats;
+	GetStats(stats);
+	stMonitorSample msample;
+	pMonitor->GetSnapshot(msample);
+
+	string sRet = "";
+	sRet += "# TYPE avsmeter_info gauge\n# HELP avsmeter_info AVSMeter version and benchmarked script\n";
+	sRet += utils.StrFormat("avsmeter_info{version=\"%s\",script=\"%s\"} 1\n", EscapeLabel(sAVSMVersion).c_str(), EscapeLabel(sScriptFile).c_str());
+
+	sRet += utils.StrFormat("# TYPE avsmeter_frames%s counter\n# HELP avsmeter_frames%s Frames requested from the script so far\n", sCounter.c_str(), sCounter.c_str());
+	sRet += utils.StrFormat("avsmeter_frames_total %u\n", stats.frames_read);
+	sRet += "# TYPE avsmeter_frames_to_process gauge\n# HELP avsmeter_frames_to_process Frames in the benchmarked range\n";
+	sRet += utils.StrFormat("avsmeter_frames_to_process %u\n", stats.frames_total);
+	sRet += "# TYPE avsmeter_completed gauge\n# HELP avsmeter_completed 1 after the last frame was processed\n";
+	sRet += utils.StrFormat("avsmeter_completed %u\n", stats.completed ? 1 : 0);
+	sRet += "# TYPE avsmeter_elapsed_seconds gauge\n# HELP avsmeter_elapsed_seconds Time since the first frame was requested\n";
+	sRet += utils.StrFormat("avsmeter_elapsed_seconds %.3f\n", stats.elapsed);
+
+	sRet += "# TYPE avsmeter_fps gauge\n# HELP avsmeter_fps Frames per second of the last refresh interval\n";
+	sRet += utils.StrFormat("avsmeter_fps %.3f\n", stats.fps);
+	sRet += "# TYPE avsmeter_fps_average gauge\n# HELP avsmeter_fps_average Frames per second since the start\n";
+	sRet += utils.StrFormat("avsmeter_fps_average %.3f\n", stats.fps_average);
+
+	//a summary in seconds, the quantiles come from the frame time sketch of the whole run
+	sRet += "# TYPE avsmeter_frame_time_seconds summary\n";
+	if (b_openmetrics)
+		sRet += "# UNIT avsmeter_frame_time_seconds seconds\n";
+	sRet += "# HELP avsmeter_frame_time_seconds Time per frame\n";
+	if (stats.frames_read > 0)
+	{
+		sRet += utils.StrFormat("avsmeter_frame_time_seconds{quantile=\"0.5\"} %.6f\n", stats.frametime_p50 / 1000.0);
+		sRet += utils.StrFormat("avsmeter_frame_time_seconds{quantile=\"0.95\"} %.6f\n", stats.frametime_p95 / 1000.0);
+		sRet += utils.StrFormat("avsmeter_frame_time_seconds{quantile=\"0.99\"} %.6f\n", stats.frametime_p99 / 1000.0);
+		sRet += utils.StrFormat("avsmeter_frame_time_seconds{quantile=\"1\"} %.6f\n", stats.frametime_max / 1000.0);
+	}
+	sRet += utils.StrFormat("avsmeter_frame_time_seconds_sum %.6f\n", stats.elapsed);
+	sRet += utils.StrFormat("avsmeter_frame_time_seconds_count %u\n", stats.frames_read);
+
+	sRet += "# TYPE avsmeter_cpu_usage_percent gauge\n# HELP avsmeter_cpu_usage_percent CPU usage of the process (100 = all cores)\n";
+	sRet += utils.StrFormat("avsmeter_cpu_usage_percent %.1f\n", msample.cpu_usage);
+	sRet += "# TYPE avsmeter_busy_cores gauge\n# HELP avsmeter_busy_cores Sum of the CPU usage of all threads in cores\n";
+	sRet += utils.StrFormat("avsmeter_busy_cores %.2f\n", msample.concurrency);
+	sRet += "# TYPE avsmeter_threads gauge\n# HELP avsmeter_threads Threads of the process\n";
+	sRet += utils.StrFormat("avsmeter_threads %u\n", (unsigned int)msample.num_threads);
+
+	sRet += "# TYPE avsmeter_memory_bytes gauge\n";
+	if (b_openmetrics)
+		sRet += "# UNIT avsmeter_memory_bytes bytes\n";
+	sRet += "# HELP avsmeter_memory_bytes Process memory\n";
+	sRet += utils.StrFormat("avsmeter_memory_bytes{kind=\"working_set\"} %I64u\n", (unsigned __int64)msample.process_memory << 20);
+	sRet += utils.StrFormat("avsmeter_memory_bytes{kind=\"working_set_peak\"} %I64u\n", (unsigned __int64)msample.process_memory_peak << 20);
+	sRet += utils.StrFormat("avsmeter_memory_bytes{kind=\"commit\"} %I64u\n", (unsigned __int64)msample.commit << 20);
+	sRet += utils.StrFormat("avsmeter_memory_bytes{kind=\"commit_peak\"} %I64u\n", (unsigned __int64)msample.commit_peak << 20);
+
+	sRet += utils.StrFormat("# TYPE avsmeter_page_faults%s counter\n# HELP avsmeter_page_faults%s Page faults since process start\n", sCounter.c_str(), sCounter.c_str());
+	if (pMonitor->bHardFaults)
+	{
+		sRet += utils.StrFormat("avsmeter_page_faults_total{kind=\"soft\"} %u\n", msample.page_faults - msample.hard_faults);
+		sRet += utils.StrFormat("avsmeter_page_faults_total{kind=\"hard\"} %u\n", msample.hard_faults);
+	}
+	else
+		sRet += utils.StrFormat("avsmeter_page_faults_total{kind=\"all\"} %u\n", msample.page_faults);
+
+	if (bGPU)
+	{
+		sRet += "# TYPE avsmeter_gpu_usage_percent gauge\n# HELP avsmeter_gpu_usage_percent GPU load\n";
+		sRet += utils.StrFormat("avsmeter_gpu_usage_percent{engine=\"gpu\"} %u\n", (unsigned int)msample.gpu_usage);
+		sRet += utils.StrFormat("avsmeter_gpu_usage_percent{engine=\"vpu\"} %u\n", (unsigned int)msample.vpu_usage);
+		sRet += "# TYPE avsmeter_gpu_power_watts gauge\n";
+		if (b_openmetrics)
+			sRet += "# UNIT avsmeter_gpu_power_watts watts\n";
+		sRet += "# HELP avsmeter_gpu_power_watts GPU power consumption\n";
+		sRet += utils.StrFormat("avsmeter_gpu_power_watts %.1f\n", msample.gpu_power);
+	}
+
+	if (b_openmetrics)
+		sRet += "# EOF\n";
+
+	return sRet;
+}
+
+
+#endif //_METRICSSERVER_H
@@ -0,0 +1,571 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_MONITOR_H)
+#define _MONITOR_H
+
+#include "common.h"
+#include "Timer.h"
+#include "ProcessInfo.h"
+#include "GPUInfo.h"
+#include "ThreadInfo.h"
+#include "AllocTracker.h"
+#include "Statistics.h"
+
+#define MONITOR_PERIOD_MS           250
+#define MONITOR_MAX_SAMPLES         8192    //about 2 MiB, the series is thinned out when it is full
+#define MONITOR_BUSY_THREAD         75.0    //percent of one core
+#define MONITOR_SERIAL_CONCURRENCY  1.5
+#define MONITOR_LEAK_WARMUP         0.10    //fraction of the frames skipped before fitting memory growth
+#define MONITOR_LEAK_MIN_POINTS     20
+#define MONITOR_LEAK_MAX_POINTS     1000
+
+
+struct stMonitorSample
+{
+	double        time;               //seconds since Start()
+	unsigned int  index;
+	double        cpu_usage;
+	double        cpu_usage_avg;
+	DWORD         process_memory;     //MiB
+	DWORD         process_memory_peak;
+	DWORD         private_ws;         //MiB, private part of the working set
+	DWORD         commit;             //MiB, private bytes
+	DWORD         commit_peak;
+	DWORD         working_set_kib;    //unrounded, for the growth fit
+	DWORD         commit_kib;
+	DWORD         own_kib;            //AVSMeter's own buffers as published by the frame loop
+	DWORD         working_set_peak;   //MiB, as tracked by the OS (not limited to the sample grid)
+	DWORD         page_faults;        //soft + hard, since process start
+	DWORD         hard_faults;
+	LONGLONG      allocs;             //heap allocations since the tracker was installed, 0 without -allocs
+	LONGLONG      alloc_bytes;
+	WORD          num_threads;
+	LONG          threads_created;    //since process start
+	LONG          threads_exited;
+	unsigned __int64 cycles;          //since process start
+	double        role_usage[THREAD_ROLE_COUNT];  //percent of one core
+	double        busiest_thread;
+	DWORD         busiest_tid;
+	double        concurrency;        //busy cores, sum of all thread usage
+	unsigned int  frames;
+	double        fps;
+	BYTE          gpu_usage;
+	BYTE          vpu_usage;
+	double        gpu_power;
+	double        gpu_usage_avg;
+	double        vpu_usage_avg;
+	double        gpu_power_avg;
+	DWORD         gpu_memory_general;
+	DWORD         gpu_memory_dedicated;
+	DWORD         gpu_memory_dynamic;
+	BOOL          gpu_read_error;
+};
+
+
+//what only the frame loop knows, published at the console refresh interval
+//for the live metrics endpoint and the shared memory stats
+struct stFrameLoopStats
+{
+	double        elapsed;            //seconds
+	unsigned int  frames_read;
+	unsigned int  frames_total;
+	double        fps;                //current interval
+	double        fps_average;
+	double        frametime_p50;      //ms
+	double        frametime_p95;
+	double        frametime_p99;
+	double        frametime_max;
+	BOOL          completed;
+};
+
+
+class CMonitor
+{
+public:
+	CMonitor();
+	virtual ~CMonitor();
+
+	BOOL   Start(CTimer *p_timer, CGPUInfo *p_gpuinfo, DWORD dw_period_ms);
+	void   Stop();
+	void   GetSnapshot(stMonitorSample &sample);
+	string FormatSamples(size_t n_maxrows);
+	string FormatConcurrency(unsigned int ui_cores);
+	double GetMeanConcurrency();
+	BOOL   FitMemoryGrowth(BOOL b_commit, double &d_slope, double &d_lower, double &d_upper);
+
+	vector<stMonitorSample> vSamples;  //time series, every uiSampleStride-th sample, only valid after Stop()
+	unsigned int uiSampleStride;
+	CThreadInfo threadinfo;            //only valid after Stop()
+	DWORD  dwPeriodMS;
+	BOOL   bHardFaults;                //set before Start()
+	volatile LONG lFramesRead;         //written by the frame loop
+	volatile LONG lOwnKiB;             //written by the frame loop
+
+private:
+	static unsigned __stdcall MonitorThread(void *p_param);
+	void   TakeSample();
+	void   Publish(stMonitorSample &sample);
+
+	CTimer       *pTimer;
+	CGPUInfo     *pGPUInfo;
+	CProcessInfo processinfo;
+	HANDLE       hThread;
+	HANDLE       hStopEvent;
+	double       dStartTime;
+
+	//seqlock: odd while the writer is updating the snapshot
+	volatile LONG   lSequence;
+	stMonitorSample snapshot;
+
+	stMonitorSample current;
+	unsigned int uiSampleCount;
+	double dCPUUsageAcc;
+	double dGPUUsageAcc;
+	double dVPUUsageAcc;
+	double dGPUPowerAcc;
+};
+
+
+CMonitor::CMonitor()
+{
+	pTimer = NULL;
+	pGPUInfo = NULL;
+	hThread = NULL;
+	hStopEvent = NULL;
+	dStartTime = 0.0;
+	dwPeriodMS = MONITOR_PERIOD_MS;
+	bHardFaults = FALSE;
+	lFramesRead = 0;
+	lOwnKiB = 0;
+	lSequence = 0;
+	uiSampleCount = 0;
+	uiSampleStride = 1;
+	::ZeroMemory(&snapshot, sizeof(stMonitorSample));
+	::ZeroMemory(&current, sizeof(stMonitorSample));
+	dCPUUsageAcc = 0.0;
+	dGPUUsageAcc = 0.0;
+	dVPUUsageAcc = 0.0;
+	dGPUPowerAcc = 0.0;
+}
+
+CMonitor::~CMonitor()
+{
+	Stop();
+	processinfo.CloseProcess();
+}
+
+
+BOOL CMonitor::Start(CTimer *p_timer, CGPUInfo *p_gpuinfo, DWORD dw_period_ms)
+{
+	if (hThread)
+		return FALSE;
+
+	pTimer = p_timer;
+	pGPUInfo = p_gpuinfo;
+	dwPeriodMS = dw_period_ms;
+	processinfo.bHardFaults = bHardFaults;
+	vSamples.clear();
+	vSamples.reserve(MONITOR_MAX_SAMPLES);
+	uiSampleCount = 0;
+	uiSampleStride = 1;
+	threadinfo.SetMainThread(::GetCurrentThreadId());
+
+	//the first sample is taken synchronously so the snapshot is valid right away
+	dStartTime = pTimer->GetTimer();
+	TakeSample();
+
+	hStopEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!hStopEvent)
+		return FALSE;
+
+	hThread = (HANDLE)_beginthreadex(NULL, 0, MonitorThread, this, 0, NULL);
+	if (!hThread)
+	{
+		::CloseHandle(hStopEvent);
+		hStopEvent = NULL;
+		return FALSE;
+	}
+
+	::SetThreadPriority(hThread, THREAD_PRIORITY_ABOVE_NORMAL);
+
+	return TRUE;
+}
+
+
+void CMonitor::Stop()
+{
+	if (!hThread)
+		return;
+
+	::SetEvent(hStopEvent);
+	::WaitForSingleObject(hThread, INFINITE);
+	::CloseHandle(hThread);
+	::CloseHandle(hStopEvent);
+	hThread = NULL;
+	hStopEvent = NULL;
+
+	return;
+}
+
+
+unsigned __stdcall CMonitor::MonitorThread(void *p_param)
+{
+	CMonitor *pMonitor = (CMonitor *)p_param;
+	double dNextSample = pMonitor->dStartTime;
+	pMonitor->threadinfo.SetMonitorThread(::GetCurrentThreadId());
+
+	for (;;)
+	{
+		//wait for the next slot on the fixed grid, late samples do not shift the grid
+		dNextSample += (double)pMonitor->dwPeriodMS / 1000.0;
+		double dWait = dNextSample - pMonitor->pTimer->GetTimer();
+		DWORD dwWait = (dWait > 0.0) ? (DWORD)(dWait * 1000.0) : 0;
+
+		if (::WaitForSingleObject(pMonitor->hStopEvent, dwWait) != WAIT_TIMEOUT)
+			break;
+
+		pMonitor->TakeSample();
+
+		double dNow = pMonitor->pTimer->GetTimer();
+		while (dNextSample < (dNow - ((double)pMonitor->dwPeriodMS / 1000.0)))
+			dNextSample += (double)pMonitor->dwPeriodMS / 1000.0;
+	}
+
+	return 0;
+}
+
+
+void CMonitor::TakeSample()
+{
+	processinfo.Update();
+
+	double dPrevTime = current.time;
+	current.time = pTimer->GetTimer() - dStartTime;
+	current.index = uiSampleCount++;
+	current.cpu_usage = processinfo.dCPUUsage;
+	current.process_memory = processinfo.dwMemMB;
+	current.private_ws = processinfo.dwPrivateWSMB;
+	current.commit = processinfo.dwCommitMB;
+	current.commit_peak = processinfo.dwCommitPeakMB;
+	current.working_set_kib = processinfo.dwMemKiB;
+	current.commit_kib = processinfo.dwCommitKiB;
+	current.own_kib = (DWORD)lOwnKiB;
+	current.working_set_peak = processinfo.dwMemPeakMB;
+	current.page_faults = processinfo.dwPageFaults;
+	current.hard_faults = processinfo.dwHardFaults;
+	current.allocs = alloccounters.llAllocs;
+	current.alloc_bytes = alloccounters.llAllocBytes;
+	current.num_threads = processinfo.wThreadCount;
+	current.threads_created = processinfo.lThreadsCreated;
+	current.threads_exited = processinfo.lThreadsExited;
+	current.cycles = processinfo.ui64Cycles;
+
+	if (current.process_memory > current.process_memory_peak)
+		current.process_memory_peak = current.process_memory;
+
+	unsigned int uiPrevFrames = current.frames;
+	current.frames = (unsigned int)lFramesRead;
+	current.fps = 0.0;
+	if ((current.index > 0) && (current.time > dPrevTime))
+		current.fps = (double)(current.frames - uiPrevFrames) / (current.time - dPrevTime);
+
+	threadinfo.Update(current.time);
+	current.busiest_thread = threadinfo.dBusiestUsage;
+	current.busiest_tid = threadinfo.dwBusiestTID;
+	current.concurrency = 0.0;
+	for (int i = 0; i < THREAD_ROLE_COUNT; i++)
+	{
+		current.role_usage[i] = threadinfo.dRoleUsage[i];
+		current.concurrency += threadinfo.dRoleUsage[i] / 100.0;
+	}
+
+	//the first sample has no CPU time delta and is not averaged
+	if (current.index > 0)
+	{
+		dCPUUsageAcc += current.cpu_usage;
+		current.cpu_usage_avg = dCPUUsageAcc / (double)current.index;
+	}
+
+	if (pGPUInfo)
+	{
+		pGPUInfo->ReadSensors();
+		current.gpu_read_error = pGPUInfo->sensors.ReadError;
+		current.gpu_usage = pGPUInfo->sensors.GPULoad;
+		current.vpu_usage = pGPUInfo->sensors.VPULoad;
+		current.gpu_power = pGPUInfo->sensors.PowerConsumption;
+		current.gpu_memory_general = pGPUInfo->sensors.MemoryUsedGeneral;
+		current.gpu_memory_dedicated = pGPUInfo->sensors.MemoryUsedDedicated;
+		current.gpu_memory_dynamic = pGPUInfo->sensors.MemoryUsedDynamic;
+
+		dGPUUsageAcc += (double)current.gpu_usage;
+		dVPUUsageAcc += (double)current.vpu_usage;
+		dGPUPowerAcc += current.gpu_power;
+		current.gpu_usage_avg = dGPUUsageAcc / (double)(current.index + 1);
+		current.vpu_usage_avg = dVPUUsageAcc / (double)(current.index + 1);
+		current.gpu_power_avg = dGPUPowerAcc / (double)(current.index + 1);
+	}
+
+	//a full series keeps every other sample and from then on only every uiSampleStride-th new one
+	if ((current.index % uiSampleStride) == 0)
+	{
+		if (vSamples.size() >= MONITOR_MAX_SAMPLES)
+		{
+			for (size_t n = 1; (n * 2) < vSamples.size(); n++)
+				vSamples[n] = vSamples[n * 2];
+			vSamples.resize((vSamples.size() + 1) / 2);
+			uiSampleStride *= 2;
+		}
+
+		if ((current.index % uiSampleStride) == 0)
+			vSamples.push_back(current);
+	}
+
+	Publish(current);
+
+	return;
+}
+
+
+void CMonitor::Publish(stMonitorSample &sample)
+{
+	::InterlockedIncrement(&lSequence);
+	snapshot = sample;
+	::InterlockedIncrement(&lSequence);
+
+	return;
+}
+
+
+void CMonitor::GetSnapshot(stMonitorSample &sample)
+{
+	//never blocks the writer, retries if a sample was published during the copy
+	for (;;)
+	{
+		LONG lBefore = lSequence;
+		if (lBefore & 1)
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		::MemoryBarrier();
+		sample = snapshot;
+		::MemoryBarrier();
+
+		if (lSequence == lBefore)
+			break;
+	}
+
+	return;
+}
+
+
+string CMonitor::FormatSamples(size_t n_maxrows)
+{
+	string sOut = "";
+	char buffer[512];
+
+	if (vSamples.size() == 0)
+		return sOut;
+
+	size_t nStride = 1;
+	while ((vSamples.size() / nStride) > n_maxrows)
+		nStride *= 2;
+
+	sprintf(buffer, "\n\n[Monitor samples]\nPeriod: %u ms, stride: %u, thread columns in percent of one core\n\n", dwPeriodMS, (unsigned int)nStride * uiSampleStride);
+	sOut += buffer;
+	sOut += "    Time (s)        FPS   CPU (%)   Memory (MiB)   Private (MiB)   Commit (MiB)   Soft faults   Hard faults   Threads   Created   Exited   Cores   Main   Avisynth   Plugin   Other   Busiest";
+	sOut += (pGPUInfo) ? "   GPU (%)   VPU (%)   Power (W)" : "";
+
+	BOOL bAllocs = (vSamples[vSamples.size() - 1].allocs > 0);
+	sOut += (bAllocs) ? "     Allocs   Alloc (MiB)\n" : "\n";
+
+	//thread churn and page faults are counted since the previous row
+	LONG lPrevCreated = vSamples[0].threads_created;
+	LONG lPrevExited = vSamples[0].threads_exited;
+	DWORD dwPrevFaults = vSamples[0].page_faults;
+	DWORD dwPrevHardFaults = vSamples[0].hard_faults;
+	LONGLONG llPrevAllocs = vSamples[0].allocs;
+	LONGLONG llPrevAllocBytes = vSamples[0].alloc_bytes;
+
+	for (size_t n = 0; n < vSamples.size(); n += nStride)
+	{
+		stMonitorSample &s = vSamples[n];
+		DWORD dwHardFaults = s.hard_faults - dwPrevHardFaults;
+		DWORD dwSoftFaults = (s.page_faults - dwPrevFaults) - dwHardFaults;
+		sprintf(buffer, "%12.3f %10.2f %9.1f %14u %15u %14u %13u %13u %9u %9d %8d %7.2f %6.0f %10.0f %8.0f %7.0f %9.0f", s.time, s.fps, s.cpu_usage, s.process_memory,
+			s.private_ws, s.commit, dwSoftFaults, dwHardFaults, s.num_threads, s.threads_created - lPrevCreated, s.threads_exited - lPrevExited, s.concurrency, s.role_usage[THREAD_ROLE_MAIN],
+			s.role_usage[THREAD_ROLE_POOL], s.role_usage[THREAD_ROLE_PLUGIN], s.role_usage[THREAD_ROLE_OTHER] + s.role_usage[THREAD_ROLE_MONITOR], s.busiest_thread);
+		sOut += buffer;
+		lPrevCreated = s.threads_created;
+		lPrevExited = s.threads_exited;
+		dwPrevFaults = s.page_faults;
+		dwPrevHardFaults = s.hard_faults;
+
+		if (pGPUInfo)
+		{
+			sprintf(buffer, " %9u %9u %11.1f", s.gpu_usage, s.vpu_usage, s.gpu_power);
+			sOut += buffer;
+		}
+
+		if (bAllocs)
+		{
+			sprintf(buffer, " %10I64d %13.1f", s.allocs - llPrevAllocs, (double)(s.alloc_bytes - llPrevAllocBytes) / 1048576.0);
+			sOut += buffer;
+			llPrevAllocs = s.allocs;
+			llPrevAllocBytes = s.alloc_bytes;
+		}
+
+		sOut += "\n";
+	}
+
+	return sOut;
+}
+
+
+double CMonitor::GetMeanConcurrency()
+{
+	//the first sample has no interval
+	double dSum = 0.0;
+	for (size_t n = 1; n < vSamples.size(); n++)
+		dSum += vSamples[n].concurrency;
+
+	return (vSamples.size() > 1) ? (dSum / (double)(vSamples.size() - 1)) : 0.0;
+}
+
+
+BOOL CMonitor::FitMemoryGrowth(BOOL b_commit, double &d_slope, double &d_lower, double &d_upper)
+{
+	//KiB per frame of working set or commit against frames read, after the warm-up,
+	//without the growth of AVSMeter's own buffers (frame store, log rows)
+	d_slope = 0.0;
+	d_lower = 0.0;
+	d_upper = 0.0;
+
+	if (vSamples.size() < MONITOR_LEAK_MIN_POINTS)
+		return FALSE;
+
+	unsigned int uiWarmup = (unsigned int)((double)vSamples[vSamples.size() - 1].frames * MONITOR_LEAK_WARMUP);
+	size_t nFirst = 0;
+	while ((nFirst < vSamples.size()) && ((vSamples[nFirst].frames == 0) || (vSamples[nFirst].frames < uiWarmup)))
+		nFirst++;
+
+	size_t nPoints = vSamples.size() - nFirst;
+	if (nPoints < MONITOR_LEAK_MIN_POINTS)
+		return FALSE;
+
+	size_t nStride = (nPoints + MONITOR_LEAK_MAX_POINTS - 1) / MONITOR_LEAK_MAX_POINTS;
+	vector<double> vFrames;
+	vector<double> vKiB;
+	for (size_t n = nFirst; n < vSamples.size(); n += nStride)
+	{
+		vFrames.push_back((double)vSamples[n].frames);
+		vKiB.push_back((double)(b_commit ? vSamples[n].commit_kib : vSamples[n].working_set_kib) - (double)vSamples[n].own_kib);
+	}
+
+	CStats stats;
+
+	return stats.FitTheilSen(vFrames, vKiB, d_slope, d_lower, d_upper);
+}
+
+
+string CMonitor::FormatConcurrency(unsigned int ui_cores)
+{
+	string sOut = "";
+	char buffer[MAX_PATH_LEN + 256];
+
+	if (vSamples.size() < 2)
+		return sOut;
+
+	if (ui_cores < 1)
+		ui_cores = 1;
+
+	vector<unsigned int> vHistogram(ui_cores + 1, 0);
+	double dPeak = 0.0;
+	double dFPSSum = 0.0;
+	size_t nIntervals = vSamples.size() - 1;
+	for (size_t n = 1; n < vSamples.size(); n++)
+	{
+		unsigned int uiCores = (unsigned int)(vSamples[n].concurrency + 0.5);
+		if (uiCores > ui_cores)
+			uiCores = ui_cores;
+		++vHistogram[uiCores];
+
+		if (vSamples[n].concurrency > dPeak)
+			dPeak = vSamples[n].concurrency;
+		dFPSSum += vSamples[n].fps;
+	}
+
+	double dMean = GetMeanConcurrency();
+	double dFPSMean = dFPSSum / (double)nIntervals;
+
+	sOut += "\n\n[Effective concurrency]\n";
+	sprintf(buffer, "Busy cores (average | peak):   %.2f | %.2f of %u\n\n", dMean, dPeak, ui_cores);
+	sOut += buffer;
+	sOut += "Cores   Intervals   Share (%)\n";
+
+	for (unsigned int c = 0; c <= ui_cores; c++)
+	{
+		if (vHistogram[c] == 0)
+			continue;
+
+		double dShare = 100.0 * (double)vHistogram[c] / (double)nIntervals;
+		sprintf(buffer, "%5u %11u %11.1f   %s\n", c, vHistogram[c], dShare, string((size_t)(dShare / 2.0 + 0.5), '#').c_str());
+		sOut += buffer;
+	}
+
+	//serialized intervals: one busy thread while the run otherwise uses more than one core
+	if (dMean < MONITOR_SERIAL_CONCURRENCY)
+		return sOut;
+
+	sOut += "\nSerialized intervals (one busy thread):\n";
+	BOOL bFound = FALSE;
+	size_t n = 1;
+	while (n < vSamples.size())
+	{
+		stMonitorSample &s = vSamples[n];
+		if (!((s.concurrency < MONITOR_SERIAL_CONCURRENCY) && (s.busiest_thread >= MONITOR_BUSY_THREAD)))
+		{
+			++n;
+			continue;
+		}
+
+		size_t nFirst = n;
+		double dFPS = 0.0;
+		while ((n < vSamples.size()) && (vSamples[n].concurrency < MONITOR_SERIAL_CONCURRENCY) && (vSamples[n].busiest_thread >= MONITOR_BUSY_THREAD))
+		{
+			dFPS += vSamples[n].fps;
+			++n;
+		}
+
+		string sThread = threadinfo.DescribeThread(s.busiest_tid);
+
+		sprintf(buffer, "%10.2f - %.2f s   FPS %.2f (run average %.2f)   %s\n", vSamples[nFirst - 1].time, vSamples[n - 1].time, dFPS / (double)(n - nFirst), dFPSMean, sThread.c_str());
+		sOut += buffer;
+		bFound = TRUE;
+	}
+
+	if (!bFound)
+		sOut += "None\n";
+
+	return sOut;
+}
+
+
+#endif //_MONITOR_H
@@ -23,6 +23,51 @@
 #define _PROCESSINFO_H
 
 #include "common.h"
+#include "ThreadCounter.h"
+
+#define PROCESSINFO_SPI_BUFFER      262144
+#define PROCESSINFO_SPI_PERIOD_MS   2000    //the system process list is expensive, it is read at most this often
+#define PROCESSINFO_RECONCILE_MS    10000   //period of the check of the TLS thread count against the system process list
+
+typedef LONG (WINAPI *NT_QUERY_SYSTEM_INFORMATION)(ULONG, PVOID, ULONG, PULONG);
+
+//leading part of SYSTEM_PROCESS_INFORMATION (class 5), layout is stable since Windows 7
+struct stSystemProcessInfo
+{
+	ULONG         NextEntryOffset;
+	ULONG         NumberOfThreads;
+	LARGE_INTEGER WorkingSetPrivateSize;
+	ULONG         HardFaultCount;
+	ULONG         NumberOfThreadsHighWatermark;
+	ULONGLONG     CycleTime;
+	LARGE_INTEGER CreateTime;
+	LARGE_INTEGER UserTime;
+	LARGE_INTEGER KernelTime;
+	USHORT        ImageNameLength;
+	USHORT        ImageNameMaximumLength;
+	PWSTR         ImageNameBuffer;
+	LONG          BasePriority;
+	HANDLE        UniqueProcessId;
+};
+
+//PROCESS_MEMORY_COUNTERS_EX2, not declared by older SDKs
+struct stProcessMemoryCountersEx2
+{
+	DWORD   cb;
+	DWORD   PageFaultCount;
+	SIZE_T  PeakWorkingSetSize;
+	SIZE_T  WorkingSetSize;
+	SIZE_T  QuotaPeakPagedPoolUsage;
+	SIZE_T  QuotaPagedPoolUsage;
+	SIZE_T  QuotaPeakNonPagedPoolUsage;
+	SIZE_T  QuotaNonPagedPoolUsage;
+	SIZE_T  PagefileUsage;
+	SIZE_T  PeakPagefileUsage;
+	SIZE_T  PrivateUsage;
+	SIZE_T  PrivateWorkingSetSize;
+	ULONG64 SharedCommitUsage;
+};
+
 
 class CProcessInfo
 {
@@ -34,11 +79,24 @@ public:
 	void   CloseProcess();
 	double dCPUUsage;
 	WORD   wThreadCount;
-	DWORD  dwMemMB;
+	LONG   lThreadsCreated;          //since process start
+	LONG   lThreadsExited;
+	unsigned __int64 ui64Cycles;     //CPU cycles of all threads since process start
+	DWORD  dwMemMB;                  //working set
+	DWORD  dwMemKiB;
+	DWORD  dwMemPeakMB;              //peak working set as tracked by the OS
+	DWORD  dwPrivateWSMB;            //private part of the working set, the rest is shared/file-backed
+	DWORD  dwCommitMB;               //private bytes (commit charge)
+	DWORD  dwCommitKiB;
+	DWORD  dwCommitPeakMB;
+	DWORD  dwPageFaults;             //soft + hard, since process start
+	DWORD  dwHardFaults;             //since process start, 0 if not available
+	BOOL   bHardFaults;              //hard faults need the system process list, off by default
 
 private:
 	WORD GetCurrentThreadCount();
 	void GetCPUUsage();
+	void GetSystemProcessInfo();
 	unsigned __int64 SubtractTimes(const FILETIME& ftA, const FILETIME& ftB);
 	BOOL bFirstRun;
 	unsigned __int64 GetSTDTimer();
@@ -49,8 +107,16 @@ private:
 	FILETIME ftPrevProcUser;
 
 	HANDLE hProcess;
-	PROCESS_MEMORY_COUNTERS pmc;
+	stProcessMemoryCountersEx2 pmc;
+	BOOL bPMCEx2;
 	volatile LONG lRunCount;
+	vector<BYTE> vSPIBuffer;
+	unsigned __int64 ui64NextSPIMS;
+	unsigned __int64 ui64NextReconcileMS;
+	LONG   lUncounted;               //threads the TLS callback never saw, as of the last check
+	LONG   lUncountedCreated;
+	LONG   lUncountedExited;
+	NT_QUERY_SYSTEM_INFORMATION pNtQuerySystemInformation;
 };
 
 
@@ -59,6 +125,23 @@ CProcessInfo::CProcessInfo()
 	hProcess = ::OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, ::GetCurrentProcessId());
 
 	dwMemMB = 0;
+	dwMemKiB = 0;
+	dwMemPeakMB = 0;
+	dwPrivateWSMB = 0;
+	dwCommitMB = 0;
+	dwCommitKiB = 0;
+	dwCommitPeakMB = 0;
+	dwPageFaults = 0;
+	dwHardFaults = 0;
+	bHardFaults = FALSE;
+	::ZeroMemory(&pmc, sizeof(pmc));
+	bPMCEx2 = TRUE;
+	ui64NextSPIMS = 0;
+	ui64NextReconcileMS = 0;
+	lUncounted = 0;
+	lUncountedCreated = 0;
+	lUncountedExited = 0;
+	pNtQuerySystemInformation = (NT_QUERY_SYSTEM_INFORMATION)::GetProcAddress(::GetModuleHandle("ntdll.dll"), "NtQuerySystemInformation");
 
 	::ZeroMemory(&ftPrevSysKernel, sizeof(FILETIME));
 	::ZeroMemory(&ftPrevSysUser, sizeof(FILETIME));
@@ -66,6 +149,9 @@ CProcessInfo::CProcessInfo()
 	::ZeroMemory(&ftPrevProcUser, sizeof(FILETIME));
 
 	dCPUUsage = 0.0;
+	lThreadsCreated = 0;
+	lThreadsExited = 0;
+	ui64Cycles = 0;
 	wThreadCount = GetCurrentThreadCount();
 	bFirstRun = TRUE;
 	lRunCount = 0;
@@ -87,29 +173,41 @@ void CProcessInfo::CloseProcess()
 
 void CProcessInfo::Update()
 {
-	static unsigned __int64 uiLastTimeRun;
-	static unsigned __int64 uiLastTimeRunTH;
-
-	if (((GetSTDTimer() - uiLastTimeRun) < 500) && !bFirstRun)
-		return;
-
-	uiLastTimeRun = GetSTDTimer();
-
+	//called at a fixed period by the monitor thread
 	GetCPUUsage();
+
+	ULONG64 ul64Cycles = 0;
+	if (::QueryProcessCycleTime(hProcess, &ul64Cycles))
+		ui64Cycles = (unsigned __int64)ul64Cycles;
 	bFirstRun = FALSE;
 
 	if (dCPUUsage >= 100.0)
 		dCPUUsage = 99.99999999;
 
-	::GetProcessMemoryInfo(hProcess, &pmc, sizeof(pmc));
+	pmc.cb = bPMCEx2 ? sizeof(pmc) : sizeof(PROCESS_MEMORY_COUNTERS_EX);
+	if (!::GetProcessMemoryInfo(hProcess, (PROCESS_MEMORY_COUNTERS *)&pmc, pmc.cb) && bPMCEx2)
+	{
+		//the private working set is only reported by recent versions of Windows 10 and 11
+		bPMCEx2 = FALSE;
+		pmc.cb = sizeof(PROCESS_MEMORY_COUNTERS_EX);
+		::GetProcessMemoryInfo(hProcess, (PROCESS_MEMORY_COUNTERS *)&pmc, pmc.cb);
+	}
+
+	if (bPMCEx2)
+		dwPrivateWSMB = (DWORD)(((double)(pmc.PrivateWorkingSetSize) / 1048576.0) + 0.5);
 	dwMemMB = (DWORD)(((double)(pmc.WorkingSetSize) / 1048576.0) + 0.5);
+	dwMemPeakMB = (DWORD)(((double)(pmc.PeakWorkingSetSize) / 1048576.0) + 0.5);
+	dwCommitMB = (DWORD)(((double)(pmc.PrivateUsage) / 1048576.0) + 0.5);
+	dwMemKiB = (DWORD)(pmc.WorkingSetSize / 1024);
+	dwCommitKiB = (DWORD)(pmc.PrivateUsage / 1024);
+	dwCommitPeakMB = (DWORD)(((double)(pmc.PeakPagefileUsage) / 1048576.0) + 0.5);
+	dwPageFaults = pmc.PageFaultCount;
 
-	//Thread count should only be updated every few seconds to reduce overhead
-	if ((GetSTDTimer() - uiLastTimeRunTH) < 5000)
-		return;
+	GetSystemProcessInfo();
 
 	wThreadCount = GetCurrentThreadCount();
-	uiLastTimeRunTH = GetSTDTimer();
+	lThreadsCreated = threadcounters.lCreated + lUncountedCreated;
+	lThreadsExited = threadcounters.lExited + lUncountedExited;
 
 	return;
 }
@@ -154,6 +252,78 @@ void CProcessInfo::GetCPUUsage()
 }
 
 
+void CProcessInfo::GetSystemProcessInfo()
+{
+	/*
+	Hard faults (and the private working set on older systems) are only exposed by the system process list,
+	a snapshot of all processes and threads, so it is read at a low rate and only when it is needed.
+	Its thread count also corrects the TLS callback count for threads created without attach
+	notifications, this check runs at an even lower rate.
+	*/
+	if (!pNtQuerySystemInformation)
+		return;
+
+	unsigned __int64 ui64NowMS = GetSTDTimer();
+	BOOL bFaults = (bHardFaults || !bPMCEx2) && (ui64NowMS >= ui64NextSPIMS);
+	BOOL bReconcile = (threadcounters.lPublished > 0) && (ui64NowMS >= ui64NextReconcileMS);
+	if (!bFaults && !bReconcile)
+		return;
+
+	if (bFaults)
+		ui64NextSPIMS = ui64NowMS + PROCESSINFO_SPI_PERIOD_MS;
+	ui64NextReconcileMS = ui64NowMS + PROCESSINFO_RECONCILE_MS;
+
+	if (vSPIBuffer.size() == 0)
+		vSPIBuffer.resize(PROCESSINFO_SPI_BUFFER);
+
+	ULONG ulNeeded = 0;
+	LONG lStatus = pNtQuerySystemInformation(5, &vSPIBuffer[0], (ULONG)vSPIBuffer.size(), &ulNeeded);
+	if (lStatus == (LONG)0xC0000004) //STATUS_INFO_LENGTH_MISMATCH
+	{
+		vSPIBuffer.resize(ulNeeded + PROCESSINFO_SPI_BUFFER);
+		lStatus = pNtQuerySystemInformation(5, &vSPIBuffer[0], (ULONG)vSPIBuffer.size(), &ulNeeded);
+	}
+
+	if (lStatus != 0)
+		return;
+
+	DWORD dwPID = ::GetCurrentProcessId();
+	size_t nOffset = 0;
+	for (;;)
+	{
+		stSystemProcessInfo *pSPI = (stSystemProcessInfo *)&vSPIBuffer[nOffset];
+		if ((DWORD)(DWORD_PTR)pSPI->UniqueProcessId == dwPID)
+		{
+			if (bHardFaults)
+				dwHardFaults = pSPI->HardFaultCount;
+			if (!bPMCEx2)
+				dwPrivateWSMB = (DWORD)(((double)(pSPI->WorkingSetPrivateSize.QuadPart) / 1048576.0) + 0.5);
+
+			//a change of the invisible threads counts as churn, a lower bound between two checks
+			if (threadcounters.lPublished > 0)
+			{
+				LONG lNow = (LONG)pSPI->NumberOfThreads - threadcounters.lAlive;
+				if (lNow < 0)
+					lNow = 0;
+				if (lNow > lUncounted)
+					lUncountedCreated += lNow - lUncounted;
+				else
+					lUncountedExited += lUncounted - lNow;
+				lUncounted = lNow;
+			}
+			break;
+		}
+
+		if (pSPI->NextEntryOffset == 0)
+			break;
+
+		nOffset += pSPI->NextEntryOffset;
+	}
+
+	return;
+}
+
+
 unsigned __int64 CProcessInfo::SubtractTimes(const FILETIME& ftA, const FILETIME& ftB)
 {
 	unsigned __int64 a = (((unsigned __int64)ftA.dwHighDateTime) << 32) + (unsigned __int64)ftA.dwLowDateTime;
@@ -165,6 +335,10 @@ unsigned __int64 CProcessInfo::SubtractTimes(const FILETIME& ftA, const FILETIME
 
 WORD CProcessInfo::GetCurrentThreadCount()
 {
+	//maintained by the TLS callback and corrected by the system process list, the Toolhelp snapshot is only a fallback
+	if (threadcounters.lPublished > 0)
+		return (WORD)(threadcounters.lAlive + lUncounted);
+
 	DWORD dwPID = ::GetCurrentProcessId();
 	HANDLE hThreadSnapshot = INVALID_HANDLE_VALUE;
 	THREADENTRY32 te32;
@@ -0,0 +1,429 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_PROFILER_H)
+#define _PROFILER_H
+
+#include "common.h"
+#include "ThreadCounter.h"
+
+#define PROFILER_PERIOD_MS          2
+#define PROFILER_MAX_ADDRESSES      200000
+#define PROFILER_TOP_MODULES        20
+#define PROFILER_TOP_SYMBOLS        30
+
+typedef BOOL    (WINAPI *SYM_INITIALIZE)(HANDLE, PCSTR, BOOL);
+typedef BOOL    (WINAPI *SYM_CLEANUP)(HANDLE);
+typedef DWORD   (WINAPI *SYM_SET_OPTIONS)(DWORD);
+typedef BOOL    (WINAPI *SYM_FROM_ADDR)(HANDLE, DWORD64, PDWORD64, PSYMBOL_INFO);
+
+
+struct stProfilerThread
+{
+	DWORD            tid;
+	HANDLE           handle;
+	unsigned __int64 cycles;
+};
+
+
+struct stProfilerModule
+{
+	DWORD_PTR        base;
+	DWORD_PTR        end;
+	string           path;
+};
+
+
+class CProfiler
+{
+public:
+	CProfiler();
+	virtual ~CProfiler();
+
+	BOOL   Start(DWORD dw_period_ms);
+	void   Stop();
+	string Report(vector<string> &v_plugins);
+
+	BOOL   bEnabled;
+	unsigned int uiSamples;
+	unsigned int uiDropped;
+
+private:
+	static unsigned __stdcall ProfilerThread(void *p_param);
+	void   TakeSamples();
+	void   UpdateThreads();
+	void   UpdateModules();
+	int    FindModule(DWORD_PTR dwp_address);
+
+	vector<stProfilerThread> vThreads;
+	vector<stProfilerModule> vModules;
+	map<DWORD_PTR, unsigned int> mAddresses;
+	LONG   lRingRead;
+	DWORD  dwPeriodMS;
+	DWORD  dwProfilerThread;
+	HANDLE hThread;
+	HANDLE hStopEvent;
+};
+
+
+CProfiler::CProfiler()
+{
+	bEnabled = FALSE;
+	uiSamples = 0;
+	uiDropped = 0;
+	lRingRead = 0;
+	dwPeriodMS = PROFILER_PERIOD_MS;
+	dwProfilerThread = 0;
+	hThread = NULL;
+	hStopEvent = NULL;
+}
+
+CProfiler::~CProfiler()
+{
+	Stop();
+
+	for (size_t i = 0; i < vThreads.size(); i++)
+	{
+		if (vThreads[i].handle)
+			::CloseHandle(vThreads[i].handle);
+	}
+}
+
+
+BOOL CProfiler::Start(DWORD dw_period_ms)
+{
+	if (hThread)
+		return FALSE;
+
+	dwPeriodMS = dw_period_ms;
+	UpdateModules();
+
+	hStopEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!hStopEvent)
+		return FALSE;
+
+	hThread = (HANDLE)_beginthreadex(NULL, 0, ProfilerThread, this, 0, NULL);
+	if (!hThread)
+	{
+		::CloseHandle(hStopEvent);
+		hStopEvent = NULL;
+		return FALSE;
+	}
+
+	::SetThreadPriority(hThread, THREAD_PRIORITY_TIME_CRITICAL);
+
+	return TRUE;
+}
+
+
+void CProfiler::Stop()
+{
+	if (!hThread)
+		return;
+
+	::SetEvent(hStopEvent);
+	::WaitForSingleObject(hThread, INFINITE);
+	::CloseHandle(hThread);
+	::CloseHandle(hStopEvent);
+	hThread = NULL;
+	hStopEvent = NULL;
+
+	return;
+}
+
+
+unsigned __stdcall CProfiler::ProfilerThread(void *p_param)
+{
+	CProfiler *pProfiler = (CProfiler *)p_param;
+	pProfiler->dwProfilerThread = ::GetCurrentThreadId();
+
+	::timeBeginPeriod(1);
+
+	while (::WaitForSingleObject(pProfiler->hStopEvent, pProfiler->dwPeriodMS) == WAIT_TIMEOUT)
+		pProfiler->TakeSamples();
+
+	::timeEndPeriod(1);
+
+	return 0;
+}
+
+
+void CProfiler::UpdateThreads()
+{
+	//same source as CThreadInfo: thread IDs published by the TLS callback
+	LONG lPublished = threadcounters.lPublished;
+	if ((lPublished - lRingRead) > THREADCOUNTER_RING_SIZE)
+		lRingRead = lPublished - THREADCOUNTER_RING_SIZE;
+
+	for (; lRingRead < lPublished; lRingRead++)
+	{
+		DWORD dwTID = threadcounters.dwThreadIDs[lRingRead % THREADCOUNTER_RING_SIZE];
+		if (dwTID == dwProfilerThread)
+			continue;
+
+		HANDLE hTarget = ::OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION | SYNCHRONIZE, FALSE, dwTID);
+		if (!hTarget)
+			continue;
+
+		stProfilerThread pt;
+		pt.tid = dwTID;
+		pt.handle = hTarget;
+		pt.cycles = 0;
+		ULONG64 ul64Cycles = 0;
+		if (::QueryThreadCycleTime(hTarget, &ul64Cycles))
+			pt.cycles = (unsigned __int64)ul64Cycles;
+
+		vThreads.push_back(pt);
+	}
+
+	return;
+}
+
+
+void CProfiler::TakeSamples()
+{
+	UpdateThreads();
+
+	DWORD_PTR dwpAddresses[256];
+	size_t nAddresses = 0;
+
+	for (size_t i = 0; i < vThreads.size(); i++)
+	{
+		stProfilerThread &pt = vThreads[i];
+		if (!pt.handle)
+			continue;
+
+		if (::WaitForSingleObject(pt.handle, 0) == WAIT_OBJECT_0)
+		{
+			::CloseHandle(pt.handle);
+			pt.handle = NULL;
+			continue;
+		}
+
+		//only threads that consumed CPU time since the last tick are sampled
+		ULONG64 ul64Cycles = 0;
+		if (!::QueryThreadCycleTime(pt.handle, &ul64Cycles) || ((unsigned __int64)ul64Cycles == pt.cycles))
+			continue;
+		pt.cycles = (unsigned __int64)ul64Cycles;
+
+		if (nAddresses >= 256)
+		{
+			++uiDropped;
+			continue;
+		}
+
+		//nothing that could take a lock (heap, loader) may run while the target is suspended
+		if (::SuspendThread(pt.handle) == (DWORD)-1)
+			continue;
+
+		CONTEXT ctx;
+		ctx.ContextFlags = CONTEXT_CONTROL;
+		BOOL bContext = ::GetThreadContext(pt.handle, &ctx);
+		::ResumeThread(pt.handle);
+
+		if (!bContext)
+			continue;
+
+#ifdef _WIN64
+		dwpAddresses[nAddresses++] = (DWORD_PTR)ctx.Rip;
+#else
+		dwpAddresses[nAddresses++] = (DWORD_PTR)ctx.Eip;
+#endif
+	}
+
+	for (size_t n = 0; n < nAddresses; n++)
+	{
+		++uiSamples;
+		map<DWORD_PTR, unsigned int>::iterator it = mAddresses.find(dwpAddresses[n]);
+		if (it != mAddresses.end())
+			++it->second;
+		else if (mAddresses.size() < PROFILER_MAX_ADDRESSES)
+			mAddresses[dwpAddresses[n]] = 1;
+		else
+			++uiDropped;
+	}
+
+	return;
+}
+
+
+void CProfiler::UpdateModules()
+{
+	vModules.clear();
+
+	HMODULE hModules[2048];
+	DWORD dwSizeNeeded = 0;
+	if (!::EnumProcessModules(::GetCurrentProcess(), hModules, sizeof(hModules), &dwSizeNeeded))
+		return;
+
+	char szModule[MAX_PATH_LEN + 1];
+	for (unsigned int i = 0; (i < (dwSizeNeeded / sizeof(HMODULE))) && (i < 2048); i++)
+	{
+		MODULEINFO mi;
+		if (!::GetModuleInformation(::GetCurrentProcess(), hModules[i], &mi, sizeof(mi)))
+			continue;
+
+		if (!::GetModuleFileName(hModules[i], szModule, MAX_PATH_LEN))
+			continue;
+
+		stProfilerModule pm;
+		pm.base = (DWORD_PTR)mi.lpBaseOfDll;
+		pm.end = pm.base + mi.SizeOfImage;
+		pm.path = szModule;
+		vModules.push_back(pm);
+	}
+
+	return;
+}
+
+
+int CProfiler::FindModule(DWORD_PTR dwp_address)
+{
+	for (size_t i = 0; i < vModules.size(); i++)
+	{
+		if ((dwp_address >= vModules[i].base) && (dwp_address < vModules[i].end))
+			return (int)i;
+	}
+
+	return -1;
+}
+
+
+string CProfiler::Report(vector<string> &v_plugins)
+{
+	string sOut = "";
+	char buffer[MAX_PATH_LEN + 512];
+
+	//plugins may have been loaded after Start()
+	UpdateModules();
+
+	vector<unsigned int> vModuleSamples(vModules.size() + 1, 0);
+	map<string, unsigned int> mSymbols;
+
+	HMODULE hDbgHelp = ::LoadLibrary("dbghelp.dll");
+	SYM_INITIALIZE pSymInitialize = hDbgHelp ? (SYM_INITIALIZE)::GetProcAddress(hDbgHelp, "SymInitialize") : NULL;
+	SYM_CLEANUP pSymCleanup = hDbgHelp ? (SYM_CLEANUP)::GetProcAddress(hDbgHelp, "SymCleanup") : NULL;
+	SYM_SET_OPTIONS pSymSetOptions = hDbgHelp ? (SYM_SET_OPTIONS)::GetProcAddress(hDbgHelp, "SymSetOptions") : NULL;
+	SYM_FROM_ADDR pSymFromAddr = hDbgHelp ? (SYM_FROM_ADDR)::GetProcAddress(hDbgHelp, "SymFromAddr") : NULL;
+
+	BOOL bSymbols = FALSE;
+	if (pSymInitialize && pSymCleanup && pSymSetOptions && pSymFromAddr)
+	{
+		pSymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_FAIL_CRITICAL_ERRORS);
+		bSymbols = pSymInitialize(::GetCurrentProcess(), NULL, TRUE);
+	}
+
+	char cSymbolBuffer[sizeof(SYMBOL_INFO) + 256];
+	PSYMBOL_INFO pSymbol = (PSYMBOL_INFO)cSymbolBuffer;
+
+	for (map<DWORD_PTR, unsigned int>::iterator it = mAddresses.begin(); it != mAddresses.end(); ++it)
+	{
+		int iModule = FindModule(it->first);
+		vModuleSamples[(iModule >= 0) ? (size_t)iModule : vModules.size()] += it->second;
+
+		string sModule = (iModule >= 0) ? vModules[iModule].path.substr(vModules[iModule].path.find_last_of('\\') + 1) : "?";
+		string sSymbol = "";
+
+		if (bSymbols)
+		{
+			::ZeroMemory(cSymbolBuffer, sizeof(cSymbolBuffer));
+			pSymbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+			pSymbol->MaxNameLen = 255;
+			DWORD64 dw64Displacement = 0;
+			if (pSymFromAddr(::GetCurrentProcess(), (DWORD64)it->first, &dw64Displacement, pSymbol))
+				sSymbol = pSymbol->Name;
+		}
+
+		if (sSymbol == "")
+			sSymbol = "?";
+
+		mSymbols[sModule + "!" + sSymbol] += it->second;
+	}
+
+	if (bSymbols)
+		pSymCleanup(::GetCurrentProcess());
+	if (hDbgHelp)
+		::FreeLibrary(hDbgHelp);
+
+	sOut += "\n\n[Sampling profile]\n";
+	sprintf(buffer, "Samples: %u (%u ms period, running threads only), dropped: %u\n\n", uiSamples, dwPeriodMS, uiDropped);
+	sOut += buffer;
+
+	if (uiSamples == 0)
+		return sOut;
+
+	//modules, labeled with the plugin inventory
+	vector<std::pair<unsigned int, size_t> > vModuleOrder;
+	for (size_t i = 0; i < vModuleSamples.size(); i++)
+	{
+		if (vModuleSamples[i] > 0)
+			vModuleOrder.push_back(std::make_pair(vModuleSamples[i], i));
+	}
+	sort(vModuleOrder.rbegin(), vModuleOrder.rend());
+
+	string sWindowsDir = "";
+	if (::GetWindowsDirectory(buffer, MAX_PATH))
+	{
+		sWindowsDir = buffer;
+		transform(sWindowsDir.begin(), sWindowsDir.end(), sWindowsDir.begin(), ::tolower);
+		sWindowsDir += "\\";
+	}
+
+	sOut += "Samples   Share (%)   Module\n";
+	for (size_t n = 0; (n < vModuleOrder.size()) && (n < PROFILER_TOP_MODULES); n++)
+	{
+		size_t i = vModuleOrder[n].second;
+		string sPath = (i < vModules.size()) ? vModules[i].path : "(unknown)";
+		string sPathLC = sPath;
+		transform(sPathLC.begin(), sPathLC.end(), sPathLC.begin(), ::tolower);
+
+		string sLabel = "";
+		if (sPathLC.substr(sPathLC.find_last_of('\\') + 1) == "avisynth.dll")
+			sLabel = " [Avisynth]";
+		else if ((sWindowsDir != "") && (sPathLC.substr(0, sWindowsDir.length()) == sWindowsDir))
+			sLabel = " [System]";
+
+		for (size_t p = 0; p < v_plugins.size(); p++)
+		{
+			string sPlugin = v_plugins[p].substr(v_plugins[p].find('|') + 1);
+			transform(sPlugin.begin(), sPlugin.end(), sPlugin.begin(), ::tolower);
+			if (sPlugin == sPathLC)
+				sLabel = " [" + v_plugins[p].substr(0, v_plugins[p].find('|')) + "]";
+		}
+
+		sprintf(buffer, "%7u %11.1f   %s%s\n", vModuleOrder[n].first, 100.0 * (double)vModuleOrder[n].first / (double)uiSamples, sPath.c_str(), sLabel.c_str());
+		sOut += buffer;
+	}
+
+	vector<std::pair<unsigned int, string> > vSymbolOrder;
+	for (map<string, unsigned int>::iterator it = mSymbols.begin(); it != mSymbols.end(); ++it)
+		vSymbolOrder.push_back(std::make_pair(it->second, it->first));
+	sort(vSymbolOrder.rbegin(), vSymbolOrder.rend());
+
+	sOut += "\nSamples   Share (%)   Symbol\n";
+	for (size_t n = 0; (n < vSymbolOrder.size()) && (n < PROFILER_TOP_SYMBOLS); n++)
+	{
+		sprintf(buffer, "%7u %11.1f   %s\n", vSymbolOrder[n].first, 100.0 * (double)vSymbolOrder[n].first / (double)uiSamples, vSymbolOrder[n].second.c_str());
+		sOut += buffer;
+	}
+
+	return sOut;
+}
+
+
+#endif //_PROFILER_H
@@ -0,0 +1,301 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_RESULTSDB_H)
+#define _RESULTSDB_H
+
+#include "common.h"
+#include "MetricsFile.h"
+
+/*
+Results database: one append-only file, no server. Every record is written with a single
+WriteFile call while the append lock is held, so several instances can share the file.
+
+File:    "AMRB" (DWORD), version (DWORD), records...
+Record:  "RREC" (DWORD), payload size (DWORD), CRC32 of the payload (DWORD), payload
+
+The three fingerprints lead the payload, a query can match them before decoding the rest.
+A damaged record (crash during a write) is skipped by searching for the next record magic.
+*/
+#define RESULTSDB_FILE_MAGIC        0x42524D41    //"AMRB"
+#define RESULTSDB_RECORD_MAGIC      0x43455252    //"RREC"
+#define RESULTSDB_VERSION           1
+#define RESULTSDB_MAX_RECORD        65536
+#define RESULTSDB_FNV_OFFSET        14695981039346656037ULL
+#define RESULTSDB_FNV_PRIME         1099511628211ULL
+
+
+struct stResultRecord
+{
+	unsigned __int64 ui64Script;       //script text and the AVSI files it imports
+	unsigned __int64 ui64Environment;  //Avisynth version, plugin inventory, auto-loaded AVSI files
+	unsigned __int64 ui64Machine;      //CPU model, logical cores, x86/x64
+	unsigned __int64 ui64Time;         //FILETIME, UTC
+	double        dFPS;
+	double        dFrameTimeP50;       //ms
+	double        dFrameTimeP99;       //ms
+	double        dRuntime;            //seconds
+	DWORD         dwFrames;
+	DWORD         dwMemPeak;           //MiB
+	string        sScriptFile;
+	string        sAVSMVersion;
+	string        sAVSVersion;
+	string        sCPU;
+};
+
+
+class CResultsDB
+{
+public:
+	CResultsDB();
+
+	BOOL   Append(string &s_file, stResultRecord &record);
+	BOOL   Load(string &s_file, vector<stResultRecord> &v_records);
+
+	static unsigned __int64 Hash(const void *p_data, size_t n_size, unsigned __int64 ui64_hash);
+	static unsigned __int64 HashString(string &s_value, unsigned __int64 ui64_hash);
+
+	unsigned int uiSkipped;   //damaged records passed over by Load()
+	string sError;
+
+private:
+	static BOOL Get(const BYTE *p_data, size_t n_size, size_t &n_pos, void *p_out, size_t n_out);
+	static BOOL GetString(const BYTE *p_data, size_t n_size, size_t &n_pos, string &s_value);
+	BOOL   Decode(const BYTE *p_data, size_t n_size, stResultRecord &record);
+};
+
+
+CResultsDB::CResultsDB()
+{
+	uiSkipped = 0;
+	sError = "";
+}
+
+
+unsigned __int64 CResultsDB::Hash(const void *p_data, size_t n_size, unsigned __int64 ui64_hash)
+{
+	//FNV-1a, like the frame hashes of the MT mode tuner
+	const BYTE *p = (const BYTE *)p_data;
+	for (size_t n = 0; n < n_size; n++)
+	{
+		ui64_hash ^= p[n];
+		ui64_hash *= RESULTSDB_FNV_PRIME;
+	}
+
+	return ui64_hash;
+}
+
+
+unsigned __int64 CResultsDB::HashString(string &s_value, unsigned __int64 ui64_hash)
+{
+	//the terminator keeps "ab" + "c" apart from "a" + "bc"
+	return Hash(s_value.c_str(), s_value.length() + 1, ui64_hash);
+}
+
+
+BOOL CResultsDB::Append(string &s_file, stResultRecord &record)
+{
+	vector<BYTE> vPayload;
+	MetricsPut(vPayload, &record.ui64Script, sizeof(record.ui64Script));
+	MetricsPut(vPayload, &record.ui64Environment, sizeof(record.ui64Environment));
+	MetricsPut(vPayload, &record.ui64Machine, sizeof(record.ui64Machine));
+	MetricsPut(vPayload, &record.ui64Time, sizeof(record.ui64Time));
+	MetricsPut(vPayload, &record.dFPS, sizeof(record.dFPS));
+	MetricsPut(vPayload, &record.dFrameTimeP50, sizeof(record.dFrameTimeP50));
+	MetricsPut(vPayload, &record.dFrameTimeP99, sizeof(record.dFrameTimeP99));
+	MetricsPut(vPayload, &record.dRuntime, sizeof(record.dRuntime));
+	MetricsPut(vPayload, &record.dwFrames, sizeof(record.dwFrames));
+	MetricsPut(vPayload, &record.dwMemPeak, sizeof(record.dwMemPeak));
+	MetricsPutString(vPayload, record.sScriptFile);
+	MetricsPutString(vPayload, record.sAVSMVersion);
+	MetricsPutString(vPayload, record.sAVSVersion);
+	MetricsPutString(vPayload, record.sCPU);
+
+	if (vPayload.size() > RESULTSDB_MAX_RECORD)
+	{
+		sError = "Result record too large";
+		return FALSE;
+	}
+
+	DWORD dwMagic = RESULTSDB_RECORD_MAGIC;
+	DWORD dwSize = (DWORD)vPayload.size();
+	DWORD dwCRC = MetricsCRC32(&vPayload[0], vPayload.size(), 0);
+	vector<BYTE> vRecord;
+	MetricsPut(vRecord, &dwMagic, sizeof(dwMagic));
+	MetricsPut(vRecord, &dwSize, sizeof(dwSize));
+	MetricsPut(vRecord, &dwCRC, sizeof(dwCRC));
+	vRecord.insert(vRecord.end(), vPayload.begin(), vPayload.end());
+
+	HANDLE hFile = ::CreateFile(s_file.c_str(), FILE_APPEND_DATA | FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		sError = "Cannot open \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	//a byte range far beyond the end of the file serves as the lock between instances
+	OVERLAPPED ovLock;
+	::ZeroMemory(&ovLock, sizeof(ovLock));
+	ovLock.Offset = 0xFFFFFFFE;
+	ovLock.OffsetHigh = 0x7FFFFFFF;
+	BOOL bLocked = ::LockFileEx(hFile, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ovLock);
+
+	BOOL bRet = TRUE;
+	DWORD dwWritten = 0;
+	LARGE_INTEGER liSize;
+	if (::GetFileSizeEx(hFile, &liSize) && (liSize.QuadPart == 0))
+	{
+		DWORD dwHeader[2] = {RESULTSDB_FILE_MAGIC, RESULTSDB_VERSION};
+		if (!::WriteFile(hFile, dwHeader, sizeof(dwHeader), &dwWritten, NULL) || (dwWritten != sizeof(dwHeader)))
+			bRet = FALSE;
+	}
+
+	if (bRet && (!::WriteFile(hFile, &vRecord[0], (DWORD)vRecord.size(), &dwWritten, NULL) || (dwWritten != (DWORD)vRecord.size())))
+		bRet = FALSE;
+
+	if (bLocked)
+		::UnlockFileEx(hFile, 0, 1, 0, &ovLock);
+	::CloseHandle(hFile);
+
+	if (!bRet)
+		sError = "Cannot write \"" + s_file + "\" (disk full?)";
+
+	return bRet;
+}
+
+
+BOOL CResultsDB::Get(const BYTE *p_data, size_t n_size, size_t &n_pos, void *p_out, size_t n_out)
+{
+	if ((n_pos + n_out) > n_size)
+		return FALSE;
+
+	memcpy(p_out, p_data + n_pos, n_out);
+	n_pos += n_out;
+
+	return TRUE;
+}
+
+
+BOOL CResultsDB::GetString(const BYTE *p_data, size_t n_size, size_t &n_pos, string &s_value)
+{
+	DWORD dwLength = 0;
+	if (!Get(p_data, n_size, n_pos, &dwLength, sizeof(dwLength)) || ((n_pos + dwLength) > n_size))
+		return FALSE;
+
+	s_value.assign((const char *)(p_data + n_pos), dwLength);
+	n_pos += dwLength;
+
+	return TRUE;
+}
+
+
+BOOL CResultsDB::Decode(const BYTE *p_data, size_t n_size, stResultRecord &record)
+{
+	size_t nPos = 0;
+
+	return Get(p_data, n_size, nPos, &record.ui64Script, sizeof(record.ui64Script)) &&
+	       Get(p_data, n_size, nPos, &record.ui64Environment, sizeof(record.ui64Environment)) &&
+	       Get(p_data, n_size, nPos, &record.ui64Machine, sizeof(record.ui64Machine)) &&
+	       Get(p_data, n_size, nPos, &record.ui64Time, sizeof(record.ui64Time)) &&
+	       Get(p_data, n_size, nPos, &record.dFPS, sizeof(record.dFPS)) &&
+	       Get(p_data, n_size, nPos, &record.dFrameTimeP50, sizeof(record.dFrameTimeP50)) &&
+	       Get(p_data, n_size, nPos, &record.dFrameTimeP99, sizeof(record.dFrameTimeP99)) &&
+	       Get(p_data, n_size, nPos, &record.dRuntime, sizeof(record.dRuntime)) &&
+	       Get(p_data, n_size, nPos, &record.dwFrames, sizeof(record.dwFrames)) &&
+	       Get(p_data, n_size, nPos, &record.dwMemPeak, sizeof(record.dwMemPeak)) &&
+	       GetString(p_data, n_size, nPos, record.sScriptFile) &&
+	       GetString(p_data, n_size, nPos, record.sAVSMVersion) &&
+	       GetString(p_data, n_size, nPos, record.sAVSVersion) &&
+	       GetString(p_data, n_size, nPos, record.sCPU);
+}
+
+
+BOOL CResultsDB::Load(string &s_file, vector<stResultRecord> &v_records)
+{
+	v_records.clear();
+	uiSkipped = 0;
+
+	HANDLE hFile = ::CreateFile(s_file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		sError = "Cannot open \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	//records appended while reading are left for the next query
+	LARGE_INTEGER liSize;
+	vector<BYTE> vData;
+	DWORD dwRead = 0;
+	BOOL bRead = ::GetFileSizeEx(hFile, &liSize) && (liSize.QuadPart < 0x40000000);
+	if (bRead && (liSize.QuadPart > 0))
+	{
+		vData.resize((size_t)liSize.QuadPart);
+		bRead = ::ReadFile(hFile, &vData[0], (DWORD)vData.size(), &dwRead, NULL);
+		vData.resize(dwRead);
+	}
+	::CloseHandle(hFile);
+
+	DWORD dwHeader[2] = {0, 0};
+	size_t nPos = 0;
+	if (!bRead || !Get(vData.size() ? &vData[0] : NULL, vData.size(), nPos, dwHeader, sizeof(dwHeader)) || (dwHeader[0] != RESULTSDB_FILE_MAGIC))
+	{
+		sError = "\"" + s_file + "\" is not an AVSMeter results database";
+		return FALSE;
+	}
+
+	if (dwHeader[1] > RESULTSDB_VERSION)
+	{
+		sError = "\"" + s_file + "\" was written by a newer AVSMeter";
+		return FALSE;
+	}
+
+	const BYTE *pData = &vData[0];
+	size_t nSize = vData.size();
+	BOOL bResync = FALSE;
+	while ((nPos + 12) <= nSize)
+	{
+		DWORD dwMagic = 0, dwSize = 0, dwCRC = 0;
+		size_t nRecord = nPos;
+		Get(pData, nSize, nPos, &dwMagic, sizeof(dwMagic));
+		Get(pData, nSize, nPos, &dwSize, sizeof(dwSize));
+		Get(pData, nSize, nPos, &dwCRC, sizeof(dwCRC));
+
+		stResultRecord record;
+		if ((dwMagic == RESULTSDB_RECORD_MAGIC) && (dwSize <= RESULTSDB_MAX_RECORD) && ((nPos + dwSize) <= nSize) &&
+		    (MetricsCRC32(pData + nPos, dwSize, 0) == dwCRC) && Decode(pData + nPos, dwSize, record))
+		{
+			v_records.push_back(record);
+			nPos += dwSize;
+			bResync = FALSE;
+			continue;
+		}
+
+		//one damaged stretch counts once, the search moves on byte by byte
+		if (!bResync)
+			uiSkipped++;
+		bResync = TRUE;
+		nPos = nRecord + 1;
+	}
+
+	sError = "";
+
+	return TRUE;
+}
+
+
+#endif //_RESULTSDB_H
@@ -0,0 +1,600 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_SKETCH_H)
+#define _SKETCH_H
+
+#include "common.h"
+
+/*
+DDSketch: logarithmic buckets with relative accuracy alpha, every quantile is within alpha
+of a value that was actually added. The bucket count grows with log(max / min), not with the
+number of values, and two sketches with the same alpha merge by adding their buckets.
+*/
+
+#define SKETCH_ALPHA                0.01
+#define SKETCH_MAX_BINS             2048      //lowest buckets are collapsed beyond this
+#define SKETCH_MIN_VALUE            1.0e-9    //smaller values go to the zero bucket
+#define SKETCH_MINUTES              60        //minute windows kept, older ones only live on in their hour
+#define SKETCH_FILE_VERSION         1
+
+
+class CDDSketch
+{
+public:
+	CDDSketch();
+
+	void   Add(double d_value);
+	BOOL   Merge(CDDSketch &other);
+	double Quantile(double d_q);
+	void   Clear();
+
+	double GetMin();
+	double GetMax();
+	double GetMean();
+	unsigned __int64 GetCount();
+
+	string Serialize();
+	BOOL   Deserialize(string &s_line);
+
+	double dAlpha;
+
+private:
+	void   Grow(int i_index);
+
+	double dGamma;
+	double dLogGamma;
+	unsigned __int64 ui64Count;
+	unsigned __int64 ui64Zero;
+	double dMin;
+	double dMax;
+	double dSum;
+	int    iOffset;               //bucket index of vBins[0]
+	vector<unsigned __int64> vBins;
+};
+
+
+CDDSketch::CDDSketch()
+{
+	dAlpha = SKETCH_ALPHA;
+	dGamma = (1.0 + dAlpha) / (1.0 - dAlpha);
+	dLogGamma = log(dGamma);
+	Clear();
+}
+
+
+void CDDSketch::Clear()
+{
+	ui64Count = 0;
+	ui64Zero = 0;
+	dMin = 0.0;
+	dMax = 0.0;
+	dSum = 0.0;
+	iOffset = 0;
+	vBins.clear();
+
+	return;
+}
+
+
+double CDDSketch::GetMin()
+{
+	return (ui64Count > 0) ? dMin : 0.0;
+}
+
+
+double CDDSketch::GetMax()
+{
+	return (ui64Count > 0) ? dMax : 0.0;
+}
+
+
+double CDDSketch::GetMean()
+{
+	return (ui64Count > 0) ? (dSum / (double)ui64Count) : 0.0;
+}
+
+
+unsigned __int64 CDDSketch::GetCount()
+{
+	return ui64Count;
+}
+
+
+void CDDSketch::Grow(int i_index)
+{
+	//makes room for bucket i_index, collapsing the lowest buckets if the range gets too wide
+	if (vBins.size() == 0)
+	{
+		iOffset = i_index;
+		vBins.resize(1, 0);
+		return;
+	}
+
+	if (i_index < iOffset)
+	{
+		size_t nAdd = (size_t)(iOffset - i_index);
+		if (vBins.size() + nAdd > SKETCH_MAX_BINS)
+			return;
+
+		vBins.insert(vBins.begin(), nAdd, 0);
+		iOffset = i_index;
+		return;
+	}
+
+	size_t nNeed = (size_t)(i_index - iOffset) + 1;
+	if (nNeed <= vBins.size())
+		return;
+
+	if (nNeed > SKETCH_MAX_BINS)
+	{
+		size_t nCollapse = nNeed - SKETCH_MAX_BINS;
+		if (nCollapse >= vBins.size())
+		{
+			unsigned __int64 ui64All = 0;
+			for (size_t n = 0; n < vBins.size(); n++)
+				ui64All += vBins[n];
+			vBins.assign(1, ui64All);
+			iOffset = i_index - SKETCH_MAX_BINS + 1;
+		}
+		else
+		{
+			for (size_t n = 0; n < nCollapse; n++)
+				vBins[nCollapse] += vBins[n];
+			vBins.erase(vBins.begin(), vBins.begin() + nCollapse);
+			iOffset += (int)nCollapse;
+		}
+		nNeed = (size_t)(i_index - iOffset) + 1;
+	}
+
+	vBins.resize(nNeed, 0);
+
+	return;
+}
+
+
+void CDDSketch::Add(double d_value)
+{
+	if (ui64Count == 0)
+	{
+		dMin = d_value;
+		dMax = d_value;
+	}
+	else
+	{
+		if (d_value < dMin)
+			dMin = d_value;
+		if (d_value > dMax)
+			dMax = d_value;
+	}
+
+	ui64Count++;
+	dSum += d_value;
+
+	if (d_value < SKETCH_MIN_VALUE)
+	{
+		ui64Zero++;
+		return;
+	}
+
+	int iIndex = (int)ceil(log(d_value) / dLogGamma);
+	Grow(iIndex);
+
+	//below a collapsed range, the value lands in the lowest bucket
+	if (iIndex < iOffset)
+		iIndex = iOffset;
+
+	vBins[iIndex - iOffset]++;
+
+	return;
+}
+
+
+BOOL CDDSketch::Merge(CDDSketch &other)
+{
+	if (fabs(other.dAlpha - dAlpha) > 1.0e-12)
+		return FALSE;
+
+	if (other.ui64Count == 0)
+		return TRUE;
+
+	if (ui64Count == 0)
+	{
+		dMin = other.dMin;
+		dMax = other.dMax;
+	}
+	else
+	{
+		if (other.dMin < dMin)
+			dMin = other.dMin;
+		if (other.dMax > dMax)
+			dMax = other.dMax;
+	}
+
+	ui64Count += other.ui64Count;
+	ui64Zero += other.ui64Zero;
+	dSum += other.dSum;
+
+	if (other.vBins.size() > 0)
+	{
+		Grow(other.iOffset);
+		Grow(other.iOffset + (int)other.vBins.size() - 1);
+		for (size_t n = 0; n < other.vBins.size(); n++)
+		{
+			int iIndex = other.iOffset + (int)n;
+			if (iIndex < iOffset)
+				iIndex = iOffset;
+			vBins[iIndex - iOffset] += other.vBins[n];
+		}
+	}
+
+	return TRUE;
+}
+
+
+double CDDSketch::Quantile(double d_q)
+{
+	if (ui64Count == 0)
+		return 0.0;
+
+	if (d_q <= 0.0)
+		return dMin;
+	if (d_q >= 1.0)
+		return dMax;
+
+	//rank of the value, 0-based
+	unsigned __int64 ui64Rank = (unsigned __int64)(d_q * (double)(ui64Count - 1));
+	if (ui64Rank < ui64Zero)
+		return (dMin < SKETCH_MIN_VALUE) ? dMin : 0.0;
+
+	unsigned __int64 ui64Seen = ui64Zero;
+	double dValue = dMax;
+	for (size_t n = 0; n < vBins.size(); n++)
+	{
+		ui64Seen += vBins[n];
+		if (ui64Seen > ui64Rank)
+		{
+			dValue = 2.0 * pow(dGamma, (double)(iOffset + (int)n)) / (dGamma + 1.0);
+			break;
+		}
+	}
+
+	if (dValue < dMin)
+		dValue = dMin;
+	if (dValue > dMax)
+		dValue = dMax;
+
+	return dValue;
+}
+
+
+string CDDSketch::Serialize()
+{
+	//alpha count zero min max sum offset, then "index:count" for every used bucket
+	string sLine = "";
+	char szTemp[128];
+	_snprintf(szTemp, sizeof(szTemp) - 1, "%.6f %I64u %I64u %.17g %.17g %.17g %d", dAlpha, ui64Count, ui64Zero, dMin, dMax, dSum, iOffset);
+	szTemp[sizeof(szTemp) - 1] = 0;
+	sLine = szTemp;
+
+	for (size_t n = 0; n < vBins.size(); n++)
+	{
+		if (vBins[n] == 0)
+			continue;
+
+		_snprintf(szTemp, sizeof(szTemp) - 1, " %u:%I64u", (unsigned int)n, vBins[n]);
+		szTemp[sizeof(szTemp) - 1] = 0;
+		sLine += szTemp;
+	}
+
+	return sLine;
+}
+
+
+BOOL CDDSketch::Deserialize(string &s_line)
+{
+	Clear();
+
+	int iRead = 0;
+	if (sscanf(s_line.c_str(), "%lf %I64u %I64u %lf %lf %lf %d%n", &dAlpha, &ui64Count, &ui64Zero, &dMin, &dMax, &dSum, &iOffset, &iRead) < 7)
+		return FALSE;
+
+	if ((dAlpha <= 0.0) || (dAlpha >= 1.0))
+		return FALSE;
+
+	dGamma = (1.0 + dAlpha) / (1.0 - dAlpha);
+	dLogGamma = log(dGamma);
+
+	unsigned __int64 ui64Bins = ui64Zero;
+	const char *p = s_line.c_str() + iRead;
+	unsigned int uiBin = 0;
+	unsigned __int64 ui64BinCount = 0;
+	int iLen = 0;
+	while (sscanf(p, " %u:%I64u%n", &uiBin, &ui64BinCount, &iLen) == 2)
+	{
+		if (uiBin >= SKETCH_MAX_BINS)
+			return FALSE;
+
+		if (uiBin >= vBins.size())
+			vBins.resize(uiBin + 1, 0);
+
+		vBins[uiBin] = ui64BinCount;
+		ui64Bins += ui64BinCount;
+		p += iLen;
+	}
+
+	return (ui64Bins == ui64Count);
+}
+
+
+struct stSketchSet
+{
+	int        iWindow;           //minute or hour number, -1 = whole run
+	CDDSketch  frametime;         //ms
+	CDDSketch  cpu;               //%
+	CDDSketch  memory;            //MiB
+};
+
+
+class CSketchWindows
+{
+public:
+	CSketchWindows();
+
+	void   Add(double d_time, double d_frametime, double d_cpu, double d_memory);
+	string FormatWindows();
+	BOOL   Save(string &s_file, string &s_source);
+
+	static string FormatHeader();
+	static string FormatSet(string s_label, stSketchSet &sketches);
+	static BOOL   Load(string &s_file, stSketchSet &overall, string &s_error);
+
+	stSketchSet overall;
+	vector<stSketchSet> vHours;
+	vector<stSketchSet> vMinutes; //ring, oldest first after the minute index wrapped
+
+private:
+	static void AddToSet(stSketchSet &sketches, double d_frametime, double d_cpu, double d_memory);
+
+	stSketchSet current;          //running minute
+};
+
+
+CSketchWindows::CSketchWindows()
+{
+	overall.iWindow = -1;
+	current.iWindow = 0;
+}
+
+
+void CSketchWindows::AddToSet(stSketchSet &sketches, double d_frametime, double d_cpu, double d_memory)
+{
+	sketches.frametime.Add(d_frametime);
+	sketches.cpu.Add(d_cpu);
+	sketches.memory.Add(d_memory);
+
+	return;
+}
+
+
+void CSketchWindows::Add(double d_time, double d_frametime, double d_cpu, double d_memory)
+{
+	int iMinute = (int)(d_time / 60.0);
+	if ((iMinute != current.iWindow) && (current.frametime.GetCount() > 0))
+	{
+		//the finished minute goes into its hour, the minute ring keeps the most recent ones
+		int iHour = current.iWindow / 60;
+		if ((vHours.size() == 0) || (vHours.back().iWindow != iHour))
+		{
+			stSketchSet hour;
+			hour.iWindow = iHour;
+			vHours.push_back(hour);
+		}
+
+		vHours.back().frametime.Merge(current.frametime);
+		vHours.back().cpu.Merge(current.cpu);
+		vHours.back().memory.Merge(current.memory);
+
+		if (vMinutes.size() >= SKETCH_MINUTES)
+			vMinutes.erase(vMinutes.begin());
+		vMinutes.push_back(current);
+
+		current.frametime.Clear();
+		current.cpu.Clear();
+		current.memory.Clear();
+	}
+
+	current.iWindow = iMinute;
+	AddToSet(current, d_frametime, d_cpu, d_memory);
+	AddToSet(overall, d_frametime, d_cpu, d_memory);
+
+	return;
+}
+
+
+string CSketchWindows::FormatHeader()
+{
+	return "Window          Frames      Frame time p50 / p95 / p99 / max (ms)          CPU p50 / p95 (%)   Memory p50 / max (MiB)\n";
+}
+
+
+string CSketchWindows::FormatSet(string s_label, stSketchSet &sketches)
+{
+	char szLine[512];
+	_snprintf(szLine, sizeof(szLine) - 1, "%-12s %9I64u   %10.3f %10.3f %10.3f %10.3f   %8.1f %8.1f   %10.0f %10.0f\n",
+		s_label.c_str(), sketches.frametime.GetCount(),
+		sketches.frametime.Quantile(0.50), sketches.frametime.Quantile(0.95), sketches.frametime.Quantile(0.99), sketches.frametime.GetMax(),
+		sketches.cpu.Quantile(0.50), sketches.cpu.Quantile(0.95),
+		sketches.memory.Quantile(0.50), sketches.memory.GetMax());
+	szLine[sizeof(szLine) - 1] = 0;
+
+	return szLine;
+}
+
+
+string CSketchWindows::FormatWindows()
+{
+	string sRet = "\n\n[Percentiles]\n";
+	char szLabel[32];
+
+	sRet += FormatHeader();
+	sRet += FormatSet("Run", overall);
+
+	//the running minute is not in its hour yet
+	vector<stSketchSet> vAllHours = vHours;
+	if (current.frametime.GetCount() > 0)
+	{
+		int iHour = current.iWindow / 60;
+		if ((vAllHours.size() == 0) || (vAllHours.back().iWindow != iHour))
+		{
+			stSketchSet hour;
+			hour.iWindow = iHour;
+			vAllHours.push_back(hour);
+		}
+
+		vAllHours.back().frametime.Merge(current.frametime);
+		vAllHours.back().cpu.Merge(current.cpu);
+		vAllHours.back().memory.Merge(current.memory);
+	}
+
+	if (vAllHours.size() > 1)
+	{
+		sRet += "\n";
+		for (size_t n = 0; n < vAllHours.size(); n++)
+		{
+			_snprintf(szLabel, sizeof(szLabel) - 1, "Hour %d", vAllHours[n].iWindow + 1);
+			szLabel[sizeof(szLabel) - 1] = 0;
+			sRet += FormatSet(szLabel, vAllHours[n]);
+		}
+	}
+
+	if (vMinutes.size() > 0)
+	{
+		sRet += "\n";
+		for (size_t n = 0; n < vMinutes.size(); n++)
+		{
+			_snprintf(szLabel, sizeof(szLabel) - 1, "Minute %d", vMinutes[n].iWindow + 1);
+			szLabel[sizeof(szLabel) - 1] = 0;
+			sRet += FormatSet(szLabel, vMinutes[n]);
+		}
+
+		if (current.frametime.GetCount() > 0)
+		{
+			_snprintf(szLabel, sizeof(szLabel) - 1, "Minute %d", current.iWindow + 1);
+			szLabel[sizeof(szLabel) - 1] = 0;
+			sRet += FormatSet(szLabel, current);
+		}
+	}
+
+	return sRet;
+}
+
+
+BOOL CSketchWindows::Save(string &s_file, string &s_source)
+{
+	//text file, one sketch per line, so that runs from different machines can be merged with -merge
+	ofstream hFile(s_file.c_str());
+	if (!hFile.is_open())
+		return FALSE;
+
+	hFile << "[AVSMeter sketches]\n";
+	hFile << "Version=" << SKETCH_FILE_VERSION << "\n";
+	hFile << "Source=" << s_source << "\n";
+
+	vector<stSketchSet *> vSets;
+	vSets.push_back(&overall);
+	for (size_t n = 0; n < vHours.size(); n++)
+		vSets.push_back(&vHours[n]);
+	if (current.frametime.GetCount() > 0)
+		vSets.push_back(&current);
+
+	for (size_t n = 0; n < vSets.size(); n++)
+	{
+		if (vSets[n] == &overall)
+			hFile << "Window=run\n";
+		else if (vSets[n] == &current)
+			hFile << "Window=minute " << (current.iWindow + 1) << "\n";
+		else
+			hFile << "Window=hour " << (vSets[n]->iWindow + 1) << "\n";
+
+		hFile << "FrameTime=" << vSets[n]->frametime.Serialize() << "\n";
+		hFile << "CPU=" << vSets[n]->cpu.Serialize() << "\n";
+		hFile << "Memory=" << vSets[n]->memory.Serialize() << "\n";
+	}
+
+	hFile.flush();
+	BOOL bRet = !hFile.fail();
+	hFile.close();
+
+	return bRet;
+}
+
+
+BOOL CSketchWindows::Load(string &s_file, stSketchSet &overall, string &s_error)
+{
+	//reads the whole-run sketches of a file written by Save()
+	ifstream hFile(s_file.c_str());
+	if (!hFile.is_open())
+	{
+		s_error = "Cannot open \"" + s_file + "\"";
+		return FALSE;
+	}
+
+	string sLine = "";
+	BOOL bHeader = FALSE;
+	BOOL bRun = FALSE;
+	int iFound = 0;
+	while (getline(hFile, sLine))
+	{
+		if (sLine == "[AVSMeter sketches]")
+		{
+			bHeader = TRUE;
+			continue;
+		}
+
+		if (sLine.substr(0, 7) == "Window=")
+		{
+			bRun = (sLine == "Window=run");
+			continue;
+		}
+
+		if (!bRun)
+			continue;
+
+		string sValue = sLine.substr(sLine.find('=') + 1);
+		if ((sLine.substr(0, 10) == "FrameTime=") && overall.frametime.Deserialize(sValue))
+			iFound++;
+		else if ((sLine.substr(0, 4) == "CPU=") && overall.cpu.Deserialize(sValue))
+			iFound++;
+		else if ((sLine.substr(0, 7) == "Memory=") && overall.memory.Deserialize(sValue))
+			iFound++;
+	}
+
+	hFile.close();
+
+	if (!bHeader || (iFound != 3))
+	{
+		s_error = "\"" + s_file + "\" is not a valid sketch file";
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+#endif //_SKETCH_H
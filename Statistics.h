@@ -0,0 +1,595 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_STATISTICS_H)
+#define _STATISTICS_H
+
+#include "common.h"
+
+class CStats
+{
+public:
+	CStats();
+	virtual ~CStats();
+
+	//Scalability models, speedup S(n) relative to one thread
+	BOOL   FitAmdahl(vector<double> &v_threads, vector<double> &v_speedup, double &d_parallel);
+	BOOL   FitUSL(vector<double> &v_threads, vector<double> &v_speedup, double &d_sigma, double &d_kappa);
+	double AmdahlSpeedup(double d_threads, double d_parallel);
+	double USLSpeedup(double d_threads, double d_sigma, double d_kappa);
+	double USLPeakThreads(double d_sigma, double d_kappa);
+
+	//Robust linear trend, slope with a two-sided 95% confidence interval
+	BOOL   FitTheilSen(vector<double> &v_x, vector<double> &v_y, double &d_slope, double &d_lower, double &d_upper);
+
+	//Two-sample comparisons, b against a
+	BOOL   MannWhitneyU(vector<double> &v_a, vector<double> &v_b, double &d_z, double &d_p);
+	BOOL   BootstrapChange(vector<double> &v_a, vector<double> &v_b, double d_q, unsigned int ui_resamples, double &d_change, double &d_lower, double &d_upper);
+	double SampleStatistic(vector<double> &v_data, double d_q);
+	double Lag1Autocorrelation(vector<double> &v_data, size_t n_first, size_t n_count);
+	size_t BlockLength(vector<double> &v_data);
+	void   BlockResample(vector<double> &v_data, size_t n_block, unsigned __int64 &ui64_state, vector<double> &v_out);
+	unsigned int Random(unsigned __int64 &ui64_state);
+};
+
+
+CStats::CStats()
+{
+}
+
+CStats::~CStats()
+{
+}
+
+
+BOOL CStats::FitAmdahl(vector<double> &v_threads, vector<double> &v_speedup, double &d_parallel)
+{
+	/*
+	Amdahl: S(n) = 1 / ((1 - p) + p / n)
+	Linearized: 1 - 1/S = p * (1 - 1/n), least squares through the origin.
+	*/
+	double dSumXY = 0.0;
+	double dSumXX = 0.0;
+	d_parallel = 0.0;
+
+	for (size_t i = 0; i < v_threads.size(); i++)
+	{
+		if ((v_threads[i] <= 1.0) || (v_speedup[i] <= 0.0))
+			continue;
+
+		double x = 1.0 - (1.0 / v_threads[i]);
+		double y = 1.0 - (1.0 / v_speedup[i]);
+		dSumXY += x * y;
+		dSumXX += x * x;
+	}
+
+	if (dSumXX <= 0.0)
+		return FALSE;
+
+	d_parallel = dSumXY / dSumXX;
+	if (d_parallel < 0.0) d_parallel = 0.0;
+	if (d_parallel > 1.0) d_parallel = 1.0;
+
+	return TRUE;
+}
+
+
+BOOL CStats::FitUSL(vector<double> &v_threads, vector<double> &v_speedup, double &d_sigma, double &d_kappa)
+{
+	/*
+	Universal Scalability Law: S(n) = n / (1 + sigma * (n - 1) + kappa * n * (n - 1))
+	Linearized: n/S - 1 = sigma * (n - 1) + kappa * n * (n - 1), two parameter least squares.
+	*/
+	double s11 = 0.0, s12 = 0.0, s22 = 0.0, s1y = 0.0, s2y = 0.0;
+	unsigned int uiPoints = 0;
+	d_sigma = 0.0;
+	d_kappa = 0.0;
+
+	for (size_t i = 0; i < v_threads.size(); i++)
+	{
+		if ((v_threads[i] <= 1.0) || (v_speedup[i] <= 0.0))
+			continue;
+
+		double x1 = v_threads[i] - 1.0;
+		double x2 = v_threads[i] * (v_threads[i] - 1.0);
+		double y = (v_threads[i] / v_speedup[i]) - 1.0;
+		s11 += x1 * x1;
+		s12 += x1 * x2;
+		s22 += x2 * x2;
+		s1y += x1 * y;
+		s2y += x2 * y;
+		++uiPoints;
+	}
+
+	if ((uiPoints < 1) || (s11 <= 0.0))
+		return FALSE;
+
+	double dDet = (s11 * s22) - (s12 * s12);
+	if ((uiPoints >= 2) && (fabs(dDet) > (1.0e-12 * s11 * s22)))
+	{
+		d_sigma = ((s1y * s22) - (s2y * s12)) / dDet;
+		d_kappa = ((s11 * s2y) - (s12 * s1y)) / dDet;
+	}
+
+	//coherency cannot be negative, fall back to the contention-only model
+	if ((uiPoints < 2) || (d_kappa < 0.0) || (fabs(dDet) <= (1.0e-12 * s11 * s22)))
+	{
+		d_kappa = 0.0;
+		d_sigma = s1y / s11;
+	}
+
+	if (d_sigma < 0.0) d_sigma = 0.0;
+	if (d_sigma > 1.0) d_sigma = 1.0;
+
+	return TRUE;
+}
+
+
+double CStats::AmdahlSpeedup(double d_threads, double d_parallel)
+{
+	return 1.0 / ((1.0 - d_parallel) + (d_parallel / d_threads));
+}
+
+
+double CStats::USLSpeedup(double d_threads, double d_sigma, double d_kappa)
+{
+	return d_threads / (1.0 + (d_sigma * (d_threads - 1.0)) + (d_kappa * d_threads * (d_threads - 1.0)));
+}
+
+
+double CStats::USLPeakThreads(double d_sigma, double d_kappa)
+{
+	//throughput maximum of the USL curve, 0 if the curve does not retrograde
+	if (d_kappa <= 0.0)
+		return 0.0;
+
+	return sqrt((1.0 - d_sigma) / d_kappa);
+}
+
+
+BOOL CStats::FitTheilSen(vector<double> &v_x, vector<double> &v_y, double &d_slope, double &d_lower, double &d_upper)
+{
+	/*
+	Theil-Sen: median of the slopes of all point pairs, unaffected by up to ~29% outliers.
+	Confidence interval after Sen (1968): the ranks (N -/+ C) / 2 of the sorted pair slopes
+	with C = 1.96 * sqrt(n(n-1)(2n+5) / 18). O(n^2) pairs, the caller limits n.
+	*/
+	d_slope = 0.0;
+	d_lower = 0.0;
+	d_upper = 0.0;
+
+	size_t n = v_x.size();
+	if ((n < 3) || (v_y.size() != n))
+		return FALSE;
+
+	vector<double> vSlopes;
+	vSlopes.reserve(n * (n - 1) / 2);
+	for (size_t i = 0; i < n; i++)
+	{
+		for (size_t j = i + 1; j < n; j++)
+		{
+			if (v_x[j] != v_x[i])
+				vSlopes.push_back((v_y[j] - v_y[i]) / (v_x[j] - v_x[i]));
+		}
+	}
+
+	if (vSlopes.size() < 2)
+		return FALSE;
+
+	sort(vSlopes.begin(), vSlopes.end());
+	size_t nSlopes = vSlopes.size();
+	d_slope = (nSlopes % 2) ? vSlopes[nSlopes / 2] : 0.5 * (vSlopes[nSlopes / 2 - 1] + vSlopes[nSlopes / 2]);
+
+	double dC = 1.96 * sqrt((double)n * (double)(n - 1) * (double)(2 * n + 5) / 18.0);
+	double dLower = floor(((double)nSlopes - dC) / 2.0);
+	double dUpper = ceil(((double)nSlopes + dC) / 2.0);
+	if (dLower < 0.0) dLower = 0.0;
+	if (dUpper > (double)(nSlopes - 1)) dUpper = (double)(nSlopes - 1);
+	d_lower = vSlopes[(size_t)dLower];
+	d_upper = vSlopes[(size_t)dUpper];
+
+	return TRUE;
+}
+
+
+BOOL CStats::MannWhitneyU(vector<double> &v_a, vector<double> &v_b, double &d_z, double &d_p)
+{
+	/*
+	Mann-Whitney U: rank sum of b in the pooled samples, U = R_b - n_b(n_b + 1) / 2.
+	Normal approximation with tie correction, fine for the sample sizes of frame times.
+	Consecutive frame times are not independent, the variance is widened by the AR(1) factor
+	(1 + r) / (1 - r) of each sample's lag-1 rank autocorrelation r (samples in frame order).
+	z > 0 when values of b tend to be larger than those of a, d_p is two-sided.
+	*/
+	d_z = 0.0;
+	d_p = 1.0;
+
+	size_t nA = v_a.size();
+	size_t nB = v_b.size();
+	if ((nA < 2) || (nB < 2))
+		return FALSE;
+
+	//second is the position in a followed by b
+	vector<std::pair<double, size_t> > vPooled;
+	vPooled.reserve(nA + nB);
+	size_t i = 0;
+	for (i = 0; i < nA; i++)
+		vPooled.push_back(std::make_pair(v_a[i], i));
+	for (i = 0; i < nB; i++)
+		vPooled.push_back(std::make_pair(v_b[i], nA + i));
+	sort(vPooled.begin(), vPooled.end());
+
+	size_t n = vPooled.size();
+	vector<double> vRanks(n, 0.0);
+	double dRankSumB = 0.0;
+	double dTies = 0.0;
+	i = 0;
+	while (i < n)
+	{
+		size_t j = i;
+		while (((j + 1) < n) && (vPooled[j + 1].first == vPooled[i].first))
+			j++;
+
+		//tied values share the mean of their ranks
+		double dRank = 0.5 * ((double)(i + 1) + (double)(j + 1));
+		double dCount = (double)(j - i + 1);
+		dTies += (dCount * dCount * dCount) - dCount;
+		for (size_t k = i; k <= j; k++)
+		{
+			vRanks[vPooled[k].second] = dRank;
+			if (vPooled[k].second >= nA)
+				dRankSumB += dRank;
+		}
+
+		i = j + 1;
+	}
+
+	double dN = (double)n;
+	double dU = dRankSumB - ((double)nB * (double)(nB + 1) / 2.0);
+	double dMean = (double)nA * (double)nB / 2.0;
+	double dVar = ((double)nA * (double)nB / 12.0) * ((dN + 1.0) - (dTies / (dN * (dN - 1.0))));
+	if (dVar <= 0.0)
+		return FALSE;
+
+	//Var(U) splits into n_b^2 * Var(sum over a) + n_a^2 * Var(sum over b), each part scales with its own factor
+	double dRhoA = Lag1Autocorrelation(vRanks, 0, nA);
+	double dRhoB = Lag1Autocorrelation(vRanks, nA, nB);
+	double dInflateA = (1.0 + dRhoA) / (1.0 - dRhoA);
+	double dInflateB = (1.0 + dRhoB) / (1.0 - dRhoB);
+	dVar *= (((double)nB * dInflateA) + ((double)nA * dInflateB)) / dN;
+
+	d_z = (dU - dMean) / sqrt(dVar);
+	d_p = erfc(fabs(d_z) / sqrt(2.0));
+
+	return TRUE;
+}
+
+
+unsigned int CStats::Random(unsigned __int64 &ui64_state)
+{
+	//64 bit LCG (Knuth's MMIX constants), the upper bits are the usable ones
+	ui64_state = (ui64_state * 6364136223846793005ULL) + 1442695040888963407ULL;
+
+	return (unsigned int)(ui64_state >> 33);
+}
+
+
+double CStats::SampleStatistic(vector<double> &v_data, double d_q)
+{
+	//mean for d_q < 0, otherwise the nearest-rank quantile. reorders v_data
+	if (v_data.size() == 0)
+		return 0.0;
+
+	if (d_q < 0.0)
+	{
+		double dSum = 0.0;
+		for (size_t i = 0; i < v_data.size(); i++)
+			dSum += v_data[i];
+		return dSum / (double)v_data.size();
+	}
+
+	size_t nRank = (size_t)(d_q * (double)(v_data.size() - 1) + 0.5);
+	if (nRank >= v_data.size())
+		nRank = v_data.size() - 1;
+	std::nth_element(v_data.begin(), v_data.begin() + nRank, v_data.end());
+
+	return v_data[nRank];
+}
+
+
+double CStats::Lag1Autocorrelation(vector<double> &v_data, size_t n_first, size_t n_count)
+{
+	//lag-1 autocorrelation of n_count values from n_first, clamped to 0..0.95 so the AR(1) factors stay finite
+	if (n_count < 3)
+		return 0.0;
+
+	double dMean = 0.0;
+	size_t i = 0;
+	for (i = 0; i < n_count; i++)
+		dMean += v_data[n_first + i];
+	dMean /= (double)n_count;
+
+	double dVar = 0.0;
+	double dCov = 0.0;
+	for (i = 0; i < n_count; i++)
+	{
+		double dDev = v_data[n_first + i] - dMean;
+		dVar += dDev * dDev;
+		if (i > 0)
+			dCov += dDev * (v_data[n_first + i - 1] - dMean);
+	}
+
+	if (dVar <= 0.0)
+		return 0.0;
+
+	double dRho = dCov / dVar;
+	if (dRho < 0.0)
+		dRho = 0.0;
+	if (dRho > 0.95)
+		dRho = 0.95;
+
+	return dRho;
+}
+
+
+size_t CStats::BlockLength(vector<double> &v_data)
+{
+	/*
+	Block length of the circular block bootstrap for an AR(1) approximation of the series,
+	l = (2r / (1 - r^2))^(2/3) * n^(1/3) (Politis & White 2004), at least 1 and at most n / 2.
+	*/
+	size_t n = v_data.size();
+	double dRho = Lag1Autocorrelation(v_data, 0, n);
+	if ((n < 4) || (dRho <= 0.0))
+		return 1;
+
+	double dBlock = pow(2.0 * dRho / (1.0 - dRho * dRho), 2.0 / 3.0) * pow((double)n, 1.0 / 3.0);
+	size_t nBlock = (size_t)ceil(dBlock);
+	if (nBlock < 1)
+		nBlock = 1;
+	if (nBlock > (n / 2))
+		nBlock = n / 2;
+
+	return nBlock;
+}
+
+
+void CStats::BlockResample(vector<double> &v_data, size_t n_block, unsigned __int64 &ui64_state, vector<double> &v_out)
+{
+	//circular block bootstrap: blocks of n_block values from random starts, wrapping at the end
+	size_t n = v_data.size();
+	size_t i = 0;
+	while (i < n)
+	{
+		size_t nStart = Random(ui64_state) % n;
+		for (size_t k = 0; (k < n_block) && (i < n); k++, i++)
+			v_out[i] = v_data[(nStart + k) % n];
+	}
+
+	return;
+}
+
+
+BOOL CStats::BootstrapChange(vector<double> &v_a, vector<double> &v_b, double d_q, unsigned int ui_resamples, double &d_change, double &d_lower, double &d_upper)
+{
+	/*
+	Relative change b / a - 1 of the mean (d_q < 0) or of the d_q quantile with a two-sided 95%
+	percentile bootstrap interval. Both samples are resampled independently in blocks so the
+	interval keeps the autocorrelation of frame times (samples in frame order), the generator has a
+	fixed seed so the same data always gives the same interval.
+	*/
+	d_change = 0.0;
+	d_lower = 0.0;
+	d_upper = 0.0;
+
+	size_t nA = v_a.size();
+	size_t nB = v_b.size();
+	if ((nA < 2) || (nB < 2) || (ui_resamples < 20))
+		return FALSE;
+
+	vector<double> vResA(v_a);
+	vector<double> vResB(v_b);
+	double dStatA = SampleStatistic(vResA, d_q);
+	double dStatB = SampleStatistic(vResB, d_q);
+	if (dStatA <= 0.0)
+		return FALSE;
+	d_change = (dStatB / dStatA) - 1.0;
+
+	size_t nBlockA = BlockLength(v_a);
+	size_t nBlockB = BlockLength(v_b);
+	unsigned __int64 ui64State = 0x41565345u;
+	vector<double> vChanges;
+	vChanges.reserve(ui_resamples);
+	for (unsigned int r = 0; r < ui_resamples; r++)
+	{
+		BlockResample(v_a, nBlockA, ui64State, vResA);
+		BlockResample(v_b, nBlockB, ui64State, vResB);
+
+		dStatA = SampleStatistic(vResA, d_q);
+		dStatB = SampleStatistic(vResB, d_q);
+		if (dStatA > 0.0)
+			vChanges.push_back((dStatB / dStatA) - 1.0);
+	}
+
+	if (vChanges.size() < 20)
+		return FALSE;
+
+	sort(vChanges.begin(), vChanges.end());
+	d_lower = vChanges[(size_t)floor(0.025 * (double)(vChanges.size() - 1))];
+	d_upper = vChanges[(size_t)ceil(0.975 * (double)(vChanges.size() - 1))];
+
+	return TRUE;
+}
+
+
+/*
+Largest-Triangle-Three-Buckets, streamed in two passes so that the series never has to be in memory.
+The first and the last point are kept, the points in between are split into equal buckets and each
+bucket keeps the point that spans the largest triangle with the point kept before it and the mean
+of the next bucket. Peaks and dips survive, unlike with a fixed stride.
+
+Pass 1: Average() for every point, pass 2: Select() for every point in the same order.
+*/
+class CLTTB
+{
+public:
+	CLTTB();
+
+	void   Init(unsigned __int64 ui64_points, size_t n_out);
+	void   Average(double d_y);
+	BOOL   Select(double d_y, BOOL &b_emit);
+
+private:
+	unsigned __int64 BucketEnd(size_t n_bucket);
+	void   Rewind();
+
+	unsigned __int64 ui64Points;
+	size_t nBuckets;
+	vector<double> vMeanX;
+	vector<double> vMeanY;
+
+	unsigned __int64 ui64Index;   //current point
+	size_t nBucket;               //bucket of the current point
+	unsigned __int64 ui64End;     //first point after the current bucket
+	double dPrevX;                //point kept in the previous bucket
+	double dPrevY;
+	double dBestArea;
+	double dBestX;
+	double dBestY;
+	BOOL   bPass2;
+};
+
+
+CLTTB::CLTTB()
+{
+	Init(0, 0);
+}
+
+
+void CLTTB::Init(unsigned __int64 ui64_points, size_t n_out)
+{
+	ui64Points = ui64_points;
+	nBuckets = (n_out < 3) ? 3 : n_out;
+	if ((unsigned __int64)nBuckets > ui64Points)
+		nBuckets = (size_t)ui64Points;
+
+	vMeanX.assign(nBuckets, 0.0);
+	vMeanY.assign(nBuckets, 0.0);
+	bPass2 = FALSE;
+	Rewind();
+
+	return;
+}
+
+
+unsigned __int64 CLTTB::BucketEnd(size_t n_bucket)
+{
+	//bucket 0 is the first point, the last bucket is the last point
+	if (n_bucket == 0)
+		return 1;
+	if (n_bucket >= nBuckets - 1)
+		return ui64Points;
+
+	return 1 + (unsigned __int64)((double)n_bucket * (double)(ui64Points - 2) / (double)(nBuckets - 2));
+}
+
+
+void CLTTB::Rewind()
+{
+	ui64Index = 0;
+	nBucket = 0;
+	ui64End = (nBuckets > 0) ? BucketEnd(0) : 0;
+	dPrevX = 0.0;
+	dPrevY = 0.0;
+	dBestArea = -1.0;
+	dBestX = 0.0;
+	dBestY = 0.0;
+
+	return;
+}
+
+
+void CLTTB::Average(double d_y)
+{
+	if (ui64Index >= ui64Points)
+		return;
+
+	vMeanX[nBucket] += (double)ui64Index;
+	vMeanY[nBucket] += d_y;
+
+	if (++ui64Index == ui64End)
+	{
+		double dCount = (double)(ui64End - ((nBucket > 0) ? BucketEnd(nBucket - 1) : 0));
+		vMeanX[nBucket] /= dCount;
+		vMeanY[nBucket] /= dCount;
+		if (++nBucket < nBuckets)
+			ui64End = BucketEnd(nBucket);
+	}
+
+	if (ui64Index == ui64Points)
+	{
+		bPass2 = TRUE;
+		Rewind();
+	}
+
+	return;
+}
+
+
+BOOL CLTTB::Select(double d_y, BOOL &b_emit)
+{
+	//returns TRUE if the point is the best of its bucket so far, b_emit is set on the last point of a bucket
+	b_emit = FALSE;
+	if (!bPass2 || (ui64Index >= ui64Points))
+		return FALSE;
+
+	double dX = (double)ui64Index;
+	BOOL bBest = FALSE;
+	if ((nBucket == 0) || (nBucket == nBuckets - 1))
+		bBest = TRUE;
+	else
+	{
+		double dArea = fabs((dPrevX - vMeanX[nBucket + 1]) * (d_y - dPrevY) - (dPrevX - dX) * (vMeanY[nBucket + 1] - dPrevY));
+		if (dArea > dBestArea)
+		{
+			dBestArea = dArea;
+			bBest = TRUE;
+		}
+	}
+
+	if (bBest)
+	{
+		dBestX = dX;
+		dBestY = d_y;
+	}
+
+	if (++ui64Index == ui64End)
+	{
+		b_emit = TRUE;
+		dPrevX = dBestX;
+		dPrevY = dBestY;
+		dBestArea = -1.0;
+		if (++nBucket < nBuckets)
+			ui64End = BucketEnd(nBucket);
+	}
+
+	return bBest;
+}
+
+
+#endif //_STATISTICS_H
@@ -0,0 +1,91 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_THREADCOUNTER_H)
+#define _THREADCOUNTER_H
+
+#include "common.h"
+
+/*
+Counts thread creation and exit in this process with a TLS callback. The loader calls it
+for every thread attach/detach, so reading the counters costs nothing compared to a
+system-wide Toolhelp snapshot. The callback runs before the CRT is initialized and under
+the loader lock, so it only touches plain static data.
+
+Threads created with THREAD_CREATE_FLAGS_SKIP_THREAD_ATTACH get neither attach nor detach
+notifications and are invisible here: the loader's parallel load workers and some thread pool
+and system worker threads. CProcessInfo corrects the alive count and the churn against the
+thread count of the system process list every few seconds. The ring of thread IDs (used by
+CThreadInfo and CProfiler) never contains these threads.
+*/
+
+#define THREADCOUNTER_RING_SIZE     4096
+
+struct stThreadCounters
+{
+	volatile LONG lAlive;
+	volatile LONG lCreated;
+	volatile LONG lExited;
+	volatile LONG lPublished;        //thread IDs written to the ring
+	DWORD         dwThreadIDs[THREADCOUNTER_RING_SIZE];
+};
+
+static stThreadCounters threadcounters;
+
+
+void NTAPI ThreadCounterCallback(PVOID h_module, DWORD dw_reason, PVOID p_reserved)
+{
+	if ((dw_reason != DLL_PROCESS_ATTACH) && (dw_reason != DLL_THREAD_ATTACH) && (dw_reason != DLL_THREAD_DETACH))
+		return;
+
+	if (dw_reason == DLL_THREAD_DETACH)
+	{
+		::InterlockedIncrement(&threadcounters.lExited);
+		::InterlockedDecrement(&threadcounters.lAlive);
+		return;
+	}
+
+	if (dw_reason == DLL_THREAD_ATTACH)
+		::InterlockedIncrement(&threadcounters.lCreated);
+
+	::InterlockedIncrement(&threadcounters.lAlive);
+
+	//attach notifications are serialized by the loader lock
+	threadcounters.dwThreadIDs[threadcounters.lPublished % THREADCOUNTER_RING_SIZE] = ::GetCurrentThreadId();
+	::InterlockedIncrement(&threadcounters.lPublished);
+
+	return;
+}
+
+
+#ifdef _WIN64
+#pragma comment (linker, "/INCLUDE:_tls_used")
+#pragma comment (linker, "/INCLUDE:pThreadCounterCallback")
+#pragma const_seg(".CRT$XLB")
+extern "C" const PIMAGE_TLS_CALLBACK pThreadCounterCallback = ThreadCounterCallback;
+#pragma const_seg()
+#else
+#pragma comment (linker, "/INCLUDE:__tls_used")
+#pragma comment (linker, "/INCLUDE:_pThreadCounterCallback")
+#pragma data_seg(".CRT$XLB")
+extern "C" PIMAGE_TLS_CALLBACK pThreadCounterCallback = ThreadCounterCallback;
+#pragma data_seg()
+#endif
+
+
+#endif //_THREADCOUNTER_H
@@ -0,0 +1,636 @@
+/*
+	This file is part of AVSMeter, (c) Groucho2004.
+
+	AVSMeter is free software. You can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation, either
+	version 3 of the License, or any later version.
+
+	AVSMeter is distributed in the hope that it will be useful
+	but WITHOUT ANY WARRANTY and without the implied warranty
+	of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with AVSMeter. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(_THREADINFO_H)
+#define _THREADINFO_H
+
+#include "common.h"
+#include "exception.h"
+#include "ThreadCounter.h"
+
+#define THREAD_ROLE_MAIN            0
+#define THREAD_ROLE_MONITOR         1
+#define THREAD_ROLE_POOL            2
+#define THREAD_ROLE_PLUGIN          3
+#define THREAD_ROLE_OTHER           4
+#define THREAD_ROLE_COUNT           5
+#define THREAD_STACK_SCAN           4096    //bytes below the stack base searched for the entry point of CRT started threads
+#define THREAD_RESOLVE_ATTEMPTS     8       //samples until a CRT started thread that has not reached its entry point counts as "Other"
+
+typedef LONG (WINAPI *NT_QUERY_INFORMATION_THREAD)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+
+struct stThreadBasicInformation
+{
+	LONG      ExitStatus;
+	PVOID     TebBaseAddress;
+	PVOID     UniqueProcess;
+	PVOID     UniqueThread;
+	ULONG_PTR AffinityMask;
+	LONG      Priority;
+	LONG      BasePriority;
+};
+
+
+struct stThreadData
+{
+	DWORD            tid;
+	HANDLE           handle;
+	int              role;
+	string           module;
+	BOOL             alive;
+	int              resolve_attempts;  //left, 0 once the start module is known
+	unsigned __int64 kernel_time;   //100 ns units, since the thread was first seen
+	unsigned __int64 user_time;
+	unsigned __int64 prev_kernel;
+	unsigned __int64 prev_user;
+	double           usage;         //last interval, percent of one core
+	double           first_seen;    //seconds
+	double           last_seen;
+};
+
+
+struct stThreadGroup
+{
+	int              role;
+	string           module;
+	unsigned int     threads;
+	unsigned __int64 kernel_time;   //100 ns units
+	unsigned __int64 user_time;
+	double           lifetime;      //seconds, summed over the threads
+};
+
+
+class CThreadInfo
+{
+public:
+	CThreadInfo();
+	virtual ~CThreadInfo();
+
+	void   SetMainThread(DWORD dw_tid);
+	void   SetMonitorThread(DWORD dw_tid);
+	void   Update(double d_time);
+	string FormatTable();
+	string DescribeThread(DWORD dw_tid);
+	static const char *RoleName(int i_role);
+
+	map<DWORD, stThreadData> mThreads;      //threads alive at the last update
+	double dRoleUsage[THREAD_ROLE_COUNT];   //last interval, percent of one core
+	double dBusiestUsage;                   //last interval, percent of one core
+	DWORD  dwBusiestTID;
+
+private:
+	void   DiscoverThreads(double d_time, double d_interval);
+	void   AddThread(DWORD dw_tid, double d_time, double d_interval);
+	void   FoldExited(stThreadData &td);
+	void   NoteBusiest(stThreadData &td);
+	int    ClassifyThread(DWORD dw_tid, HANDLE h_thread, string &s_module, BOOL &b_resolved);
+	string ResolveStartModule(HANDLE h_thread);
+	BOOL   IsRuntimeModule(string &s_module);
+	unsigned __int64 FileTimeToUInt64(const FILETIME &ft);
+
+	DWORD  dwMainThread;
+	DWORD  dwMonitorThread;
+	double dLastTime;
+	unsigned __int64 ui64StartTime;         //FILETIME of the first update
+	LONG   lRingRead;
+	map<string, stThreadGroup> mExited;     //by role and start module
+	map<DWORD, string> mBusiest;            //descriptions of the threads that were the busiest in a sample
+	string sAvisynthModule;
+	NT_QUERY_INFORMATION_THREAD pNtQueryInformationThread;
+};
+
+
+CThreadInfo::CThreadInfo()
+{
+	dwMainThread = 0;
+	dwMonitorThread = 0;
+	dLastTime = -1.0;
+	ui64StartTime = 0;
+	lRingRead = 0;
+	for (int i = 0; i < THREAD_ROLE_COUNT; i++)
+		dRoleUsage[i] = 0.0;
+	dBusiestUsage = 0.0;
+	dwBusiestTID = 0;
+
+	sAvisynthModule = "";
+	HMODULE hAvisynth = ::GetModuleHandle("avisynth");
+	if (hAvisynth)
+	{
+		char szModule[MAX_PATH_LEN + 1];
+		if (::GetModuleFileName(hAvisynth, szModule, MAX_PATH_LEN))
+			sAvisynthModule = szModule;
+	}
+
+	pNtQueryInformationThread = (NT_QUERY_INFORMATION_THREAD)::GetProcAddress(::GetModuleHandle("ntdll.dll"), "NtQueryInformationThread");
+}
+
+CThreadInfo::~CThreadInfo()
+{
+	for (map<DWORD, stThreadData>::iterator it = mThreads.begin(); it != mThreads.end(); ++it)
+	{
+		if (it->second.handle)
+			::CloseHandle(it->second.handle);
+	}
+}
+
+
+void CThreadInfo::SetMainThread(DWORD dw_tid)
+{
+	dwMainThread = dw_tid;
+
+	return;
+}
+
+
+void CThreadInfo::SetMonitorThread(DWORD dw_tid)
+{
+	dwMonitorThread = dw_tid;
+
+	return;
+}
+
+
+const char *CThreadInfo::RoleName(int i_role)
+{
+	switch (i_role)
+	{
+		case THREAD_ROLE_MAIN:    return "Main";
+		case THREAD_ROLE_MONITOR: return "Monitor";
+		case THREAD_ROLE_POOL:    return "Avisynth";
+		case THREAD_ROLE_PLUGIN:  return "Plugin";
+	}
+
+	return "Other";
+}
+
+
+int CThreadInfo::ClassifyThread(DWORD dw_tid, HANDLE h_thread, string &s_module, BOOL &b_resolved)
+{
+	//the start address tells who created the thread: avisynth.dll (Prefetch pool), a plugin or the system
+	s_module = "";
+	b_resolved = TRUE;
+	LPVOID pStartAddress = NULL;
+	if (pNtQueryInformationThread)
+	{
+		//ThreadQuerySetWin32StartAddress
+		if (pNtQueryInformationThread(h_thread, 9, &pStartAddress, sizeof(pStartAddress), NULL) == 0)
+			s_module = GetExceptionModule(pStartAddress);
+	}
+
+	//_beginthreadex and std::thread with the dynamic CRT start in ucrtbase.dll
+	if ((s_module != "") && IsRuntimeModule(s_module))
+	{
+		string sEntryModule = ResolveStartModule(h_thread);
+		if (sEntryModule != "")
+			s_module = sEntryModule;
+		else
+			b_resolved = FALSE;
+	}
+
+	if (dw_tid == dwMainThread)
+		return THREAD_ROLE_MAIN;
+
+	if (dw_tid == dwMonitorThread)
+		return THREAD_ROLE_MONITOR;
+
+	if (s_module == "")
+		return THREAD_ROLE_OTHER;
+
+	string sModuleLC = s_module;
+	string sAvisynthLC = sAvisynthModule;
+	transform(sModuleLC.begin(), sModuleLC.end(), sModuleLC.begin(), ::tolower);
+	transform(sAvisynthLC.begin(), sAvisynthLC.end(), sAvisynthLC.begin(), ::tolower);
+
+	if ((sAvisynthLC != "") && (sModuleLC == sAvisynthLC))
+		return THREAD_ROLE_POOL;
+
+	if (IsRuntimeModule(s_module))
+		return THREAD_ROLE_OTHER;
+
+	char szExe[MAX_PATH_LEN + 1];
+	if (::GetModuleFileName(NULL, szExe, MAX_PATH_LEN))
+	{
+		string sExeLC = szExe;
+		transform(sExeLC.begin(), sExeLC.end(), sExeLC.begin(), ::tolower);
+		if (sModuleLC == sExeLC)
+			return THREAD_ROLE_OTHER;
+	}
+
+	return THREAD_ROLE_PLUGIN;
+}
+
+
+string CThreadInfo::ResolveStartModule(HANDLE h_thread)
+{
+	//the outermost frames are RtlUserThreadStart, BaseThreadInitThunk and the CRT thread start,
+	//the first return address above them that is not in a system or runtime module belongs to the real entry point
+	if (!pNtQueryInformationThread)
+		return "";
+
+	stThreadBasicInformation tbi;
+	if (pNtQueryInformationThread(h_thread, 0, &tbi, sizeof(tbi), NULL) != 0) //ThreadBasicInformation
+		return "";
+
+	NT_TIB tib;
+	SIZE_T nRead = 0;
+	if (!::ReadProcessMemory(::GetCurrentProcess(), tbi.TebBaseAddress, &tib, sizeof(tib), &nRead) || (nRead != sizeof(tib)))
+		return "";
+
+	BYTE *pStackBase = (BYTE *)tib.StackBase;
+	size_t nBytes = THREAD_STACK_SCAN;
+	if ((size_t)(pStackBase - (BYTE *)tib.StackLimit) < nBytes)
+		nBytes = (size_t)(pStackBase - (BYTE *)tib.StackLimit);
+
+	ULONG_PTR uStack[THREAD_STACK_SCAN / sizeof(ULONG_PTR)];
+	if (!::ReadProcessMemory(::GetCurrentProcess(), pStackBase - nBytes, uStack, nBytes, &nRead) || (nRead != nBytes))
+		return "";
+
+	DWORD dwExecute = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+	char szModule[MAX_PATH_LEN + 1];
+	for (size_t n = nBytes / sizeof(ULONG_PTR); n > 0; n--)
+	{
+		MEMORY_BASIC_INFORMATION mbi;
+		if (!::VirtualQuery((LPCVOID)uStack[n - 1], &mbi, sizeof(mbi)) || (mbi.Type != MEM_IMAGE) || !(mbi.Protect & dwExecute))
+			continue;
+
+		if (!::GetModuleFileName((HMODULE)mbi.AllocationBase, szModule, MAX_PATH_LEN))
+			continue;
+
+		string sModule = szModule;
+		if (!IsRuntimeModule(sModule))
+			return sModule;
+	}
+
+	return "";
+}
+
+
+BOOL CThreadInfo::IsRuntimeModule(string &s_module)
+{
+	//system DLLs and the C/C++ runtime, avisynth.dll may be installed into the system directory
+	string sModuleLC = s_module;
+	string sAvisynthLC = sAvisynthModule;
+	transform(sModuleLC.begin(), sModuleLC.end(), sModuleLC.begin(), ::tolower);
+	transform(sAvisynthLC.begin(), sAvisynthLC.end(), sAvisynthLC.begin(), ::tolower);
+
+	if ((sAvisynthLC != "") && (sModuleLC == sAvisynthLC))
+		return FALSE;
+
+	char szSystemDir[MAX_PATH_LEN + 1];
+	if (::GetSystemDirectory(szSystemDir, MAX_PATH_LEN))
+	{
+		string sSystemDirLC = szSystemDir;
+		transform(sSystemDirLC.begin(), sSystemDirLC.end(), sSystemDirLC.begin(), ::tolower);
+		if (sModuleLC.substr(0, sSystemDirLC.length()) == sSystemDirLC)
+			return TRUE;
+	}
+
+	//app-local copies of the runtime
+	static const char *szRuntime[] = { "ucrtbase", "vcruntime", "msvcp", "msvcr", "concrt", "api-ms-win-", 0 };
+	string sFileLC = sModuleLC.substr(sModuleLC.find_last_of('\\') + 1);
+	for (int i = 0; szRuntime[i]; i++)
+	{
+		if (sFileLC.substr(0, strlen(szRuntime[i])) == szRuntime[i])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+void CThreadInfo::DiscoverThreads(double d_time, double d_interval)
+{
+	//new threads are taken from the TLS callback ring, Toolhelp is only used if the ring overflowed
+	LONG lPublished = threadcounters.lPublished;
+	if ((lPublished > 0) && ((lPublished - lRingRead) <= THREADCOUNTER_RING_SIZE))
+	{
+		for (; lRingRead < lPublished; lRingRead++)
+			AddThread(threadcounters.dwThreadIDs[lRingRead % THREADCOUNTER_RING_SIZE], d_time, d_interval);
+
+		return;
+	}
+
+	lRingRead = lPublished;
+
+	DWORD dwPID = ::GetCurrentProcessId();
+	HANDLE hThreadSnapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if (hThreadSnapshot == INVALID_HANDLE_VALUE)
+		return;
+
+	THREADENTRY32 te32;
+	te32.dwSize = sizeof(THREADENTRY32);
+
+	if (::Thread32First(hThreadSnapshot, &te32))
+	{
+		do
+		{
+			if (te32.th32OwnerProcessID == dwPID)
+				AddThread(te32.th32ThreadID, d_time, d_interval);
+		}
+		while (::Thread32Next(hThreadSnapshot, &te32));
+	}
+
+	::CloseHandle(hThreadSnapshot);
+
+	return;
+}
+
+
+void CThreadInfo::AddThread(DWORD dw_tid, double d_time, double d_interval)
+{
+	if (mThreads.find(dw_tid) != mThreads.end())
+		return;
+
+	HANDLE hThread = ::OpenThread(THREAD_QUERY_INFORMATION | SYNCHRONIZE, FALSE, dw_tid);
+	if (!hThread)
+		return;
+
+	stThreadData td;
+	td.tid = dw_tid;
+	td.handle = hThread;
+	BOOL bResolved = TRUE;
+	td.role = ClassifyThread(td.tid, hThread, td.module, bResolved);
+	td.resolve_attempts = bResolved ? 0 : THREAD_RESOLVE_ATTEMPTS;
+	td.alive = TRUE;
+	td.kernel_time = 0;
+	td.user_time = 0;
+	td.prev_kernel = 0;
+	td.prev_user = 0;
+	td.usage = 0.0;
+	td.first_seen = d_time;
+	td.last_seen = d_time;
+
+	//the ring can hold IDs of short-lived threads that have exited in the meantime, their whole CPU time is read now
+	BOOL bExited = (::WaitForSingleObject(hThread, 0) == WAIT_OBJECT_0);
+	FILETIME ftCreation, ftExit, ftKernel, ftUser;
+	BOOL bTimes = ::GetThreadTimes(hThread, &ftCreation, &ftExit, &ftKernel, &ftUser);
+
+	if (bExited)
+	{
+		::CloseHandle(hThread);
+		td.handle = NULL;
+		td.alive = FALSE;
+		if (!bTimes)
+			return;
+
+		//threads that ended before the monitor started do not belong to the run, one that
+		//started before is counted with the part of its lifetime inside the run
+		unsigned __int64 uiCreation = FileTimeToUInt64(ftCreation);
+		unsigned __int64 uiExit = FileTimeToUInt64(ftExit);
+		if (uiExit <= ui64StartTime)
+			return;
+
+		double dShare = 1.0;
+		if ((uiCreation < ui64StartTime) && (uiExit > uiCreation))
+			dShare = (double)(uiExit - ui64StartTime) / (double)(uiExit - uiCreation);
+
+		td.kernel_time = (unsigned __int64)((double)FileTimeToUInt64(ftKernel) * dShare);
+		td.user_time = (unsigned __int64)((double)FileTimeToUInt64(ftUser) * dShare);
+		td.first_seen = d_time - ((double)(uiExit - ((uiCreation > ui64StartTime) ? uiCreation : ui64StartTime)) / 1.0e+7);
+
+		if (d_interval > 0.0)
+		{
+			td.usage = 100.0 * ((double)(td.kernel_time + td.user_time) / 1.0e+7) / d_interval;
+			dRoleUsage[td.role] += td.usage;
+			NoteBusiest(td);
+		}
+
+		FoldExited(td);
+
+		return;
+	}
+
+	if (bTimes)
+	{
+		td.prev_kernel = FileTimeToUInt64(ftKernel);
+		td.prev_user = FileTimeToUInt64(ftUser);
+	}
+
+	mThreads[dw_tid] = td;
+
+	return;
+}
+
+
+void CThreadInfo::FoldExited(stThreadData &td)
+{
+	//exited threads only live on as one row per role and start module
+	string sKey = string(RoleName(td.role)) + "|" + td.module;
+	map<string, stThreadGroup>::iterator it = mExited.find(sKey);
+	if (it == mExited.end())
+	{
+		stThreadGroup tg;
+		tg.role = td.role;
+		tg.module = td.module;
+		tg.threads = 0;
+		tg.kernel_time = 0;
+		tg.user_time = 0;
+		tg.lifetime = 0.0;
+		it = mExited.insert(std::make_pair(sKey, tg)).first;
+	}
+
+	stThreadGroup &tg = it->second;
+	++tg.threads;
+	tg.kernel_time += td.kernel_time;
+	tg.user_time += td.user_time;
+	tg.lifetime += td.last_seen - td.first_seen;
+
+	return;
+}
+
+
+void CThreadInfo::NoteBusiest(stThreadData &td)
+{
+	if (td.usage <= dBusiestUsage)
+		return;
+
+	dBusiestUsage = td.usage;
+	dwBusiestTID = td.tid;
+
+	//the description outlives the thread, the samples refer to it by TID
+	if (mBusiest.find(td.tid) == mBusiest.end())
+	{
+		string sModule = td.module.substr(td.module.find_last_of('\\') + 1);
+		char buffer[MAX_PATH_LEN + 64];
+		sprintf(buffer, "TID %u (%s, %s)", td.tid, RoleName(td.role), (sModule != "") ? sModule.c_str() : "-");
+		mBusiest[td.tid] = buffer;
+	}
+
+	return;
+}
+
+
+string CThreadInfo::DescribeThread(DWORD dw_tid)
+{
+	map<DWORD, string>::iterator it = mBusiest.find(dw_tid);
+	if (it == mBusiest.end())
+		return "-";
+
+	return it->second;
+}
+
+
+void CThreadInfo::Update(double d_time)
+{
+	for (int i = 0; i < THREAD_ROLE_COUNT; i++)
+		dRoleUsage[i] = 0.0;
+	dBusiestUsage = 0.0;
+	dwBusiestTID = 0;
+
+	if (dLastTime < 0.0)
+	{
+		FILETIME ftNow;
+		::GetSystemTimeAsFileTime(&ftNow);
+		ui64StartTime = FileTimeToUInt64(ftNow);
+	}
+
+	double dInterval = (dLastTime >= 0.0) ? (d_time - dLastTime) : 0.0;
+	dLastTime = d_time;
+
+	DiscoverThreads(d_time, dInterval);
+
+	map<DWORD, stThreadData>::iterator it = mThreads.begin();
+	while (it != mThreads.end())
+	{
+		stThreadData &td = it->second;
+		td.usage = 0.0;
+
+		//a new thread may not have reached its entry point when it was first seen
+		if (td.resolve_attempts > 0)
+		{
+			BOOL bResolved = TRUE;
+			int iRole = ClassifyThread(td.tid, td.handle, td.module, bResolved);
+			td.resolve_attempts = bResolved ? 0 : (td.resolve_attempts - 1);
+			if (bResolved)
+				td.role = iRole;
+		}
+
+		//checked before the times are read, the last read of an exited thread is then complete
+		BOOL bExited = (::WaitForSingleObject(td.handle, 0) == WAIT_OBJECT_0);
+
+		FILETIME ftCreation, ftExit, ftKernel, ftUser;
+		if (::GetThreadTimes(td.handle, &ftCreation, &ftExit, &ftKernel, &ftUser))
+		{
+			unsigned __int64 uiKernel = FileTimeToUInt64(ftKernel);
+			unsigned __int64 uiUser = FileTimeToUInt64(ftUser);
+			unsigned __int64 uiDelta = (uiKernel - td.prev_kernel) + (uiUser - td.prev_user);
+
+			td.kernel_time += uiKernel - td.prev_kernel;
+			td.user_time += uiUser - td.prev_user;
+			td.prev_kernel = uiKernel;
+			td.prev_user = uiUser;
+			td.last_seen = d_time;
+
+			if (dInterval > 0.0)
+			{
+				td.usage = 100.0 * ((double)uiDelta / 1.0e+7) / dInterval;
+				dRoleUsage[td.role] += td.usage;
+				NoteBusiest(td);
+			}
+		}
+
+		//exited threads keep their totals in the role/module rows, the handle is released
+		if (bExited)
+		{
+			td.alive = FALSE;
+			::CloseHandle(td.handle);
+			td.handle = NULL;
+			FoldExited(td);
+			mThreads.erase(it++);
+		}
+		else
+			++it;
+	}
+
+	return;
+}
+
+
+string CThreadInfo::FormatTable()
+{
+	string sOut = "";
+	char buffer[MAX_PATH_LEN + 256];
+	unsigned __int64 uiRoleTime[THREAD_ROLE_COUNT];
+	unsigned int uiRoleThreads[THREAD_ROLE_COUNT];
+
+	for (int i = 0; i < THREAD_ROLE_COUNT; i++)
+	{
+		uiRoleTime[i] = 0;
+		uiRoleThreads[i] = 0;
+	}
+
+	sOut += "\n\n[Per-thread CPU time]\n";
+	sOut += "     TID   Role            User (s)   Kernel (s)   Avg. (% of one core)   Start module\n";
+
+	for (map<DWORD, stThreadData>::iterator it = mThreads.begin(); it != mThreads.end(); ++it)
+	{
+		stThreadData &td = it->second;
+		double dLifetime = td.last_seen - td.first_seen;
+		double dTotal = (double)(td.kernel_time + td.user_time) / 1.0e+7;
+		double dAvg = (dLifetime > 0.0) ? (100.0 * dTotal / dLifetime) : 0.0;
+
+		uiRoleTime[td.role] += td.kernel_time + td.user_time;
+		++uiRoleThreads[td.role];
+
+		string sModule = td.module.substr(td.module.find_last_of('\\') + 1);
+		if (sModule == "")
+			sModule = "-";
+
+		sprintf(buffer, "%8u   %-12s %11.2f %12.2f %22.1f   %s\n", td.tid, RoleName(td.role), (double)td.user_time / 1.0e+7, (double)td.kernel_time / 1.0e+7, dAvg, sModule.c_str());
+		sOut += buffer;
+	}
+
+	//one row per role and start module for the threads that ended during the run
+	for (map<string, stThreadGroup>::iterator it = mExited.begin(); it != mExited.end(); ++it)
+	{
+		stThreadGroup &tg = it->second;
+		double dTotal = (double)(tg.kernel_time + tg.user_time) / 1.0e+7;
+		double dAvg = (tg.lifetime > 0.0) ? (100.0 * dTotal / tg.lifetime) : 0.0;
+
+		uiRoleTime[tg.role] += tg.kernel_time + tg.user_time;
+		uiRoleThreads[tg.role] += tg.threads;
+
+		string sModule = tg.module.substr(tg.module.find_last_of('\\') + 1);
+		if (sModule == "")
+			sModule = "-";
+
+		sprintf(buffer, "  exited   %-12s %11.2f %12.2f %22.1f   %s (%u threads)\n", RoleName(tg.role), (double)tg.user_time / 1.0e+7, (double)tg.kernel_time / 1.0e+7, dAvg, sModule.c_str(), tg.threads);
+		sOut += buffer;
+	}
+
+	sOut += "\nRole           Threads   CPU time (s)\n";
+	for (int i = 0; i < THREAD_ROLE_COUNT; i++)
+	{
+		if (uiRoleThreads[i] == 0)
+			continue;
+
+		sprintf(buffer, "%-12s %9u %14.2f\n", RoleName(i), uiRoleThreads[i], (double)uiRoleTime[i] / 1.0e+7);
+		sOut += buffer;
+	}
+
+	return sOut;
+}
+
+
+unsigned __int64 CThreadInfo::FileTimeToUInt64(const FILETIME &ft)
+{
+	return (((unsigned __int64)ft.dwHighDateTime) << 32) + (unsigned __int64)ft.dwLowDateTime;
+}
+
+
+#endif //_THREADINFO_H
@@ -20,6 +20,14 @@
 #define _TIMER_H
 
 #include "common.h"
+#include <intrin.h>
+
+#define TIMER_BACKEND_AUTO          0
+#define TIMER_BACKEND_QPC           1
+#define TIMER_BACKEND_TSC           2
+
+#define TIMER_CALIBRATION_TIME      0.050   //seconds
+#define TIMER_OVERHEAD_CALLS        100000
 
 class CTimer
 {
@@ -30,9 +38,24 @@ public:
 	double           GetSTDTimer();
 	unsigned __int64 GetSTDTimerMS();
 	string           FormatTimeString(__int64 i_milliseconds, BOOL b_rightaligned);
+	BOOL             SetBackend(int i_backend);
+	string           GetBackendInfo();
 	LARGE_INTEGER    liPerfFreq;
 	double           dPerfFreq;
 	BOOL             supported;
+	int              iBackend;
+	BOOL             bInvariantTSC;
+	double           dTSCFreq;
+	double           dOverheadNS;
+	double           dResolutionNS;
+
+private:
+	BOOL             HasInvariantTSC();
+	void             CalibrateTSC();
+	void             MeasureOverhead();
+	double           GetQPCTimer();
+	unsigned __int64 ui64TSCBase;
+	double           dTSCBaseTime;
 };
 
 CTimer::CTimer()
@@ -43,6 +66,14 @@ CTimer::CTimer()
 		supported = FALSE;
 
 	dPerfFreq = (double)liPerfFreq.QuadPart;
+
+	iBackend = TIMER_BACKEND_QPC;
+	bInvariantTSC = HasInvariantTSC();
+	dTSCFreq = 0.0;
+	dOverheadNS = 0.0;
+	dResolutionNS = 0.0;
+	ui64TSCBase = 0;
+	dTSCBaseTime = 0.0;
 }
 
 CTimer::~CTimer()
@@ -52,19 +83,123 @@ CTimer::~CTimer()
 
 
 double CTimer::GetTimer()
+{
+	//no affinity changes or yields here, this is called for every frame
+	if (iBackend == TIMER_BACKEND_TSC)
+		return dTSCBaseTime + ((double)(__rdtsc() - ui64TSCBase) / dTSCFreq);
+
+	return GetQPCTimer();
+}
+
+
+double CTimer::GetQPCTimer()
 {
 	LARGE_INTEGER liPerfCounter = {0,0};
-	DWORD_PTR dwpOldMask = ::SetThreadAffinityMask(::GetCurrentThread(), 0x1);
-	Sleep(0);
 	::QueryPerformanceCounter(&liPerfCounter);
 
-	if (dwpOldMask != 0)
-		::SetThreadAffinityMask(::GetCurrentThread(), dwpOldMask);
-
 	return (double)liPerfCounter.QuadPart / dPerfFreq;
 }
 
 
+BOOL CTimer::SetBackend(int i_backend)
+{
+	//the TSC is only used if it runs at a constant rate across P-states and cores
+	if (!supported)
+		return FALSE;
+
+	iBackend = TIMER_BACKEND_QPC;
+
+	if ((i_backend != TIMER_BACKEND_QPC) && bInvariantTSC)
+	{
+		CalibrateTSC();
+		if (dTSCFreq > 0.0)
+			iBackend = TIMER_BACKEND_TSC;
+	}
+
+	MeasureOverhead();
+
+	return ((i_backend == TIMER_BACKEND_AUTO) || (i_backend == iBackend)) ? TRUE : FALSE;
+}
+
+
+BOOL CTimer::HasInvariantTSC()
+{
+	int iRegs[4] = {0, 0, 0, 0};
+
+	__cpuid(iRegs, 0x80000000);
+	if ((unsigned int)iRegs[0] < 0x80000007)
+		return FALSE;
+
+	__cpuid(iRegs, 0x80000007);
+
+	return (iRegs[3] & (1 << 8)) ? TRUE : FALSE;
+}
+
+
+void CTimer::CalibrateTSC()
+{
+	//count TSC ticks over a fixed QPC interval
+	double dStart = GetQPCTimer();
+	unsigned __int64 ui64Start = __rdtsc();
+	double dEnd = dStart;
+
+	while ((dEnd - dStart) < TIMER_CALIBRATION_TIME)
+		dEnd = GetQPCTimer();
+
+	unsigned __int64 ui64End = __rdtsc();
+
+	dTSCFreq = 0.0;
+	if ((ui64End > ui64Start) && (dEnd > dStart))
+		dTSCFreq = (double)(ui64End - ui64Start) / (dEnd - dStart);
+
+	ui64TSCBase = ui64End;
+	dTSCBaseTime = dEnd;
+
+	return;
+}
+
+
+void CTimer::MeasureOverhead()
+{
+	double dMinDelta = 1.0e+20;
+	double dLast = GetTimer();
+	double dStart = dLast;
+
+	for (int i = 0; i < TIMER_OVERHEAD_CALLS; i++)
+	{
+		double dNow = GetTimer();
+		if ((dNow > dLast) && ((dNow - dLast) < dMinDelta))
+			dMinDelta = dNow - dLast;
+		dLast = dNow;
+	}
+
+	dOverheadNS = (dLast - dStart) * 1.0e+9 / (double)TIMER_OVERHEAD_CALLS;
+
+	//the smallest observable step, bounded by the tick period of the counter
+	double dTickNS = 1.0e+9 / ((iBackend == TIMER_BACKEND_TSC) ? dTSCFreq : dPerfFreq);
+	dResolutionNS = (dMinDelta < 1.0e+20) ? (dMinDelta * 1.0e+9) : dTickNS;
+	if (dResolutionNS < dTickNS)
+		dResolutionNS = dTickNS;
+
+	return;
+}
+
+
+string CTimer::GetBackendInfo()
+{
+	char buffer[256];
+
+	if (iBackend == TIMER_BACKEND_TSC)
+		sprintf(buffer, "Invariant TSC (%.3f MHz), overhead %.1f ns, resolution %.1f ns", dTSCFreq / 1.0e+6, dOverheadNS, dResolutionNS);
+	else
+		sprintf(buffer, "QueryPerformanceCounter (%.3f MHz), overhead %.1f ns, resolution %.1f ns", dPerfFreq / 1.0e+6, dOverheadNS, dResolutionNS);
+
+	string sInfo = &buffer[0];
+
+	return sInfo;
+}
+
+
 double CTimer::GetSTDTimer()
 {
 	return ((double)GetSTDTimerMS() / 1000.0);